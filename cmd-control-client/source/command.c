@@ -41,7 +41,8 @@ bool cnc_client_start_encode_response(int message_type, CborDataWrapper * data_w
     }
 
     cbor_encoder_init(&encoder, data_wrapper->data, MTU, 0);
-    err = cbor_encoder_create_map(&encoder, &container, 5); //TODO: Dynamically assign map size
+    //MSG_TYPE, ID, ARG_COUNT, COMMAND_NAME and ARGS
+    err = cbor_encoder_create_map(&encoder, &container, 5);
     if (err)
     {
         return false;
@@ -53,6 +54,12 @@ bool cnc_client_start_encode_response(int message_type, CborDataWrapper * data_w
         return false;
     }
 
+    err = cbor_encode_text_stringz(&container, "ID");
+    if (err || cbor_encode_uint(&container, packet->id))
+    {
+        return false;
+    }
+
     switch (message_type)
     {
         case MESSAGE_TYPE_COMMAND_INPUT:
@@ -67,13 +74,20 @@ bool cnc_client_start_encode_response(int message_type, CborDataWrapper * data_w
 
 bool cnc_client_encode_command(CborDataWrapper * data_wrapper, CNCCommandPacket * packet, CborEncoder * encoder, CborEncoder * container)
 {
+    CborEncoder args;
     CborError err;
+    int i;
 
     if(data_wrapper == NULL || packet == NULL || encoder == NULL || container == NULL)
     {
         return false;
     }
 
+    if (packet->arg_count < 0 || packet->arg_count > CMD_PACKET_NUM_ARGS)
+    {
+        return false;
+    }
+
     err = cbor_encode_text_stringz(container, "ARG_COUNT");
     if (err || cbor_encode_int(container, packet->arg_count))
     {
@@ -86,9 +100,21 @@ bool cnc_client_encode_command(CborDataWrapper * data_wrapper, CNCCommandPacket
         return false;
     }
 
-    //TODO:Encode multiple args
     err = cbor_encode_text_stringz(container, "ARGS");
-    if (err || cbor_encode_text_stringz(container, packet->args[0]))
+    if (err || cbor_encoder_create_array(container, &args, packet->arg_count))
+    {
+        return false;
+    }
+
+    for (i = 0; i < packet->arg_count; i++)
+    {
+        if (cbor_encode_text_stringz(&args, packet->args[i]))
+        {
+            return false;
+        }
+    }
+
+    if (cbor_encoder_close_container(container, &args))
     {
         return false;
     }
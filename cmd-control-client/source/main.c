@@ -184,6 +184,33 @@ bool send_msg(CborDataWrapper * data_wrapper)
 }
 
 
+bool cnc_client_response_matches(csp_packet_t * packet, uint32_t id)
+{
+    CborParser parser;
+    CborValue map, element;
+    uint64_t response_id;
+
+    if (packet == NULL)
+    {
+        return false;
+    }
+
+    if (cbor_parser_init((uint8_t*) packet->data, packet->length, 0, &parser, &map))
+    {
+        return false;
+    }
+
+    //Daemons which run one command at a time don't send an id
+    if (cbor_value_map_find_value(&map, "ID", &element) || !cbor_value_is_unsigned_integer(&element))
+    {
+        return true;
+    }
+
+    cbor_value_get_uint64(&element, &response_id);
+    return (response_id == id);
+}
+
+
 bool cnc_client_parse_response(csp_packet_t * packet)
 {
     CborParser parser;
@@ -274,31 +301,30 @@ bool cnc_client_parse_processing_error(CborParser * parser, CborValue * map)
 }
 
 
-void cnc_client_get_response()
+void cnc_client_get_response(uint32_t id)
 {
     csp_socket_t *sock;
     csp_conn_t *conn;
     csp_packet_t *packet;
+    bool done = false;
 
     sock = csp_socket(CSP_SO_NONE);
     csp_bind(sock, CSP_PORT);
     csp_listen(sock, 5);
 
-    while (conn = csp_accept(sock, 1000))
+    while (!done && (conn = csp_accept(sock, 1000)))
     {
-        if (conn)
+        packet = csp_read(conn, 0);
+        //Results of other commands are skipped
+        if (packet && cnc_client_response_matches(packet, id))
         {
-            packet = csp_read(conn, 0);
-            if (packet)
-            {
-                cnc_client_parse_response(packet);
-            }
-            csp_buffer_free(packet);
-            csp_close_socket(sock);
-            csp_close(conn);
-            return;
+            cnc_client_parse_response(packet);
+            done = true;
         }
+        csp_buffer_free(packet);
+        csp_close(conn);
     }
+    csp_close_socket(sock);
 }
 
 
@@ -320,6 +346,8 @@ int main(int argc, char **argv)
     CborError err;
 
     cmd_packet = (CNCCommandPacket){0};
+    //Tells this command's result apart from those of commands sent by other clients
+    cmd_packet.id = getpid();
 
     if (!cnc_client_parse_cl_args(&cmd_packet, argc, argv))
     {
@@ -340,7 +368,7 @@ int main(int argc, char **argv)
     }
 
     send_msg(&data_wrapper);
-    cnc_client_get_response();
+    cnc_client_get_response(cmd_packet.id);
 
     return 0;
 }
@@ -20,7 +20,13 @@
 #include <command-and-control/types.h>
 #include <tinycbor/cbor.h>
 
-typedef int (*lib_function)(int, char**);
+//A command received by the daemon, owning the storage the wrapper points to
+typedef struct
+{
+    CNCCommandPacket  command;
+    CNCResponsePacket response;
+    CNCWrapper        wrapper;
+} CNCJob;
 
 bool cnc_daemon_encode_processing_error(uint8_t * data, CNCWrapper * result, CborEncoder * encoder, CborEncoder * container);
 
@@ -46,6 +52,14 @@ bool cnc_daemon_start_encode_response(int message_type, CNCWrapper * wrapper);
 
 bool cnc_daemon_send_result(CNCWrapper * wrapper);
 
+CNCJob * cnc_daemon_job_create(void);
+
+bool cnc_daemon_workers_start(void);
+
+bool cnc_daemon_workers_submit(CNCJob * job);
+
+void cnc_daemon_workers_stop(void);
+
 
 #define LIB_FORMAT_STR "/%s"
 
@@ -69,6 +83,20 @@ bool cnc_daemon_send_result(CNCWrapper * wrapper);
 #define SO_PATH_LENGTH 75
 #endif
 
+//Number of commands which can run at the same time
+#ifdef YOTTA_CFG_CNC_DAEMON_NUM_WORKERS
+#define CNC_DAEMON_NUM_WORKERS YOTTA_CFG_CNC_DAEMON_NUM_WORKERS
+#else
+#define CNC_DAEMON_NUM_WORKERS 4
+#endif
+
+//Number of commands which can wait for a free worker before new ones are rejected
+#ifdef YOTTA_CFG_CNC_DAEMON_QUEUE_SIZE
+#define CNC_DAEMON_QUEUE_SIZE YOTTA_CFG_CNC_DAEMON_QUEUE_SIZE
+#else
+#define CNC_DAEMON_QUEUE_SIZE 8
+#endif
+
 #ifdef YOTTA_CFG_CNC_DAEMON_LOG_PATH
 #define DAEMON_LOG_PATH YOTTA_CFG_CNC_DAEMON_LOG_PATH
 #else
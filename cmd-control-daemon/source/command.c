@@ -14,10 +14,17 @@
 * limitations under the License.
 */
 
+//For pipe2
+#define _GNU_SOURCE
+
 #include <csp/csp.h>
-#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -28,7 +35,8 @@
 #include "tinycbor/cbor.h"
 
 #define CBOR_BUF_SIZE YOTTA_CFG_CSP_MTU
-#define CMD_STR_LEN 150
+
+extern char ** environ;
 
 
 bool cnc_daemon_parse_command_cbor(csp_packet_t * packet, char * command)
@@ -74,116 +82,111 @@ bool file_exists(char * path) //Should this live in a higher level module utilit
 }
 
 
-bool cnc_daemon_run_command(CNCWrapper * wrapper, void ** handle, lib_function func)
+bool assemble_argv(char ** argv, char * exe_path, CNCWrapper * wrapper)
 {
-    int original_stdout;
-    //Redirect stdout to the response output field.
-    //TODO: Redirect or figure out what to do with STDERR
+    int i;
+    int argc = 0;
 
-    if (wrapper == NULL || handle == NULL)
+    if (argv == NULL || exe_path == NULL || wrapper == NULL)
     {
         KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "%s called with a NULL pointer\n", __func__);
         return false;
     }
 
-    KLOG_INFO(&log_handle, LOG_COMPONENT_NAME, "Redirecting STDOUT and running command.\n");
-
-    fflush(stdout);
-    original_stdout = dup(STDOUT_FILENO);
-    freopen("/dev/null", "a", stdout);
-    setbuf(stdout, wrapper->response_packet->output);
-
-    //This block is not good. This is generating a Char** from a Char[][]
-    //After discussion today it seems all parsing should move to the client
-    //side. Doing so would eliminate this and all parsing from the service
-    //side of the C&C framework. In the next release all parsing will be moved
-    //into the client.
-    char *argv[CMD_PACKET_NUM_ARGS];
-    int i = 0;
-    for (; i < wrapper->command_packet->arg_count; i++)
+    if (wrapper->command_packet->arg_count < 0 || wrapper->command_packet->arg_count > CMD_PACKET_NUM_ARGS)
     {
-        argv[i] = wrapper->command_packet->args[i];
+        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Invalid argument count %i\n", wrapper->command_packet->arg_count);
+        return false;
     }
 
-    //Measure the clock before and after the function has run
-    clock_t start_time = clock();
-    wrapper->response_packet->return_code = func(wrapper->command_packet->arg_count, (char**)argv);
-    clock_t finish_time = clock();
-
-    //Redirect stdout back to the terminal.
-    freopen("/dev/null", "a", stdout);
-    dup2(original_stdout, STDOUT_FILENO); //restore the previous state of stdout
-    setbuf(stdout, NULL);
-
-    KLOG_INFO(&log_handle, LOG_COMPONENT_NAME, "STDOUT set back after running command\n");
-    //Calculate the runtime
-    wrapper->response_packet->execution_time = (double)(finish_time - start_time) / (CLOCKS_PER_SEC/1000); //execution time in milliseconds
-    KLOG_INFO(&log_handle, LOG_COMPONENT_NAME, "Command execution time %f\n", wrapper->response_packet->execution_time);
-
-    //Unload the library
-    dlclose(*handle);
-
+    //Empty arguments are passed on as they are, like any other argument
+    argv[argc++] = exe_path;
+    for (i = 0; i < wrapper->command_packet->arg_count; i++)
+    {
+        argv[argc++] = wrapper->command_packet->args[i];
+    }
+    argv[argc] = NULL;
     return true;
 }
 
 
-bool append_str(char * str, int * size, char * new_str)
+bool cnc_daemon_spawn_command(char ** argv, pid_t * pid, int * output_fd)
 {
-    int result;
+    posix_spawn_file_actions_t actions;
+    int fds[2];
+    int err;
 
-    if (str == NULL || size == NULL || new_str == NULL)
+    if (argv == NULL || pid == NULL || output_fd == NULL)
     {
         KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "%s called with a NULL pointer\n", __func__);
         return false;
     }
 
-    result = snprintf(str + *size, CMD_STR_LEN - *size, new_str);
+    //Commands spawned by other workers must not inherit the write end of this
+    //pipe or it won't see end of file until they exit too, so it is created
+    //close-on-exec. The command gets its own copy through dup2.
+    if (pipe2(fds, O_CLOEXEC) != 0)
+    {
+        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Unable to create the command output pipe: %s\n", strerror(errno));
+        return false;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    err = posix_spawn(pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
 
-    if (result < 0)
+    if (err != 0)
     {
-        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "There was an error appending string: %s to buffer: %s\nerror: %i\n", new_str, str, result);
+        close(fds[0]);
+        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Unable to start the command process: %s\n", strerror(err));
         return false;
     }
 
-    *size += result;
+    *output_fd = fds[0];
     return true;
 }
 
 
-bool assemble_cmd_string(char * cmd_str, char * exe_path, CNCWrapper * wrapper)
+void cnc_daemon_read_output(int output_fd, char * output, size_t output_len)
 {
-    int i, used_size;
-    int size = 0;
-
-    if (cmd_str == NULL || exe_path == NULL || wrapper == NULL)
-    {
-        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "%s called with a NULL pointer\n", __func__);
-        return false;
-    }
-
-    if (!append_str(cmd_str, &size, exe_path))
-    {
-        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "There was an error processing the command\n");
-        return false;
-    }
+    char discard[64];
+    size_t size = 0;
+    ssize_t count;
 
-    for (i = 0; i < wrapper->command_packet->arg_count; i++)
+    while (true)
     {
-        append_str(cmd_str, &size, " ");
-        append_str(cmd_str, &size, wrapper->command_packet->args[i]);
+        if (size < output_len - 1)
+        {
+            count = read(output_fd, output + size, output_len - 1 - size);
+            if (count > 0)
+            {
+                size += count;
+            }
+        }
+        else
+        {
+            //Output which doesn't fit is drained so the command never blocks writing it
+            count = read(output_fd, discard, sizeof(discard));
+        }
+
+        if (count == 0 || (count < 0 && errno != EINTR))
+        {
+            break;
+        }
     }
+    output[size] = '\0';
 }
 
 
 bool cnc_daemon_load_and_run_command(CNCWrapper * wrapper)
 {
-    char exe_path[SO_PATH_LENGTH]   = {0};
-    char cmd_str[CMD_STR_LEN]       = {0};
-    char buf[RES_PACKET_STDOUT_LEN] = {0};
-    clock_t start_time, end_time;
-    FILE * fptr;
-    int  exe_len, return_code;
-    int  size = 0;
+    char exe_path[SO_PATH_LENGTH] = {0};
+    char * argv[CMD_PACKET_NUM_ARGS + 2];
+    struct timespec start_time, end_time;
+    int  exe_len, output_fd, status;
+    pid_t pid;
 
     if (wrapper == NULL)
     {
@@ -194,7 +197,7 @@ bool cnc_daemon_load_and_run_command(CNCWrapper * wrapper)
     // exe_len - the format specifier length (-2) + the null character (+1) leading to the -1
     exe_len = strlen(MODULE_REGISTRY_DIR) + strlen(wrapper->command_packet->cmd_name) - 1;
 
-    if (exe_len > CMD_STR_LEN)
+    if (exe_len > SO_PATH_LENGTH)
     {
         KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "The path the executable is too long to fit into the command string\n");
         wrapper->err = true;
@@ -214,32 +217,53 @@ bool cnc_daemon_load_and_run_command(CNCWrapper * wrapper)
         return false;
     }
 
-    if (!assemble_cmd_string(cmd_str, exe_path, wrapper))
+    if (!assemble_argv(argv, exe_path, wrapper))
     {
-        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "There was an issue procesing the command string.\n");
-        snprintf(wrapper->response_packet->output, RES_PACKET_STDOUT_LEN, "There was an issue procesing the command string.\n");
+        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "There was an issue procesing the command arguments.\n");
+        wrapper->err = true;
+        snprintf(wrapper->output, sizeof(wrapper->output), "There was an issue procesing the command arguments.\n");
+        cnc_daemon_send_result(wrapper);
         return false;
     }
 
-    KLOG_INFO(&log_handle, LOG_COMPONENT_NAME, "Running command: '%s'\n", cmd_str);
+    KLOG_INFO(&log_handle, LOG_COMPONENT_NAME, "Running command: '%s'\n", exe_path);
 
-    start_time = clock();
-    fptr = popen(cmd_str, "r");
-    if (fptr == NULL)
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    if (!cnc_daemon_spawn_command(argv, &pid, &output_fd))
     {
-        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "There was an issue starting the command process %i\n", fptr);
-        snprintf(wrapper->response_packet->output, RES_PACKET_STDOUT_LEN, "There was an issue starting the command process\n");
+        wrapper->err = true;
+        snprintf(wrapper->output, sizeof(wrapper->output), "There was an issue starting the command process\n");
+        cnc_daemon_send_result(wrapper);
         return false;
     }
 
-    while (fgets(buf, RES_PACKET_STDOUT_LEN, fptr) != NULL) {
-        size += snprintf(wrapper->response_packet->output + size, RES_PACKET_STDOUT_LEN - size, "%s", buf);
+    cnc_daemon_read_output(output_fd, wrapper->response_packet->output, sizeof(wrapper->response_packet->output));
+    close(output_fd);
+
+    while (waitpid(pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            status = 0;
+            break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+    if (WIFEXITED(status))
+    {
+        wrapper->response_packet->return_code = WEXITSTATUS(status);
+    }
+    else
+    {
+        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Command %s was terminated by signal %i\n", exe_path, WTERMSIG(status));
+        wrapper->response_packet->return_code = 128 + WTERMSIG(status);
     }
 
-    wrapper->response_packet->return_code = pclose(fptr);
-    end_time = clock();
-    wrapper->response_packet->execution_time = (double)(end_time - start_time) / (CLOCKS_PER_SEC/1000); //execution time in milliseconds
+    //execution time in milliseconds
+    wrapper->response_packet->execution_time = (end_time.tv_sec - start_time.tv_sec) * 1000.0
+                                             + (end_time.tv_nsec - start_time.tv_nsec) / 1000000.0;
+    KLOG_INFO(&log_handle, LOG_COMPONENT_NAME, "Command execution time %f\n", wrapper->response_packet->execution_time);
     cnc_daemon_send_result(wrapper);
     return true;
-
 }
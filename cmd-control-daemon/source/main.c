@@ -141,6 +141,8 @@ bool init_logging()
     log_handle.config.klog_console_level = LOG_ALL;
     log_handle.config.klog_file_level = LOG_ALL;
     log_handle.config.klog_file_logging = true;
+    //Command workers log at the same time
+    log_handle.config.klog_async = true;
 
     res = klog_init_file(&log_handle);
     if (res == 0)
@@ -206,15 +208,6 @@ bool cnc_daemon_send_buffer(uint8_t * data, size_t data_len)
 }
 
 
-void zero_vars(char * command_str, CNCCommandPacket * command, CNCResponsePacket * response, CNCWrapper * wrapper)
-{
-    memset(command_str, 0, sizeof(command_str) * sizeof(char));
-    memset(command, 0, sizeof(CNCCommandPacket));
-    memset(response, 0, sizeof(CNCResponsePacket));
-    memset(wrapper->output, 0, sizeof(wrapper->output));
-    wrapper->err = false;
-}
-
 bool cnc_daemon_get_buffer(csp_socket_t* sock, CborDataWrapper * data_wrapper)
 {
     csp_conn_t *conn;
@@ -253,31 +246,32 @@ bool cnc_daemon_get_buffer(csp_socket_t* sock, CborDataWrapper * data_wrapper)
 int main(int argc, char **argv)
 {
     csp_socket_t *sock;
-    char command_str[CMD_STR_LEN];
-    CNCCommandPacket command;
-    CNCResponsePacket response;
-    //The wrapper keeps track of a command input, its result and
+    //A job keeps track of a command input, its result and
     //any pre-run processing error messages that may occur
-    CNCWrapper wrapper;
+    CNCJob * job;
     bool exit = false;
     uint8_t buffer[CMD_STR_LEN];
     //The CborDataWrapper keeps a reference to a buffer and the length of the
     //buffer tied together and simplifies passing both pieces of data between functions
     CborDataWrapper data_wrapper;
     data_wrapper.data = buffer;
-    wrapper.command_packet  = &command;
-    wrapper.response_packet = &response;
 
     init_logging();
     init();
 
+    if (!cnc_daemon_workers_start())
+    {
+        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Unable to start the command workers\n");
+        klog_cleanup(&log_handle);
+        return 1;
+    }
+
     sock = csp_socket(CSP_SO_NONE);
     csp_bind(sock, CSP_PORT);
     csp_listen(sock, 5);
 
     while (!exit)
     {
-        zero_vars(command_str, &command, &response, &wrapper);
         KLOG_INFO(&log_handle, LOG_COMPONENT_NAME, "Getting Command\n");
         if (!cnc_daemon_get_buffer(sock, &data_wrapper))
         {
@@ -285,18 +279,28 @@ int main(int argc, char **argv)
             continue;
         }
 
-        if (!cnc_daemon_parse_buffer(&wrapper, &data_wrapper))
+        if ((job = cnc_daemon_job_create()) == NULL)
+        {
+            KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Unable to allocate the received command\n");
+            continue;
+        }
+
+        if (!cnc_daemon_parse_buffer(&(job->wrapper), &data_wrapper))
         {
             KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "There was an error decoding the received command\n");
+            free(job);
             continue;
         }
 
-        if(!cnc_daemon_load_and_run_command(&wrapper))
+        //The command runs and sends its result on a worker thread, the next
+        //command can be received in the meantime
+        if (!cnc_daemon_workers_submit(job))
         {
-            KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "There was an error parsing the received command\n");
+            KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "There was an error queueing the received command\n");
             continue;
         }
     }
+    cnc_daemon_workers_stop();
     klog_cleanup(&log_handle);
     return 0;
 }
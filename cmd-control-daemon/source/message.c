@@ -54,7 +54,8 @@ bool cnc_daemon_start_encode_response(int message_type, CNCWrapper * wrapper)
     }
 
     cbor_encoder_init(&encoder, data, MTU, 0);
-    err = cbor_encoder_create_map(&encoder, &container, 4); //TODO: Dynamically assign map size
+    //MSG_TYPE and ID, plus RETURN_CODE, EXEC_TIME and OUTPUT or just ERROR_MSG
+    err = cbor_encoder_create_map(&encoder, &container, (message_type == RESPONSE_TYPE_COMMAND_RESULT) ? 5 : 3);
     if (err)
     {
         KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Unable to initialize cbor encoder, Error code: %i", err);
@@ -73,6 +74,19 @@ bool cnc_daemon_start_encode_response(int message_type, CNCWrapper * wrapper)
         return false;
     }
 
+    //Commands run concurrently, so results may not arrive in the order the commands were sent
+    if (err = cbor_encode_text_stringz(&container, "ID"))
+    {
+        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Unable to encode key \"ID\". Error code: %i\n", err);
+        return false;
+    }
+
+    if (err = cbor_encode_uint(&container, wrapper->command_packet->id))
+    {
+        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Unable to encode value for key \"ID\" Error code: %i\n", err);
+        return false;
+    }
+
     switch (message_type)
     {
         case RESPONSE_TYPE_COMMAND_RESULT:
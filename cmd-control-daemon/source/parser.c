@@ -87,6 +87,14 @@ bool cnc_daemon_parse_command(CborParser * parser, CborValue * map, CNCWrapper *
         return false;
     }
 
+    //Older clients don't send an id, their commands all get id 0
+    if (!cbor_value_map_find_value(map, "ID", &element) && cbor_value_is_unsigned_integer(&element))
+    {
+        uint64_t id;
+        cbor_value_get_uint64(&element, &id);
+        wrapper->command_packet->id = id;
+    }
+
     if (err = cbor_value_map_find_value(map, "ARG_COUNT", &element))
     {
         KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Unable to find key ARG_COUNT. Error code: %i\n", err);
@@ -113,7 +121,11 @@ bool cnc_daemon_parse_command(CborParser * parser, CborValue * map, CNCWrapper *
         return false;
     }
 
-    len = CMD_PACKET_ARG_LEN;
+    if (wrapper->command_packet->arg_count < 0 || wrapper->command_packet->arg_count > CMD_PACKET_NUM_ARGS)
+    {
+        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Invalid argument count %i\n", wrapper->command_packet->arg_count);
+        return false;
+    }
 
     if (err = cbor_value_map_find_value(map, "ARGS", &element))
     {
@@ -121,11 +133,43 @@ bool cnc_daemon_parse_command(CborParser * parser, CborValue * map, CNCWrapper *
         return false;
     }
 
+    if (cbor_value_is_array(&element))
+    {
+        CborValue arg;
+        size_t num_args;
+
+        if ((err = cbor_value_get_array_length(&element, &num_args)) || num_args != wrapper->command_packet->arg_count)
+        {
+            KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Number of ARGS does not match ARG_COUNT %i\n", wrapper->command_packet->arg_count);
+            return false;
+        }
+
+        if (err = cbor_value_enter_container(&element, &arg))
+        {
+            KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Unable to parse value for key ARGS. Error code: %i\n", err);
+            return false;
+        }
+
+        for (i = 0; i < num_args; i++)
+        {
+            len = CMD_PACKET_ARG_LEN;
+            if (err = cbor_value_copy_text_string(&arg, wrapper->command_packet->args[i], &len, &arg))
+            {
+                KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Unable to parse argument %i. Error code: %i\n", i, err);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //Older clients only send the first argument, which they leave empty if there are none
+    len = CMD_PACKET_ARG_LEN;
     if (err = cbor_value_copy_text_string(&element, &(wrapper->command_packet->args[0]), &len, NULL))
     {
-        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Unable to parse value for key COMMAND_NAME. Error code: %i\n", err);
+        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Unable to parse value for key ARGS. Error code: %i\n", err);
         return false;
     }
+    wrapper->command_packet->arg_count = (wrapper->command_packet->args[0][0] != '\0') ? 1 : 0;
     return true;
 
 }
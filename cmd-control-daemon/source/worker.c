@@ -0,0 +1,133 @@
+/*
+* Copyright (C) 2017 Kubos Corporation
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#include <csp/arch/csp_queue.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <command-and-control/types.h>
+
+#include "cmd-control-daemon/daemon.h"
+#include "cmd-control-daemon/logging.h"
+
+//Commands waiting for a worker. A NULL job tells a worker to exit.
+static csp_queue_handle_t job_queue = NULL;
+
+static pthread_t workers[CNC_DAEMON_NUM_WORKERS];
+static int num_workers = 0;
+
+
+CNCJob * cnc_daemon_job_create(void)
+{
+    CNCJob * job = calloc(1, sizeof(CNCJob));
+
+    if (job != NULL)
+    {
+        job->wrapper.command_packet  = &(job->command);
+        job->wrapper.response_packet = &(job->response);
+    }
+    return job;
+}
+
+
+void * cnc_daemon_worker(void * parameters)
+{
+    CNCJob * job;
+
+    while (csp_queue_dequeue(job_queue, &job, CSP_MAX_DELAY) == CSP_QUEUE_OK)
+    {
+        if (job == NULL)
+        {
+            break;
+        }
+
+        if (!cnc_daemon_load_and_run_command(&(job->wrapper)))
+        {
+            KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "There was an error running the command %s\n", job->command.cmd_name);
+        }
+        free(job);
+    }
+
+    return NULL;
+}
+
+
+bool cnc_daemon_workers_start(void)
+{
+    job_queue = csp_queue_create(CNC_DAEMON_QUEUE_SIZE, sizeof(CNCJob *));
+    if (job_queue == NULL)
+    {
+        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Unable to create the command queue\n");
+        return false;
+    }
+
+    for (num_workers = 0; num_workers < CNC_DAEMON_NUM_WORKERS; num_workers++)
+    {
+        if (pthread_create(&workers[num_workers], NULL, cnc_daemon_worker, NULL) != 0)
+        {
+            KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Unable to start command worker %i\n", num_workers);
+            break;
+        }
+    }
+
+    //Commands can still be run as long as one worker started
+    return (num_workers > 0);
+}
+
+
+bool cnc_daemon_workers_submit(CNCJob * job)
+{
+    if (job == NULL)
+    {
+        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "%s called with a NULL pointer\n", __func__);
+        return false;
+    }
+
+    //Never waits, a full queue means the workers can't keep up
+    if (csp_queue_enqueue(job_queue, &job, 0) != CSP_QUEUE_OK)
+    {
+        KLOG_ERR(&log_handle, LOG_COMPONENT_NAME, "Command queue is full, rejecting %s\n", job->command.cmd_name);
+        job->wrapper.err = true;
+        snprintf(job->wrapper.output, sizeof(job->wrapper.output), "The daemon is busy, try the command again later\n");
+        cnc_daemon_send_result(&(job->wrapper));
+        free(job);
+        return false;
+    }
+    return true;
+}
+
+
+void cnc_daemon_workers_stop(void)
+{
+    CNCJob * job = NULL;
+    int i;
+
+    //Lets every worker finish the commands already queued before exiting
+    for (i = 0; i < num_workers; i++)
+    {
+        csp_queue_enqueue(job_queue, &job, CSP_MAX_DELAY);
+    }
+
+    for (i = 0; i < num_workers; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    num_workers = 0;
+
+    csp_queue_remove(job_queue);
+    job_queue = NULL;
+}
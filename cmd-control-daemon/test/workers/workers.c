@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmocka.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+//The daemon is an executable, so the pool is built straight into the test
+#include "../../source/worker.c"
+
+//Posted by every command once it is running
+static sem_t started;
+//Posted by the test to let one running command finish
+static sem_t release;
+
+static pthread_mutex_t count_lock = PTHREAD_MUTEX_INITIALIZER;
+static int running = 0;
+static int max_running = 0;
+static int finished = 0;
+static int rejected = 0;
+
+bool cnc_daemon_load_and_run_command(CNCWrapper * wrapper)
+{
+    pthread_mutex_lock(&count_lock);
+    running++;
+    if (running > max_running)
+    {
+        max_running = running;
+    }
+    pthread_mutex_unlock(&count_lock);
+
+    sem_post(&started);
+    sem_wait(&release);
+
+    pthread_mutex_lock(&count_lock);
+    running--;
+    finished++;
+    pthread_mutex_unlock(&count_lock);
+    return true;
+}
+
+bool cnc_daemon_send_result(CNCWrapper * wrapper)
+{
+    assert_true(wrapper->err);
+    rejected++;
+    return true;
+}
+
+static CNCJob * job_create(void)
+{
+    CNCJob * job = cnc_daemon_job_create();
+
+    assert_non_null(job);
+    strcpy(job->command.cmd_name, "test");
+    return job;
+}
+
+static void wait_started(int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        sem_wait(&started);
+    }
+}
+
+static void release_commands(int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        sem_post(&release);
+    }
+}
+
+static int setup(void ** state)
+{
+    sem_init(&started, 0, 0);
+    sem_init(&release, 0, 0);
+    running = 0;
+    max_running = 0;
+    finished = 0;
+    rejected = 0;
+
+    assert_true(cnc_daemon_workers_start());
+    return 0;
+}
+
+static int teardown(void ** state)
+{
+    sem_destroy(&started);
+    sem_destroy(&release);
+    return 0;
+}
+
+static void test_workers_concurrent(void ** arg)
+{
+    int i;
+
+    for (i = 0; i < CNC_DAEMON_NUM_WORKERS; i++)
+    {
+        assert_true(cnc_daemon_workers_submit(job_create()));
+    }
+
+    //Every worker picks up a command before any of them finished
+    wait_started(CNC_DAEMON_NUM_WORKERS);
+    assert_int_equal(max_running, CNC_DAEMON_NUM_WORKERS);
+    assert_int_equal(finished, 0);
+
+    release_commands(CNC_DAEMON_NUM_WORKERS);
+    cnc_daemon_workers_stop();
+
+    assert_int_equal(finished, CNC_DAEMON_NUM_WORKERS);
+    assert_int_equal(rejected, 0);
+}
+
+static void test_workers_queue_full(void ** arg)
+{
+    int total = CNC_DAEMON_NUM_WORKERS + CNC_DAEMON_QUEUE_SIZE;
+    int i;
+
+    for (i = 0; i < CNC_DAEMON_NUM_WORKERS; i++)
+    {
+        assert_true(cnc_daemon_workers_submit(job_create()));
+    }
+    wait_started(CNC_DAEMON_NUM_WORKERS);
+
+    for (i = 0; i < CNC_DAEMON_QUEUE_SIZE; i++)
+    {
+        assert_true(cnc_daemon_workers_submit(job_create()));
+    }
+
+    //No worker and no queue slot is free, so the command is answered with an error
+    assert_false(cnc_daemon_workers_submit(job_create()));
+    assert_int_equal(rejected, 1);
+
+    release_commands(total);
+    cnc_daemon_workers_stop();
+
+    assert_int_equal(finished, total);
+    assert_int_equal(max_running, CNC_DAEMON_NUM_WORKERS);
+}
+
+static void test_workers_stop(void ** arg)
+{
+    int total = CNC_DAEMON_NUM_WORKERS + CNC_DAEMON_QUEUE_SIZE;
+    int i;
+
+    for (i = 0; i < total; i++)
+    {
+        assert_true(cnc_daemon_workers_submit(job_create()));
+    }
+    wait_started(CNC_DAEMON_NUM_WORKERS);
+
+    //Stopping runs the queued commands before the workers exit
+    release_commands(total);
+    cnc_daemon_workers_stop();
+    assert_int_equal(finished, total);
+    assert_int_equal(running, 0);
+
+    //The pool can be started again afterwards
+    assert_true(cnc_daemon_workers_start());
+    assert_true(cnc_daemon_workers_submit(job_create()));
+    release_commands(1);
+    cnc_daemon_workers_stop();
+    assert_int_equal(finished, total + 1);
+    assert_int_equal(rejected, 0);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_workers_concurrent, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_workers_queue_full, setup, teardown),
+        cmocka_unit_test_setup_teardown(test_workers_stop, setup, teardown),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
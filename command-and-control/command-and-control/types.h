@@ -75,6 +75,9 @@
 
 typedef struct arguments
 {
+    //Picked by the client and sent back with the command's result, so the
+    //client can tell its result apart from those of other commands
+    uint32_t id;
     int arg_count;
     char cmd_name[CMD_PACKET_CMD_NAME_LEN];
     char args[CMD_PACKET_NUM_ARGS][CMD_PACKET_ARG_LEN];
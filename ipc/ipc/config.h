@@ -45,6 +45,20 @@
 #define IPC_SOCKET_PORT 8888
 #endif
 
+/*! Use unix domain sockets instead of SCTP sockets on localhost for IPC sockets */
+#ifdef YOTTA_CFG_IPC_UNIX_SOCKET
+#define IPC_UNIX_SOCKET YOTTA_CFG_IPC_UNIX_SOCKET
+#else
+#define IPC_UNIX_SOCKET 0
+#endif
+
+/*! Max bytes queued for a connection of a socket_reactor before messages are dropped */
+#ifdef YOTTA_CFG_IPC_SEND_QUEUE_SIZE
+#define IPC_SEND_QUEUE_SIZE YOTTA_CFG_IPC_SEND_QUEUE_SIZE
+#else
+#define IPC_SEND_QUEUE_SIZE 8192
+#endif
+
 #endif
 
 /* @} */
\ No newline at end of file
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @defgroup Reactor Socket Reactor Interface
+ * @addtogroup Reactor
+ * @brief IPC Socket Reactor API
+ *
+ * Serves all connections of a listening socket from a single thread.
+ * Incoming messages are put back together from the length prefixed
+ * stream and handed to callbacks, outgoing messages which can not be
+ * sent right away wait in a per connection send queue.
+ * @{
+ */
+
+#pragma once
+
+#include <csp/arch/csp_semaphore.h>
+#include <ipc/socket.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Connection served by a socket reactor
+ */
+typedef struct reactor_conn
+{
+    /*! Underlying socket connection */
+    socket_conn conn;
+    /*! Free for use by the reactor callbacks */
+    void * user;
+    /*! Received bytes not handed to on_message yet */
+    uint8_t * rx_buffer;
+    /*! Number of bytes in rx_buffer */
+    uint32_t rx_fill;
+    /*! Bytes waiting to be sent, IPC_SEND_QUEUE_SIZE large */
+    uint8_t * tx_queue;
+    /*! Offset of the first byte waiting in tx_queue */
+    uint32_t tx_start;
+    /*! Offset behind the last byte waiting in tx_queue */
+    uint32_t tx_end;
+    /*! Lock protecting tx_queue */
+    csp_mutex_t tx_lock;
+    /*! Set once sending failed, the connection is closed by the reactor */
+    bool failed;
+    /*! Next connection of the reactor */
+    struct reactor_conn * next;
+} reactor_conn;
+
+/**
+ * Functions called by a socket reactor, all from the thread calling
+ * kprv_reactor_poll
+ */
+typedef struct
+{
+    /*! Called for a new connection, returning false closes it again */
+    bool (*on_accept)(reactor_conn * conn, void * arg);
+    /*! Called for every complete message, returning false closes the connection */
+    bool (*on_message)(reactor_conn * conn, const uint8_t * data, uint32_t length, void * arg);
+    /*! Called before an accepted connection is closed and freed */
+    void (*on_close)(reactor_conn * conn, void * arg);
+} socket_reactor_callbacks;
+
+/**
+ * Socket reactor structure
+ */
+typedef struct
+{
+    /*! epoll instance watching the server and all connections */
+    int epoll_fd;
+    /*! Listening socket */
+    socket_conn server;
+    /*! Connection callbacks */
+    socket_reactor_callbacks callbacks;
+    /*! Argument passed to the callbacks */
+    void * arg;
+    /*! Largest message accepted from a connection */
+    uint32_t max_message;
+    /*! List of open connections */
+    reactor_conn * conns;
+} socket_reactor;
+
+/**
+ * Sets up a listening socket and the reactor serving its connections
+ * @param [out] reactor pointer to socket_reactor
+ * @param [in] port port to listen on
+ * @param [in] num_connections number of pending connections to allow
+ * @param [in] callbacks functions called for connection events
+ * @param [in] arg argument passed to the callbacks
+ * @param [in] max_message largest message accepted, larger ones close the connection
+ * @return bool true if successful, otherwise false
+ */
+bool kprv_reactor_init(socket_reactor * reactor, uint16_t port, uint8_t num_connections,
+                       const socket_reactor_callbacks * callbacks, void * arg, uint32_t max_message);
+
+/**
+ * Waits for socket events and handles them: accepts new connections,
+ * calls on_message for received messages, sends queued data and
+ * closes broken connections
+ * @param [in,out] reactor pointer to socket_reactor
+ * @param [in] timeout max time (ms) to wait for events, -1 to wait forever
+ * @return bool true if successful, otherwise false
+ */
+bool kprv_reactor_poll(socket_reactor * reactor, int timeout);
+
+/**
+ * Sends a message to a connection without blocking. Whatever can not be
+ * sent right away is queued and sent by kprv_reactor_poll. May be called
+ * from any thread while the connection is open.
+ * @param [in] reactor pointer to socket_reactor
+ * @param [in] conn connection to send to
+ * @param [in] data_buffer data to send
+ * @param [in] data_length length of data to send
+ * @return bool true if sent or queued, false if the send queue is full or the connection failed
+ */
+bool kprv_reactor_send(socket_reactor * reactor, reactor_conn * conn, const uint8_t * data_buffer, uint32_t data_length);
+
+/**
+ * Closes all connections, calling on_close for each, and the listening socket
+ * @param [in,out] reactor pointer to socket_reactor
+ */
+void kprv_reactor_cleanup(socket_reactor * reactor);
+
+/* @} */
@@ -18,6 +18,10 @@
  * @defgroup Socket TCP Socket Interface
  * @addtogroup Socket
  * @brief IPC Socket API
+ *
+ * Every message is sent with a 4 byte length prefix in network byte order,
+ * so message boundaries do not depend on the transport and a message
+ * arriving in pieces is put back together by the receiver.
  * @{
  */
 
@@ -28,6 +32,9 @@
 #include <stdint.h>
 #include <sys/socket.h>
 
+/*! Size of the length prefix sent in front of every message */
+#define SOCKET_HEADER_SIZE 4
+
 /**
  * PubSub connection structure.
  */
@@ -74,7 +81,7 @@ bool kprv_socket_client_connect(socket_conn * conn, uint16_t port);
 bool kprv_socket_close(socket_conn * conn);
 
 /**
- * Performs socket send
+ * Performs socket send of a single message, blocking until all of it is sent
  * @param [in] conn pointer to socket_conn
  * @param [in] data_buffer data to send
  * @param [in] data_length length of data to send
@@ -83,7 +90,11 @@ bool kprv_socket_close(socket_conn * conn);
 bool kprv_socket_send(const socket_conn * conn, const uint8_t * data_buffer, uint32_t data_length);
 
 /**
- * Performs socket receive
+ * Performs socket receive of a single message. If the message is larger
+ * than data_buffer, the rest of it is returned by the following calls.
+ * A receive timeout or signal before any of the message body arrived can
+ * be retried, but once it stops partway through the body every further
+ * receive on the connection fails, as the stream can't be resumed from there.
  * @param [in] conn pointer to socket_conn
  * @param [out] data_buffer buffer to write received data to
  * @param [in] data_length max size of data buffer
@@ -0,0 +1,409 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ipc/reactor.h"
+#include "ipc/config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* Events handled per epoll_wait */
+#define REACTOR_MAX_EVENTS 16
+
+/**
+ * Changes the events watched for a connection
+ */
+static bool kprv_reactor_watch(socket_reactor * reactor, reactor_conn * conn, bool want_send)
+{
+    struct epoll_event event = {
+        .events = EPOLLIN | (want_send ? EPOLLOUT : 0),
+        .data.ptr = conn
+    };
+
+    return (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_MOD, conn->conn.socket_handle, &event) == 0);
+}
+
+/**
+ * Closes a connection and removes it from the reactor
+ */
+static void kprv_reactor_close(socket_reactor * reactor, reactor_conn * conn)
+{
+    reactor_conn ** link;
+
+    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, conn->conn.socket_handle, NULL);
+
+    if (reactor->callbacks.on_close != NULL)
+    {
+        reactor->callbacks.on_close(conn, reactor->arg);
+    }
+
+    for (link = &(reactor->conns); *link != NULL; link = &((*link)->next))
+    {
+        if (*link == conn)
+        {
+            *link = conn->next;
+            break;
+        }
+    }
+
+    kprv_socket_close(&(conn->conn));
+    csp_mutex_remove(&(conn->tx_lock));
+    free(conn->rx_buffer);
+    free(conn->tx_queue);
+    free(conn);
+}
+
+/**
+ * Accepts all pending connections
+ */
+static void kprv_reactor_accept(socket_reactor * reactor)
+{
+    reactor_conn * conn;
+    struct epoll_event event = {
+        .events = EPOLLIN
+    };
+    socklen_t addr_len;
+    int socket_handle;
+
+    while (true)
+    {
+        if ((conn = calloc(1, sizeof(reactor_conn))) == NULL)
+        {
+            return;
+        }
+
+        addr_len = sizeof(conn->conn.socket_addr);
+        socket_handle = accept(reactor->server.socket_handle, (struct sockaddr *)&(conn->conn.socket_addr), &addr_len);
+        if (socket_handle < 0)
+        {
+            free(conn);
+            return;
+        }
+        fcntl(socket_handle, F_SETFL, fcntl(socket_handle, F_GETFL, 0) | O_NONBLOCK);
+
+        conn->conn.socket_handle = socket_handle;
+        conn->conn.is_active = true;
+        conn->rx_buffer = malloc(SOCKET_HEADER_SIZE + reactor->max_message);
+        conn->tx_queue = malloc(IPC_SEND_QUEUE_SIZE);
+        if ((conn->rx_buffer == NULL) || (conn->tx_queue == NULL)
+            || (csp_mutex_create(&(conn->tx_lock)) != CSP_SEMAPHORE_OK))
+        {
+            kprv_socket_close(&(conn->conn));
+            free(conn->rx_buffer);
+            free(conn->tx_queue);
+            free(conn);
+            continue;
+        }
+
+        conn->next = reactor->conns;
+        reactor->conns = conn;
+
+        event.data.ptr = conn;
+        if ((epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, socket_handle, &event) != 0)
+            || ((reactor->callbacks.on_accept != NULL) && !reactor->callbacks.on_accept(conn, reactor->arg)))
+        {
+            /* on_close is only called for accepted connections */
+            reactor->conns = conn->next;
+            epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, socket_handle, NULL);
+            kprv_socket_close(&(conn->conn));
+            csp_mutex_remove(&(conn->tx_lock));
+            free(conn->rx_buffer);
+            free(conn->tx_queue);
+            free(conn);
+        }
+    }
+}
+
+/**
+ * Receives what is available on a connection and hands every complete
+ * message to on_message
+ * @return bool false if the connection should be closed
+ */
+static bool kprv_reactor_receive(socket_reactor * reactor, reactor_conn * conn)
+{
+    uint32_t offset = 0;
+    uint32_t length;
+    ssize_t recv_size;
+
+    recv_size = recv(conn->conn.socket_handle, conn->rx_buffer + conn->rx_fill,
+                     SOCKET_HEADER_SIZE + reactor->max_message - conn->rx_fill, MSG_DONTWAIT);
+    if (recv_size < 0)
+    {
+        return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR));
+    }
+    if (recv_size == 0)
+    {
+        /* Connection was closed */
+        return false;
+    }
+    conn->rx_fill += recv_size;
+
+    while ((conn->rx_fill - offset) >= SOCKET_HEADER_SIZE)
+    {
+        memcpy(&length, conn->rx_buffer + offset, SOCKET_HEADER_SIZE);
+        length = ntohl(length);
+        if (length > reactor->max_message)
+        {
+            return false;
+        }
+        if ((conn->rx_fill - offset - SOCKET_HEADER_SIZE) < length)
+        {
+            break;
+        }
+
+        if ((reactor->callbacks.on_message != NULL)
+            && !reactor->callbacks.on_message(conn, conn->rx_buffer + offset + SOCKET_HEADER_SIZE, length, reactor->arg))
+        {
+            return false;
+        }
+        offset += SOCKET_HEADER_SIZE + length;
+    }
+
+    /* Keeps the start of an incomplete message for the next receive */
+    conn->rx_fill -= offset;
+    memmove(conn->rx_buffer, conn->rx_buffer + offset, conn->rx_fill);
+
+    return true;
+}
+
+/**
+ * Sends as much of the send queue as possible, tx_lock must be held
+ */
+static void kprv_reactor_flush(socket_reactor * reactor, reactor_conn * conn)
+{
+    ssize_t sent;
+
+    while (conn->tx_start < conn->tx_end)
+    {
+        sent = send(conn->conn.socket_handle, conn->tx_queue + conn->tx_start,
+                    conn->tx_end - conn->tx_start, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+            {
+                conn->failed = true;
+            }
+            return;
+        }
+        conn->tx_start += sent;
+    }
+
+    conn->tx_start = 0;
+    conn->tx_end = 0;
+    kprv_reactor_watch(reactor, conn, false);
+}
+
+bool kprv_reactor_init(socket_reactor * reactor, uint16_t port, uint8_t num_connections,
+                       const socket_reactor_callbacks * callbacks, void * arg, uint32_t max_message)
+{
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = NULL
+    };
+    int flags;
+
+    if ((reactor == NULL) || (callbacks == NULL))
+    {
+        return false;
+    }
+
+    memset(reactor, 0, sizeof(socket_reactor));
+    reactor->callbacks = *callbacks;
+    reactor->arg = arg;
+    reactor->max_message = max_message;
+
+    if (!kprv_socket_server_setup(&(reactor->server), port, num_connections))
+    {
+        return false;
+    }
+
+    flags = fcntl(reactor->server.socket_handle, F_GETFL, 0);
+    reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if ((flags < 0) || (fcntl(reactor->server.socket_handle, F_SETFL, flags | O_NONBLOCK) < 0)
+        || (reactor->epoll_fd < 0)
+        || (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->server.socket_handle, &event) != 0))
+    {
+        if (reactor->epoll_fd >= 0)
+        {
+            close(reactor->epoll_fd);
+        }
+        kprv_socket_close(&(reactor->server));
+        return false;
+    }
+
+    return true;
+}
+
+bool kprv_reactor_poll(socket_reactor * reactor, int timeout)
+{
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    reactor_conn * conn;
+    bool keep;
+    int num_events;
+    int i;
+
+    if ((reactor == NULL) || (reactor->server.is_active == false))
+    {
+        return false;
+    }
+
+    num_events = epoll_wait(reactor->epoll_fd, events, REACTOR_MAX_EVENTS, timeout);
+    if (num_events < 0)
+    {
+        return (errno == EINTR);
+    }
+
+    for (i = 0; i < num_events; i++)
+    {
+        conn = events[i].data.ptr;
+        if (conn == NULL)
+        {
+            kprv_reactor_accept(reactor);
+            continue;
+        }
+
+        keep = ((events[i].events & EPOLLERR) == 0);
+
+        if (keep && (events[i].events & (EPOLLIN | EPOLLHUP)))
+        {
+            /* After a hangup, everything the peer sent before closing is
+             * already here, so it is read up to the end of the stream */
+            do
+            {
+                keep = kprv_reactor_receive(reactor, conn);
+            } while (keep && (events[i].events & EPOLLHUP));
+        }
+
+        csp_mutex_lock(&(conn->tx_lock), CSP_MAX_DELAY);
+        if (keep && (events[i].events & EPOLLOUT))
+        {
+            kprv_reactor_flush(reactor, conn);
+        }
+        keep = keep && !conn->failed;
+        csp_mutex_unlock(&(conn->tx_lock));
+
+        if (!keep)
+        {
+            kprv_reactor_close(reactor, conn);
+        }
+    }
+
+    return true;
+}
+
+bool kprv_reactor_send(socket_reactor * reactor, reactor_conn * conn, const uint8_t * data_buffer, uint32_t data_length)
+{
+    uint32_t header = htonl(data_length);
+    uint32_t total = SOCKET_HEADER_SIZE + data_length;
+    uint32_t queued;
+    ssize_t sent = 0;
+    bool ret = false;
+
+    if ((reactor == NULL) || (conn == NULL) || (data_buffer == NULL))
+    {
+        return false;
+    }
+
+    csp_mutex_lock(&(conn->tx_lock), CSP_MAX_DELAY);
+
+    queued = conn->tx_end - conn->tx_start;
+    /* A message is only accepted if all of it fits, so the stream never
+     * holds part of a message */
+    if (!conn->failed && (total <= (IPC_SEND_QUEUE_SIZE - queued)))
+    {
+        if (queued == 0)
+        {
+            struct iovec iov[2] = {
+                { .iov_base = &header, .iov_len = SOCKET_HEADER_SIZE },
+                { .iov_base = (void *)data_buffer, .iov_len = data_length }
+            };
+            struct msghdr msg = {
+                .msg_iov = iov,
+                .msg_iovlen = 2
+            };
+
+            do
+            {
+                sent = sendmsg(conn->conn.socket_handle, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+            } while ((sent < 0) && (errno == EINTR));
+
+            if (sent < 0)
+            {
+                if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+                {
+                    conn->failed = true;
+                }
+                sent = 0;
+            }
+        }
+
+        if (!conn->failed)
+        {
+            if ((uint32_t) sent < total)
+            {
+                if ((IPC_SEND_QUEUE_SIZE - conn->tx_end) < (total - sent))
+                {
+                    memmove(conn->tx_queue, conn->tx_queue + conn->tx_start, queued);
+                    conn->tx_start = 0;
+                    conn->tx_end = queued;
+                }
+                for (; (uint32_t) sent < SOCKET_HEADER_SIZE; sent++)
+                {
+                    conn->tx_queue[conn->tx_end++] = ((uint8_t *)&header)[sent];
+                }
+                memcpy(conn->tx_queue + conn->tx_end, data_buffer + (sent - SOCKET_HEADER_SIZE), total - sent);
+                conn->tx_end += total - sent;
+
+                if (queued == 0)
+                {
+                    kprv_reactor_watch(reactor, conn, true);
+                }
+            }
+            ret = true;
+        }
+    }
+
+    csp_mutex_unlock(&(conn->tx_lock));
+
+    return ret;
+}
+
+void kprv_reactor_cleanup(socket_reactor * reactor)
+{
+    if (reactor != NULL)
+    {
+        while (reactor->conns != NULL)
+        {
+            kprv_reactor_close(reactor, reactor->conns);
+        }
+
+        if (reactor->epoll_fd >= 0)
+        {
+            close(reactor->epoll_fd);
+            reactor->epoll_fd = -1;
+        }
+
+        kprv_socket_close(&(reactor->server));
+    }
+}
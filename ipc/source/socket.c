@@ -15,31 +15,156 @@
  */
 
 #include "ipc/socket.h"
+#include "ipc/config.h"
 #include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #define LOCAL_ADDRESS "127.0.0.1"
 
+/**
+ * Receive state of a connection, kept outside of socket_conn so receiving
+ * doesn't modify the connection
+ */
+typedef struct
+{
+    /* Bytes of the current incoming message which have not been received yet */
+    uint32_t remaining;
+    /* Length prefix of the next incoming message, if only partly received */
+    uint8_t header[SOCKET_HEADER_SIZE];
+    /* Bytes of header received so far */
+    uint8_t header_len;
+    /* A message body was cut short, the stream is out of sync */
+    bool broken;
+} socket_rx_state;
+
+/* Receive state indexed by socket handle, grown as larger handles show up */
+static socket_rx_state * rx_states = NULL;
+static int rx_states_len = 0;
+static pthread_mutex_t rx_states_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Copies the receive state of socket_handle into state
+ */
+static bool kprv_socket_rx_state_get(int socket_handle, socket_rx_state * state)
+{
+    bool ret = true;
+
+    pthread_mutex_lock(&rx_states_lock);
+    if (socket_handle >= rx_states_len)
+    {
+        int len = (rx_states_len == 0) ? 64 : rx_states_len;
+        socket_rx_state * states;
+
+        while (len <= socket_handle)
+        {
+            len *= 2;
+        }
+        states = realloc(rx_states, len * sizeof(socket_rx_state));
+        if (states == NULL)
+        {
+            ret = false;
+        }
+        else
+        {
+            memset(states + rx_states_len, 0, (len - rx_states_len) * sizeof(socket_rx_state));
+            rx_states = states;
+            rx_states_len = len;
+        }
+    }
+    if (ret)
+    {
+        *state = rx_states[socket_handle];
+    }
+    pthread_mutex_unlock(&rx_states_lock);
+
+    return ret;
+}
+
+/**
+ * Stores the receive state of socket_handle, NULL resets it for a new connection
+ */
+static void kprv_socket_rx_state_set(int socket_handle, const socket_rx_state * state)
+{
+    pthread_mutex_lock(&rx_states_lock);
+    if ((socket_handle >= 0) && (socket_handle < rx_states_len))
+    {
+        if (state == NULL)
+        {
+            memset(&rx_states[socket_handle], 0, sizeof(socket_rx_state));
+        }
+        else
+        {
+            rx_states[socket_handle] = *state;
+        }
+    }
+    pthread_mutex_unlock(&rx_states_lock);
+}
+
+/**
+ * Creates a socket of the configured transport and fills in the address of
+ * port. Unix domain sockets use SOCK_STREAM, as messages are framed by the
+ * length prefix and may be received in pieces.
+ */
+static int kprv_socket_create(uint16_t port, struct sockaddr_storage * addr, socklen_t * addr_len)
+{
+    memset(addr, 0, sizeof(struct sockaddr_storage));
+
+    if (IPC_UNIX_SOCKET)
+    {
+        struct sockaddr_un * local = (struct sockaddr_un *)addr;
+        int length;
+
+        /* Abstract address (leading NUL), nothing is left behind in the file system */
+        local->sun_family = AF_UNIX;
+        length = snprintf(local->sun_path + 1, sizeof(local->sun_path) - 1, "ipc-socket-%u", port);
+        *addr_len = offsetof(struct sockaddr_un, sun_path) + 1 + length;
+        return socket(AF_UNIX, SOCK_STREAM, 0);
+    }
+    else
+    {
+        struct sockaddr_in * inet = (struct sockaddr_in *)addr;
+
+        inet->sin_addr.s_addr = inet_addr(LOCAL_ADDRESS);
+        inet->sin_family = AF_INET;
+        inet->sin_port = htons(port);
+        *addr_len = sizeof(struct sockaddr_in);
+        return socket(AF_INET, SOCK_STREAM, IPPROTO_SCTP);
+    }
+}
+
 bool kprv_socket_server_setup(socket_conn * conn, uint16_t port, uint8_t num_connections)
 {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+
     if (conn == NULL)
     {
         return false;
     }
 
-    if ((conn->socket_handle = socket(AF_INET, SOCK_STREAM, IPPROTO_SCTP)) == -1)
+    if ((conn->socket_handle = kprv_socket_create(port, &addr, &addr_len)) == -1)
     {
         printf("Failed to create socket\r\n");
         return false;
     }
 
-    conn->socket_addr.sin_addr.s_addr = inet_addr(LOCAL_ADDRESS);
-    conn->socket_addr.sin_family = AF_INET;
-    conn->socket_addr.sin_port = htons(port);
+    /* Only holds the address of SCTP sockets */
+    memset(&(conn->socket_addr), 0, sizeof(conn->socket_addr));
+    if (addr.ss_family == AF_INET)
+    {
+        memcpy(&(conn->socket_addr), &addr, sizeof(struct sockaddr_in));
+    }
 
-    if (bind(conn->socket_handle, (struct sockaddr *)&(conn->socket_addr), sizeof(struct sockaddr_in)) < 0)
+    if (bind(conn->socket_handle, (struct sockaddr *)&addr, addr_len) < 0)
     {
         printf("Failed to bind socket\r\n");
         return false;
@@ -52,6 +177,7 @@ bool kprv_socket_server_setup(socket_conn * conn, uint16_t port, uint8_t num_con
     }
 
     conn->is_active = true;
+    kprv_socket_rx_state_set(conn->socket_handle, NULL);
 
     return true;
 }
@@ -73,6 +199,7 @@ bool kprv_socket_server_accept(const socket_conn * server_conn, socket_conn * cl
     client_conn->socket_handle = socket_handle;
 
     client_conn->is_active = true;
+    kprv_socket_rx_state_set(socket_handle, NULL);
 
     return true;
 }
@@ -80,33 +207,64 @@ bool kprv_socket_server_accept(const socket_conn * server_conn, socket_conn * cl
 bool kprv_socket_client_connect(socket_conn * conn, uint16_t port)
 {
     int socket_handle;
-    struct sockaddr_in server;
+    struct sockaddr_storage server;
+    socklen_t server_len;
 
     if (conn == NULL)
     {
         return false;
     }
 
-    socket_handle = socket(AF_INET, SOCK_STREAM, IPPROTO_SCTP);
+    socket_handle = kprv_socket_create(port, &server, &server_len);
     if (socket_handle == -1)
     {
         conn->is_active = false;
         return false;
     }
 
-    server.sin_addr.s_addr = inet_addr(LOCAL_ADDRESS);
-    server.sin_family = AF_INET;
-    server.sin_port = htons(port);
-
     //Connect to remote server
-    if (connect(socket_handle, (struct sockaddr *)&server, sizeof(server)) != 0)
+    if (connect(socket_handle, (struct sockaddr *)&server, server_len) != 0)
     {
+        close(socket_handle);
         conn->is_active = false;
         return false;
     }
 
     conn->socket_handle = socket_handle;
     conn->is_active = true;
+    kprv_socket_rx_state_set(conn->socket_handle, NULL);
+
+    return true;
+}
+
+/**
+ * Receives until length bytes are in buffer, waiting for more if they arrive
+ * in pieces. received holds the bytes already in buffer and is kept up to
+ * date, so a read which times out can be resumed.
+ */
+static bool kprv_socket_recv_all(int socket_handle, void * buffer, uint32_t length, uint32_t * received)
+{
+    uint8_t * data = buffer;
+    int recv_size;
+
+    while (*received < length)
+    {
+        recv_size = recv(socket_handle, data + *received, length - *received, MSG_WAITALL);
+        if (recv_size < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        if (recv_size == 0)
+        {
+            /* Connection was closed */
+            return false;
+        }
+        *received += recv_size;
+    }
 
     return true;
 }
@@ -118,10 +276,41 @@ bool kprv_socket_send(const socket_conn * conn, const uint8_t * data_buffer, uin
         return false;
     }
 
-    int result = send(conn->socket_handle, data_buffer, data_length, MSG_NOSIGNAL);
-    if (result < 0)
+    uint32_t header = htonl(data_length);
+    struct iovec iov[2] = {
+        { .iov_base = &header, .iov_len = SOCKET_HEADER_SIZE },
+        { .iov_base = (void *)data_buffer, .iov_len = data_length }
+    };
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = 2
+    };
+    ssize_t result;
+
+    /* Sends the prefix and the message together, continuing after partial sends */
+    while (msg.msg_iovlen > 0)
     {
-        return false;
+        result = sendmsg(conn->socket_handle, &msg, MSG_NOSIGNAL);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        while ((msg.msg_iovlen > 0) && ((size_t) result >= msg.msg_iov->iov_len))
+        {
+            result -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0)
+        {
+            msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + result;
+            msg.msg_iov->iov_len -= result;
+        }
     }
 
     return true;
@@ -129,19 +318,53 @@ bool kprv_socket_send(const socket_conn * conn, const uint8_t * data_buffer, uin
 
 bool kprv_socket_recv(const socket_conn * conn, uint8_t * data_buffer, uint32_t data_length, uint32_t * length_read)
 {
+    socket_rx_state state;
+    uint32_t header;
+    uint32_t header_len;
+    uint32_t length;
+    uint32_t received = 0;
+    bool ret = false;
+
     if ((conn == NULL) || (length_read == NULL) || (data_buffer == NULL) || (conn->is_active == false))
     {
         return false;
     }
 
-    int recv_size = recv(conn->socket_handle, (void *)data_buffer, data_length, 0);
-    if (recv_size < 0) {
+    if (!kprv_socket_rx_state_get(conn->socket_handle, &state) || state.broken)
+    {
         return false;
     }
 
-    *length_read = recv_size;
+    if (state.remaining == 0)
+    {
+        /* Picks up a prefix a previous call only got part of */
+        header_len = state.header_len;
+        if (!kprv_socket_recv_all(conn->socket_handle, state.header, SOCKET_HEADER_SIZE, &header_len))
+        {
+            state.header_len = header_len;
+            kprv_socket_rx_state_set(conn->socket_handle, &state);
+            return false;
+        }
+        state.header_len = 0;
+        memcpy(&header, state.header, SOCKET_HEADER_SIZE);
+        state.remaining = ntohl(header);
+    }
 
-    return true;
+    length = (state.remaining < data_length) ? state.remaining : data_length;
+    if (kprv_socket_recv_all(conn->socket_handle, data_buffer, length, &received))
+    {
+        state.remaining -= length;
+        *length_read = length;
+        ret = true;
+    }
+    else if (received > 0)
+    {
+        /* Part of the body is gone with this call's buffer */
+        state.broken = true;
+    }
+    kprv_socket_rx_state_set(conn->socket_handle, &state);
+
+    return ret;
 }
 
 bool kprv_socket_close(socket_conn * conn)
@@ -152,6 +375,7 @@ bool kprv_socket_close(socket_conn * conn)
     }
 
     conn->is_active = false;
+    kprv_socket_rx_state_set(conn->socket_handle, NULL);
 
     if (shutdown(conn->socket_handle, SHUT_RDWR) != 0)
     {
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmocka.h>
+#include <csp/arch/csp_thread.h>
+#include <csp/csp.h>
+#include <ipc/reactor.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TEST_SOCKET_PORT 8282
+#define TEST_MAX_MESSAGE 64
+
+static uint8_t send_msg[] = "test123test";
+static uint8_t reply_msg[] = "reply";
+
+static socket_reactor reactor;
+static int num_accepted = 0;
+static int num_messages = 0;
+static int num_closed = 0;
+static bool client_done = false;
+
+static bool on_accept(reactor_conn * conn, void * arg)
+{
+    num_accepted++;
+    return true;
+}
+
+static bool on_message(reactor_conn * conn, const uint8_t * data, uint32_t length, void * arg)
+{
+    assert_int_equal(length, sizeof(send_msg));
+    assert_memory_equal(data, send_msg, sizeof(send_msg));
+    num_messages++;
+
+    if (num_messages == 3)
+    {
+        assert_true(kprv_reactor_send(&reactor, conn, reply_msg, sizeof(reply_msg)));
+    }
+    return true;
+}
+
+static void on_close(reactor_conn * conn, void * arg)
+{
+    num_closed++;
+}
+
+CSP_DEFINE_TASK(client_task)
+{
+    socket_conn conn;
+    uint8_t recv_msg[4];
+    uint8_t frame[SOCKET_HEADER_SIZE + sizeof(send_msg)];
+    uint32_t header = htonl(sizeof(send_msg));
+    uint32_t bytes_recv = 0;
+    int tries = 0;
+
+    while ((tries++ < 5) && !kprv_socket_client_connect(&conn, TEST_SOCKET_PORT))
+    {
+        csp_sleep_ms(10);
+    }
+    assert_true(conn.is_active);
+
+    /* Two messages sent back to back */
+    assert_true(kprv_socket_send(&conn, send_msg, sizeof(send_msg)));
+    assert_true(kprv_socket_send(&conn, send_msg, sizeof(send_msg)));
+
+    /* A message arriving in pieces */
+    memcpy(frame, &header, SOCKET_HEADER_SIZE);
+    memcpy(frame + SOCKET_HEADER_SIZE, send_msg, sizeof(send_msg));
+    assert_int_equal(send(conn.socket_handle, frame, 2, 0), 2);
+    csp_sleep_ms(20);
+    assert_int_equal(send(conn.socket_handle, frame + 2, sizeof(frame) - 2, 0), sizeof(frame) - 2);
+
+    /* The reply is larger than the buffer and returned by two reads */
+    assert_true(kprv_socket_recv(&conn, recv_msg, sizeof(recv_msg), &bytes_recv));
+    assert_int_equal(bytes_recv, sizeof(recv_msg));
+    assert_memory_equal(recv_msg, reply_msg, sizeof(recv_msg));
+    assert_true(kprv_socket_recv(&conn, recv_msg, sizeof(recv_msg), &bytes_recv));
+    assert_int_equal(bytes_recv, sizeof(reply_msg) - sizeof(recv_msg));
+    assert_memory_equal(recv_msg, reply_msg + sizeof(recv_msg), bytes_recv);
+
+    assert_true(kprv_socket_close(&conn));
+
+    client_done = true;
+
+    csp_thread_exit();
+}
+
+static void test_socket_reactor(void ** arg)
+{
+    csp_thread_handle_t client_task_handle;
+    const socket_reactor_callbacks callbacks = {
+        .on_accept = on_accept,
+        .on_message = on_message,
+        .on_close = on_close
+    };
+    int polls = 0;
+
+    assert_true(kprv_reactor_init(&reactor, TEST_SOCKET_PORT, 20, &callbacks, NULL, TEST_MAX_MESSAGE));
+
+    csp_thread_create(client_task, "CLIENT", 1024, NULL, 0, &client_task_handle);
+
+    while ((polls++ < 100) && (!client_done || (num_closed == 0)))
+    {
+        assert_true(kprv_reactor_poll(&reactor, 50));
+    }
+
+    assert_int_equal(num_accepted, 1);
+    assert_int_equal(num_messages, 3);
+    assert_int_equal(num_closed, 1);
+    assert_null(reactor.conns);
+
+    kprv_reactor_cleanup(&reactor);
+    assert_false(reactor.server.is_active);
+}
+
+static void test_socket_reactor_hangup(void ** arg)
+{
+    const socket_reactor_callbacks callbacks = {
+        .on_accept = on_accept,
+        .on_message = on_message,
+        .on_close = on_close
+    };
+    socket_conn conn;
+    int polls = 0;
+
+    num_accepted = 0;
+    num_messages = 0;
+    num_closed = 0;
+
+    assert_true(kprv_reactor_init(&reactor, TEST_SOCKET_PORT, 20, &callbacks, NULL, TEST_MAX_MESSAGE));
+
+    /* The peer is gone before the reactor sees its last messages */
+    assert_true(kprv_socket_client_connect(&conn, TEST_SOCKET_PORT));
+    assert_true(kprv_socket_send(&conn, send_msg, sizeof(send_msg)));
+    assert_true(kprv_socket_send(&conn, send_msg, sizeof(send_msg)));
+    assert_true(kprv_socket_close(&conn));
+
+    while ((polls++ < 100) && (num_closed == 0))
+    {
+        assert_true(kprv_reactor_poll(&reactor, 50));
+    }
+
+    assert_int_equal(num_accepted, 1);
+    assert_int_equal(num_messages, 2);
+    assert_int_equal(num_closed, 1);
+    assert_null(reactor.conns);
+
+    kprv_reactor_cleanup(&reactor);
+}
+
+static void test_socket_recv_partial(void ** arg)
+{
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = 20000 };
+    uint32_t header = htonl(sizeof(send_msg));
+    uint8_t frame[SOCKET_HEADER_SIZE + sizeof(send_msg)];
+    uint8_t recv_msg[sizeof(send_msg)];
+    uint32_t bytes_recv = 0;
+    socket_conn conn = { 0 };
+    int fds[2];
+
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    conn.socket_handle = fds[0];
+    conn.is_active = true;
+
+    memcpy(frame, &header, SOCKET_HEADER_SIZE);
+    memcpy(frame + SOCKET_HEADER_SIZE, send_msg, sizeof(send_msg));
+
+    /* A read timing out within the length prefix resumes from it */
+    assert_int_equal(send(fds[1], frame, 2, 0), 2);
+    assert_false(kprv_socket_recv(&conn, recv_msg, sizeof(recv_msg), &bytes_recv));
+    assert_int_equal(send(fds[1], frame + 2, sizeof(frame) - 2, 0), sizeof(frame) - 2);
+    assert_true(kprv_socket_recv(&conn, recv_msg, sizeof(recv_msg), &bytes_recv));
+    assert_int_equal(bytes_recv, sizeof(send_msg));
+    assert_memory_equal(recv_msg, send_msg, sizeof(send_msg));
+
+    /* One timing out before the body, too */
+    assert_int_equal(send(fds[1], frame, SOCKET_HEADER_SIZE, 0), SOCKET_HEADER_SIZE);
+    assert_false(kprv_socket_recv(&conn, recv_msg, sizeof(recv_msg), &bytes_recv));
+    assert_int_equal(send(fds[1], send_msg, sizeof(send_msg), 0), sizeof(send_msg));
+    assert_true(kprv_socket_recv(&conn, recv_msg, sizeof(recv_msg), &bytes_recv));
+    assert_int_equal(bytes_recv, sizeof(send_msg));
+    assert_memory_equal(recv_msg, send_msg, sizeof(send_msg));
+
+    /* A body cut short leaves the stream out of sync */
+    assert_int_equal(send(fds[1], frame, SOCKET_HEADER_SIZE + 2, 0), SOCKET_HEADER_SIZE + 2);
+    assert_false(kprv_socket_recv(&conn, recv_msg, sizeof(recv_msg), &bytes_recv));
+    assert_int_equal(send(fds[1], frame, sizeof(frame), 0), sizeof(frame));
+    assert_false(kprv_socket_recv(&conn, recv_msg, sizeof(recv_msg), &bytes_recv));
+
+    assert_true(kprv_socket_close(&conn));
+    close(fds[1]);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_socket_reactor),
+        cmocka_unit_test(test_socket_reactor_hangup),
+        cmocka_unit_test(test_socket_recv_partial),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -60,6 +60,24 @@ extern "C" {
 #define KLOG_PART_SIZE_DEFAULT (1024 * 512) /**< Default file partition size  */
 #define KLOG_MAX_PARTS_DEFAULT 4 /**< Default partition count limit  */
 
+#define KLOG_ASYNC_BUFFER_DEFAULT 8192 /**< Default async line buffer size  */
+#define KLOG_SYNC_INTERVAL_DEFAULT 1000 /**< Default max time (ms) between syncs in async mode  */
+#define KLOG_SYNC_BYTES_DEFAULT 4096 /**< Default max bytes written between syncs in async mode  */
+#define KLOG_ASYNC_STACK_SIZE 1000 /**< Stack size of the async writer thread  */
+#define KLOG_ASYNC_PRIORITY 0 /**< Priority of the async writer thread  */
+
+#define KLOG_BINARY_MAGIC 0x42474C4B /**< Starts every binary log part ("KLGB") */
+#define KLOG_BINARY_VERSION 1 /**< Current version of the binary log format */
+#ifndef KLOG_BINARY_MAX_FORMATS
+#define KLOG_BINARY_MAX_FORMATS 128 /**< Number of format strings which can be registered */
+#endif
+#define KLOG_BINARY_MAX_ARGS 12 /**< Arguments a registered format string may take */
+#define KLOG_BINARY_MAX_FORMAT_LEN 255 /**< Length limit of registered format strings */
+
+#define KLOG_BINARY_DEFINITION 1 /**< Record type of ::klog_binary_definition */
+#define KLOG_BINARY_LINE 2 /**< Record type of a ::klog_binary_line holding packed arguments */
+#define KLOG_BINARY_TEXT 3 /**< Record type of a ::klog_binary_line holding formatted text */
+
 /**
  * KLog configuration structure
  */
@@ -72,8 +90,64 @@ typedef struct
     uint8_t klog_console_level; /**< Console logging level */
     uint8_t klog_file_level; /**< File logging level */
     bool klog_file_logging; /**< Specifies whether logging-to-file is enabled */
+    bool klog_async; /**< Specifies whether a background thread writes log lines to file */
+    uint32_t async_buffer_size; /**< Async line buffer size, KLOG_ASYNC_BUFFER_DEFAULT if 0 */
+    uint32_t sync_interval; /**< Async max time (ms) between syncs, KLOG_SYNC_INTERVAL_DEFAULT if 0 */
+    uint32_t sync_bytes; /**< Async max bytes written between syncs, KLOG_SYNC_BYTES_DEFAULT if 0 */
+    bool klog_binary; /**< Specifies whether log lines are stored in the binary format */
 } klog_config;
 
+/**
+ * Header at the start of every binary log part. Values in binary log
+ * parts are stored in the byte order of the machine which wrote them.
+ */
+typedef struct __attribute__((packed))
+{
+    uint32_t magic; /**< Always KLOG_BINARY_MAGIC */
+    uint8_t version; /**< Format version, KLOG_BINARY_VERSION */
+    uint8_t reserved[3]; /**< Unused, always zero */
+} klog_binary_header;
+
+/**
+ * Binary record defining a format string id, followed by the logger and
+ * the format string without NUL terminators. Written to a part before the
+ * first line which uses the id.
+ */
+typedef struct __attribute__((packed))
+{
+    uint8_t type; /**< Always KLOG_BINARY_DEFINITION */
+    uint8_t logger_length; /**< Length of the logger */
+    uint16_t id; /**< Format string id */
+    uint16_t format_length; /**< Length of the format string */
+} klog_binary_definition;
+
+/**
+ * Binary record of a log line, followed by length bytes of arguments.
+ *
+ * For KLOG_BINARY_LINE the arguments are packed in the order of the
+ * format string's conversions: int sized integers and '*' widths take 4
+ * bytes, wider integers, pointers and floating point values take 8 bytes
+ * and strings a length byte followed by the string. Unsigned conversions
+ * are zero extended, signed ones sign extended.
+ *
+ * For KLOG_BINARY_TEXT, used for format strings which can not be
+ * registered, id is 0 and the arguments are the NUL terminated logger
+ * followed by the formatted message.
+ */
+typedef struct __attribute__((packed))
+{
+    uint8_t type; /**< KLOG_BINARY_LINE or KLOG_BINARY_TEXT */
+    uint8_t level; /**< Severity level */
+    uint16_t id; /**< Format string id */
+    uint32_t millis; /**< Time (ms) the line was logged */
+    uint16_t length; /**< Length of the arguments */
+} klog_binary_line;
+
+/**
+ * State of an async KLog writer
+ */
+struct klog_async;
+
 /**
  * KLog handle
  */
@@ -83,6 +157,9 @@ typedef struct
     uint8_t current_part; /**< Current file partition in use */
     uint32_t current_part_size; /**< Size of current partition */
     klog_config config; /**< Pointer to KLog configuration */
+    struct klog_async *async; /**< Async writer, NULL when writing synchronously */
+    uint32_t dropped_lines; /**< Lines dropped because the async line buffer was full */
+    uint8_t binary_defined[(KLOG_BINARY_MAX_FORMATS + 7) / 8]; /**< Format string ids defined in the current binary part */
 } klog_handle;
 
 /**
@@ -91,6 +168,17 @@ typedef struct
  * This function will create a new log file and save the file
  * pointer into handle->log_file.
  *
+ * If handle->config.klog_async is set, a background thread is started
+ * which writes log lines to file. Logging calls only copy their line into
+ * a buffer and return. The thread writes all buffered lines with a single
+ * write and syncs the file every sync_interval ms, every sync_bytes bytes
+ * and after every LOG_ERROR line. Lines which do not fit into a full
+ * buffer are dropped and counted in handle->dropped_lines.
+ *
+ * If handle->config.klog_binary is set, log lines are stored in the binary
+ * format described by ::klog_binary_line, which can be turned back into
+ * text with tools/klog_decode.py.
+ *
  * @param[in] handle Pointer to logging handle
  *
  * @return int 0 on success, -1 on error
@@ -119,9 +207,30 @@ void klog_console(unsigned level, const char *logger, const char *format, ...);
  * @param[in] format Message to log
  */
 void klog_file(klog_handle *handle, unsigned level, const char *logger, const char *format, ...);
+/**
+ * @brief Add message to file in the binary format
+ *
+ * Instead of formatting the message, this stores the id of the format
+ * string and the raw arguments. Each call site registers its format
+ * string on first use and remembers the id in site. Format strings with
+ * more than KLOG_BINARY_MAX_ARGS arguments, wide characters or unknown
+ * conversions are formatted and stored as text.
+ *
+ * @param[in] handle Pointer to logging handle
+ * @param[in,out] site   Format string id cache of the call site, initially 0
+ * @param[in] level  Severity level of message
+ * @param[in] logger Tag for message, must stay valid while the handle is used
+ * @param[in] format Message to log, must stay valid while the handle is used
+ */
+void klog_file_binary(klog_handle *handle, uint16_t *site, unsigned level, const char *logger, const char *format, ...);
 /**
  * @brief Sync and close logging file
  *
+ * An async writer writes all buffered lines and stops first. Logging with
+ * the handle afterwards is done synchronously until klog_init_file is
+ * called again. Must not be called while other threads are logging with
+ * the handle.
+ *
  * @param[in] handle Pointer to logging handle
  */
 void klog_cleanup(klog_handle *handle);
@@ -130,7 +239,8 @@ void klog_cleanup(klog_handle *handle);
  * @brief KLog write macro
  *
  * If the specified level is greater than or equal to the current configured minimum logging level,
- * calls logging function. Otherwise, ignores the input
+ * calls logging function. Otherwise, ignores the input. Each use of the
+ * macro has its own format string id cache for binary logging.
  *
  * @param[in] handle Pointer to logging handle
  * @param[in] level  Severity level of message
@@ -141,7 +251,12 @@ void klog_cleanup(klog_handle *handle);
         klog_console(level, logger, __VA_ARGS__); \
     } \
     if (level <= ((handle)->config.klog_file_level) && ((handle)->config.klog_file_logging)) { \
-        klog_file(handle, level, logger, __VA_ARGS__); \
+        if ((handle)->config.klog_binary) { \
+            static uint16_t klog_site; \
+            klog_file_binary(handle, &klog_site, level, logger, __VA_ARGS__); \
+        } else { \
+            klog_file(handle, level, logger, __VA_ARGS__); \
+        } \
     } \
 } while (0)
 
@@ -19,28 +19,140 @@
 
 #include <errno.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/unistd.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <csp/arch/csp_semaphore.h>
+#include <csp/arch/csp_thread.h>
 #include <csp/arch/csp_time.h>
 #include "kubos-core/modules/klog.h"
 
+#define KLOG_ASYNC_BUFFER_MIN 512
+
+/* States of a record in the async line buffer */
+#define KLOG_RECORD_EMPTY 0 /* Free, or reserved and still being copied */
+#define KLOG_RECORD_READY 1 /* Holds a complete line */
+#define KLOG_RECORD_WRAP  2 /* Rest of the buffer is unused, continue at the start */
+
+/* Records are kept 4 byte aligned so their headers are never split */
+#define KLOG_RECORD_SIZE(len) ((sizeof(klog_record) + (len) + 3) & ~3u)
+
+/**
+ * Header of a line in the async line buffer, followed by the line itself
+ */
+typedef struct
+{
+    uint16_t length;
+    uint8_t level;
+    uint8_t state;
+} klog_record;
+
+/* Ways binary logging fetches an argument from a va_list */
+enum
+{
+    KLOG_ARG_INT,
+    KLOG_ARG_UINT,
+    KLOG_ARG_LONG,
+    KLOG_ARG_ULONG,
+    KLOG_ARG_LLONG,
+    KLOG_ARG_ULLONG,
+    KLOG_ARG_INTMAX,
+    KLOG_ARG_UINTMAX,
+    KLOG_ARG_PTRDIFF,
+    KLOG_ARG_SIZE,
+    KLOG_ARG_PTR,
+    KLOG_ARG_DOUBLE,
+    KLOG_ARG_LDOUBLE,
+    KLOG_ARG_STRING
+};
+
+/* Largest definition record, see klog_binary_definition */
+#define KLOG_BINARY_DEFINITION_MAX (sizeof(klog_binary_definition) + 255 + KLOG_BINARY_MAX_FORMAT_LEN)
+
+/**
+ * A registered binary logging format string
+ */
+typedef struct
+{
+    const char *logger;
+    const char *format;
+    uint8_t args[KLOG_BINARY_MAX_ARGS];
+    uint8_t num_args;
+    uint8_t ready; /* Set once the entry is filled in */
+} klog_format;
+
+/* Shared by all handles, allocated when the first format is registered */
+static klog_format *klog_formats = NULL;
+static uint16_t klog_num_formats = 0;
+
+struct klog_async
+{
+    uint8_t *ring; /* Line buffer, size is a power of two */
+    uint8_t *staging; /* Lines collected for a single write */
+    uint32_t staging_size; /* Size of the staging buffer */
+    uint32_t mask; /* Line buffer size - 1 */
+    uint32_t head; /* Position up to which loggers have reserved space */
+    uint32_t tail; /* Position up to which the writer has taken lines */
+    uint32_t idle; /* Set while the writer waits for lines */
+    bool stop; /* Set to stop the writer once all lines are written */
+    uint32_t unsynced; /* Bytes written since the last sync */
+    uint32_t last_sync; /* Time (ms) of the last sync */
+    csp_bin_sem_handle_t wake;
+    csp_bin_sem_handle_t done;
+    csp_thread_handle_t thread;
+};
+
+static void _close_log_file(klog_handle *handle)
+{
+    if (handle->log_file) {
+        fsync(fileno(handle->log_file));
+        fclose(handle->log_file);
+    }
+
+    handle->log_file = NULL;
+}
+
+static int _async_start(klog_handle *handle);
+
+/**
+ * Prepares a newly opened log file part for binary records. Definitions
+ * are repeated in every part so each part can be decoded on its own.
+ */
+static void _binary_start_part(klog_handle *handle, bool created)
+{
+    klog_binary_header header = {
+        .magic = KLOG_BINARY_MAGIC,
+        .version = KLOG_BINARY_VERSION
+    };
+
+    memset(handle->binary_defined, 0, sizeof(handle->binary_defined));
+
+    if (created) {
+        fwrite(&header, sizeof(header), 1, handle->log_file);
+        fflush(handle->log_file);
+        handle->current_part_size = sizeof(header);
+    }
+}
+
 static void _next_log_file(klog_handle *handle)
 {
     char buf[KLOG_PATH_LEN];
     char *tail;
     uint32_t pos = 0;
+    bool created = false;
     struct stat st;
 
     if (handle == NULL) {
         return;
     }
 
-    klog_cleanup(handle);
+    _close_log_file(handle);
     if (!handle->config.file_path) {
         return;
     }
@@ -57,6 +169,7 @@ static void _next_log_file(klog_handle *handle)
                 handle->log_file = fopen(buf, "w+");
                 handle->current_part = i;
                 handle->current_part_size = 0;
+                created = true;
                 break;
             }
             continue;
@@ -83,6 +196,7 @@ static void _next_log_file(klog_handle *handle)
 
         klog_console(LOG_DEBUG, "klog", "rotating to %s", buf);
         handle->log_file = fopen(buf, "w+");
+        created = true;
     }
 
     if (handle->log_file) {
@@ -90,6 +204,9 @@ static void _next_log_file(klog_handle *handle)
         if (pos > 0) {
             fseek(handle->log_file, 0, SEEK_END);
         }
+        if (handle->config.klog_binary) {
+            _binary_start_part(handle, created);
+        }
     }
 }
 
@@ -103,6 +220,8 @@ int klog_init_file(klog_handle *handle)
     handle->log_file = NULL;
     handle->current_part = -1;
     handle->current_part_size = 0;
+    handle->async = NULL;
+    handle->dropped_lines = 0;
     
     _next_log_file(handle);
     
@@ -110,8 +229,18 @@ int klog_init_file(klog_handle *handle)
     {
         return -ENOENT;
     }
+
+    if (!handle->config.klog_file_logging)
+    {
+        return -1;
+    }
+
+    if (handle->config.klog_async)
+    {
+        return _async_start(handle);
+    }
     
-    return handle->config.klog_file_logging ? 0 : -1;
+    return 0;
 }
 
 static inline char *_level_str(unsigned level)
@@ -144,6 +273,605 @@ static int _klog(FILE *f, unsigned level, const char *logger,
     return written;
 }
 
+/**
+ * Formats a complete log line, without a terminating NUL, into a buffer
+ * of KLOG_MAX_LINE bytes. Overlong lines are cut short.
+ */
+static int _klog_line(char *line, unsigned level, const char *logger,
+                      const char *format, va_list args)
+{
+    uint32_t millis = csp_get_ms();
+    int len, msg_len;
+
+    len = snprintf(line, KLOG_MAX_LINE, "%010d.%03d %s:%s ", millis / 1000, millis % 1000,
+                   logger, _level_str(level));
+    if ((len >= 0) && (len < KLOG_MAX_LINE - 1)) {
+        msg_len = vsnprintf(line + len, KLOG_MAX_LINE - len, format, args);
+        if (msg_len > 0) {
+            len += msg_len;
+        }
+    }
+    if (len < 0) {
+        return 0;
+    }
+    if (len > KLOG_MAX_LINE - 1) {
+        len = KLOG_MAX_LINE - 1;
+    }
+    line[len++] = '\n';
+    return len;
+}
+
+/**
+ * Works out how each argument of a format string is fetched.
+ *
+ * @return Number of arguments, -1 if the format string can not be logged
+ *         in the binary format
+ */
+static int _binary_parse_format(const char *format, uint8_t *args)
+{
+    const char *p = format;
+    int count = 0;
+    bool is_unsigned;
+    char length;
+    uint8_t kind;
+
+    while ((p = strchr(p, '%')) != NULL) {
+        p++;
+        p += strspn(p, "-+ #0'");
+        if (*p == '*') {
+            if (count >= KLOG_BINARY_MAX_ARGS) {
+                return -1;
+            }
+            args[count++] = KLOG_ARG_INT;
+            p++;
+        } else {
+            p += strspn(p, "0123456789");
+        }
+        if (*p == '.') {
+            p++;
+            if (*p == '*') {
+                if (count >= KLOG_BINARY_MAX_ARGS) {
+                    return -1;
+                }
+                args[count++] = KLOG_ARG_INT;
+                p++;
+            } else {
+                p += strspn(p, "0123456789");
+            }
+        }
+
+        if ((p[0] == 'h') && (p[1] == 'h')) {
+            length = 'h';
+            p += 2;
+        } else if ((p[0] == 'l') && (p[1] == 'l')) {
+            length = 'q';
+            p += 2;
+        } else if ((*p != '\0') && (strchr("hlLqjzt", *p) != NULL)) {
+            length = (*p == 'L') ? 'q' : *p;
+            p++;
+        } else {
+            length = 0;
+        }
+
+        is_unsigned = false;
+        switch (*p) {
+            case '%':
+                p++;
+                continue;
+            case 'u': case 'o': case 'x': case 'X':
+                is_unsigned = true;
+                /* fall through */
+            case 'd': case 'i':
+                switch (length) {
+                    case 'l': kind = is_unsigned ? KLOG_ARG_ULONG : KLOG_ARG_LONG; break;
+                    case 'q': kind = is_unsigned ? KLOG_ARG_ULLONG : KLOG_ARG_LLONG; break;
+                    case 'j': kind = is_unsigned ? KLOG_ARG_UINTMAX : KLOG_ARG_INTMAX; break;
+                    case 'z': case 't': kind = is_unsigned ? KLOG_ARG_SIZE : KLOG_ARG_PTRDIFF; break;
+                    default: kind = is_unsigned ? KLOG_ARG_UINT : KLOG_ARG_INT; break;
+                }
+                break;
+            case 'c':
+                kind = KLOG_ARG_INT;
+                break;
+            case 'e': case 'E': case 'f': case 'F':
+            case 'g': case 'G': case 'a': case 'A':
+                kind = (length == 'q') ? KLOG_ARG_LDOUBLE : KLOG_ARG_DOUBLE;
+                break;
+            case 's':
+                if (length == 'l') {
+                    return -1;
+                }
+                kind = KLOG_ARG_STRING;
+                break;
+            case 'p':
+            case 'n':
+                kind = KLOG_ARG_PTR;
+                break;
+            default:
+                return -1;
+        }
+        p++;
+
+        if (count >= KLOG_BINARY_MAX_ARGS) {
+            return -1;
+        }
+        args[count++] = kind;
+    }
+
+    return count;
+}
+
+static klog_format *_binary_formats(void)
+{
+    klog_format *formats = __atomic_load_n(&klog_formats, __ATOMIC_ACQUIRE);
+    klog_format *expected = NULL;
+
+    if (formats == NULL) {
+        formats = calloc(KLOG_BINARY_MAX_FORMATS, sizeof(klog_format));
+        if (formats == NULL) {
+            return NULL;
+        }
+        if (!__atomic_compare_exchange_n(&klog_formats, &expected, formats,
+                                         false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            /* Another thread got there first */
+            free(formats);
+            formats = expected;
+        }
+    }
+    return formats;
+}
+
+/**
+ * Returns the id of a logger and format string pair, registering it if
+ * this is its first use.
+ *
+ * @return Format string id, -1 if it can not be registered
+ */
+static int _binary_register(const char *logger, const char *format)
+{
+    klog_format *formats = _binary_formats();
+    klog_format entry = { .logger = logger, .format = format };
+    uint16_t count;
+    int num_args;
+    int i;
+
+    if (formats == NULL) {
+        return -1;
+    }
+
+    count = __atomic_load_n(&klog_num_formats, __ATOMIC_ACQUIRE);
+    for (i = 0; i < count; i++) {
+        if (__atomic_load_n(&formats[i].ready, __ATOMIC_ACQUIRE)
+            && (formats[i].format == format) && (formats[i].logger == logger)) {
+            return i;
+        }
+    }
+
+    num_args = _binary_parse_format(format, entry.args);
+    if ((num_args < 0) || (strlen(logger) > 255) || (strlen(format) > KLOG_BINARY_MAX_FORMAT_LEN)) {
+        return -1;
+    }
+    entry.num_args = num_args;
+
+    do {
+        if (count >= KLOG_BINARY_MAX_FORMATS) {
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&klog_num_formats, &count, count + 1,
+                                          true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    formats[count] = entry;
+    __atomic_store_n(&formats[count].ready, 1, __ATOMIC_RELEASE);
+    return count;
+}
+
+static const klog_format *_binary_lookup(uint16_t *site, const char *logger, const char *format)
+{
+    uint16_t cached = __atomic_load_n(site, __ATOMIC_ACQUIRE);
+    klog_format *formats = __atomic_load_n(&klog_formats, __ATOMIC_ACQUIRE);
+    int id;
+
+    /* The site cache holds id + 1, the checks catch varying arguments */
+    if ((cached > 0) && (formats != NULL) && (formats[cached - 1].format == format)
+        && (formats[cached - 1].logger == logger)) {
+        return &formats[cached - 1];
+    }
+
+    id = _binary_register(logger, format);
+    if (id < 0) {
+        return NULL;
+    }
+    __atomic_store_n(site, id + 1, __ATOMIC_RELEASE);
+    return &klog_formats[id];
+}
+
+/**
+ * Builds a binary line record in a buffer of KLOG_MAX_LINE bytes. Strings
+ * are cut short so that the record fits.
+ *
+ * @return Length of the record
+ */
+static int _binary_line(uint8_t *record, uint16_t *site, unsigned level,
+                        const char *logger, const char *format, va_list args)
+{
+    klog_binary_line line = {
+        .type = KLOG_BINARY_LINE,
+        .level = level,
+        .millis = csp_get_ms()
+    };
+    const klog_format *entry = _binary_lookup(site, logger, format);
+    uint8_t *out = record + sizeof(line);
+    uint8_t *end = record + KLOG_MAX_LINE;
+    const char *str;
+    int64_t value;
+    double real;
+    int32_t small;
+    int room, len, i;
+
+    if (entry == NULL) {
+        line.type = KLOG_BINARY_TEXT;
+        len = strlen(logger);
+        if (len > 64) {
+            len = 64;
+        }
+        memcpy(out, logger, len);
+        out += len;
+        *out++ = '\0';
+        len = vsnprintf((char *) out, end - out, format, args);
+        if (len > 0) {
+            out += (len < end - out) ? len : end - out - 1;
+        }
+    } else {
+        line.id = entry - klog_formats;
+        for (i = 0; i < entry->num_args; i++) {
+            switch (entry->args[i]) {
+                case KLOG_ARG_INT:
+                    small = va_arg(args, int);
+                    memcpy(out, &small, sizeof(small));
+                    out += sizeof(small);
+                    continue;
+                case KLOG_ARG_UINT:
+                    small = va_arg(args, unsigned int);
+                    memcpy(out, &small, sizeof(small));
+                    out += sizeof(small);
+                    continue;
+                case KLOG_ARG_STRING:
+                    str = va_arg(args, const char *);
+                    if (str == NULL) {
+                        str = "(null)";
+                    }
+                    /* Leave room for the remaining arguments */
+                    room = (end - out) - 1 - 9 * (entry->num_args - i - 1);
+                    len = strlen(str);
+                    if (len > 255) {
+                        len = 255;
+                    }
+                    if (len > room) {
+                        len = (room > 0) ? room : 0;
+                    }
+                    *out++ = len;
+                    memcpy(out, str, len);
+                    out += len;
+                    continue;
+                case KLOG_ARG_DOUBLE:
+                    real = va_arg(args, double);
+                    memcpy(out, &real, sizeof(real));
+                    out += sizeof(real);
+                    continue;
+                case KLOG_ARG_LDOUBLE:
+                    real = va_arg(args, long double);
+                    memcpy(out, &real, sizeof(real));
+                    out += sizeof(real);
+                    continue;
+                case KLOG_ARG_LONG: value = va_arg(args, long); break;
+                case KLOG_ARG_ULONG: value = va_arg(args, unsigned long); break;
+                case KLOG_ARG_LLONG: value = va_arg(args, long long); break;
+                case KLOG_ARG_ULLONG: value = va_arg(args, unsigned long long); break;
+                case KLOG_ARG_INTMAX: value = va_arg(args, intmax_t); break;
+                case KLOG_ARG_UINTMAX: value = va_arg(args, uintmax_t); break;
+                case KLOG_ARG_PTRDIFF: value = va_arg(args, ptrdiff_t); break;
+                case KLOG_ARG_SIZE: value = va_arg(args, size_t); break;
+                case KLOG_ARG_PTR:
+                default:
+                    value = (uintptr_t) va_arg(args, void *);
+                    break;
+            }
+            memcpy(out, &value, sizeof(value));
+            out += sizeof(value);
+        }
+    }
+
+    line.length = out - (record + sizeof(line));
+    memcpy(record, &line, sizeof(line));
+    return out - record;
+}
+
+/**
+ * Writes the definition of a line's format string id into out, unless the
+ * current part already has it.
+ *
+ * @return Length of the definition, 0 if none is needed
+ */
+static uint32_t _binary_define(klog_handle *handle, const uint8_t *record, uint8_t *out)
+{
+    klog_binary_definition definition = { .type = KLOG_BINARY_DEFINITION };
+    const klog_format *entry;
+    uint16_t id;
+
+    if (record[0] != KLOG_BINARY_LINE) {
+        return 0;
+    }
+
+    memcpy(&id, record + offsetof(klog_binary_line, id), sizeof(id));
+    if (handle->binary_defined[id / 8] & (1 << (id % 8))) {
+        return 0;
+    }
+    handle->binary_defined[id / 8] |= 1 << (id % 8);
+
+    entry = &klog_formats[id];
+    definition.id = id;
+    definition.logger_length = strlen(entry->logger);
+    definition.format_length = strlen(entry->format);
+
+    memcpy(out, &definition, sizeof(definition));
+    memcpy(out + sizeof(definition), entry->logger, definition.logger_length);
+    memcpy(out + sizeof(definition) + definition.logger_length, entry->format, definition.format_length);
+    return sizeof(definition) + definition.logger_length + definition.format_length;
+}
+
+/**
+ * Copies a line into the async line buffer. Any number of threads may do
+ * this at once, each one reserves space for its line by moving head.
+ */
+static bool _async_push(klog_handle *handle, unsigned level, const void *line, int len)
+{
+    struct klog_async *async = handle->async;
+    uint32_t size = async->mask + 1;
+    uint32_t needed = KLOG_RECORD_SIZE(len);
+    uint32_t head, tail, idx, skip;
+    klog_record *record;
+
+    head = __atomic_load_n(&async->head, __ATOMIC_RELAXED);
+    do {
+        tail = __atomic_load_n(&async->tail, __ATOMIC_ACQUIRE);
+        idx = head & async->mask;
+        /* Lines are never split, the end of the buffer is skipped instead */
+        skip = (size - idx < needed) ? size - idx : 0;
+        if (head + skip + needed - tail > size) {
+            __atomic_fetch_add(&handle->dropped_lines, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&async->head, &head, head + skip + needed,
+                                          true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    if (skip > 0) {
+        record = (klog_record *) &async->ring[idx];
+        __atomic_store_n(&record->state, KLOG_RECORD_WRAP, __ATOMIC_RELEASE);
+        idx = 0;
+    }
+
+    record = (klog_record *) &async->ring[idx];
+    record->length = len;
+    record->level = level;
+    memcpy(record + 1, line, len);
+    __atomic_store_n(&record->state, KLOG_RECORD_READY, __ATOMIC_SEQ_CST);
+
+    /* Pairs with the writer setting idle and then checking for lines */
+    if (__atomic_load_n(&async->idle, __ATOMIC_SEQ_CST)
+        && __atomic_exchange_n(&async->idle, 0, __ATOMIC_SEQ_CST)) {
+        csp_bin_sem_post(&async->wake);
+    }
+    return true;
+}
+
+/**
+ * Moves complete lines from the line buffer to the staging buffer, stopping
+ * after a line which fills up the current log file part.
+ *
+ * @return Number of bytes staged
+ */
+static uint32_t _async_stage(klog_handle *handle, bool *sync_now)
+{
+    struct klog_async *async = handle->async;
+    uint32_t size = async->mask + 1;
+    uint32_t tail = async->tail;
+    uint32_t staged = 0;
+    uint32_t part_room = 0;
+    uint32_t idx, advance;
+    klog_record *record;
+    uint8_t state;
+
+    if (handle->current_part_size < handle->config.part_size) {
+        part_room = handle->config.part_size - handle->current_part_size;
+    }
+
+    while (staged < part_room || staged == 0) {
+        idx = tail & async->mask;
+        record = (klog_record *) &async->ring[idx];
+        state = __atomic_load_n(&record->state, __ATOMIC_ACQUIRE);
+
+        if (state == KLOG_RECORD_EMPTY) {
+            break;
+        }
+
+        if (state == KLOG_RECORD_WRAP) {
+            advance = size - idx;
+        } else {
+            if (handle->config.klog_binary) {
+                if (staged + KLOG_BINARY_DEFINITION_MAX + record->length > async->staging_size) {
+                    break;
+                }
+                staged += _binary_define(handle, (uint8_t *) (record + 1), async->staging + staged);
+            }
+            memcpy(async->staging + staged, record + 1, record->length);
+            staged += record->length;
+            if (record->level == LOG_ERROR) {
+                *sync_now = true;
+            }
+            advance = KLOG_RECORD_SIZE(record->length);
+        }
+
+        /* Loggers expect free space to be zeroed */
+        memset(record, 0, advance);
+        tail += advance;
+    }
+
+    __atomic_store_n(&async->tail, tail, __ATOMIC_RELEASE);
+    return staged;
+}
+
+static void _async_sync(klog_handle *handle)
+{
+    if (handle->log_file) {
+        fsync(fileno(handle->log_file));
+    }
+    handle->async->unsynced = 0;
+    handle->async->last_sync = csp_get_ms();
+}
+
+static void _async_write(klog_handle *handle, uint32_t len, bool sync_now)
+{
+    struct klog_async *async = handle->async;
+    uint32_t sync_bytes = handle->config.sync_bytes ? handle->config.sync_bytes : KLOG_SYNC_BYTES_DEFAULT;
+
+    if (!handle->log_file) {
+        _next_log_file(handle);
+        if (!handle->log_file) {
+            return;
+        }
+    }
+
+    if (write(fileno(handle->log_file), async->staging, len) > 0) {
+        handle->current_part_size += len;
+        async->unsynced += len;
+    }
+
+    if (sync_now || async->unsynced >= sync_bytes) {
+        _async_sync(handle);
+    }
+
+    if (handle->current_part_size >= handle->config.part_size) {
+        /* Syncs the full part before moving on */
+        _next_log_file(handle);
+        async->unsynced = 0;
+        async->last_sync = csp_get_ms();
+    }
+}
+
+static CSP_DEFINE_TASK(_async_writer)
+{
+    klog_handle *handle = param;
+    struct klog_async *async = handle->async;
+    uint32_t interval = handle->config.sync_interval ? handle->config.sync_interval : KLOG_SYNC_INTERVAL_DEFAULT;
+    klog_record *record;
+    uint32_t staged;
+    bool sync_now;
+
+#if defined(CSP_POSIX)
+    /* Nobody joins the writer, it signals done instead */
+    pthread_detach(pthread_self());
+#endif
+
+    while (1) {
+        sync_now = false;
+        staged = _async_stage(handle, &sync_now);
+        if (staged > 0) {
+            _async_write(handle, staged, sync_now);
+            continue;
+        }
+
+        if (__atomic_load_n(&async->stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        if ((async->unsynced > 0) && ((csp_get_ms() - async->last_sync) >= interval)) {
+            _async_sync(handle);
+        }
+
+        __atomic_store_n(&async->idle, 1, __ATOMIC_SEQ_CST);
+        record = (klog_record *) &async->ring[async->tail & async->mask];
+        if (__atomic_load_n(&record->state, __ATOMIC_SEQ_CST) == KLOG_RECORD_EMPTY) {
+            csp_bin_sem_wait(&async->wake, interval);
+        }
+        __atomic_store_n(&async->idle, 0, __ATOMIC_SEQ_CST);
+    }
+
+    csp_bin_sem_post(&async->done);
+    csp_thread_exit();
+    return CSP_TASK_RETURN;
+}
+
+static void _async_free(struct klog_async *async)
+{
+    csp_bin_sem_remove(&async->wake);
+    csp_bin_sem_remove(&async->done);
+    free(async->ring);
+    free(async->staging);
+    free(async);
+}
+
+static int _async_start(klog_handle *handle)
+{
+    struct klog_async *async;
+    uint32_t requested = handle->config.async_buffer_size ? handle->config.async_buffer_size : KLOG_ASYNC_BUFFER_DEFAULT;
+    uint32_t size = KLOG_ASYNC_BUFFER_MIN;
+
+    while (size < requested) {
+        size <<= 1;
+    }
+
+    async = calloc(1, sizeof(struct klog_async));
+    if (async == NULL) {
+        return -ENOMEM;
+    }
+
+    /* Binary lines may need a definition written before them */
+    async->staging_size = size + (handle->config.klog_binary ? KLOG_BINARY_DEFINITION_MAX : 0);
+    async->ring = calloc(size, 1);
+    async->staging = malloc(async->staging_size);
+    async->mask = size - 1;
+    async->last_sync = csp_get_ms();
+
+    if ((async->ring == NULL) || (async->staging == NULL)
+        || (csp_bin_sem_create(&async->wake) != CSP_SEMAPHORE_OK)
+        || (csp_bin_sem_create(&async->done) != CSP_SEMAPHORE_OK)) {
+        free(async->ring);
+        free(async->staging);
+        free(async);
+        return -ENOMEM;
+    }
+
+    /* Semaphores are created available */
+    csp_bin_sem_wait(&async->wake, 0);
+    csp_bin_sem_wait(&async->done, 0);
+
+    handle->async = async;
+    if (csp_thread_create(_async_writer, "KLOG", KLOG_ASYNC_STACK_SIZE, handle,
+                          KLOG_ASYNC_PRIORITY, &async->thread) != 0) {
+        handle->async = NULL;
+        _async_free(async);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+static void _async_stop(klog_handle *handle)
+{
+    struct klog_async *async = handle->async;
+
+    if (async == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&async->stop, true, __ATOMIC_RELEASE);
+    csp_bin_sem_post(&async->wake);
+    csp_bin_sem_wait(&async->done, CSP_MAX_DELAY);
+
+    handle->async = NULL;
+    _async_free(async);
+}
+
 void klog_console(unsigned level, const char *logger, const char *format, ...)
 {
     va_list args;
@@ -160,7 +888,18 @@ void klog_console(unsigned level, const char *logger, const char *format, ...)
 void klog_file(klog_handle *handle, unsigned level, const char *logger, const char *format, ...)
 {
     va_list args;
-    if ((handle != NULL) && (logger != NULL) && (format != NULL))
+    char line[KLOG_MAX_LINE];
+    int len;
+
+    if ((handle != NULL) && (handle->async != NULL) && (logger != NULL) && (format != NULL))
+    {
+        va_start(args, format);
+        len = _klog_line(line, level, logger, format, args);
+        va_end(args);
+
+        _async_push(handle, level, line, len);
+    }
+    else if ((handle != NULL) && (logger != NULL) && (format != NULL))
     {
         va_start(args, format);
         if (!handle->log_file) {
@@ -181,16 +920,51 @@ void klog_file(klog_handle *handle, unsigned level, const char *logger, const ch
     }
 }
 
-void klog_cleanup(klog_handle *handle)
+void klog_file_binary(klog_handle *handle, uint16_t *site, unsigned level, const char *logger, const char *format, ...)
 {
-    if (handle != NULL)
+    va_list args;
+    uint8_t record[KLOG_MAX_LINE];
+    uint8_t definition[KLOG_BINARY_DEFINITION_MAX];
+    uint32_t len;
+
+    if ((handle == NULL) || (site == NULL) || (logger == NULL) || (format == NULL))
+    {
+        return;
+    }
+
+    va_start(args, format);
+    len = _binary_line(record, site, level, logger, format, args);
+    va_end(args);
+
+    if (handle->async != NULL)
     {
-        if (handle->log_file) {
-            fsync(fileno(handle->log_file));
-            fclose(handle->log_file);
+        _async_push(handle, level, record, len);
+        return;
+    }
+
+    if (!handle->log_file) {
+        _next_log_file(handle);
+        if (!handle->log_file) {
+            return;
         }
+    }
+
+    handle->current_part_size += fwrite(definition, 1, _binary_define(handle, record, definition), handle->log_file);
+    handle->current_part_size += fwrite(record, 1, len, handle->log_file);
+    fflush(handle->log_file);
+    fsync(fileno(handle->log_file));
 
-        handle->log_file = NULL;
+    if (handle->current_part_size >= handle->config.part_size) {
+        _next_log_file(handle);
+    }
+}
+
+void klog_cleanup(klog_handle *handle)
+{
+    if (handle != NULL)
+    {
+        _async_stop(handle);
+        _close_log_file(handle);
     }
 }
 
@@ -156,6 +156,273 @@ static void test_RotateParts(void)
     TEST_ASSERT_EQUAL_INT(size, 42);
 }
 
+void test_AsyncLog(void)
+{
+    klog_handle log_handle = {
+        .config.file_path = LOG_PATH,
+        .config.file_path_len = strlen(LOG_PATH),
+        .config.part_size = 256,
+        .config.max_parts = 1,
+        .config.klog_console_level = LOG_NONE,
+        .config.klog_file_level = LOG_DEBUG,
+        .config.klog_file_logging = true,
+        .config.klog_async = true
+    };
+
+    int result = klog_init_file(&log_handle);
+    TEST_ASSERT_EQUAL_INT(result, 0);
+    TEST_ASSERT_NOT_NULL(log_handle.async);
+
+    KLOG_INFO(&log_handle, "test", "123:%d", 456);
+    KLOG_ERR(&log_handle, "o", "error");
+    klog_cleanup(&log_handle);
+    TEST_ASSERT_NULL(log_handle.async);
+
+    FILE *log_file = fopen(LOG_PATH ".000", "r");
+    TEST_ASSERT_NOT_NULL(log_file);
+
+    char line[64];
+    TEST_ASSERT_NOT_NULL(fgets(line, sizeof(line), log_file));
+    TEST_ASSERT_EQUAL_STRING(&line[14], " test:I 123:456\n");
+    TEST_ASSERT_NOT_NULL(fgets(line, sizeof(line), log_file));
+    TEST_ASSERT_EQUAL_STRING(&line[14], " o:E error\n");
+    TEST_ASSERT_NULL(fgets(line, sizeof(line), log_file));
+    fclose(log_file);
+}
+
+
+static void test_AsyncRotateParts(void)
+{
+    klog_handle log_handle = {
+        .config.file_path = LOG_PATH,
+        .config.file_path_len = strlen(LOG_PATH),
+        .config.part_size = 42,
+        .config.max_parts = 3,
+        .config.klog_console_level = LOG_NONE,
+        .config.klog_file_level = LOG_DEBUG,
+        .config.klog_file_logging = true,
+        .config.klog_async = true
+    };
+
+    int result = klog_init_file(&log_handle);
+    int size = 0;
+
+    TEST_ASSERT_EQUAL_INT(result, 0);
+
+    // Each line is 21 long, so this fills the first part and starts the second
+    KLOG_WARN(&log_handle, "a", "b");
+    KLOG_WARN(&log_handle, "a", "b");
+    KLOG_WARN(&log_handle, "a", "b");
+    klog_cleanup(&log_handle);
+
+    TEST_ASSERT(_fstat(LOG_PATH ".000", &size));
+    TEST_ASSERT_EQUAL_INT(size, 42);
+    TEST_ASSERT(_fstat(LOG_PATH ".001", &size));
+    TEST_ASSERT_EQUAL_INT(size, 21);
+}
+
+
+static void test_AsyncDropped(void)
+{
+    klog_handle log_handle = {
+        .config.file_path = LOG_PATH,
+        .config.file_path_len = strlen(LOG_PATH),
+        .config.part_size = 1024 * 1024,
+        .config.max_parts = 1,
+        .config.klog_console_level = LOG_NONE,
+        .config.klog_file_level = LOG_DEBUG,
+        .config.klog_file_logging = true,
+        .config.klog_async = true,
+        .config.async_buffer_size = 512
+    };
+
+    int result = klog_init_file(&log_handle);
+    int size = 0;
+    int i;
+
+    TEST_ASSERT_EQUAL_INT(result, 0);
+
+    for (i = 0; i < 10000; i++)
+    {
+        KLOG_WARN(&log_handle, "a", "b");
+    }
+    klog_cleanup(&log_handle);
+
+    // Every line was either written or counted as dropped
+    TEST_ASSERT(_fstat(LOG_PATH ".000", &size));
+    TEST_ASSERT_EQUAL_INT(size / 21 + log_handle.dropped_lines, 10000);
+}
+
+/**
+ * Reads the next binary record from a log file into record.
+ * @return record type, 0 at end of file
+ */
+static int read_binary_record(FILE *log_file, uint8_t *record)
+{
+    klog_binary_definition definition;
+    klog_binary_line line;
+
+    if (fread(record, 1, 1, log_file) != 1) {
+        return 0;
+    }
+    if (record[0] == KLOG_BINARY_DEFINITION) {
+        TEST_ASSERT_EQUAL_INT(1, fread(record + 1, sizeof(definition) - 1, 1, log_file));
+        memcpy(&definition, record, sizeof(definition));
+        TEST_ASSERT_EQUAL_INT(definition.logger_length + definition.format_length,
+            fread(record + sizeof(definition), 1, definition.logger_length + definition.format_length, log_file));
+    } else {
+        TEST_ASSERT_EQUAL_INT(1, fread(record + 1, sizeof(line) - 1, 1, log_file));
+        memcpy(&line, record, sizeof(line));
+        TEST_ASSERT_EQUAL_INT(line.length, fread(record + sizeof(line), 1, line.length, log_file));
+    }
+    return record[0];
+}
+
+static void log_binary_lines(klog_handle *log_handle)
+{
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        KLOG_INFO(log_handle, "test", "123:%d %s %lld", 456 + i, "abc", -7LL);
+    }
+    KLOG_ERR(log_handle, "o", "error");
+}
+
+static void check_binary_lines(void)
+{
+    klog_binary_header header;
+    klog_binary_definition definition;
+    klog_binary_line line;
+    uint8_t record[512];
+    int32_t value;
+    int64_t wide;
+
+    FILE *log_file = fopen(LOG_PATH ".000", "rb");
+    TEST_ASSERT_NOT_NULL(log_file);
+
+    TEST_ASSERT_EQUAL_INT(1, fread(&header, sizeof(header), 1, log_file));
+    TEST_ASSERT_EQUAL_HEX32(KLOG_BINARY_MAGIC, header.magic);
+    TEST_ASSERT_EQUAL_INT(KLOG_BINARY_VERSION, header.version);
+
+    // The first use of a format string defines it
+    TEST_ASSERT_EQUAL_INT(KLOG_BINARY_DEFINITION, read_binary_record(log_file, record));
+    memcpy(&definition, record, sizeof(definition));
+    TEST_ASSERT_EQUAL_INT(4, definition.logger_length);
+    TEST_ASSERT_EQUAL_MEMORY("test123:%d %s %lld", record + sizeof(definition), 18);
+
+    // Arguments are packed, the format string is only referenced
+    TEST_ASSERT_EQUAL_INT(KLOG_BINARY_LINE, read_binary_record(log_file, record));
+    memcpy(&line, record, sizeof(line));
+    TEST_ASSERT_EQUAL_INT(LOG_INFO, line.level);
+    TEST_ASSERT_EQUAL_INT(definition.id, line.id);
+    TEST_ASSERT_EQUAL_INT(4 + 4 + 8, line.length);
+    memcpy(&value, record + sizeof(line), sizeof(value));
+    TEST_ASSERT_EQUAL_INT(456, value);
+    TEST_ASSERT_EQUAL_INT(3, record[sizeof(line) + 4]);
+    TEST_ASSERT_EQUAL_MEMORY("abc", record + sizeof(line) + 5, 3);
+    memcpy(&wide, record + sizeof(line) + 8, sizeof(wide));
+    TEST_ASSERT(wide == -7);
+
+    TEST_ASSERT_EQUAL_INT(KLOG_BINARY_LINE, read_binary_record(log_file, record));
+    memcpy(&line, record, sizeof(line));
+    TEST_ASSERT_EQUAL_INT(definition.id, line.id);
+    memcpy(&value, record + sizeof(line), sizeof(value));
+    TEST_ASSERT_EQUAL_INT(457, value);
+
+    TEST_ASSERT_EQUAL_INT(KLOG_BINARY_DEFINITION, read_binary_record(log_file, record));
+    memcpy(&definition, record, sizeof(definition));
+    TEST_ASSERT_EQUAL_MEMORY("oerror", record + sizeof(definition), 6);
+    TEST_ASSERT_EQUAL_INT(KLOG_BINARY_LINE, read_binary_record(log_file, record));
+    memcpy(&line, record, sizeof(line));
+    TEST_ASSERT_EQUAL_INT(LOG_ERROR, line.level);
+    TEST_ASSERT_EQUAL_INT(definition.id, line.id);
+    TEST_ASSERT_EQUAL_INT(0, line.length);
+
+    TEST_ASSERT_EQUAL_INT(0, read_binary_record(log_file, record));
+    fclose(log_file);
+}
+
+static void test_BinaryLog(void)
+{
+    klog_handle log_handle = {
+        .config.file_path = LOG_PATH,
+        .config.file_path_len = strlen(LOG_PATH),
+        .config.part_size = 256,
+        .config.max_parts = 1,
+        .config.klog_console_level = LOG_NONE,
+        .config.klog_file_level = LOG_DEBUG,
+        .config.klog_file_logging = true,
+        .config.klog_binary = true
+    };
+
+    int result = klog_init_file(&log_handle);
+    TEST_ASSERT_EQUAL_INT(result, 0);
+
+    log_binary_lines(&log_handle);
+    klog_cleanup(&log_handle);
+
+    check_binary_lines();
+}
+
+static void test_AsyncBinaryLog(void)
+{
+    klog_handle log_handle = {
+        .config.file_path = LOG_PATH,
+        .config.file_path_len = strlen(LOG_PATH),
+        .config.part_size = 256,
+        .config.max_parts = 1,
+        .config.klog_console_level = LOG_NONE,
+        .config.klog_file_level = LOG_DEBUG,
+        .config.klog_file_logging = true,
+        .config.klog_async = true,
+        .config.klog_binary = true
+    };
+
+    int result = klog_init_file(&log_handle);
+    TEST_ASSERT_EQUAL_INT(result, 0);
+
+    log_binary_lines(&log_handle);
+    klog_cleanup(&log_handle);
+
+    check_binary_lines();
+}
+
+static void test_BinaryLogText(void)
+{
+    klog_handle log_handle = {
+        .config.file_path = LOG_PATH,
+        .config.file_path_len = strlen(LOG_PATH),
+        .config.part_size = 256,
+        .config.max_parts = 1,
+        .config.klog_console_level = LOG_NONE,
+        .config.klog_file_level = LOG_DEBUG,
+        .config.klog_file_logging = true,
+        .config.klog_binary = true
+    };
+    klog_binary_header header;
+    klog_binary_line line;
+    uint8_t record[512];
+
+    int result = klog_init_file(&log_handle);
+    TEST_ASSERT_EQUAL_INT(result, 0);
+
+    // Too many arguments to register, stored as text
+    KLOG_WARN(&log_handle, "t", "%d%d%d%d%d%d%d%d%d%d%d%d%d", 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3);
+    klog_cleanup(&log_handle);
+
+    FILE *log_file = fopen(LOG_PATH ".000", "rb");
+    TEST_ASSERT_NOT_NULL(log_file);
+    TEST_ASSERT_EQUAL_INT(1, fread(&header, sizeof(header), 1, log_file));
+    TEST_ASSERT_EQUAL_INT(KLOG_BINARY_TEXT, read_binary_record(log_file, record));
+    memcpy(&line, record, sizeof(line));
+    TEST_ASSERT_EQUAL_INT(LOG_WARNING, line.level);
+    TEST_ASSERT_EQUAL_INT(15, line.length);
+    TEST_ASSERT_EQUAL_MEMORY("t\0" "1234567890123", record + sizeof(line), 15);
+    TEST_ASSERT_EQUAL_INT(0, read_binary_record(log_file, record));
+    fclose(log_file);
+}
+
 void resetTest(void)
 {
     tearDown();
@@ -166,5 +433,11 @@ int main(void)
     UNITY_BEGIN();
     RUN_TEST(test_FileLog);
     RUN_TEST(test_RotateParts);
+    RUN_TEST(test_AsyncLog);
+    RUN_TEST(test_AsyncRotateParts);
+    RUN_TEST(test_AsyncDropped);
+    RUN_TEST(test_BinaryLog);
+    RUN_TEST(test_AsyncBinaryLog);
+    RUN_TEST(test_BinaryLogText);
     return UNITY_END();
 }
@@ -0,0 +1,66 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 Gomspace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk) 
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _RING_QUEUE_H_
+#define _RING_QUEUE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <csp/arch/csp_queue.h>
+
+#define RING_QUEUE_ERROR CSP_QUEUE_ERROR
+#define RING_QUEUE_EMPTY CSP_QUEUE_ERROR
+#define RING_QUEUE_FULL CSP_QUEUE_ERROR
+#define RING_QUEUE_OK CSP_QUEUE_OK
+
+/* Bounded multi-producer/multi-consumer ring. Producers and consumers only
+ * touch their own position counter and the sequence number of a cell, and
+ * only go to sleep on a futex when the ring is full or empty. */
+typedef struct ring_queue_s {
+	uint8_t * cells;
+	uint32_t mask;
+	uint32_t size;
+	uint32_t item_size;
+	uint32_t cell_size;
+	/* Futex words, bumped when an item or a free cell becomes available.
+	 * The lowest bit is set while somebody sleeps on them. */
+	uint32_t not_empty;
+	uint32_t not_full;
+	/* Producer and consumer positions live on separate cache lines */
+	uint32_t in __attribute__((aligned(64)));
+	uint32_t out __attribute__((aligned(64)));
+} ring_queue_t;
+
+ring_queue_t * ring_queue_create(int length, size_t item_size);
+void ring_queue_delete(ring_queue_t * q);
+int ring_queue_enqueue(ring_queue_t * queue, void * value, uint32_t timeout);
+int ring_queue_dequeue(ring_queue_t * queue, void * buf, uint32_t timeout);
+int ring_queue_items(ring_queue_t * queue);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif // _RING_QUEUE_H_
@@ -303,7 +303,19 @@ int csp_bind(csp_socket_t *socket, uint8_t port);
 int csp_route_start_task(unsigned int task_stack_size, unsigned int priority);
 
 /**
- * Ends the router task.
+ * Start a number of router tasks.
+ * Incoming packets are spread over the workers by connection, so packets of
+ * one connection are always routed in order by the same worker. The number
+ * of workers cannot change while the router runs; end it first.
+ * @param task_stack_size The number of portStackType to allocate. This only affects FreeRTOS systems.
+ * @param priority The OS task priority of the routers
+ * @param workers Number of router tasks, at most CSP_ROUTE_WORKERS_MAX
+ * @return CSP_ERR_NONE on success, CSP_ERR_BUSY if the router is already running, otherwise an error code.
+ */
+int csp_route_start_workers(unsigned int task_stack_size, unsigned int priority, unsigned int workers);
+
+/**
+ * Ends the router task, or all router workers.
  */
 void csp_route_end_task();
 
@@ -401,6 +413,88 @@ int csp_sfp_recv(csp_conn_t * conn, void ** dataout, int * datasize, uint32_t ti
  */
 int csp_sfp_recv_fp(csp_conn_t * conn, void ** dataout, int * datasize, uint32_t timeout, csp_packet_t * first_packet);
 
+/** Maximum number of SFP bulk fragments in flight */
+#define CSP_SFP_MAX_WINDOW 32
+
+/**
+ * Reads data for csp_sfp_send_bulk
+ * @param arg argument given to csp_sfp_send_bulk
+ * @param offset offset in the transfer of the data to read
+ * @param data buffer to read into
+ * @param size number of bytes to read
+ * @return 0 if OK, -1 if ERR
+ */
+typedef int (*csp_sfp_source_t)(void * arg, uint32_t offset, void * data, uint32_t size);
+
+/**
+ * Stores data received by csp_sfp_recv_bulk. Fragments may arrive out of order,
+ * but every byte is stored exactly once.
+ * @param arg argument given to csp_sfp_recv_bulk
+ * @param offset offset in the transfer of the data
+ * @param data received data
+ * @param size number of bytes received
+ * @return 0 if OK, -1 if ERR
+ */
+typedef int (*csp_sfp_sink_t)(void * arg, uint32_t offset, const void * data, uint32_t size);
+
+/**
+ * Send data using the windowed bulk mode of the simple fragmentation protocol.
+ * Up to window fragments are in flight at once. The receiver reports which
+ * fragments it has, and missing ones are sent again, so the connection does
+ * not need to be reliable. Must be received with csp_sfp_recv_bulk.
+ * @param conn pointer to connection
+ * @param source function reading the data to send
+ * @param arg argument passed to source
+ * @param totalsize size of data to send
+ * @param offset offset to resume sending from. The receiver may ask for another offset.
+ * @param mtu maximum transfer unit, the size of every fragment but the last
+ * @param window number of fragments in flight, at most CSP_SFP_MAX_WINDOW
+ * @param timeout timeout in ms to wait for the receiver, before sending again
+ * @return 0 if OK, -1 if ERR
+ */
+int csp_sfp_send_bulk(csp_conn_t * conn, csp_sfp_source_t source, void * arg, uint32_t totalsize, uint32_t offset, int mtu, int window, uint32_t timeout);
+
+/**
+ * This is the counterpart to the csp_sfp_send_bulk function. Fragments are
+ * handed to sink as they arrive, so the data never has to fit in memory.
+ * Once complete, the function keeps answering the sender until it has been
+ * quiet for timeout, in case the final status was lost.
+ * @param conn pointer to active conn, on which you expect to receive sfp bulk data
+ * @param sink function storing the received data
+ * @param arg argument passed to sink
+ * @param offset number of bytes already received, to resume an earlier transfer
+ * @param datasize total size of the transfer
+ * @param timeout timeout in ms to wait for each fragment
+ * @return 0 if OK, -1 if ERR
+ */
+int csp_sfp_recv_bulk(csp_conn_t * conn, csp_sfp_sink_t sink, void * arg, uint32_t offset, uint32_t * datasize, uint32_t timeout);
+
+#ifdef CSP_POSIX
+/**
+ * Same as csp_sfp_send_bulk, reading the data from a file descriptor
+ * @param conn pointer to connection
+ * @param fd file descriptor to read from, at the offsets of the transfer
+ * @param totalsize size of data to send
+ * @param offset offset to resume sending from
+ * @param mtu maximum transfer unit
+ * @param window number of fragments in flight, at most CSP_SFP_MAX_WINDOW
+ * @param timeout timeout in ms to wait for the receiver
+ * @return 0 if OK, -1 if ERR
+ */
+int csp_sfp_send_fd(csp_conn_t * conn, int fd, uint32_t totalsize, uint32_t offset, int mtu, int window, uint32_t timeout);
+
+/**
+ * Same as csp_sfp_recv_bulk, writing the data to a file descriptor
+ * @param conn pointer to active conn, on which you expect to receive sfp bulk data
+ * @param fd file descriptor to write to, at the offsets of the transfer
+ * @param offset number of bytes already received, to resume an earlier transfer
+ * @param datasize total size of the transfer
+ * @param timeout timeout in ms to wait for each fragment
+ * @return 0 if OK, -1 if ERR
+ */
+int csp_sfp_recv_fd(csp_conn_t * conn, int fd, uint32_t offset, uint32_t * datasize, uint32_t timeout);
+#endif
+
 /**
  * If the given packet is a service-request (that is uses one of the csp service ports)
  * it will be handled according to the CSP service handler.
@@ -473,9 +567,10 @@ void csp_uptime(uint8_t node, uint32_t timeout);
 
 /**
  * Set RDP options
- * @param window_size Window size
+ * @param window_size Window size, at most CSP_RDP_MAX_WINDOW
  * @param conn_timeout_ms Connection timeout in ms
- * @param packet_timeout_ms Packet timeout in ms
+ * @param packet_timeout_ms Initial and maximum retransmission timeout in ms, the
+ *        timeout used follows the measured round trip time
  * @param delayed_acks Enable/disable delayed acknowledgements
  * @param ack_timeout Acknowledgement timeout when delayed ACKs is enabled
  * @param ack_delay_count Send acknowledgement for every ack_delay_count packets
@@ -497,6 +592,30 @@ void csp_rdp_get_opt(unsigned int *window_size, unsigned int *conn_timeout_ms,
 		unsigned int *packet_timeout_ms, unsigned int *delayed_acks,
 		unsigned int *ack_timeout, unsigned int *ack_delay_count);
 
+/** Deduplicator statistics */
+typedef struct {
+	uint32_t hits;			/**< Duplicate packets discarded */
+	uint32_t misses;		/**< Unique packets seen */
+	uint32_t evictions;		/**< Entries pushed out before their window expired */
+} csp_dedup_stats_t;
+
+/**
+ * Set the time window in which a repeated packet is considered a duplicate
+ * @param window_ms Window in ms
+ */
+void csp_dedup_set_window(uint32_t window_ms);
+
+/**
+ * Get deduplicator statistics
+ * @param stats Pointer to statistics struct to fill
+ */
+void csp_dedup_get_stats(csp_dedup_stats_t * stats);
+
+/**
+ * Print deduplicator statistics
+ */
+void csp_dedup_print_stats(void);
+
 /**
  * Set XTEA key
  * @param key Pointer to key array
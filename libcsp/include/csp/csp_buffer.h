@@ -27,6 +27,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #ifndef _CSP_BUFFER_H_
 #define _CSP_BUFFER_H_
 
+#include <csp/csp_autoconfig.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -43,6 +45,32 @@ extern "C" {
  */
 int csp_buffer_init(int count, int size);
 
+#ifdef CSP_BUFFER_LOCKFREE
+/** Maximum number of size classes supported by the lock-free buffer pool */
+#define CSP_BUFFER_MAX_CLASSES 4
+
+/**
+ * Bytes every buffer keeps past its size for headers and checksums that are
+ * appended in place after packet->length: SFP (8), RDP (5), XTEA nonce (4),
+ * HMAC (4) and CRC32 (4).
+ */
+#define CSP_BUFFER_TRAILER_MAX (8 + 5 + 4 + 4 + 4)
+
+/**
+ * Start the lock-free buffer handling system with several size classes.
+ * csp_buffer_get() hands out a buffer from the smallest class that fits the
+ * requested size, falling back to larger classes when that one is empty.
+ * Each buffer has CSP_BUFFER_TRAILER_MAX bytes of room beyond its size.
+ *
+ * @param classes Number of size classes, at most CSP_BUFFER_MAX_CLASSES
+ * @param counts Number of buffers to allocate for each class
+ * @param sizes Buffer size in bytes for each class, in increasing order
+ *
+ * @return CSP_ERR_NONE if malloc() succeeded, CSP_ERR message otherwise.
+ */
+int csp_buffer_init_classes(unsigned int classes, const int * counts, const int * sizes);
+#endif
+
 /** 
  * Shutdown the buffer handling system and free all buffers.
  */
@@ -84,6 +112,30 @@ void csp_buffer_free_isr(void *packet);
  */
 void * csp_buffer_clone(void *buffer);
 
+/**
+ * Take another reference to a buffer instead of copying it. The buffer
+ * returns to the pool once csp_buffer_free() has been called for every
+ * reference. A shared buffer must not be modified, see csp_buffer_unshare().
+ * @param buffer pointer to memory area, must be acquired by csp_buffer_get().
+ * @return buffer, or NULL if it is not an allocated buffer
+ */
+void * csp_buffer_ref(void *buffer);
+
+/**
+ * Return the number of references to a buffer.
+ * @param buffer pointer to memory area, must be acquired by csp_buffer_get().
+ * @return number of references, 0 if the buffer is not allocated
+ */
+int csp_buffer_refcount(void *buffer);
+
+/**
+ * Get a buffer which may be modified. A shared buffer is cloned and the
+ * caller's reference to it is freed, otherwise the buffer itself is returned.
+ * @param buffer pointer to memory area, must be acquired by csp_buffer_get().
+ * @return writable buffer, or NULL (with buffer left untouched) if out of memory
+ */
+void * csp_buffer_unshare(void *buffer);
+
 /**
  * Return how many buffers that are currently free.
  * @return number of free buffers
@@ -92,6 +144,7 @@ int csp_buffer_remaining(void);
 
 /**
  * Return the size of the CSP buffers
+ * With multiple size classes this is the size of the largest class.
  * @return size of CSP buffers
  */
 int csp_buffer_size(void);
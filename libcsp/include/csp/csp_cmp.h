@@ -50,6 +50,7 @@ extern "C" {
 #define CSP_CMP_POKE 5
 #define CSP_CMP_POKE_MAX_LEN 200
 #define CSP_CMP_CLOCK 6
+#define CSP_CMP_DEDUP_STATS 7
 
 struct csp_cmp_message {
 	uint8_t type;
@@ -91,6 +92,11 @@ struct csp_cmp_message {
 			char data[CSP_CMP_POKE_MAX_LEN];
 		} poke;
 		csp_timestamp_t clock;
+		struct __attribute__((__packed__)) {
+			uint32_t hits;
+			uint32_t misses;
+			uint32_t evictions;
+		} dedup_stats;
 	};
 } __attribute__ ((packed));
 
@@ -109,6 +115,7 @@ CMP_MESSAGE(CSP_CMP_IF_STATS, if_stats)
 CMP_MESSAGE(CSP_CMP_PEEK, peek)
 CMP_MESSAGE(CSP_CMP_POKE, poke)
 CMP_MESSAGE(CSP_CMP_CLOCK, clock)
+CMP_MESSAGE(CSP_CMP_DEDUP_STATS, dedup_stats)
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -33,11 +33,35 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 extern "C" {
 #endif
 
+/** CRC32 implementations selectable with csp_crc32_set_kernel() */
+typedef enum {
+	CSP_CRC32_KERNEL_AUTO = 0,	/**< Fastest kernel supported by the running CPU */
+	CSP_CRC32_KERNEL_BYTE,		/**< Table lookup, one byte at a time */
+	CSP_CRC32_KERNEL_SLICE8,	/**< Table lookup, eight bytes at a time */
+	CSP_CRC32_KERNEL_SSE42,		/**< x86 SSE4.2 crc32 instruction */
+	CSP_CRC32_KERNEL_ARMV8,		/**< ARMv8 CRC extension */
+} csp_crc32_kernel_t;
+
 /**
- * Generate precomputed CRC32 table
+ * Generate precomputed CRC32 tables and select the fastest kernel
+ * supported by the running CPU. This is called from csp_init().
  */
 void csp_crc32_gentab(void);
 
+/**
+ * Select the kernel used by csp_crc32_memory()
+ * @param kernel Kernel to use, or CSP_CRC32_KERNEL_AUTO
+ * @return CSP_ERR_NONE on success, CSP_ERR_NOTSUP if the kernel is not
+ * available in this build or on this CPU
+ */
+int csp_crc32_set_kernel(csp_crc32_kernel_t kernel);
+
+/**
+ * Get the kernel currently used by csp_crc32_memory()
+ * @return Selected kernel
+ */
+csp_crc32_kernel_t csp_crc32_get_kernel(void);
+
 /**
  * Append CRC32 checksum to packet
  * @param packet Packet to append checksum
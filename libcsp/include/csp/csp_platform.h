@@ -42,6 +42,8 @@ extern "C" {
 	#define CSP_INIT_CRITICAL(lock) ({(csp_bin_sem_create(&lock) == CSP_SEMAPHORE_OK) ? CSP_ERR_NONE : CSP_ERR_NOMEM;})
 	#define CSP_ENTER_CRITICAL(lock) do { csp_bin_sem_wait(&lock, CSP_MAX_DELAY); } while(0)
 	#define CSP_EXIT_CRITICAL(lock) do { csp_bin_sem_post(&lock); } while(0)
+	#define CSP_ENTER_CRITICAL_ISR(lock, state) do { (void) (state); CSP_ENTER_CRITICAL(lock); } while(0)
+	#define CSP_EXIT_CRITICAL_ISR(lock, state) do { (void) (state); CSP_EXIT_CRITICAL(lock); } while(0)
 #elif defined(CSP_FREERTOS)
 	#include "FreeRTOS.h"
 	#define CSP_BASE_TYPE portBASE_TYPE
@@ -51,6 +53,8 @@ extern "C" {
 	#define CSP_INIT_CRITICAL(lock) ({CSP_ERR_NONE;})
 	#define CSP_ENTER_CRITICAL(lock) do { portENTER_CRITICAL(); } while (0)
 	#define CSP_EXIT_CRITICAL(lock) do { portEXIT_CRITICAL(); } while (0)
+	#define CSP_ENTER_CRITICAL_ISR(lock, state) do { state = portSET_INTERRUPT_MASK_FROM_ISR(); } while (0)
+	#define CSP_EXIT_CRITICAL_ISR(lock, state) do { portCLEAR_INTERRUPT_MASK_FROM_ISR(state); } while (0)
 #else
 	#error "OS must be either CSP_POSIX, CSP_MACOSX, CSP_FREERTOS OR CSP_WINDOWS"
 #endif
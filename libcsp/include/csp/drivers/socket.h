@@ -24,9 +24,11 @@
 #define SOCKET_H_
 
 #include <csp/interfaces/csp_if_socket.h>
+#include <sys/uio.h>
 
 /**
- * Initializes and connects a unix socket, returns socket handle
+ * Initializes and connects a unix socket, returns socket handle. Uses the
+ * transport set by the csp.socket_transport config (CSP_SOCKET_TRANSPORT).
  * @param socket_iface socket interface to store handle in
  * @param mode CSP_SOCKET_CLIENT or CSP_SOCKET_SERVER, which type of connection is created
  * @param port socket interface port number
@@ -34,8 +36,57 @@
  */
 int socket_init(csp_socket_handle_t * socket_iface, uint8_t mode, uint16_t port);
 
+/**
+ * Initializes and connects a socket using a specific transport. Both ends
+ * of a connection must use the same transport.
+ * @param socket_iface socket interface to store handle in
+ * @param mode CSP_SOCKET_CLIENT or CSP_SOCKET_SERVER, which type of connection is created
+ * @param port socket interface port number
+ * @param transport transport to use
+ * @return int CSP_ERR_NONE if successful, otherwise CSP_ERR_DRIVER
+ */
+int socket_init_transport(csp_socket_handle_t * socket_iface, uint8_t mode, uint16_t port, csp_socket_transport transport);
+
 int socket_close(csp_socket_handle_t * socket_driver);
 
+/**
+ * Sends a single message over the socket's transport
+ * @param socket_driver socket to send with
+ * @param data message to send
+ * @param length length of message
+ * @param timeout max time (ms) to wait for space in a shared memory ring
+ * @return int CSP_ERR_NONE if successful, otherwise CSP_ERR_DRIVER or CSP_ERR_TIMEDOUT
+ */
+int socket_send(csp_socket_handle_t * socket_driver, const void * data, size_t length, uint32_t timeout);
+
+/**
+ * Sends a single message gathered from several buffers
+ * @param socket_driver socket to send with
+ * @param iov parts of the message
+ * @param iovcnt number of parts
+ * @param timeout max time (ms) to wait for space in a shared memory ring
+ * @return int CSP_ERR_NONE if successful, otherwise CSP_ERR_DRIVER or CSP_ERR_TIMEDOUT
+ */
+int socket_sendv(csp_socket_handle_t * socket_driver, const struct iovec * iov, int iovcnt, uint32_t timeout);
+
+/**
+ * Waits for and receives a single message from the socket's transport
+ * @param socket_driver socket to receive with
+ * @param buffer buffer to store the message in, longer messages are truncated
+ * @param length size of buffer
+ * @return int number of bytes received, 0 if the connection was closed, negative on error
+ */
+int socket_recv(csp_socket_handle_t * socket_driver, void * buffer, size_t length);
+
+/**
+ * Waits for a single message and scatters it into several buffers
+ * @param socket_driver socket to receive with
+ * @param iov buffers to store the message in, filled in order, longer messages are truncated
+ * @param iovcnt number of buffers
+ * @return int number of bytes received, 0 if the connection was closed, negative on error
+ */
+int socket_recvv(csp_socket_handle_t * socket_driver, const struct iovec * iov, int iovcnt);
+
 /**
  * Attempts to check open/closed status of socket
  * @param socket_iface socket interface containing socket handle
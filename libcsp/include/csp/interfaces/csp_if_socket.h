@@ -34,6 +34,33 @@ extern "C" {
 #include <csp/csp_interface.h>
 #include <csp/arch/csp_thread.h>
 
+/**
+ * Enum for the transport used by a csp socket
+ */
+typedef enum {
+    /*! SCTP socket on the loopback address */
+    CSP_SOCKET_TRANSPORT_SCTP = 0,
+    /*! Unix domain SOCK_SEQPACKET socket */
+    CSP_SOCKET_TRANSPORT_UNIX,
+    /*! Shared memory rings, set up over a unix domain socket */
+    CSP_SOCKET_TRANSPORT_SHM
+} csp_socket_transport;
+
+/**
+ * Enum for the way csp packets are framed on a csp socket
+ */
+typedef enum {
+    /*! CBOR map holding the packet's length, id and data */
+    CSP_SOCKET_FRAMING_CBOR = 0,
+    /*! SOCKET_RAW_HEADER_SIZE byte header of length and id in network byte order, followed by the data */
+    CSP_SOCKET_FRAMING_RAW
+} csp_socket_framing;
+
+/**
+ * Shared memory state of a CSP_SOCKET_TRANSPORT_SHM socket
+ */
+struct csp_socket_shm;
+
 /**
  * Unix socket driver handle
  */
@@ -43,6 +70,12 @@ typedef struct {
     /*! Handle for RX thread */
     csp_thread_handle_t rx_thread_handle;
     bool is_active;
+    /*! Transport the socket uses */
+    csp_socket_transport transport;
+    /*! Framing of packets, may be changed before csp_socket_init */
+    csp_socket_framing framing;
+    /*! Shared memory rings, only used by CSP_SOCKET_TRANSPORT_SHM */
+    struct csp_socket_shm * shm;
 } csp_socket_handle_t;
 
 /**
@@ -67,6 +100,9 @@ int csp_socket_close(csp_iface_t * socket_iface, csp_socket_handle_t * socket_dr
 
 #define SOCKET_BUFFER_SIZE 256
 
+/*! Size of the length and id in front of a CSP_SOCKET_FRAMING_RAW packet */
+#define SOCKET_RAW_HEADER_SIZE (sizeof(uint16_t) + sizeof(csp_id_t))
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
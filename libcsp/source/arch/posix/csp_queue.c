@@ -24,20 +24,27 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 /* CSP includes */
 #include <csp/csp.h>
 
-#include <csp/arch/posix/pthread_queue.h>
 #include <csp/arch/csp_queue.h>
 
+#ifdef CSP_QUEUE_LOCKFREE
+#include <csp/arch/posix/ring_queue.h>
+#define QUEUE(name) ring_queue_##name
+#else
+#include <csp/arch/posix/pthread_queue.h>
+#define QUEUE(name) pthread_queue_##name
+#endif
+
 
 csp_queue_handle_t csp_queue_create(int length, size_t item_size) {
-	return pthread_queue_create(length, item_size);
+	return QUEUE(create)(length, item_size);
 }
 
 void csp_queue_remove(csp_queue_handle_t queue) {
-	return pthread_queue_delete(queue);
+	return QUEUE(delete)(queue);
 }
 
 int csp_queue_enqueue(csp_queue_handle_t handle, void *value, uint32_t timeout) {
-	return pthread_queue_enqueue(handle, value, timeout);
+	return QUEUE(enqueue)(handle, value, timeout);
 }
 
 int csp_queue_enqueue_isr(csp_queue_handle_t handle, void * value, CSP_BASE_TYPE * task_woken) {
@@ -47,7 +54,7 @@ int csp_queue_enqueue_isr(csp_queue_handle_t handle, void * value, CSP_BASE_TYPE
 }
 
 int csp_queue_dequeue(csp_queue_handle_t handle, void *buf, uint32_t timeout) {
-	return pthread_queue_dequeue(handle, buf, timeout);
+	return QUEUE(dequeue)(handle, buf, timeout);
 }
 
 int csp_queue_dequeue_isr(csp_queue_handle_t handle, void *buf, CSP_BASE_TYPE * task_woken) {
@@ -56,9 +63,9 @@ int csp_queue_dequeue_isr(csp_queue_handle_t handle, void *buf, CSP_BASE_TYPE *
 }
 
 int csp_queue_size(csp_queue_handle_t handle) {
-	return pthread_queue_items(handle);
+	return QUEUE(items)(handle);
 }
 
 int csp_queue_size_isr(csp_queue_handle_t handle) {
-	return pthread_queue_items(handle);
+	return QUEUE(items)(handle);
 }
@@ -0,0 +1,262 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 Gomspace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk) 
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+Bounded MPMC ring after Dmitry Vyukov's design. Every cell carries a sequence
+number that tells producers and consumers which lap of the ring it belongs
+to, so the fast path is a single compare-and-swap on the position counter.
+Threads only sleep on a futex when the ring is empty or full, and the other
+side only makes a system call when someone went to sleep since the last one.
+*/
+
+#include <pthread.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* CSP includes */
+#include <csp/csp.h>
+#include <csp/arch/posix/ring_queue.h>
+
+/* Flag in the futex words telling that a thread is about to sleep on them */
+#define RING_QUEUE_SLEEPING 1
+
+#define RING_QUEUE_CELL(q, pos) ((uint32_t *) ((q)->cells + ((pos) & (q)->mask) * (q)->cell_size))
+
+ring_queue_t * ring_queue_create(int length, size_t item_size) {
+
+	ring_queue_t * q;
+	uint32_t cells = 1, i;
+
+	if (length < 1)
+		return NULL;
+
+	/* Cells are indexed with a mask, the length limit is enforced separately */
+	while (cells < (uint32_t) length)
+		cells <<= 1;
+
+	if (posix_memalign((void **) &q, 64, sizeof(*q)) != 0)
+		return NULL;
+
+	memset(q, 0, sizeof(*q));
+	q->mask = cells - 1;
+	q->size = length;
+	q->item_size = item_size;
+	/* Sequence number followed by the item, padded to keep the next one aligned */
+	q->cell_size = (sizeof(uint32_t) + item_size + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+
+	q->cells = malloc((size_t) cells * q->cell_size);
+	if (q->cells == NULL) {
+		free(q);
+		return NULL;
+	}
+
+	for (i = 0; i < cells; i++)
+		*RING_QUEUE_CELL(q, i) = i;
+
+	return q;
+
+}
+
+void ring_queue_delete(ring_queue_t * q) {
+
+	if (q == NULL)
+		return;
+
+	free(q->cells);
+	free(q);
+
+}
+
+static bool ring_queue_try_enqueue(ring_queue_t * q, void * value) {
+
+	uint32_t pos = __atomic_load_n(&q->in, __ATOMIC_RELAXED);
+	uint32_t * cell;
+	int32_t diff;
+
+	while (1) {
+		cell = RING_QUEUE_CELL(q, pos);
+		diff = (int32_t) (__atomic_load_n(cell, __ATOMIC_ACQUIRE) - pos);
+
+		if (diff == 0) {
+			/* Cell is free, but the ring may have more cells than it may hold items */
+			if ((int32_t) (pos - __atomic_load_n(&q->out, __ATOMIC_ACQUIRE)) >= (int32_t) q->size)
+				return false;
+			if (__atomic_compare_exchange_n(&q->in, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* Cell still holds an item from the previous lap */
+			return false;
+		} else {
+			pos = __atomic_load_n(&q->in, __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy(cell + 1, value, q->item_size);
+	__atomic_store_n(cell, pos + 1, __ATOMIC_RELEASE);
+
+	return true;
+
+}
+
+static bool ring_queue_try_dequeue(ring_queue_t * q, void * buf) {
+
+	uint32_t pos = __atomic_load_n(&q->out, __ATOMIC_RELAXED);
+	uint32_t * cell;
+	int32_t diff;
+
+	while (1) {
+		cell = RING_QUEUE_CELL(q, pos);
+		diff = (int32_t) (__atomic_load_n(cell, __ATOMIC_ACQUIRE) - (pos + 1));
+
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&q->out, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* Nothing written to this cell yet */
+			return false;
+		} else {
+			pos = __atomic_load_n(&q->out, __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy(buf, cell + 1, q->item_size);
+	/* Hand the cell to the producer one lap ahead */
+	__atomic_store_n(cell, pos + q->mask + 1, __ATOMIC_RELEASE);
+
+	return true;
+
+}
+
+static void ring_queue_wake(uint32_t * event) {
+
+	uint32_t seen;
+
+	/* Pairs with the fence in ring_queue_wait, either the sleeper sees the
+	 * new item or we see its flag */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	seen = __atomic_load_n(event, __ATOMIC_RELAXED);
+
+	/* Only the first producer after a sleeper arrived pays for the system
+	 * call. Adding one clears the flag and bumps the generation, and all
+	 * sleepers are woken as the flag no longer tells how many there are. */
+	while (seen & RING_QUEUE_SLEEPING) {
+		if (__atomic_compare_exchange_n(event, &seen, seen + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+			syscall(SYS_futex, event, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+			break;
+		}
+	}
+
+}
+
+static bool ring_queue_wait(ring_queue_t * q, bool (*try)(ring_queue_t *, void *), void * item,
+		uint32_t * event, uint32_t timeout) {
+
+	struct timespec deadline, * ts = NULL;
+	uint32_t seen;
+	int ret, cancel;
+
+	if (try(q, item))
+		return true;
+
+	if (timeout == 0)
+		return false;
+
+	/* Absolute deadline, so spurious wakeups do not stretch the timeout */
+	if (timeout != CSP_MAX_DELAY) {
+		if (clock_gettime(CLOCK_MONOTONIC, &deadline))
+			return false;
+		deadline.tv_sec += timeout / 1000;
+		deadline.tv_nsec += (timeout % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		ts = &deadline;
+	}
+
+	while (1) {
+		/* Announce that we are about to sleep */
+		seen = __atomic_load_n(event, __ATOMIC_RELAXED);
+		if (!(seen & RING_QUEUE_SLEEPING)) {
+			if (!__atomic_compare_exchange_n(event, &seen, seen | RING_QUEUE_SLEEPING, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+				continue;
+			seen |= RING_QUEUE_SLEEPING;
+		}
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+		if (try(q, item))
+			return true;
+
+		/* The futex wait is not a cancellation point by itself, so allow
+		 * csp_thread_kill to end tasks blocked on an empty queue */
+		pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, &cancel);
+		ret = syscall(SYS_futex, event, FUTEX_WAIT_BITSET_PRIVATE, seen, ts, NULL, FUTEX_BITSET_MATCH_ANY);
+		pthread_setcanceltype(cancel, NULL);
+
+		if (ret != 0 && errno == ETIMEDOUT)
+			return try(q, item);
+	}
+
+}
+
+int ring_queue_enqueue(ring_queue_t * queue, void * value, uint32_t timeout) {
+
+	if (!ring_queue_wait(queue, ring_queue_try_enqueue, value, &queue->not_full, timeout))
+		return RING_QUEUE_FULL;
+
+	ring_queue_wake(&queue->not_empty);
+
+	return RING_QUEUE_OK;
+
+}
+
+int ring_queue_dequeue(ring_queue_t * queue, void * buf, uint32_t timeout) {
+
+	if (!ring_queue_wait(queue, ring_queue_try_dequeue, buf, &queue->not_empty, timeout))
+		return RING_QUEUE_EMPTY;
+
+	ring_queue_wake(&queue->not_full);
+
+	return RING_QUEUE_OK;
+
+}
+
+int ring_queue_items(ring_queue_t * queue) {
+
+	uint32_t out = __atomic_load_n(&queue->out, __ATOMIC_ACQUIRE);
+	int32_t items = (int32_t) (__atomic_load_n(&queue->in, __ATOMIC_ACQUIRE) - out);
+
+	/* Positions are read separately and may be momentarily inconsistent */
+	if (items < 0)
+		return 0;
+	if (items > (int32_t) queue->size)
+		return queue->size;
+
+	return items;
+
+}
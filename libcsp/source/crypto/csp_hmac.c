@@ -40,11 +40,20 @@ static uint8_t csp_hmac_key[HMAC_KEY_LENGTH];
 /* HMAC state structure */
 typedef struct {
 	csp_sha1_state	md;
-	uint8_t		key[SHA1_BLOCKSIZE];
+	csp_sha1_state	outer;
 } hmac_state;
 
+/* State of csp_hmac_key after the key blocks, copied for every packet.
+ * New keys are hashed into the copy that is not in use and published by
+ * bumping the generation, which selects the current copy. A reader that
+ * sees the generation change while copying looks again. Generation 0
+ * means no key blocks were hashed yet. */
+static hmac_state csp_hmac_keyed[2];
+static uint32_t csp_hmac_keyed_generation;
+
 int csp_hmac_init(hmac_state * hmac, const uint8_t * key, uint32_t keylen) {
 	uint32_t i;
+	uint8_t padded[SHA1_BLOCKSIZE];
 	uint8_t buf[SHA1_BLOCKSIZE];
 
 	/* NULL pointer and key check */
@@ -53,23 +62,30 @@ int csp_hmac_init(hmac_state * hmac, const uint8_t * key, uint32_t keylen) {
 
 	/* Make sure we have a large enough key */
 	if(keylen > SHA1_BLOCKSIZE) {
-		csp_sha1_memory(key, keylen, hmac->key);
+		csp_sha1_memory(key, keylen, padded);
 		if(SHA1_DIGESTSIZE < SHA1_BLOCKSIZE)
-			memset((hmac->key) + SHA1_DIGESTSIZE, 0, (size_t)(SHA1_BLOCKSIZE - SHA1_DIGESTSIZE));
+			memset(padded + SHA1_DIGESTSIZE, 0, (size_t)(SHA1_BLOCKSIZE - SHA1_DIGESTSIZE));
 	} else {
-		memcpy(hmac->key, key, (size_t)keylen);
+		memcpy(padded, key, (size_t)keylen);
 		if(keylen < SHA1_BLOCKSIZE)
-			memset((hmac->key) + keylen, 0, (size_t)(SHA1_BLOCKSIZE - keylen));
+			memset(padded + keylen, 0, (size_t)(SHA1_BLOCKSIZE - keylen));
 	}
 
 	/* Create the initial vector */
 	for(i = 0; i < SHA1_BLOCKSIZE; i++)
-	   buf[i] = hmac->key[i] ^ 0x36;
+	   buf[i] = padded[i] ^ 0x36;
 
 	/* Prepend to the hash data */
 	csp_sha1_init(&hmac->md);
 	csp_sha1_process(&hmac->md, buf, SHA1_BLOCKSIZE);
 
+	/* Hash the second HMAC vector now, so finishing only needs the inner hash */
+	for(i = 0; i < SHA1_BLOCKSIZE; i++)
+	   buf[i] = padded[i] ^ 0x5C;
+
+	csp_sha1_init(&hmac->outer);
+	csp_sha1_process(&hmac->outer, buf, SHA1_BLOCKSIZE);
+
 	return CSP_ERR_NONE;
 }
 
@@ -87,8 +103,6 @@ int csp_hmac_process(hmac_state * hmac, const uint8_t * in, uint32_t inlen) {
 
 int csp_hmac_done(hmac_state * hmac, uint8_t * out) {
 
-	uint32_t i;
-	uint8_t buf[SHA1_BLOCKSIZE];
 	uint8_t isha[SHA1_DIGESTSIZE];
 
 	if (!hmac || !out)
@@ -97,19 +111,9 @@ int csp_hmac_done(hmac_state * hmac, uint8_t * out) {
 	/* Get the hash of the first HMAC vector plus the data */
 	csp_sha1_done(&hmac->md, isha);
 
-	/* Create the second HMAC vector vector */
-	for(i = 0; i < SHA1_BLOCKSIZE; i++)
-		buf[i] = hmac->key[i] ^ 0x5C;
-
 	/* Now calculate the outer hash */
-	csp_sha1_init(&hmac->md);
-	csp_sha1_process(&hmac->md, buf, SHA1_BLOCKSIZE);
-	csp_sha1_process(&hmac->md, isha, SHA1_DIGESTSIZE);
-	csp_sha1_done(&hmac->md, buf);
-
-	/* Copy to output  */
-	for (i = 0; i < SHA1_DIGESTSIZE; i++)
-		out[i] = buf[i];
+	csp_sha1_process(&hmac->outer, isha, SHA1_DIGESTSIZE);
+	csp_sha1_done(&hmac->outer, out);
 
 	return CSP_ERR_NONE;
 }
@@ -136,6 +140,34 @@ int csp_hmac_memory(const uint8_t * key, uint32_t keylen, const uint8_t * data,
 	return CSP_ERR_NONE;
 }
 
+/* Hash the key blocks of csp_hmac_key once, instead of for every packet */
+static void csp_hmac_keyed_publish(void) {
+
+	uint32_t generation = __atomic_load_n(&csp_hmac_keyed_generation, __ATOMIC_RELAXED) + 1;
+	hmac_state state;
+
+	/* Generation 0 is never published, it stands for no key */
+	if (generation == 0)
+		generation = 2;
+
+	csp_hmac_init(&state, csp_hmac_key, HMAC_KEY_LENGTH);
+
+	/* Readers of this copy must see the previous generation change before
+	 * it is overwritten */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	csp_hmac_keyed[generation & 1] = state;
+	__atomic_store_n(&csp_hmac_keyed_generation, generation, __ATOMIC_RELEASE);
+
+}
+
+void csp_hmac_init_key(void) {
+
+	/* Packets sent before any key is set use the all zero key */
+	if (__atomic_load_n(&csp_hmac_keyed_generation, __ATOMIC_ACQUIRE) == 0)
+		csp_hmac_keyed_publish();
+
+}
+
 int csp_hmac_set_key(char * key, uint32_t keylen) {
 
 	/* Use SHA1 as KDF */
@@ -145,10 +177,35 @@ int csp_hmac_set_key(char * key, uint32_t keylen) {
 	/* Copy key */
 	memcpy(csp_hmac_key, hash, HMAC_KEY_LENGTH);
 
+	csp_hmac_keyed_publish();
+
 	return CSP_ERR_NONE;
 
 }
 
+/* HMAC of a block of memory with the key set by csp_hmac_set_key */
+static void csp_hmac_keyed_memory(const uint8_t * data, uint32_t datalen, uint8_t * hmac) {
+
+	static const uint8_t zero_key[HMAC_KEY_LENGTH];
+	hmac_state state;
+	uint32_t generation;
+
+	do {
+		generation = __atomic_load_n(&csp_hmac_keyed_generation, __ATOMIC_ACQUIRE);
+		if (generation == 0) {
+			/* Used before csp_init and without a key */
+			csp_hmac_init(&state, zero_key, HMAC_KEY_LENGTH);
+			break;
+		}
+		state = csp_hmac_keyed[generation & 1];
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (generation != __atomic_load_n(&csp_hmac_keyed_generation, __ATOMIC_RELAXED));
+
+	csp_hmac_process(&state, data, datalen);
+	csp_hmac_done(&state, hmac);
+
+}
+
 int csp_hmac_append(csp_packet_t * packet, bool include_header) {
 
 	/* NULL pointer check */
@@ -159,9 +216,9 @@ int csp_hmac_append(csp_packet_t * packet, bool include_header) {
 
 	/* Calculate HMAC */
 	if (include_header) {
-		csp_hmac_memory(csp_hmac_key, HMAC_KEY_LENGTH, (uint8_t *) &packet->id, packet->length + sizeof(packet->id), hmac);
+		csp_hmac_keyed_memory((uint8_t *) &packet->id, packet->length + sizeof(packet->id), hmac);
 	} else {
-		csp_hmac_memory(csp_hmac_key, HMAC_KEY_LENGTH, packet->data, packet->length, hmac);
+		csp_hmac_keyed_memory(packet->data, packet->length, hmac);
 	}
 
 	/* Truncate hash and copy to packet */
@@ -182,9 +239,9 @@ int csp_hmac_verify(csp_packet_t * packet, bool include_header) {
 
 	/* Calculate HMAC */
 	if (include_header) {
-		csp_hmac_memory(csp_hmac_key, HMAC_KEY_LENGTH, (uint8_t *) &packet->id, packet->length + sizeof(packet->id) - CSP_HMAC_LENGTH, hmac);
+		csp_hmac_keyed_memory((uint8_t *) &packet->id, packet->length + sizeof(packet->id) - CSP_HMAC_LENGTH, hmac);
 	} else {
-		csp_hmac_memory(csp_hmac_key, HMAC_KEY_LENGTH, packet->data, packet->length - CSP_HMAC_LENGTH, hmac);
+		csp_hmac_keyed_memory(packet->data, packet->length - CSP_HMAC_LENGTH, hmac);
 	}
 
 	/* Compare calculated HMAC with packet header */
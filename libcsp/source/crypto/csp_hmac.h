@@ -30,6 +30,23 @@ extern "C" {
 
 #define CSP_HMAC_LENGTH	4
 
+/**
+ * Calculate HMAC of a block of memory
+ * @param key Pointer to key
+ * @param keylen Length of key
+ * @param data Pointer to data
+ * @param datalen Length of data
+ * @param hmac Pointer to HMAC output buffer. Must be 20 bytes or more!
+ * @return 0 on success, -1 on failure
+ */
+int csp_hmac_memory(const uint8_t * key, uint32_t keylen, const uint8_t * data, uint32_t datalen, uint8_t * hmac);
+
+/**
+ * Hash the key blocks of the default all zero key, unless a key was set.
+ * Called by csp_init, so the router workers only ever copy the result.
+ */
+void csp_hmac_init_key(void);
+
 /**
  * Append HMAC to packet
  * @param packet Pointer to packet
@@ -28,7 +28,21 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include "csp_sha1.h"
 
-#ifdef CSP_USE_HMAC
+/* XTEA uses SHA1 to derive its key */
+#if defined(CSP_USE_HMAC) || defined(CSP_USE_XTEA)
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CSP_SHA1_SHANI
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+#if defined(__aarch64__) && defined(__linux__) && defined(__GNUC__)
+#define CSP_SHA1_ARMV8
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
 
 /* Rotate left macro */
 #define ROL(x,y)	(((x) << (y)) | ((x) >> (32-y)))
@@ -66,71 +80,228 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define FF_2(a, b, c, d, e, i) do {e = (ROL(a, 5) + F2(b,c,d) + e + W[i] + 0x8f1bbcdcUL); b = ROL(b, 30);} while (0)
 #define FF_3(a, b, c, d, e, i) do {e = (ROL(a, 5) + F3(b,c,d) + e + W[i] + 0xca62c1d6UL); b = ROL(b, 30);} while (0)
 
-static void csp_sha1_compress(csp_sha1_state * sha1, const uint8_t * buf) {
+typedef void (*csp_sha1_kernel_fnc_t)(uint32_t * state, const uint8_t * buf, uint32_t blocks);
+
+static void csp_sha1_generic(uint32_t * state, const uint8_t * buf, uint32_t blocks) {
 
 	uint32_t a, b, c, d, e, W[80], i;
 
-	/* Copy the state into 512-bits into W[0..15] */
-	for (i = 0; i < 16; i++)
-		LOAD32H(W[i], buf + (4*i));
-
-	/* Copy state */
-	a = sha1->state[0];
-	b = sha1->state[1];
-	c = sha1->state[2];
-	d = sha1->state[3];
-	e = sha1->state[4];
-
-	/* Expand it */
-	for (i = 16; i < 80; i++)
-		W[i] = ROL(W[i-3] ^ W[i-8] ^ W[i-14] ^ W[i-16], 1);
-
-	/* Compress */
-	i = 0;
-
-	/* Round one */
-	for (; i < 20;) {
-	   FF_0(a, b, c, d, e, i++);
-	   FF_0(e, a, b, c, d, i++);
-	   FF_0(d, e, a, b, c, i++);
-	   FF_0(c, d, e, a, b, i++);
-	   FF_0(b, c, d, e, a, i++);
+	for (; blocks > 0; blocks--, buf += SHA1_BLOCKSIZE) {
+		/* Copy the state into 512-bits into W[0..15] */
+		for (i = 0; i < 16; i++)
+			LOAD32H(W[i], buf + (4*i));
+
+		/* Copy state */
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		e = state[4];
+
+		/* Expand it */
+		for (i = 16; i < 80; i++)
+			W[i] = ROL(W[i-3] ^ W[i-8] ^ W[i-14] ^ W[i-16], 1);
+
+		/* Compress */
+		i = 0;
+
+		/* Round one */
+		for (; i < 20;) {
+		   FF_0(a, b, c, d, e, i++);
+		   FF_0(e, a, b, c, d, i++);
+		   FF_0(d, e, a, b, c, i++);
+		   FF_0(c, d, e, a, b, i++);
+		   FF_0(b, c, d, e, a, i++);
+		}
+
+		/* Round two */
+		for (; i < 40;)  {
+		   FF_1(a, b, c, d, e, i++);
+		   FF_1(e, a, b, c, d, i++);
+		   FF_1(d, e, a, b, c, i++);
+		   FF_1(c, d, e, a, b, i++);
+		   FF_1(b, c, d, e, a, i++);
+		}
+
+		/* Round three */
+		for (; i < 60;)  {
+		   FF_2(a, b, c, d, e, i++);
+		   FF_2(e, a, b, c, d, i++);
+		   FF_2(d, e, a, b, c, i++);
+		   FF_2(c, d, e, a, b, i++);
+		   FF_2(b, c, d, e, a, i++);
+		}
+
+		/* Round four */
+		for (; i < 80;)  {
+		   FF_3(a, b, c, d, e, i++);
+		   FF_3(e, a, b, c, d, i++);
+		   FF_3(d, e, a, b, c, i++);
+		   FF_3(c, d, e, a, b, i++);
+		   FF_3(b, c, d, e, a, i++);
+		}
+
+		/* Store */
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
 	}
 
-	/* Round two */
-	for (; i < 40;)  {
-	   FF_1(a, b, c, d, e, i++);
-	   FF_1(e, a, b, c, d, i++);
-	   FF_1(d, e, a, b, c, i++);
-	   FF_1(c, d, e, a, b, i++);
-	   FF_1(b, c, d, e, a, i++);
+}
+
+#ifdef CSP_SHA1_SHANI
+
+/* Four rounds, with the message schedule for the next ones computed alongside */
+#define SHANI_ROUNDS4(g, f) do { \
+	if ((g) >= 4) \
+		W[(g) % 4] = _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(W[(g) % 4], W[((g) + 1) % 4]), W[((g) + 2) % 4]), W[((g) + 3) % 4]); \
+	E = ((g) == 0) ? _mm_add_epi32(E, W[0]) : _mm_sha1nexte_epu32(prev, W[(g) % 4]); \
+	prev = abcd; \
+	abcd = _mm_sha1rnds4_epu32(abcd, E, f); } while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void csp_sha1_shani(uint32_t * state, const uint8_t * buf, uint32_t blocks) {
+
+	const __m128i swap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, E, e_save, prev, W[4];
+	unsigned int i;
+
+	/* The instructions keep a in the highest lane and e in a lane of its own */
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) state), 0x1B);
+	E = _mm_set_epi32(state[4], 0, 0, 0);
+
+	for (; blocks > 0; blocks--, buf += SHA1_BLOCKSIZE) {
+		abcd_save = abcd;
+		e_save = E;
+
+		for (i = 0; i < 4; i++)
+			W[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (buf + 16 * i)), swap);
+
+		SHANI_ROUNDS4(0, 0);  SHANI_ROUNDS4(1, 0);  SHANI_ROUNDS4(2, 0);  SHANI_ROUNDS4(3, 0);  SHANI_ROUNDS4(4, 0);
+		SHANI_ROUNDS4(5, 1);  SHANI_ROUNDS4(6, 1);  SHANI_ROUNDS4(7, 1);  SHANI_ROUNDS4(8, 1);  SHANI_ROUNDS4(9, 1);
+		SHANI_ROUNDS4(10, 2); SHANI_ROUNDS4(11, 2); SHANI_ROUNDS4(12, 2); SHANI_ROUNDS4(13, 2); SHANI_ROUNDS4(14, 2);
+		SHANI_ROUNDS4(15, 3); SHANI_ROUNDS4(16, 3); SHANI_ROUNDS4(17, 3); SHANI_ROUNDS4(18, 3); SHANI_ROUNDS4(19, 3);
+
+		E = _mm_sha1nexte_epu32(prev, e_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
 	}
 
-	/* Round three */
-	for (; i < 60;)  {
-	   FF_2(a, b, c, d, e, i++);
-	   FF_2(e, a, b, c, d, i++);
-	   FF_2(d, e, a, b, c, i++);
-	   FF_2(c, d, e, a, b, i++);
-	   FF_2(b, c, d, e, a, i++);
+	_mm_storeu_si128((__m128i *) state, _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = _mm_extract_epi32(E, 3);
+
+}
+
+static bool csp_sha1_shani_supported(void) {
+
+	unsigned int eax, ebx, ecx, edx;
+
+	/* SHA is CPUID leaf 7 EBX bit 29, SSSE3 and SSE4.1 are leaf 1 ECX bits 9 and 19 */
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & (1 << 9)) || !(ecx & (1 << 19)))
+		return false;
+	if (__get_cpuid_max(0, NULL) < 7)
+		return false;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	return (ebx & (1 << 29)) != 0;
+
+}
+
+#endif // CSP_SHA1_SHANI
+
+#ifdef CSP_SHA1_ARMV8
+
+/* Four rounds, with the message schedule for the next ones computed alongside */
+#define ARMV8_ROUNDS4(g, f, k) do { \
+	if ((g) >= 4) \
+		W[(g) % 4] = vsha1su1q_u32(vsha1su0q_u32(W[(g) % 4], W[((g) + 1) % 4], W[((g) + 2) % 4]), W[((g) + 3) % 4]); \
+	e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0)); \
+	abcd = f(abcd, e, vaddq_u32(W[(g) % 4], vdupq_n_u32(k))); \
+	e = e_next; } while (0)
+
+__attribute__((target("+crypto")))
+static void csp_sha1_armv8(uint32_t * state, const uint8_t * buf, uint32_t blocks) {
+
+	uint32x4_t abcd, abcd_save, W[4];
+	uint32_t e, e_save, e_next;
+	unsigned int i;
+
+	abcd = vld1q_u32(state);
+	e = state[4];
+
+	for (; blocks > 0; blocks--, buf += SHA1_BLOCKSIZE) {
+		abcd_save = abcd;
+		e_save = e;
+
+		for (i = 0; i < 4; i++)
+			W[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(buf + 16 * i)));
+
+		ARMV8_ROUNDS4(0, vsha1cq_u32, 0x5a827999);  ARMV8_ROUNDS4(1, vsha1cq_u32, 0x5a827999);
+		ARMV8_ROUNDS4(2, vsha1cq_u32, 0x5a827999);  ARMV8_ROUNDS4(3, vsha1cq_u32, 0x5a827999);
+		ARMV8_ROUNDS4(4, vsha1cq_u32, 0x5a827999);  ARMV8_ROUNDS4(5, vsha1pq_u32, 0x6ed9eba1);
+		ARMV8_ROUNDS4(6, vsha1pq_u32, 0x6ed9eba1);  ARMV8_ROUNDS4(7, vsha1pq_u32, 0x6ed9eba1);
+		ARMV8_ROUNDS4(8, vsha1pq_u32, 0x6ed9eba1);  ARMV8_ROUNDS4(9, vsha1pq_u32, 0x6ed9eba1);
+		ARMV8_ROUNDS4(10, vsha1mq_u32, 0x8f1bbcdc); ARMV8_ROUNDS4(11, vsha1mq_u32, 0x8f1bbcdc);
+		ARMV8_ROUNDS4(12, vsha1mq_u32, 0x8f1bbcdc); ARMV8_ROUNDS4(13, vsha1mq_u32, 0x8f1bbcdc);
+		ARMV8_ROUNDS4(14, vsha1mq_u32, 0x8f1bbcdc); ARMV8_ROUNDS4(15, vsha1pq_u32, 0xca62c1d6);
+		ARMV8_ROUNDS4(16, vsha1pq_u32, 0xca62c1d6); ARMV8_ROUNDS4(17, vsha1pq_u32, 0xca62c1d6);
+		ARMV8_ROUNDS4(18, vsha1pq_u32, 0xca62c1d6); ARMV8_ROUNDS4(19, vsha1pq_u32, 0xca62c1d6);
+
+		abcd = vaddq_u32(abcd, abcd_save);
+		e += e_save;
 	}
 
-	/* Round four */
-	for (; i < 80;)  {
-	   FF_3(a, b, c, d, e, i++);
-	   FF_3(e, a, b, c, d, i++);
-	   FF_3(d, e, a, b, c, i++);
-	   FF_3(c, d, e, a, b, i++);
-	   FF_3(b, c, d, e, a, i++);
+	vst1q_u32(state, abcd);
+	state[4] = e;
+
+}
+
+#endif // CSP_SHA1_ARMV8
+
+static csp_sha1_kernel_t csp_sha1_kernel = CSP_SHA1_KERNEL_GENERIC;
+static csp_sha1_kernel_fnc_t csp_sha1_kernel_fnc = csp_sha1_generic;
+
+int csp_sha1_set_kernel(csp_sha1_kernel_t kernel) {
+
+	switch (kernel) {
+	case CSP_SHA1_KERNEL_AUTO:
+#if defined(CSP_SHA1_SHANI)
+		if (csp_sha1_set_kernel(CSP_SHA1_KERNEL_SHANI) == CSP_ERR_NONE)
+			return CSP_ERR_NONE;
+#elif defined(CSP_SHA1_ARMV8)
+		if (csp_sha1_set_kernel(CSP_SHA1_KERNEL_ARMV8) == CSP_ERR_NONE)
+			return CSP_ERR_NONE;
+#endif
+		return csp_sha1_set_kernel(CSP_SHA1_KERNEL_GENERIC);
+	case CSP_SHA1_KERNEL_GENERIC:
+		csp_sha1_kernel_fnc = csp_sha1_generic;
+		break;
+#ifdef CSP_SHA1_SHANI
+	case CSP_SHA1_KERNEL_SHANI:
+		if (!csp_sha1_shani_supported())
+			return CSP_ERR_NOTSUP;
+		csp_sha1_kernel_fnc = csp_sha1_shani;
+		break;
+#endif
+#ifdef CSP_SHA1_ARMV8
+	case CSP_SHA1_KERNEL_ARMV8:
+		if (!(getauxval(AT_HWCAP) & HWCAP_SHA1))
+			return CSP_ERR_NOTSUP;
+		csp_sha1_kernel_fnc = csp_sha1_armv8;
+		break;
+#endif
+	default:
+		return CSP_ERR_NOTSUP;
 	}
 
-	/* Store */
-	sha1->state[0] += a;
-	sha1->state[1] += b;
-	sha1->state[2] += c;
-	sha1->state[3] += d;
-	sha1->state[4] += e;
+	csp_sha1_kernel = kernel;
+	return CSP_ERR_NONE;
+
+}
 
+csp_sha1_kernel_t csp_sha1_get_kernel(void) {
+	return csp_sha1_kernel;
 }
 
 void csp_sha1_init(csp_sha1_state * sha1) {
@@ -150,10 +321,12 @@ void csp_sha1_process(csp_sha1_state * sha1, const uint8_t * in, uint32_t inlen)
 	uint32_t n;
 	while (inlen > 0) {
 		if (sha1->curlen == 0 && inlen >= SHA1_BLOCKSIZE) {
-		   csp_sha1_compress(sha1, in);
-		   sha1->length += SHA1_BLOCKSIZE * 8;
-		   in += SHA1_BLOCKSIZE;
-		   inlen -= SHA1_BLOCKSIZE;
+		   /* Hand every whole block to the kernel at once */
+		   n = inlen / SHA1_BLOCKSIZE;
+		   csp_sha1_kernel_fnc(sha1->state, in, n);
+		   sha1->length += (uint64_t) n * SHA1_BLOCKSIZE * 8;
+		   in += n * SHA1_BLOCKSIZE;
+		   inlen -= n * SHA1_BLOCKSIZE;
 		} else {
 		   n = MIN(inlen, (SHA1_BLOCKSIZE - sha1->curlen));
 		   memcpy(sha1->buf + sha1->curlen, in, (size_t)n);
@@ -161,7 +334,7 @@ void csp_sha1_process(csp_sha1_state * sha1, const uint8_t * in, uint32_t inlen)
 		   in += n;
 		   inlen -= n;
 		   if (sha1->curlen == SHA1_BLOCKSIZE) {
-			  csp_sha1_compress(sha1, sha1->buf);
+			  csp_sha1_kernel_fnc(sha1->state, sha1->buf, 1);
 			  sha1->length += 8*SHA1_BLOCKSIZE;
 			  sha1->curlen = 0;
 		   }
@@ -187,7 +360,7 @@ void csp_sha1_done(csp_sha1_state * sha1, uint8_t * out) {
 	if (sha1->curlen > 56) {
 		while (sha1->curlen < 64)
 			sha1->buf[sha1->curlen++] = 0;
-		csp_sha1_compress(sha1, sha1->buf);
+		csp_sha1_kernel_fnc(sha1->state, sha1->buf, 1);
 		sha1->curlen = 0;
 	}
 
@@ -197,7 +370,7 @@ void csp_sha1_done(csp_sha1_state * sha1, uint8_t * out) {
 
 	/* Store length */
 	STORE64H(sha1->length, sha1->buf + 56);
-	csp_sha1_compress(sha1, sha1->buf);
+	csp_sha1_kernel_fnc(sha1->state, sha1->buf, 1);
 
 	/* Copy output */
 	for (i = 0; i < 5; i++)
@@ -214,4 +387,4 @@ void csp_sha1_memory(const uint8_t * msg, uint32_t len, uint8_t * hash) {
 
 }
 
-#endif // CSP_USE_HMAC
+#endif // CSP_USE_HMAC || CSP_USE_XTEA
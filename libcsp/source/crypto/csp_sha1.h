@@ -38,6 +38,28 @@ typedef struct {
 	uint8_t buf[SHA1_BLOCKSIZE];
 } csp_sha1_state;
 
+/* SHA1 compression implementations selectable with csp_sha1_set_kernel() */
+typedef enum {
+	CSP_SHA1_KERNEL_AUTO = 0,	/* Fastest kernel supported by the running CPU */
+	CSP_SHA1_KERNEL_GENERIC,	/* Portable C */
+	CSP_SHA1_KERNEL_SHANI,		/* x86 SHA extensions */
+	CSP_SHA1_KERNEL_ARMV8,		/* ARMv8 cryptography extension */
+} csp_sha1_kernel_t;
+
+/**
+ * Select the kernel used to compress blocks
+ * @param kernel Kernel to use, or CSP_SHA1_KERNEL_AUTO
+ * @return CSP_ERR_NONE on success, CSP_ERR_NOTSUP if the kernel is not
+ * available in this build or on this CPU
+ */
+int csp_sha1_set_kernel(csp_sha1_kernel_t kernel);
+
+/**
+ * Get the kernel currently used to compress blocks
+ * @return Selected kernel
+ */
+csp_sha1_kernel_t csp_sha1_get_kernel(void);
+
 /**
  * Initialize the hash state
  * @param sha1   The hash state you wish to initialize
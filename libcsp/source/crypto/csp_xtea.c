@@ -22,6 +22,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <stdint.h>
 #include <string.h>
+#include <stdbool.h>
 
 /* CSP includes */
 #include <csp/csp.h>
@@ -32,13 +33,29 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #ifdef CSP_USE_XTEA
 
+#if defined(__SSE2__)
+#define CSP_XTEA_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CSP_XTEA_NEON
+#include <arm_neon.h>
+#endif
+
 #define XTEA_BLOCKSIZE 	8
 #define XTEA_ROUNDS 	32
 #define XTEA_KEY_LENGTH	16
+#define XTEA_DELTA		0x9E3779B9
+
+/* Number of counter blocks encrypted together */
+#define XTEA_BATCH		8
 
 /* XTEA key */
 static uint32_t csp_xtea_key[XTEA_KEY_LENGTH/sizeof(uint32_t)] __attribute__ ((aligned(sizeof(uint32_t))));
 
+/* Round keys of csp_xtea_key, sum + k[] for each half round */
+static uint32_t csp_xtea_schedule[2 * XTEA_ROUNDS];
+static bool csp_xtea_schedule_ready = false;
+
 #define STORE32L(x, y) do { (y)[3] = (uint8_t)(((x) >> 24) & 0xff); \
 							(y)[2] = (uint8_t)(((x) >> 16) & 0xff); \
 							(y)[1] = (uint8_t)(((x) >> 8) & 0xff); \
@@ -49,38 +66,123 @@ static uint32_t csp_xtea_key[XTEA_KEY_LENGTH/sizeof(uint32_t)] __attribute__ ((a
 								 ((uint32_t)((y)[1] & 0xff) << 8)  | \
 								 ((uint32_t)((y)[0] & 0xff) << 0); } while (0)
 
-/* This function takes 64 bits of data in block and the 128 bits key in key */
-static inline void csp_xtea_encrypt_block(uint8_t *block, uint8_t const *key) {
+static void csp_xtea_gen_schedule(void) {
 
-	uint32_t i, v0, v1, delta = 0x9E3779B9, sum = 0, k[4];
+	uint32_t i, sum = 0, k[4];
+	const uint8_t * key = (const uint8_t *) csp_xtea_key;
 
 	LOAD32L(k[0], &key[0]);
 	LOAD32L(k[1], &key[4]);
 	LOAD32L(k[2], &key[8]);
 	LOAD32L(k[3], &key[12]);
 
-	LOAD32L(v0, &block[0]);
-	LOAD32L(v1, &block[4]);
+	for (i = 0; i < XTEA_ROUNDS; i++) {
+		csp_xtea_schedule[2 * i] = sum + k[sum & 3];
+		sum += XTEA_DELTA;
+		csp_xtea_schedule[2 * i + 1] = sum + k[(sum >> 11) & 3];
+	}
+
+	csp_xtea_schedule_ready = true;
+
+}
+
+/* Encrypts the first n of XTEA_BATCH blocks in place, the halves of block i are v0[i] and v1[i] */
+#if defined(CSP_XTEA_SSE2)
+
+static void csp_xtea_encrypt_batch(uint32_t * v0, uint32_t * v1, uint32_t n) {
+
+	__m128i a0 = _mm_loadu_si128((const __m128i *) &v0[0]);
+	__m128i a1 = _mm_loadu_si128((const __m128i *) &v0[4]);
+	__m128i b0 = _mm_loadu_si128((const __m128i *) &v1[0]);
+	__m128i b1 = _mm_loadu_si128((const __m128i *) &v1[4]);
+	__m128i k;
+	unsigned int i;
+
+	/* Short packets only need one vector of blocks */
+	if (n <= 4) {
+		for (i = 0; i < XTEA_ROUNDS; i++) {
+			a0 = _mm_add_epi32(a0, _mm_xor_si128(_mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(b0, 4), _mm_srli_epi32(b0, 5)), b0), _mm_set1_epi32(csp_xtea_schedule[2 * i])));
+			b0 = _mm_add_epi32(b0, _mm_xor_si128(_mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(a0, 4), _mm_srli_epi32(a0, 5)), a0), _mm_set1_epi32(csp_xtea_schedule[2 * i + 1])));
+		}
+		_mm_storeu_si128((__m128i *) &v0[0], a0);
+		_mm_storeu_si128((__m128i *) &v1[0], b0);
+		return;
+	}
 
 	for (i = 0; i < XTEA_ROUNDS; i++) {
-		v0 += (((v1 << 4) ^ (v1 >> 5)) + v1) ^ (sum + k[sum & 3]);
-		sum += delta;
-		v1 += (((v0 << 4) ^ (v0 >> 5)) + v0) ^ (sum + k[(sum >> 11) & 3]);
+		k = _mm_set1_epi32(csp_xtea_schedule[2 * i]);
+		a0 = _mm_add_epi32(a0, _mm_xor_si128(_mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(b0, 4), _mm_srli_epi32(b0, 5)), b0), k));
+		a1 = _mm_add_epi32(a1, _mm_xor_si128(_mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(b1, 4), _mm_srli_epi32(b1, 5)), b1), k));
+		k = _mm_set1_epi32(csp_xtea_schedule[2 * i + 1]);
+		b0 = _mm_add_epi32(b0, _mm_xor_si128(_mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(a0, 4), _mm_srli_epi32(a0, 5)), a0), k));
+		b1 = _mm_add_epi32(b1, _mm_xor_si128(_mm_add_epi32(_mm_xor_si128(_mm_slli_epi32(a1, 4), _mm_srli_epi32(a1, 5)), a1), k));
 	}
 
-	STORE32L(v0, &block[0]);
-	STORE32L(v1, &block[4]);
+	_mm_storeu_si128((__m128i *) &v0[0], a0);
+	_mm_storeu_si128((__m128i *) &v0[4], a1);
+	_mm_storeu_si128((__m128i *) &v1[0], b0);
+	_mm_storeu_si128((__m128i *) &v1[4], b1);
 
 }
 
-static inline void csp_xtea_xor_byte(uint8_t * dst, uint8_t * src, uint32_t len) {
+#elif defined(CSP_XTEA_NEON)
 
+static void csp_xtea_encrypt_batch(uint32_t * v0, uint32_t * v1, uint32_t n) {
+
+	uint32x4_t a0 = vld1q_u32(&v0[0]);
+	uint32x4_t a1 = vld1q_u32(&v0[4]);
+	uint32x4_t b0 = vld1q_u32(&v1[0]);
+	uint32x4_t b1 = vld1q_u32(&v1[4]);
+	uint32x4_t k;
 	unsigned int i;
-	for (i = 0; i < len; i++)
-		dst[i] ^= src[i];
+
+	/* Short packets only need one vector of blocks */
+	if (n <= 4) {
+		for (i = 0; i < XTEA_ROUNDS; i++) {
+			a0 = vaddq_u32(a0, veorq_u32(vaddq_u32(veorq_u32(vshlq_n_u32(b0, 4), vshrq_n_u32(b0, 5)), b0), vdupq_n_u32(csp_xtea_schedule[2 * i])));
+			b0 = vaddq_u32(b0, veorq_u32(vaddq_u32(veorq_u32(vshlq_n_u32(a0, 4), vshrq_n_u32(a0, 5)), a0), vdupq_n_u32(csp_xtea_schedule[2 * i + 1])));
+		}
+		vst1q_u32(&v0[0], a0);
+		vst1q_u32(&v1[0], b0);
+		return;
+	}
+
+	for (i = 0; i < XTEA_ROUNDS; i++) {
+		k = vdupq_n_u32(csp_xtea_schedule[2 * i]);
+		a0 = vaddq_u32(a0, veorq_u32(vaddq_u32(veorq_u32(vshlq_n_u32(b0, 4), vshrq_n_u32(b0, 5)), b0), k));
+		a1 = vaddq_u32(a1, veorq_u32(vaddq_u32(veorq_u32(vshlq_n_u32(b1, 4), vshrq_n_u32(b1, 5)), b1), k));
+		k = vdupq_n_u32(csp_xtea_schedule[2 * i + 1]);
+		b0 = vaddq_u32(b0, veorq_u32(vaddq_u32(veorq_u32(vshlq_n_u32(a0, 4), vshrq_n_u32(a0, 5)), a0), k));
+		b1 = vaddq_u32(b1, veorq_u32(vaddq_u32(veorq_u32(vshlq_n_u32(a1, 4), vshrq_n_u32(a1, 5)), a1), k));
+	}
+
+	vst1q_u32(&v0[0], a0);
+	vst1q_u32(&v0[4], a1);
+	vst1q_u32(&v1[0], b0);
+	vst1q_u32(&v1[4], b1);
 
 }
 
+#else
+
+static void csp_xtea_encrypt_batch(uint32_t * v0, uint32_t * v1, uint32_t n) {
+
+	uint32_t i, j, k;
+
+	/* Independent blocks side by side keep a pipelined CPU busy */
+	for (i = 0; i < XTEA_ROUNDS; i++) {
+		k = csp_xtea_schedule[2 * i];
+		for (j = 0; j < n; j++)
+			v0[j] += (((v1[j] << 4) ^ (v1[j] >> 5)) + v1[j]) ^ k;
+		k = csp_xtea_schedule[2 * i + 1];
+		for (j = 0; j < n; j++)
+			v1[j] += (((v0[j] << 4) ^ (v0[j] >> 5)) + v0[j]) ^ k;
+	}
+
+}
+
+#endif
+
 int csp_xtea_set_key(char * key, uint32_t keylen) {
 
 	/* Use SHA1 as KDF */
@@ -90,37 +192,62 @@ int csp_xtea_set_key(char * key, uint32_t keylen) {
 	/* Copy key */
 	memcpy(csp_xtea_key, hash, XTEA_KEY_LENGTH);
 
+	/* Expand the key once, instead of for every block */
+	csp_xtea_gen_schedule();
+
 	return CSP_ERR_NONE;
 
 }
 
 int csp_xtea_encrypt(uint8_t * plain, const uint32_t len, uint32_t iv[2]) {
 
-	unsigned int i;
-	uint32_t stream[2];
+	uint32_t v0[XTEA_BATCH], v1[XTEA_BATCH];
+	uint32_t i, j, n, word;
+	uint8_t stream[XTEA_BLOCKSIZE];
 
 	uint32_t blocks = (len + XTEA_BLOCKSIZE - 1)/ XTEA_BLOCKSIZE;
-	uint32_t remain;
 
-	/* Initialize stream */
-	stream[0] = csp_htobe32(iv[0]);
-	stream[1] = csp_htobe32(iv[1]);
+	/* Packets sent before any key is set use the all zero key */
+	if (!csp_xtea_schedule_ready)
+		csp_xtea_gen_schedule();
 
-	for (i = 0; i < blocks; i++) {
-		/* Create stream */
-		csp_xtea_encrypt_block((uint8_t *)stream, (uint8_t *)csp_xtea_key);
+	/* The counter is stored big endian and loaded little endian */
+	uint32_t nonce = csp_letoh32(csp_htobe32(iv[0]));
 
-		/* Calculate remaining bytes */
-		remain = len - i * XTEA_BLOCKSIZE;
+	for (i = 0; i < blocks; i += XTEA_BATCH) {
+		n = (blocks - i < XTEA_BATCH) ? blocks - i : XTEA_BATCH;
 
-		/* XOR plain text with stream to generate cipher text */
-		csp_xtea_xor_byte(&plain[len - remain], (uint8_t *)stream, remain < XTEA_BLOCKSIZE ? remain : XTEA_BLOCKSIZE);
+		/* Create stream. The first two blocks share a counter, as they always have */
+		for (j = 0; j < XTEA_BATCH; j++) {
+			v0[j] = nonce;
+			v1[j] = csp_letoh32(csp_htobe32(iv[1] + (i + j > 0 ? i + j - 1 : 0)));
+		}
+		csp_xtea_encrypt_batch(v0, v1, n);
 
-		/* Increment counter */
-		stream[0] = csp_htobe32(iv[0]);
-		stream[1] = csp_htobe32(iv[1]++);
+		/* XOR plain text with stream to generate cipher text */
+		for (j = 0; j < n; j++) {
+			uint8_t * block = &plain[(i + j) * XTEA_BLOCKSIZE];
+			uint32_t remain = len - (i + j) * XTEA_BLOCKSIZE;
+
+			if (remain >= XTEA_BLOCKSIZE) {
+				memcpy(&word, &block[0], sizeof(word));
+				word ^= csp_htole32(v0[j]);
+				memcpy(&block[0], &word, sizeof(word));
+				memcpy(&word, &block[4], sizeof(word));
+				word ^= csp_htole32(v1[j]);
+				memcpy(&block[4], &word, sizeof(word));
+			} else {
+				STORE32L(v0[j], &stream[0]);
+				STORE32L(v1[j], &stream[4]);
+				while (remain--)
+					block[remain] ^= stream[remain];
+			}
+		}
 	}
 
+	/* Leave the counter where the block by block version did */
+	iv[1] += blocks;
+
 	return CSP_ERR_NONE;
 
 }
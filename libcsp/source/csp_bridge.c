@@ -38,7 +38,7 @@ CSP_DEFINE_TASK(csp_bridge) {
 	while (1) {
 
 		/* Get next packet to route */
-		if (csp_qfifo_read(&input) != CSP_ERR_NONE)
+		if (csp_qfifo_read(0, &input, FIFO_TIMEOUT) != CSP_ERR_NONE)
 			continue;
 
 		packet = input.packet;
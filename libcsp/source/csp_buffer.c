@@ -151,6 +151,9 @@ void *csp_buffer_get(size_t buf_size) {
 
 void csp_buffer_free_isr(void *packet) {
 	CSP_BASE_TYPE task_woken = 0;
+	CSP_BASE_TYPE state = 0;
+	unsigned int refcount;
+
 	if (!packet)
 		return;
 
@@ -162,15 +165,14 @@ void csp_buffer_free_isr(void *packet) {
 	if (buf->skbf_addr != buf)
 		return;
 
-	if (buf->refcount == 0) {
-		return;
-	} else if (buf->refcount > 1) {
+	CSP_ENTER_CRITICAL_ISR(csp_critical_lock, state);
+	refcount = buf->refcount;
+	if (refcount > 0)
 		buf->refcount--;
-		return;
-	} else {
-		buf->refcount = 0;
+	CSP_EXIT_CRITICAL_ISR(csp_critical_lock, state);
+
+	if (refcount == 1)
 		csp_queue_enqueue_isr(csp_buffers, &buf, &task_woken);
-	}
 
 }
 
@@ -192,15 +194,19 @@ void csp_buffer_free(void *packet) {
 		return;
 	}
 
-	if (buf->refcount == 0) {
+	CSP_ENTER_CRITICAL(csp_critical_lock);
+	unsigned int refcount = buf->refcount;
+	if (refcount > 0)
+		buf->refcount--;
+	CSP_EXIT_CRITICAL(csp_critical_lock);
+
+	if (refcount == 0) {
 		csp_log_error("FREE: Buffer already free %p", buf);
 		return;
-	} else if (buf->refcount > 1) {
-		buf->refcount--;
-		csp_log_error("FREE: Buffer %p in use by %u users", buf, buf->refcount);
+	} else if (refcount > 1) {
+		csp_log_buffer("FREE: Buffer %p still in use by %u users", buf, refcount - 1);
 		return;
 	} else {
-		buf->refcount = 0;
 		csp_log_buffer("FREE: %p", buf);
 		csp_queue_enqueue(csp_buffers, &buf, 0);
 	}
@@ -223,6 +229,60 @@ void *csp_buffer_clone(void *buffer) {
 
 }
 
+void *csp_buffer_ref(void *buffer) {
+
+	if (!buffer)
+		return NULL;
+
+	csp_skbf_t * buf = buffer - sizeof(csp_skbf_t);
+
+	if ((((uintptr_t) buf % CSP_BUFFER_ALIGN) > 0) || (buf->skbf_addr != buf)) {
+		csp_log_error("REF: Invalid CSP buffer pointer %p", buffer);
+		return NULL;
+	}
+
+	CSP_ENTER_CRITICAL(csp_critical_lock);
+	unsigned int refcount = buf->refcount;
+	if (refcount > 0)
+		buf->refcount++;
+	CSP_EXIT_CRITICAL(csp_critical_lock);
+
+	if (refcount == 0) {
+		csp_log_error("REF: Buffer is free %p", buf);
+		return NULL;
+	}
+
+	return buffer;
+
+}
+
+int csp_buffer_refcount(void *buffer) {
+
+	if (!buffer)
+		return 0;
+
+	csp_skbf_t * buf = buffer - sizeof(csp_skbf_t);
+
+	if ((((uintptr_t) buf % CSP_BUFFER_ALIGN) > 0) || (buf->skbf_addr != buf))
+		return 0;
+
+	return buf->refcount;
+
+}
+
+void *csp_buffer_unshare(void *buffer) {
+
+	if (csp_buffer_refcount(buffer) <= 1)
+		return buffer;
+
+	void * clone = csp_buffer_clone(buffer);
+	if (clone)
+		csp_buffer_free(buffer);
+
+	return clone;
+
+}
+
 int csp_buffer_remaining(void) {
 	return csp_queue_size(csp_buffers);
 }
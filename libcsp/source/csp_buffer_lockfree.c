@@ -0,0 +1,559 @@
+/*
+Cubesat Space Protocol - A small network-layer protocol designed for Cubesats
+Copyright (C) 2012 GomSpace ApS (http://www.gomspace.com)
+Copyright (C) 2012 AAUSAT3 Project (http://aausat3.space.aau.dk)
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 2.1 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/*
+ * Lock-free buffer pool backend.
+ *
+ * Buffers are split into up to CSP_BUFFER_MAX_CLASSES size classes. Each
+ * class keeps its free buffers on a Treiber stack whose head packs a 32-bit
+ * ABA tag together with the 32-bit index of the first free buffer, so get
+ * and free are a single 64-bit compare-and-swap instead of a trip through
+ * the locked csp_queue used by csp_buffer.c.
+ *
+ * If CSP_BUFFER_MAGAZINE_SIZE is non-zero, every thread additionally keeps a
+ * small private magazine of free buffers per class, which is refilled from
+ * and spilled to the shared stacks. Buffers in a magazine are still counted
+ * as free by csp_buffer_remaining(), and are handed back to the shared
+ * stacks when the owning thread exits.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* CSP includes */
+#include <csp/csp.h>
+#include <csp/csp_error.h>
+#include <csp/arch/csp_malloc.h>
+
+#if (CSP_BUFFER_MAGAZINE_SIZE > 0)
+#ifndef CSP_POSIX
+#error "Per-thread buffer magazines require CSP_POSIX"
+#endif
+#include <pthread.h>
+#endif
+
+#ifndef CSP_BUFFER_ALIGN
+#define CSP_BUFFER_ALIGN	(sizeof(int *))
+#endif
+
+/** Index value marking the end of a free list */
+#define CSP_BUFFER_NIL		UINT32_MAX
+
+typedef struct csp_skbf_s {
+	unsigned int refcount;
+	uint32_t skbf_next;
+	uint32_t skbf_class;
+	void * skbf_addr;
+	char skbf_data[];
+} csp_skbf_t;
+
+#define CSP_SKBF_HEADER		offsetof(csp_skbf_t, skbf_data)
+
+typedef struct {
+	uint64_t head;			/**< (ABA tag << 32) | index of first free buffer */
+	int free;				/**< Free buffers, including those held in magazines */
+	unsigned int count;		/**< Total number of buffers in class */
+	unsigned int size;		/**< Usable size including CSP_BUFFER_PACKET_OVERHEAD, without the trailer room */
+	unsigned int skbfsize;	/**< Aligned size of one pool element */
+	char * pool;
+} csp_buffer_class_t;
+
+static csp_buffer_class_t csp_buffer_classes[CSP_BUFFER_MAX_CLASSES];
+static unsigned int csp_buffer_class_count;
+
+/* Bumped on every (re)initialisation, so stale magazines can be detected */
+static unsigned int csp_buffer_generation;
+
+static inline csp_skbf_t * csp_buffer_at(csp_buffer_class_t * cls, uint32_t index) {
+	return (void *) &cls->pool[index * cls->skbfsize];
+}
+
+static csp_skbf_t * csp_buffer_pop(csp_buffer_class_t * cls) {
+
+	uint64_t head, next;
+	csp_skbf_t * buf;
+
+	head = __atomic_load_n(&cls->head, __ATOMIC_ACQUIRE);
+	do {
+		if ((uint32_t) head == CSP_BUFFER_NIL)
+			return NULL;
+		buf = csp_buffer_at(cls, (uint32_t) head);
+		/* The tag in the upper word protects against ABA if buf is
+		 * popped and pushed back by someone else while we look at it */
+		next = (((head >> 32) + 1) << 32) | __atomic_load_n(&buf->skbf_next, __ATOMIC_RELAXED);
+	} while (!__atomic_compare_exchange_n(&cls->head, &head, next, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	return buf;
+
+}
+
+static void csp_buffer_push(csp_buffer_class_t * cls, csp_skbf_t * buf) {
+
+	uint64_t head, next;
+	uint32_t index = ((char *) buf - cls->pool) / cls->skbfsize;
+
+	head = __atomic_load_n(&cls->head, __ATOMIC_RELAXED);
+	do {
+		__atomic_store_n(&buf->skbf_next, (uint32_t) head, __ATOMIC_RELAXED);
+		next = (((head >> 32) + 1) << 32) | index;
+	} while (!__atomic_compare_exchange_n(&cls->head, &head, next, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+}
+
+#if (CSP_BUFFER_MAGAZINE_SIZE > 0)
+
+typedef struct {
+	unsigned int generation;
+	unsigned int count[CSP_BUFFER_MAX_CLASSES];
+	csp_skbf_t * bufs[CSP_BUFFER_MAX_CLASSES][CSP_BUFFER_MAGAZINE_SIZE];
+} csp_buffer_magazine_t;
+
+static __thread csp_buffer_magazine_t csp_buffer_magazine;
+static pthread_key_t csp_buffer_magazine_key;
+static pthread_once_t csp_buffer_magazine_once = PTHREAD_ONCE_INIT;
+
+/* Called on thread exit: return everything held by the magazine */
+static void csp_buffer_magazine_flush(void * arg) {
+
+	csp_buffer_magazine_t * mag = arg;
+	unsigned int c;
+
+	if (mag->generation != __atomic_load_n(&csp_buffer_generation, __ATOMIC_ACQUIRE))
+		return;
+
+	for (c = 0; c < csp_buffer_class_count; c++) {
+		while (mag->count[c] > 0)
+			csp_buffer_push(&csp_buffer_classes[c], mag->bufs[c][--mag->count[c]]);
+	}
+
+}
+
+static void csp_buffer_magazine_key_create(void) {
+	pthread_key_create(&csp_buffer_magazine_key, csp_buffer_magazine_flush);
+}
+
+static csp_buffer_magazine_t * csp_buffer_magazine_get(void) {
+
+	csp_buffer_magazine_t * mag = &csp_buffer_magazine;
+	unsigned int generation = __atomic_load_n(&csp_buffer_generation, __ATOMIC_ACQUIRE);
+
+	if (mag->generation != generation) {
+		/* First use in this thread, or the pool has been re-initialised */
+		memset(mag->count, 0, sizeof(mag->count));
+		mag->generation = generation;
+		pthread_setspecific(csp_buffer_magazine_key, mag);
+	}
+
+	return mag;
+
+}
+
+#endif
+
+int csp_buffer_init_classes(unsigned int classes, const int * counts, const int * sizes) {
+
+	unsigned int c, i;
+	csp_buffer_class_t * cls;
+	csp_skbf_t * buf;
+
+	if (classes == 0 || classes > CSP_BUFFER_MAX_CLASSES)
+		return CSP_ERR_INVAL;
+
+	for (c = 0; c < classes; c++) {
+		if (counts[c] <= 0 || sizes[c] <= 0)
+			return CSP_ERR_INVAL;
+		if (c > 0 && sizes[c] <= sizes[c - 1])
+			return CSP_ERR_INVAL;
+	}
+
+#if (CSP_BUFFER_MAGAZINE_SIZE > 0)
+	pthread_once(&csp_buffer_magazine_once, csp_buffer_magazine_key_create);
+#endif
+
+	for (c = 0; c < classes; c++) {
+
+		cls = &csp_buffer_classes[c];
+		cls->count = counts[c];
+		cls->size = sizes[c] + CSP_BUFFER_PACKET_OVERHEAD;
+		cls->skbfsize = sizeof(csp_skbf_t) + cls->size + CSP_BUFFER_TRAILER_MAX;
+		cls->skbfsize = CSP_BUFFER_ALIGN * ((cls->skbfsize + CSP_BUFFER_ALIGN - 1) / CSP_BUFFER_ALIGN);
+
+		cls->pool = csp_malloc(cls->count * cls->skbfsize);
+		if (cls->pool == NULL)
+			goto fail_malloc;
+
+		memset(cls->pool, 0, cls->count * cls->skbfsize);
+
+		/* Chain all elements in index order; pushing would work too,
+		 * but nobody else can see the stack yet */
+		for (i = 0; i < cls->count; i++) {
+			buf = csp_buffer_at(cls, i);
+			buf->refcount = 0;
+			buf->skbf_class = c;
+			buf->skbf_addr = buf;
+			buf->skbf_next = (i + 1 < cls->count) ? i + 1 : CSP_BUFFER_NIL;
+		}
+
+		cls->head = 0;
+		cls->free = cls->count;
+
+	}
+
+	csp_buffer_class_count = classes;
+	__atomic_add_fetch(&csp_buffer_generation, 1, __ATOMIC_RELEASE);
+
+	return CSP_ERR_NONE;
+
+fail_malloc:
+	while (c-- > 0)
+		csp_free(csp_buffer_classes[c].pool);
+	return CSP_ERR_NOMEM;
+
+}
+
+int csp_buffer_init(int buf_count, int buf_size) {
+	return csp_buffer_init_classes(1, &buf_count, &buf_size);
+}
+
+void csp_buffer_cleanup(void) {
+
+	unsigned int c;
+
+	__atomic_add_fetch(&csp_buffer_generation, 1, __ATOMIC_RELEASE);
+
+	for (c = 0; c < csp_buffer_class_count; c++) {
+		csp_free(csp_buffer_classes[c].pool);
+		csp_buffer_classes[c].pool = NULL;
+	}
+
+	csp_buffer_class_count = 0;
+
+}
+
+static csp_skbf_t * csp_buffer_take(csp_buffer_class_t * cls, bool use_magazine) {
+
+	csp_skbf_t * buf = NULL;
+
+#if (CSP_BUFFER_MAGAZINE_SIZE > 0)
+	if (use_magazine) {
+		csp_buffer_magazine_t * mag = csp_buffer_magazine_get();
+		unsigned int c = cls - csp_buffer_classes;
+
+		if (mag->count[c] == 0) {
+			/* Refill half a magazine so get/free ping-pong stays local */
+			while (mag->count[c] < (CSP_BUFFER_MAGAZINE_SIZE + 1) / 2) {
+				buf = csp_buffer_pop(cls);
+				if (buf == NULL)
+					break;
+				mag->bufs[c][mag->count[c]++] = buf;
+			}
+		}
+
+		buf = (mag->count[c] > 0) ? mag->bufs[c][--mag->count[c]] : NULL;
+	} else
+#endif
+	{
+		buf = csp_buffer_pop(cls);
+	}
+
+	if (buf != NULL)
+		__atomic_sub_fetch(&cls->free, 1, __ATOMIC_RELAXED);
+
+	return buf;
+
+}
+
+static void csp_buffer_give(csp_buffer_class_t * cls, csp_skbf_t * buf, bool use_magazine) {
+
+	__atomic_add_fetch(&cls->free, 1, __ATOMIC_RELAXED);
+
+#if (CSP_BUFFER_MAGAZINE_SIZE > 0)
+	if (use_magazine) {
+		csp_buffer_magazine_t * mag = csp_buffer_magazine_get();
+		unsigned int c = cls - csp_buffer_classes;
+
+		if (mag->count[c] == CSP_BUFFER_MAGAZINE_SIZE) {
+			/* Spill half the magazine back to the shared stack */
+			while (mag->count[c] > CSP_BUFFER_MAGAZINE_SIZE / 2)
+				csp_buffer_push(cls, mag->bufs[c][--mag->count[c]]);
+		}
+
+		mag->bufs[c][mag->count[c]++] = buf;
+		return;
+	}
+#endif
+
+	csp_buffer_push(cls, buf);
+
+}
+
+/* Find the smallest class with room for buf_size, or -1 if it is too large */
+static int csp_buffer_class_for(size_t buf_size) {
+
+	unsigned int c;
+
+	for (c = 0; c < csp_buffer_class_count; c++) {
+		if (buf_size + CSP_BUFFER_PACKET_OVERHEAD <= csp_buffer_classes[c].size)
+			return c;
+	}
+
+	return -1;
+
+}
+
+static csp_skbf_t * csp_buffer_alloc(size_t buf_size, bool use_magazine) {
+
+	csp_skbf_t * buffer = NULL;
+	int c = csp_buffer_class_for(buf_size);
+
+	if (c < 0)
+		return NULL;
+
+	/* Fall back to a larger class if the best fit is exhausted */
+	for (; c < (int) csp_buffer_class_count && buffer == NULL; c++)
+		buffer = csp_buffer_take(&csp_buffer_classes[c], use_magazine);
+
+	return buffer;
+
+}
+
+void *csp_buffer_get_isr(size_t buf_size) {
+
+	csp_skbf_t * buffer = csp_buffer_alloc(buf_size, false);
+	if (buffer == NULL)
+		return NULL;
+
+	if (buffer != buffer->skbf_addr)
+		return NULL;
+
+	__atomic_add_fetch(&buffer->refcount, 1, __ATOMIC_RELAXED);
+	return buffer->skbf_data;
+
+}
+
+void *csp_buffer_get(size_t buf_size) {
+
+	csp_skbf_t * buffer;
+
+	if (csp_buffer_class_for(buf_size) < 0) {
+		csp_log_error("Attempt to allocate too large block %u", buf_size);
+		return NULL;
+	}
+
+	buffer = csp_buffer_alloc(buf_size, true);
+	if (buffer == NULL) {
+		csp_log_error("Out of buffers");
+		return NULL;
+	}
+
+	csp_log_buffer("GET: %p %p", buffer, buffer->skbf_addr);
+
+	if (buffer != buffer->skbf_addr) {
+		csp_log_error("Corrupt CSP buffer");
+		return NULL;
+	}
+
+	__atomic_add_fetch(&buffer->refcount, 1, __ATOMIC_RELAXED);
+	return buffer->skbf_data;
+
+}
+
+/* Validate a buffer header. Returns the buffer, or NULL if it is not ours. */
+static csp_skbf_t * csp_buffer_header(void * packet) {
+
+	csp_skbf_t * buf = packet - CSP_SKBF_HEADER;
+
+	if (((uintptr_t) buf % CSP_BUFFER_ALIGN) > 0)
+		return NULL;
+
+	if (buf->skbf_addr != buf)
+		return NULL;
+
+	if (buf->skbf_class >= csp_buffer_class_count)
+		return NULL;
+
+	return buf;
+
+}
+
+void csp_buffer_free_isr(void *packet) {
+
+	csp_skbf_t * buf;
+	unsigned int refcount;
+
+	if (!packet)
+		return;
+
+	buf = csp_buffer_header(packet);
+	if (buf == NULL)
+		return;
+
+	refcount = __atomic_load_n(&buf->refcount, __ATOMIC_RELAXED);
+	do {
+		if (refcount == 0)
+			return;
+	} while (!__atomic_compare_exchange_n(&buf->refcount, &refcount, refcount - 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	if (refcount == 1)
+		csp_buffer_give(&csp_buffer_classes[buf->skbf_class], buf, false);
+
+}
+
+void csp_buffer_free(void *packet) {
+
+	csp_skbf_t * buf;
+	unsigned int refcount;
+
+	if (!packet) {
+		csp_log_error("Attempt to free null pointer");
+		return;
+	}
+
+	buf = csp_buffer_header(packet);
+	if (buf == NULL) {
+		csp_log_error("FREE: Invalid CSP buffer pointer %p", packet);
+		return;
+	}
+
+	refcount = __atomic_load_n(&buf->refcount, __ATOMIC_RELAXED);
+	do {
+		if (refcount == 0) {
+			csp_log_error("FREE: Buffer already free %p", buf);
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(&buf->refcount, &refcount, refcount - 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	if (refcount > 1) {
+		csp_log_buffer("FREE: Buffer %p still in use by %u users", buf, refcount - 1);
+		return;
+	}
+
+	csp_log_buffer("FREE: %p", buf);
+	csp_buffer_give(&csp_buffer_classes[buf->skbf_class], buf, true);
+
+}
+
+void *csp_buffer_clone(void *buffer) {
+
+	csp_packet_t *packet = (csp_packet_t *) buffer;
+	csp_skbf_t * src, * dst;
+	unsigned int copy;
+
+	if (!packet)
+		return NULL;
+
+	src = csp_buffer_header(packet);
+	if (src == NULL)
+		return NULL;
+
+	csp_packet_t *clone = csp_buffer_get(packet->length);
+
+	if (clone) {
+		/* The clone may come from a smaller class than the original */
+		dst = csp_buffer_header(clone);
+		copy = csp_buffer_classes[src->skbf_class].size;
+		if (csp_buffer_classes[dst->skbf_class].size < copy)
+			copy = csp_buffer_classes[dst->skbf_class].size;
+		copy += CSP_BUFFER_TRAILER_MAX;
+		memcpy(clone, packet, copy);
+	}
+
+	return clone;
+
+}
+
+void *csp_buffer_ref(void *buffer) {
+
+	csp_skbf_t * buf;
+	unsigned int refcount;
+
+	if (!buffer)
+		return NULL;
+
+	buf = csp_buffer_header(buffer);
+	if (buf == NULL) {
+		csp_log_error("REF: Invalid CSP buffer pointer %p", buffer);
+		return NULL;
+	}
+
+	refcount = __atomic_load_n(&buf->refcount, __ATOMIC_RELAXED);
+	do {
+		if (refcount == 0) {
+			csp_log_error("REF: Buffer is free %p", buf);
+			return NULL;
+		}
+	} while (!__atomic_compare_exchange_n(&buf->refcount, &refcount, refcount + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	return buffer;
+
+}
+
+int csp_buffer_refcount(void *buffer) {
+
+	csp_skbf_t * buf;
+
+	if (!buffer)
+		return 0;
+
+	buf = csp_buffer_header(buffer);
+	if (buf == NULL)
+		return 0;
+
+	return __atomic_load_n(&buf->refcount, __ATOMIC_ACQUIRE);
+
+}
+
+void *csp_buffer_unshare(void *buffer) {
+
+	void * clone;
+
+	if (csp_buffer_refcount(buffer) <= 1)
+		return buffer;
+
+	clone = csp_buffer_clone(buffer);
+	if (clone)
+		csp_buffer_free(buffer);
+
+	return clone;
+
+}
+
+int csp_buffer_remaining(void) {
+
+	unsigned int c;
+	int remaining = 0;
+
+	for (c = 0; c < csp_buffer_class_count; c++)
+		remaining += __atomic_load_n(&csp_buffer_classes[c].free, __ATOMIC_RELAXED);
+
+	return remaining;
+
+}
+
+int csp_buffer_size(void) {
+
+	if (csp_buffer_class_count == 0)
+		return 0;
+
+	return csp_buffer_classes[csp_buffer_class_count - 1].size;
+
+}
@@ -34,11 +34,41 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/arch/csp_time.h>
 
 #include "csp_conn.h"
+#include "csp_qfifo.h"
 #include "transport/csp_transport.h"
 
 /* Static connection pool */
 static csp_conn_t arr_conn[CSP_CONN_MAX];
 
+/* Number of hash buckets for client connection lookup */
+#if CSP_CONN_MAX <= 16
+#define CSP_CONN_HASH_SIZE 16
+#elif CSP_CONN_MAX <= 64
+#define CSP_CONN_HASH_SIZE 64
+#elif CSP_CONN_MAX <= 256
+#define CSP_CONN_HASH_SIZE 256
+#else
+#define CSP_CONN_HASH_SIZE 1024
+#endif
+
+/* Client connections hashed on idin & CSP_ID_CONN_MASK. Buckets are chained
+ * through csp_conn_t.hash_next and modified with conn_lock held, while the
+ * router reads them without locking, just as it used to scan arr_conn. */
+static int16_t conn_hash[CSP_CONN_HASH_SIZE];
+
+/* Odd while a chain is being changed and bumped again after, so a lookup
+ * can tell if its walk may have been led onto another chain */
+static uint32_t conn_hash_seq;
+
+/* Lookups which miss while chains change retry this often before scanning */
+#define CSP_CONN_HASH_RETRIES 3
+
+#ifdef CSP_USE_RDP
+/* Open RDP connections, so timeouts need not scan the whole pool */
+static csp_conn_t * conn_rdp[CSP_CONN_MAX];
+static int conn_rdp_count;
+#endif
+
 /* Connection pool lock */
 static csp_bin_sem_handle_t conn_lock;
 
@@ -48,13 +78,96 @@ static uint8_t sport;
 /* Source port lock */
 static csp_bin_sem_handle_t sport_lock;
 
-void csp_conn_check_timeouts(void) {
+static inline unsigned int csp_conn_hash(uint32_t id) {
+	return ((id & CSP_ID_CONN_MASK) * 2654435761u >> 16) & (CSP_CONN_HASH_SIZE - 1);
+}
+
+/* Must be called with conn_lock held */
+static inline void csp_conn_hash_write_begin(void) {
+
+	__atomic_store_n(&conn_hash_seq, conn_hash_seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+}
+
+/* Must be called with conn_lock held */
+static inline void csp_conn_hash_write_end(void) {
+
+	__atomic_store_n(&conn_hash_seq, conn_hash_seq + 1, __ATOMIC_RELEASE);
+
+}
+
+/* Must be called with conn_lock held */
+static void csp_conn_hash_insert(csp_conn_t * conn) {
+
+	unsigned int bucket = csp_conn_hash(conn->idin.ext);
+
+	csp_conn_hash_write_begin();
+	__atomic_store_n(&conn->hash_next, conn_hash[bucket], __ATOMIC_RELAXED);
+	__atomic_store_n(&conn_hash[bucket], (int16_t) (conn - arr_conn), __ATOMIC_RELEASE);
+	csp_conn_hash_write_end();
+
+}
+
+/* Must be called with conn_lock held */
+static void csp_conn_hash_remove(csp_conn_t * conn) {
+
+	int16_t * link = &conn_hash[csp_conn_hash(conn->idin.ext)];
+	int16_t index = conn - arr_conn;
+
+	csp_conn_hash_write_begin();
+	while (*link >= 0) {
+		if (*link == index) {
+			__atomic_store_n(link, conn->hash_next, __ATOMIC_RELEASE);
+			break;
+		}
+		link = &arr_conn[*link].hash_next;
+	}
+	csp_conn_hash_write_end();
+
+}
+
 #ifdef CSP_USE_RDP
-	int i;
-	for (i = 0; i < CSP_CONN_MAX; i++)
-		if (arr_conn[i].state == CONN_OPEN)
-			if (arr_conn[i].idin.flags & CSP_FRDP)
-				csp_rdp_check_timeouts(&arr_conn[i]);
+/* Must be called with conn_lock held */
+static void csp_conn_rdp_insert(csp_conn_t * conn) {
+
+	conn->rdp_slot = conn_rdp_count;
+	conn_rdp[conn_rdp_count++] = conn;
+
+}
+
+/* Must be called with conn_lock held */
+static void csp_conn_rdp_remove(csp_conn_t * conn) {
+
+	if (conn->rdp_slot < 0)
+		return;
+
+	/* Move the last entry into the hole */
+	conn_rdp[conn->rdp_slot] = conn_rdp[--conn_rdp_count];
+	conn_rdp[conn->rdp_slot]->rdp_slot = conn->rdp_slot;
+	conn->rdp_slot = -1;
+
+}
+#endif
+
+void csp_conn_check_timeouts(unsigned int worker) {
+#ifdef CSP_USE_RDP
+	int i, count;
+	csp_conn_t * active[CSP_CONN_MAX];
+
+	/* Take a snapshot, since checking timeouts may close connections */
+	if (csp_bin_sem_wait(&conn_lock, 100) != CSP_SEMAPHORE_OK)
+		return;
+	count = conn_rdp_count;
+	memcpy(active, conn_rdp, count * sizeof(active[0]));
+	csp_bin_sem_post(&conn_lock);
+
+	/* Only look at connections whose packets this router worker handles */
+	for (i = 0; i < count; i++)
+		if (active[i]->state == CONN_OPEN)
+			if (active[i]->idin.flags & CSP_FRDP)
+				if (csp_qfifo_shard(active[i]->idin.ext) == worker)
+					csp_rdp_check_timeouts(active[i]);
 #endif
 }
 
@@ -156,6 +269,10 @@ int csp_conn_init(void) {
 		arr_conn[i].rx_event = csp_queue_create(CSP_CONN_QUEUE_LENGTH, sizeof(int));
 #endif
 		arr_conn[i].state = CONN_CLOSED;
+		arr_conn[i].hash_next = -1;
+#ifdef CSP_USE_RDP
+		arr_conn[i].rdp_slot = -1;
+#endif
 
 		if (csp_mutex_create(&arr_conn[i].lock) != CSP_MUTEX_OK) {
 			csp_log_error("Failed to create connection lock");
@@ -170,6 +287,13 @@ int csp_conn_init(void) {
 #endif
 	}
 
+	for (i = 0; i < CSP_CONN_HASH_SIZE; i++)
+		conn_hash[i] = -1;
+
+#ifdef CSP_USE_RDP
+	conn_rdp_count = 0;
+#endif
+
 	if (csp_bin_sem_create(&conn_lock) != CSP_SEMAPHORE_OK) {
 		csp_log_error("No more memory for conn semaphore");
 		return CSP_ERR_NOMEM;
@@ -203,9 +327,33 @@ void csp_conn_terminate(void) {
 csp_conn_t * csp_conn_find(uint32_t id, uint32_t mask) {
 
 	/* Search for matching connection */
-	int i;
+	int i, index, retry;
+	uint32_t seq;
 	csp_conn_t * conn;
 
+	/* Full connection lookups, as done for every routed packet, use the hash.
+	 * A hit is always valid, but a miss only counts if no chain changed during
+	 * the walk: a connection closed and reused meanwhile may have led it onto
+	 * another chain. The walk is bounded for the same reason. */
+	if (mask == CSP_ID_CONN_MASK) {
+		for (retry = 0; retry < CSP_CONN_HASH_RETRIES; retry++) {
+			seq = __atomic_load_n(&conn_hash_seq, __ATOMIC_ACQUIRE);
+			if (seq & 1)
+				continue;
+			index = __atomic_load_n(&conn_hash[csp_conn_hash(id)], __ATOMIC_ACQUIRE);
+			for (i = 0; index >= 0 && i < CSP_CONN_MAX; i++) {
+				conn = &arr_conn[index];
+				if ((conn->state != CONN_CLOSED) && (conn->type == CONN_CLIENT) && (conn->idin.ext & mask) == (id & mask))
+					return conn;
+				index = __atomic_load_n(&conn->hash_next, __ATOMIC_ACQUIRE);
+			}
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&conn_hash_seq, __ATOMIC_RELAXED) == seq)
+				return NULL;
+		}
+		/* The chains kept changing, scan the pool instead */
+	}
+
 	for (i = 0; i < CSP_CONN_MAX; i++) {
 		conn = &arr_conn[i];
 		if ((conn->state != CONN_CLOSED) && (conn->type == CONN_CLIENT) && (conn->idin.ext & mask) == (id & mask))
@@ -291,6 +439,19 @@ csp_conn_t * csp_conn_new(csp_id_t idin, csp_id_t idout) {
 
 		/* Ensure connection queue is empty */
 		csp_conn_flush_rx_queue(conn);
+
+		/* Make the connection visible to csp_conn_find */
+		if (csp_bin_sem_wait(&conn_lock, 100) != CSP_SEMAPHORE_OK) {
+			csp_log_error("Failed to lock conn array");
+			conn->state = CONN_CLOSED;
+			return NULL;
+		}
+		csp_conn_hash_insert(conn);
+#ifdef CSP_USE_RDP
+		if (idin.flags & CSP_FRDP)
+			csp_conn_rdp_insert(conn);
+#endif
+		csp_bin_sem_post(&conn_lock);
 	}
 
 	return conn;
@@ -325,6 +486,12 @@ int csp_close(csp_conn_t * conn) {
 	/* Set to closed */
 	conn->state = CONN_CLOSED;
 
+	if (conn->type == CONN_CLIENT)
+		csp_conn_hash_remove(conn);
+#ifdef CSP_USE_RDP
+	csp_conn_rdp_remove(conn);
+#endif
+
 	/* Ensure connection queue is empty */
 	csp_conn_flush_rx_queue(conn);
 
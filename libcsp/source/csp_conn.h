@@ -52,6 +52,33 @@ typedef enum {
 	RDP_CLOSE_WAIT,
 } csp_rdp_state_t;
 
+/* Slots in an RDP window. Must hold twice the max window, since the receiver
+ * accepts sequence numbers up to two windows ahead, and must be a power of two
+ * so slots stay in order when sequence numbers wrap. */
+#if (CSP_RDP_MAX_WINDOW * 2) <= 16
+#define CSP_RDP_WINDOW_SLOTS 16
+#elif (CSP_RDP_MAX_WINDOW * 2) <= 32
+#define CSP_RDP_WINDOW_SLOTS 32
+#elif (CSP_RDP_MAX_WINDOW * 2) <= 64
+#define CSP_RDP_WINDOW_SLOTS 64
+#elif (CSP_RDP_MAX_WINDOW * 2) <= 128
+#define CSP_RDP_WINDOW_SLOTS 128
+#elif (CSP_RDP_MAX_WINDOW * 2) <= 256
+#define CSP_RDP_WINDOW_SLOTS 256
+#else
+#error "CSP_RDP_MAX_WINDOW must be at most 128"
+#endif
+
+#define CSP_RDP_WINDOW_WORDS (CSP_RDP_WINDOW_SLOTS / 32)
+
+/** @brief RDP window of packets, indexed by sequence number */
+typedef struct {
+	csp_packet_t * slots[CSP_RDP_WINDOW_SLOTS];	/**< Packet of each sequence number, modulo the number of slots */
+	uint32_t used[CSP_RDP_WINDOW_WORDS];		/**< Bitmap of slots holding a packet */
+	uint32_t resent[CSP_RDP_WINDOW_WORDS];		/**< Bitmap of slots whose packet was retransmitted */
+	uint16_t count;								/**< Number of slots holding a packet */
+} csp_rdp_window_t;
+
 /** @brief RDP Connection header
  *  @note Do not try to pack this struct, the posix sem handle will stop working */
 typedef struct {
@@ -69,9 +96,12 @@ typedef struct {
 	uint32_t ack_timeout;
 	uint32_t ack_delay_count;
 	uint32_t ack_timestamp;
+	uint32_t srtt;						/**< Smoothed round trip time (ms), times 8 */
+	uint32_t rttvar;					/**< Round trip time variation (ms), times 4 */
+	uint32_t rto;						/**< Retransmission timeout (ms), at most packet_timeout */
 	csp_bin_sem_handle_t tx_wait;
-	csp_queue_handle_t tx_queue;
-	csp_queue_handle_t rx_queue;
+	csp_rdp_window_t tx_window;			/**< Unacknowledged sent packets */
+	csp_rdp_window_t rx_window;			/**< Packets received out of sequence */
 } csp_rdp_t;
 
 /** @brief Connection struct */
@@ -90,7 +120,9 @@ struct csp_conn_s {
 	uint32_t opts;					/* Connection or socket options */
 #ifdef CSP_USE_RDP
 	csp_rdp_t rdp;					/* RDP state */
+	int16_t rdp_slot;				/* Position in active RDP list, or -1 */
 #endif
+	int16_t hash_next;				/* Next connection in hash bucket, or -1 */
 };
 
 int csp_conn_lock(csp_conn_t * conn, uint32_t timeout);
@@ -101,7 +133,7 @@ void csp_conn_terminate(void);
 csp_conn_t * csp_conn_allocate(csp_conn_type_t type);
 csp_conn_t * csp_conn_find(uint32_t id, uint32_t mask);
 csp_conn_t * csp_conn_new(csp_id_t idin, csp_id_t idout);
-void csp_conn_check_timeouts(void);
+void csp_conn_check_timeouts(unsigned int worker);
 int csp_conn_get_rxq(int prio);
 
 #ifdef __cplusplus
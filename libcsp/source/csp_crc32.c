@@ -24,6 +24,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <csp/csp.h>
 #include <csp/csp_endian.h>
+#include <csp/csp_crc32.h>
 
 #ifdef CSP_USE_CRC32
 
@@ -66,18 +67,206 @@ static const uint32_t crc_tab[256] = {
 		0xF36E6F75, 0x0105EC76, 0x12551F82, 0xE03E9C81, 0x34F4F86A, 0xC69F7B69, 0xD5CF889D, 0x27A40B9E,
 		0x79B737BA, 0x8BDCB4B9, 0x988C474D, 0x6AE7C44E, 0xBE2DA0A5, 0x4C4623A6, 0x5F16D052, 0xAD7D5351 };
 
-uint32_t csp_crc32_memory(const uint8_t * data, uint32_t length) {
-   uint32_t crc;
+/* Slicing-by-8 needs 7 KiB of extra tables, which small targets cannot spare */
+#if !defined(__AVR__) && !defined(CSP_FREERTOS)
+#define CSP_CRC32_SLICE8
+#endif
 
-   crc = 0xFFFFFFFF;
-   while (length--)
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CSP_CRC32_SSE42
+#include <nmmintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__linux__) && defined(__GNUC__)
+#define CSP_CRC32_ARMV8
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+typedef uint32_t (*csp_crc32_kernel_fnc_t)(uint32_t crc, const uint8_t * data, uint32_t length);
+
+static uint32_t csp_crc32_byte(uint32_t crc, const uint8_t * data, uint32_t length) {
+
+	while (length--)
 #ifdef __AVR__
-	   crc = pgm_read_dword(&crc_tab[(crc ^ *data++) & 0xFFL]) ^ (crc >> 8);
+		crc = pgm_read_dword(&crc_tab[(crc ^ *data++) & 0xFFL]) ^ (crc >> 8);
 #else
-	   crc = crc_tab[(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
+		crc = crc_tab[(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
 #endif
 
-   return (crc ^ 0xFFFFFFFF);
+	return crc;
+
+}
+
+#ifdef CSP_CRC32_SLICE8
+
+/* crc_slice_tab[k - 1] advances the CRC of a byte by k further zero bytes */
+static uint32_t crc_slice_tab[7][256];
+static bool crc_slice_tab_ready = false;
+
+static void csp_crc32_slice8_gentab(void) {
+
+	unsigned int i, k;
+
+	if (crc_slice_tab_ready)
+		return;
+
+	for (i = 0; i < 256; i++) {
+		uint32_t crc = crc_tab[i];
+		for (k = 0; k < 7; k++) {
+			crc = crc_tab[crc & 0xFF] ^ (crc >> 8);
+			crc_slice_tab[k][i] = crc;
+		}
+	}
+
+	crc_slice_tab_ready = true;
+
+}
+
+static uint32_t csp_crc32_slice8(uint32_t crc, const uint8_t * data, uint32_t length) {
+
+	uint32_t lo, hi;
+
+	while (length >= 8) {
+		lo = crc ^ ((uint32_t) data[0] | (uint32_t) data[1] << 8 | (uint32_t) data[2] << 16 | (uint32_t) data[3] << 24);
+		hi = ((uint32_t) data[4] | (uint32_t) data[5] << 8 | (uint32_t) data[6] << 16 | (uint32_t) data[7] << 24);
+		crc = crc_slice_tab[6][lo & 0xFF] ^
+			  crc_slice_tab[5][(lo >> 8) & 0xFF] ^
+			  crc_slice_tab[4][(lo >> 16) & 0xFF] ^
+			  crc_slice_tab[3][lo >> 24] ^
+			  crc_slice_tab[2][hi & 0xFF] ^
+			  crc_slice_tab[1][(hi >> 8) & 0xFF] ^
+			  crc_slice_tab[0][(hi >> 16) & 0xFF] ^
+			  crc_tab[hi >> 24];
+		data += 8;
+		length -= 8;
+	}
+
+	return csp_crc32_byte(crc, data, length);
+
+}
+
+#endif // CSP_CRC32_SLICE8
+
+#ifdef CSP_CRC32_SSE42
+
+/* The SSE4.2 crc32 instruction implements exactly the Castagnoli polynomial */
+__attribute__((target("sse4.2")))
+static uint32_t csp_crc32_sse42(uint32_t crc, const uint8_t * data, uint32_t length) {
+
+#ifdef __x86_64__
+	uint64_t crc64 = crc, word64;
+	while (length >= 8) {
+		memcpy(&word64, data, sizeof(word64));
+		crc64 = _mm_crc32_u64(crc64, word64);
+		data += 8;
+		length -= 8;
+	}
+	crc = (uint32_t) crc64;
+#endif
+
+	uint32_t word;
+	while (length >= 4) {
+		memcpy(&word, data, sizeof(word));
+		crc = _mm_crc32_u32(crc, word);
+		data += 4;
+		length -= 4;
+	}
+
+	while (length--)
+		crc = _mm_crc32_u8(crc, *data++);
+
+	return crc;
+
+}
+
+#endif // CSP_CRC32_SSE42
+
+#ifdef CSP_CRC32_ARMV8
+
+__attribute__((target("+crc")))
+static uint32_t csp_crc32_armv8(uint32_t crc, const uint8_t * data, uint32_t length) {
+
+	uint64_t word64;
+	while (length >= 8) {
+		memcpy(&word64, data, sizeof(word64));
+		crc = __crc32cd(crc, word64);
+		data += 8;
+		length -= 8;
+	}
+
+	while (length--)
+		crc = __crc32cb(crc, *data++);
+
+	return crc;
+
+}
+
+#endif // CSP_CRC32_ARMV8
+
+static csp_crc32_kernel_t csp_crc32_kernel = CSP_CRC32_KERNEL_BYTE;
+static csp_crc32_kernel_fnc_t csp_crc32_kernel_fnc = csp_crc32_byte;
+
+int csp_crc32_set_kernel(csp_crc32_kernel_t kernel) {
+
+	switch (kernel) {
+	case CSP_CRC32_KERNEL_AUTO:
+#if defined(CSP_CRC32_SSE42)
+		if (csp_crc32_set_kernel(CSP_CRC32_KERNEL_SSE42) == CSP_ERR_NONE)
+			return CSP_ERR_NONE;
+#elif defined(CSP_CRC32_ARMV8)
+		if (csp_crc32_set_kernel(CSP_CRC32_KERNEL_ARMV8) == CSP_ERR_NONE)
+			return CSP_ERR_NONE;
+#endif
+#ifdef CSP_CRC32_SLICE8
+		return csp_crc32_set_kernel(CSP_CRC32_KERNEL_SLICE8);
+#else
+		return csp_crc32_set_kernel(CSP_CRC32_KERNEL_BYTE);
+#endif
+	case CSP_CRC32_KERNEL_BYTE:
+		csp_crc32_kernel_fnc = csp_crc32_byte;
+		break;
+#ifdef CSP_CRC32_SLICE8
+	case CSP_CRC32_KERNEL_SLICE8:
+		csp_crc32_slice8_gentab();
+		csp_crc32_kernel_fnc = csp_crc32_slice8;
+		break;
+#endif
+#ifdef CSP_CRC32_SSE42
+	case CSP_CRC32_KERNEL_SSE42:
+		__builtin_cpu_init();
+		if (!__builtin_cpu_supports("sse4.2"))
+			return CSP_ERR_NOTSUP;
+		csp_crc32_kernel_fnc = csp_crc32_sse42;
+		break;
+#endif
+#ifdef CSP_CRC32_ARMV8
+	case CSP_CRC32_KERNEL_ARMV8:
+		if (!(getauxval(AT_HWCAP) & HWCAP_CRC32))
+			return CSP_ERR_NOTSUP;
+		csp_crc32_kernel_fnc = csp_crc32_armv8;
+		break;
+#endif
+	default:
+		return CSP_ERR_NOTSUP;
+	}
+
+	csp_crc32_kernel = kernel;
+	return CSP_ERR_NONE;
+
+}
+
+csp_crc32_kernel_t csp_crc32_get_kernel(void) {
+	return csp_crc32_kernel;
+}
+
+void csp_crc32_gentab(void) {
+	csp_crc32_set_kernel(CSP_CRC32_KERNEL_AUTO);
+}
+
+uint32_t csp_crc32_memory(const uint8_t * data, uint32_t length) {
+	return csp_crc32_kernel_fnc(0xFFFFFFFF, data, length) ^ 0xFFFFFFFF;
 }
 
 int csp_crc32_append(csp_packet_t * packet, bool include_header) {
@@ -27,38 +27,97 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/arch/csp_time.h>
 #include <csp/csp_crc32.h>
 
-#define CSP_DEDUP_COUNT	16
-#define CSP_DEDUP_WINDOW_MS 1000
+#include "csp_dedup.h"
+#include "csp_qfifo.h"
 
-/* Store packet CRC's in a ringbuffer */
-static uint32_t csp_dedup_array[CSP_DEDUP_COUNT] = {};
-static uint32_t csp_dedup_timestamp[CSP_DEDUP_COUNT] = {};
-static int csp_dedup_in = 0;
+#if (CSP_DEDUP_CAPACITY & (CSP_DEDUP_CAPACITY - 1)) != 0
+#error "CSP_DEDUP_CAPACITY must be a power of two"
+#endif
+
+/* Number of slots probed from the home slot of a CRC. This bounds the cost
+ * of a lookup, and the oldest entry in the probe range is evicted when all
+ * of them are still inside the window. */
+#define CSP_DEDUP_PROBES	8
+
+#define CSP_DEDUP_MASK		(CSP_DEDUP_CAPACITY - 1)
+
+typedef struct {
+	uint32_t crc;
+	uint32_t timestamp;
+	uint8_t used;
+} csp_dedup_entry_t;
+
+/* Open addressed hash set of recently seen packet CRC's. Duplicates carry
+ * the same identifier and thereby reach the same router worker, so each
+ * worker has a table of its own and no locking is needed. */
+static csp_dedup_entry_t csp_dedup_table[CSP_ROUTE_WORKERS_MAX][CSP_DEDUP_CAPACITY] = {};
+static uint32_t csp_dedup_window = CSP_DEDUP_WINDOW_MS;
+static csp_dedup_stats_t csp_dedup_stats = {};
+
+static inline bool csp_dedup_live(const csp_dedup_entry_t * entry, uint32_t now) {
+	return entry->used && (uint32_t) (now - entry->timestamp) < csp_dedup_window;
+}
 
 int csp_dedup_check(csp_packet_t * packet) {
 
+	csp_dedup_entry_t * table, * entry, * free_entry = NULL, * oldest = NULL;
+	unsigned int i, slot;
+
 	/* Calculate CRC32 for packet */
 	uint32_t crc = csp_crc32_memory((const uint8_t *) &packet->id, packet->length + sizeof(packet->id));
+	uint32_t now = csp_get_ms();
 
-	//csp_log_packet("CRC %x", crc);
+	table = csp_dedup_table[csp_qfifo_shard(packet->id.ext)];
+	slot = (crc ^ (crc >> 16)) & CSP_DEDUP_MASK;
 
-	/* Check if we have received this packet before,
-	 * Use a bit obscure but fast method of looping backwards in the array with overflow using two's compliment method */
-	for (int i = 0; i < CSP_DEDUP_COUNT; i++) {
+	/* Check if we have received this packet before */
+	for (i = 0; i < CSP_DEDUP_PROBES && i < CSP_DEDUP_CAPACITY; i++) {
 
-		/* Check for match */
-		if (crc == csp_dedup_array[i]) {
+		entry = &table[(slot + i) & CSP_DEDUP_MASK];
 
-			/* Check the timestamp */
-			if (csp_get_ms() < csp_dedup_timestamp[i] + CSP_DEDUP_WINDOW_MS)
-				return 1;
+		if (!csp_dedup_live(entry, now)) {
+			/* Never used or expired, can be reused */
+			if (free_entry == NULL)
+				free_entry = entry;
+			continue;
+		}
+
+		/* Check for match */
+		if (entry->crc == crc) {
+			csp_dedup_stats.hits++;
+			return 1;
 		}
+
+		if (oldest == NULL || (uint32_t) (now - entry->timestamp) > (uint32_t) (now - oldest->timestamp))
+			oldest = entry;
+
 	}
 
-	/* If not, insert CRC into memory */
-	csp_dedup_array[csp_dedup_in] = crc;
-	csp_dedup_timestamp[csp_dedup_in] = csp_get_ms();
-	csp_dedup_in = (csp_dedup_in + 1) % CSP_DEDUP_COUNT;
+	/* If not, insert CRC into memory, pushing out the oldest entry
+	 * in range if everything is still inside the window */
+	if (free_entry == NULL) {
+		free_entry = oldest;
+		csp_dedup_stats.evictions++;
+	}
+
+	free_entry->crc = crc;
+	free_entry->timestamp = now;
+	free_entry->used = 1;
+	csp_dedup_stats.misses++;
 
 	return 0;
 }
+
+void csp_dedup_set_window(uint32_t window_ms) {
+	csp_dedup_window = window_ms;
+}
+
+void csp_dedup_get_stats(csp_dedup_stats_t * stats) {
+	*stats = csp_dedup_stats;
+}
+
+void csp_dedup_print_stats(void) {
+	printf("Dedup: %"PRIu32" duplicates, %"PRIu32" unique, %"PRIu32" evicted (capacity %u, window %"PRIu32" ms)\r\n",
+			csp_dedup_stats.hits, csp_dedup_stats.misses, csp_dedup_stats.evictions,
+			CSP_DEDUP_CAPACITY, csp_dedup_window);
+}
@@ -38,6 +38,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/arch/csp_malloc.h>
 
 #include "crypto/csp_hmac.h"
+#include "crypto/csp_sha1.h"
 #include "crypto/csp_xtea.h"
 
 #include "csp_io.h"
@@ -119,6 +120,20 @@ int csp_init(unsigned char address) {
 	if (ret != CSP_ERR_NONE)
 		return ret;
 
+#ifdef CSP_USE_CRC32
+	/* Pick the fastest CRC32 implementation for this CPU */
+	csp_crc32_gentab();
+#endif
+
+#if defined(CSP_USE_HMAC) || defined(CSP_USE_XTEA)
+	/* Pick the fastest SHA1 implementation for this CPU */
+	csp_sha1_set_kernel(CSP_SHA1_KERNEL_AUTO);
+#endif
+
+#ifdef CSP_USE_HMAC
+	csp_hmac_init_key();
+#endif
+
 	/* Loopback */
 	csp_iflist_add(&csp_if_lo);
 
@@ -18,79 +18,153 @@ License along with this library; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
+#include <string.h>
+
 #include <csp/csp.h>
 #include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_semaphore.h>
 #include "csp_qfifo.h"
 
-static csp_queue_handle_t qfifo[CSP_ROUTE_FIFOS];
 #ifdef CSP_USE_QOS
-static csp_queue_handle_t qfifo_events;
+/* All priority levels of a worker sit behind one lock and one wait point.
+ * A bit is set in pending for every level holding packets, so the router
+ * takes the highest priority packet in a single operation. Each worker has
+ * its own lock, so workers and the writers feeding them don't contend. */
+typedef struct {
+	csp_qfifo_t ring[CSP_ROUTE_FIFOS][CSP_FIFO_INPUT];
+	uint16_t head[CSP_ROUTE_FIFOS];
+	uint16_t count[CSP_ROUTE_FIFOS];
+	uint8_t pending;
+	uint8_t created;
+	csp_bin_sem_handle_t lock;	/* Unused where critical sections need no lock object */
+	csp_bin_sem_handle_t signal;
+} csp_qfifo_levels_t;
+
+static csp_qfifo_levels_t qfifo[CSP_ROUTE_WORKERS_MAX];
+#else
+/* One router fifo per worker */
+static csp_queue_handle_t qfifo[CSP_ROUTE_WORKERS_MAX];
 #endif
 
-int csp_qfifo_init(void) {
-	int prio;
+/* Number of workers packets are currently spread over */
+static unsigned int qfifo_workers = 1;
 
-	/* Create router fifos for each priority */
-	for (prio = 0; prio < CSP_ROUTE_FIFOS; prio++) {
-		if (qfifo[prio] == NULL) {
-			qfifo[prio] = csp_queue_create(CSP_FIFO_INPUT, sizeof(csp_qfifo_t));
-			if (!qfifo[prio])
-				return CSP_ERR_NOMEM;
-		}
-	}
+static int csp_qfifo_create(unsigned int worker) {
 
 #ifdef CSP_USE_QOS
-	/* Create QoS fifo notification queue */
-	qfifo_events = csp_queue_create(CSP_FIFO_INPUT, sizeof(int));
-	if (!qfifo_events)
+	csp_qfifo_levels_t * levels = &qfifo[worker];
+
+	if (levels->created)
+		return CSP_ERR_NONE;
+
+	if (CSP_INIT_CRITICAL(levels->lock) != CSP_ERR_NONE)
+		return CSP_ERR_NOMEM;
+
+	/* The wait point starts out empty */
+	if (csp_bin_sem_create(&levels->signal) != CSP_SEMAPHORE_OK)
 		return CSP_ERR_NOMEM;
+	csp_bin_sem_wait(&levels->signal, 0);
+
+	memset(levels->head, 0, sizeof(levels->head));
+	memset(levels->count, 0, sizeof(levels->count));
+	levels->pending = 0;
+	levels->created = 1;
+#else
+	/* Create router fifo */
+	if (qfifo[worker] == NULL) {
+		qfifo[worker] = csp_queue_create(CSP_FIFO_INPUT, sizeof(csp_qfifo_t));
+		if (!qfifo[worker])
+			return CSP_ERR_NOMEM;
+	}
 #endif
 
 	return CSP_ERR_NONE;
 
 }
 
-void csp_qfifo_terminate(void) {
-    int prio;
+int csp_qfifo_init(void) {
 
-	/* Remove router fifos for each priority */
-	for (prio = 0; prio < CSP_ROUTE_FIFOS; prio++) {
-		if (qfifo[prio] != NULL) {
-			csp_queue_remove(qfifo[prio]);
-		}
+	qfifo_workers = 1;
+
+	return csp_qfifo_create(0);
+
+}
+
+int csp_qfifo_set_workers(unsigned int workers) {
+
+	unsigned int worker;
+
+	if (workers < 1 || workers > CSP_ROUTE_WORKERS_MAX)
+		return CSP_ERR_INVAL;
+
+	for (worker = 0; worker < workers; worker++) {
+		if (csp_qfifo_create(worker) != CSP_ERR_NONE)
+			return CSP_ERR_NOMEM;
 	}
 
+	qfifo_workers = workers;
+
+	return CSP_ERR_NONE;
+
+}
+
+unsigned int csp_qfifo_shard(uint32_t id) {
+
+	if (qfifo_workers == 1)
+		return 0;
+
+	return ((id & CSP_ID_CONN_MASK) * 2654435761u >> 16) % qfifo_workers;
+
+}
+
+void csp_qfifo_terminate(void) {
+	unsigned int worker;
+
+	for (worker = 0; worker < CSP_ROUTE_WORKERS_MAX; worker++) {
 #ifdef CSP_USE_QOS
-	/* Remove QoS fifo notification queue */
-	csp_queue_remove(qfifo_events);
+		/* Remove wait point, packets still queued are dropped with it */
+		if (qfifo[worker].created) {
+			csp_bin_sem_remove(&qfifo[worker].signal);
+			qfifo[worker].created = 0;
+		}
+#else
+		/* Remove router fifo */
+		if (qfifo[worker] != NULL) {
+			csp_queue_remove(qfifo[worker]);
+			qfifo[worker] = NULL;
+		}
 #endif
+	}
 
 }
 
-int csp_qfifo_read(csp_qfifo_t * input) {
+int csp_qfifo_read(unsigned int worker, csp_qfifo_t * input, uint32_t timeout) {
 
 #ifdef CSP_USE_QOS
-	int prio, found, event;
-
-	/* Wait for packet in any queue */
-	if (csp_queue_dequeue(qfifo_events, &event, FIFO_TIMEOUT) != CSP_QUEUE_OK)
-		return CSP_ERR_TIMEDOUT;
+	csp_qfifo_levels_t * levels = &qfifo[worker];
+	int prio;
 
-	/* Find packet with highest priority */
-	found = 0;
-	for (prio = 0; prio < CSP_ROUTE_FIFOS; prio++) {
-		if (csp_queue_dequeue(qfifo[prio], input, 0) == CSP_QUEUE_OK) {
-			found = 1;
+	while (1) {
+		CSP_ENTER_CRITICAL(levels->lock);
+		if (levels->pending) {
+			/* Lowest set bit is the highest priority */
+			prio = __builtin_ctz(levels->pending);
+			*input = levels->ring[prio][levels->head[prio]];
+			levels->head[prio] = (levels->head[prio] + 1) % CSP_FIFO_INPUT;
+			if (--levels->count[prio] == 0)
+				levels->pending &= ~(1 << prio);
+			CSP_EXIT_CRITICAL(levels->lock);
 			break;
 		}
-	}
+		CSP_EXIT_CRITICAL(levels->lock);
 
-	if (!found) {
-		csp_log_warn("Spurious wakeup: No packet found");
-		return CSP_ERR_TIMEDOUT;
+		/* Wait for a packet in any level. A signal may be left over from
+		 * a packet that was taken in the previous round, so look again. */
+		if (csp_bin_sem_wait(&levels->signal, timeout) != CSP_SEMAPHORE_OK)
+			return CSP_ERR_TIMEDOUT;
 	}
 #else
-	if (csp_queue_dequeue(qfifo[0], input, FIFO_TIMEOUT) != CSP_QUEUE_OK)
+	if (csp_queue_dequeue(qfifo[worker], input, timeout) != CSP_QUEUE_OK)
 		return CSP_ERR_TIMEDOUT;
 #endif
 
@@ -98,6 +172,42 @@ int csp_qfifo_read(csp_qfifo_t * input) {
 
 }
 
+#ifdef CSP_USE_QOS
+static int csp_qfifo_push(unsigned int worker, csp_qfifo_t * element, int prio, CSP_BASE_TYPE * pxTaskWoken) {
+
+	csp_qfifo_levels_t * levels = &qfifo[worker];
+	int result = CSP_QUEUE_FULL;
+	CSP_BASE_TYPE state = 0;
+
+	if (pxTaskWoken == NULL)
+		CSP_ENTER_CRITICAL(levels->lock);
+	else
+		CSP_ENTER_CRITICAL_ISR(levels->lock, state);
+
+	if (levels->count[prio] < CSP_FIFO_INPUT) {
+		levels->ring[prio][(levels->head[prio] + levels->count[prio]) % CSP_FIFO_INPUT] = *element;
+		levels->count[prio]++;
+		levels->pending |= 1 << prio;
+		result = CSP_QUEUE_OK;
+	}
+
+	if (pxTaskWoken == NULL)
+		CSP_EXIT_CRITICAL(levels->lock);
+	else
+		CSP_EXIT_CRITICAL_ISR(levels->lock, state);
+
+	if (result == CSP_QUEUE_OK) {
+		if (pxTaskWoken == NULL)
+			csp_bin_sem_post(&levels->signal);
+		else
+			csp_bin_sem_post_isr(&levels->signal, pxTaskWoken);
+	}
+
+	return result;
+
+}
+#endif
+
 void csp_qfifo_write(csp_packet_t * packet, csp_iface_t * interface, CSP_BASE_TYPE * pxTaskWoken) {
 
 	int result;
@@ -118,26 +228,16 @@ void csp_qfifo_write(csp_packet_t * packet, csp_iface_t * interface, CSP_BASE_TY
 	queue_element.interface = interface;
 	queue_element.packet = packet;
 
+	/* All packets of a connection go to the same worker to keep them in order */
+	unsigned int worker = csp_qfifo_shard(packet->id.ext);
+
 #ifdef CSP_USE_QOS
-	int fifo = packet->id.pri;
+	result = csp_qfifo_push(worker, &queue_element, packet->id.pri, pxTaskWoken);
 #else
-	int fifo = 0;
-#endif
-
 	if (pxTaskWoken == NULL)
-		result = csp_queue_enqueue(qfifo[fifo], &queue_element, 0);
+		result = csp_queue_enqueue(qfifo[worker], &queue_element, 0);
 	else
-		result = csp_queue_enqueue_isr(qfifo[fifo], &queue_element, pxTaskWoken);
-
-#ifdef CSP_USE_QOS
-	static int event = 0;
-
-	if (result == CSP_QUEUE_OK) {
-		if (pxTaskWoken == NULL)
-			csp_queue_enqueue(qfifo_events, &event, 0);
-		else
-			csp_queue_enqueue_isr(qfifo_events, &event, pxTaskWoken);
-	}
+		result = csp_queue_enqueue_isr(qfifo[worker], &queue_element, pxTaskWoken);
 #endif
 
 	if (result != CSP_QUEUE_OK) {
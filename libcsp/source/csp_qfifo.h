@@ -40,11 +40,29 @@ typedef struct {
 	csp_packet_t * packet;
 } csp_qfifo_t;
 
+/**
+ * Create input queues for a number of router workers and start
+ * spreading incoming packets over them
+ * @param workers number of workers, at most CSP_ROUTE_WORKERS_MAX
+ * @return CSP_ERR type
+ */
+int csp_qfifo_set_workers(unsigned int workers);
+
+/**
+ * Get the router worker that handles packets with a given identifier.
+ * All packets of one connection map to the same worker.
+ * @param id CSP identifier
+ * @return worker index
+ */
+unsigned int csp_qfifo_shard(uint32_t id);
+
 /**
  * Read next packet from router input queue
+ * @param worker router worker to read the queues of
  * @param input pointer to router queue item element
+ * @param timeout max time (ms) to wait for a packet
  * @return CSP_ERR type
  */
-int csp_qfifo_read(csp_qfifo_t * input);
+int csp_qfifo_read(unsigned int worker, csp_qfifo_t * input, uint32_t timeout);
 
 #endif /* CSP_QFIFO_H_ */
@@ -21,6 +21,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <stdlib.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <stdio.h>
 
 /* CSP includes */
 #include <csp/csp.h>
@@ -41,8 +42,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include "csp_dedup.h"
 #include "transport/csp_transport.h"
 
-/* Static handle for router task */
-static csp_thread_handle_t handle_router;
+/* Static handles for router worker tasks */
+static csp_thread_handle_t handle_router[CSP_ROUTE_WORKERS_MAX];
+static unsigned int router_workers;
 
 /**
  * Check supported packet options
@@ -169,7 +171,7 @@ static int csp_route_security_check(uint32_t security_opts, csp_iface_t * interf
 
 }
 
-int csp_route_work(uint32_t timeout) {
+static int csp_route_work_worker(unsigned int worker, uint32_t timeout) {
 
 	csp_qfifo_t input;
 	csp_packet_t * packet;
@@ -178,11 +180,11 @@ int csp_route_work(uint32_t timeout) {
 
 #ifdef CSP_USE_RDP
 	/* Check connection timeouts (currently only for RDP) */
-	csp_conn_check_timeouts();
+	csp_conn_check_timeouts(worker);
 #endif
 
 	/* Get next packet to route */
-	if (csp_qfifo_read(&input) != CSP_ERR_NONE)
+	if (csp_qfifo_read(worker, &input, timeout) != CSP_ERR_NONE)
 		return -1;
 
 	packet = input.packet;
@@ -316,28 +318,88 @@ int csp_route_work(uint32_t timeout) {
 	return 0;
 }
 
+int csp_route_work(uint32_t timeout) {
+
+	return csp_route_work_worker(0, timeout);
+
+}
+
 CSP_DEFINE_TASK(csp_task_router) {
 
+	unsigned int worker = (uintptr_t) param;
+
 	/* Here there be routing */
 	while (1) {
-		csp_route_work(FIFO_TIMEOUT);
+		csp_route_work_worker(worker, FIFO_TIMEOUT);
 	}
 
 }
 
-int csp_route_start_task(unsigned int task_stack_size, unsigned int priority) {
+int csp_route_start_workers(unsigned int task_stack_size, unsigned int priority, unsigned int workers) {
 
-	int ret = csp_thread_create(csp_task_router, "RTE", task_stack_size, NULL, priority, &handle_router);
+	unsigned int worker;
+	char name[8];
 
-	if (ret != 0) {
-		csp_log_error("Failed to start router task");
+	/* Flows are hashed over the workers, so changing their number while
+	 * packets are queued would route packets of a connection out of order */
+	if (router_workers > 0) {
+		csp_log_error("Router is already running with %u workers", router_workers);
+		return CSP_ERR_BUSY;
+	}
+
+	if (workers < 1 || workers > CSP_ROUTE_WORKERS_MAX) {
+		csp_log_error("Router supports 1 to %u workers, not %u", CSP_ROUTE_WORKERS_MAX, workers);
+		return CSP_ERR_INVAL;
+	}
+
+	/* Spread incoming packets over the worker queues */
+	if (csp_qfifo_set_workers(workers) != CSP_ERR_NONE) {
+		csp_log_error("Failed to create router queues");
 		return CSP_ERR_NOMEM;
 	}
 
+	for (worker = 0; worker < workers; worker++) {
+
+		/* The first worker keeps the traditional task name */
+		if (worker == 0)
+			snprintf(name, sizeof(name), "RTE");
+		else
+			snprintf(name, sizeof(name), "RTE%u", worker);
+
+		int ret = csp_thread_create(csp_task_router, name, task_stack_size, (void *) (uintptr_t) worker, priority, &handle_router[worker]);
+
+		if (ret != 0) {
+			csp_log_error("Failed to start router task");
+			/* Stop the workers that did start, rather than re-hash flows under them */
+			while (worker-- > 0) {
+				csp_thread_kill(handle_router[worker]);
+			}
+			csp_qfifo_set_workers(1);
+			return CSP_ERR_NOMEM;
+		}
+
+	}
+
+	router_workers = workers;
+
 	return CSP_ERR_NONE;
 
 }
 
+int csp_route_start_task(unsigned int task_stack_size, unsigned int priority) {
+
+	return csp_route_start_workers(task_stack_size, priority, 1);
+
+}
+
 void csp_route_end_task() {
-    csp_thread_kill(handle_router);
+
+	unsigned int worker;
+
+	for (worker = 0; worker < router_workers; worker++) {
+		csp_thread_kill(handle_router[worker]);
+	}
+
+	router_workers = 0;
+
 }
\ No newline at end of file
@@ -159,6 +159,23 @@ static int do_cmp_clock(struct csp_cmp_message *cmp) {
 
 }
 
+static int do_cmp_dedup_stats(struct csp_cmp_message *cmp) {
+
+#ifdef CSP_USE_DEDUP
+	csp_dedup_stats_t stats;
+	csp_dedup_get_stats(&stats);
+
+	cmp->dedup_stats.hits =      csp_hton32(stats.hits);
+	cmp->dedup_stats.misses =    csp_hton32(stats.misses);
+	cmp->dedup_stats.evictions = csp_hton32(stats.evictions);
+
+	return CSP_ERR_NONE;
+#else
+	return CSP_ERR_NOTSUP;
+#endif
+
+}
+
 /* CSP Management Protocol handler */
 int csp_cmp_handler(csp_conn_t * conn, csp_packet_t * packet) {
 
@@ -197,6 +214,11 @@ int csp_cmp_handler(csp_conn_t * conn, csp_packet_t * packet) {
 			ret = do_cmp_clock(cmp);
 			break;
 
+		case CSP_CMP_DEDUP_STATS:
+			ret = do_cmp_dedup_stats(cmp);
+			packet->length = CMP_SIZE(dedup_stats);
+			break;
+
 		default:
 			ret = CSP_ERR_INVAL;
 			break;
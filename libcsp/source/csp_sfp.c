@@ -25,11 +25,40 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #include <csp/arch/csp_malloc.h>
 #include "csp_conn.h"
 
+#ifdef CSP_POSIX
+#include <unistd.h>
+#endif
+
+/* Number of timeouts in a row before a bulk transfer is given up */
+#define SFP_BULK_RETRIES 3
+
+/* Most fragments resent for one status, so resends follow the receiver's pace */
+#define SFP_BULK_RESEND_BURST 2
+
+/* Set in the window of a fragment the receiver should answer at once */
+#define SFP_BULK_PROBE 0x80
+
 typedef struct __attribute__((__packed__)) {
 	uint32_t offset;
 	uint32_t totalsize;
 } sfp_header_t;
 
+/* Fragments of a bulk transfer start at multiples of mtu */
+typedef struct __attribute__((__packed__)) {
+	uint32_t offset;
+	uint32_t totalsize;
+	uint16_t mtu;
+	uint8_t window;
+	uint16_t seq;				// Counts every send, so a resent fragment is not taken for a duplicate
+} sfp_bulk_header_t;
+
+/* Sent back by the receiver of a bulk transfer */
+typedef struct __attribute__((__packed__)) {
+	uint32_t next;				// Every byte before next has been received
+	uint32_t received;			// Bit i is set if the fragment i fragments after next has been received
+	uint16_t seq;				// Counts every status, so a repeated status is not taken for a duplicate
+} sfp_status_t;
+
 /**
  * SFP Headers:
  * The following functions are helper functions that handles the extra SFP
@@ -165,3 +194,308 @@ int csp_sfp_recv(csp_conn_t * conn, void ** dataout, int * datasize, uint32_t ti
 	return csp_sfp_recv_fp(conn, dataout, datasize, timeout, NULL);
 }
 
+static int csp_sfp_send_fragment(csp_conn_t * conn, csp_sfp_source_t source, void * arg, uint32_t totalsize, uint32_t index, int mtu, int window, uint32_t seq, uint32_t timeout) {
+
+	uint32_t offset = index * mtu;
+	uint32_t size = totalsize - offset;
+	if (size > (uint32_t) mtu)
+		size = mtu;
+
+	/* Allocate packet */
+	csp_packet_t * packet = csp_buffer_get(mtu + sizeof(sfp_bulk_header_t));
+	if (packet == NULL)
+		return -1;
+
+	if (size > 0 && (*source)(arg, offset, packet->data, size) != 0) {
+		csp_debug(CSP_ERROR, "SFP source failed at %u", offset);
+		csp_buffer_free(packet);
+		return -1;
+	}
+
+	/* Add SFP header */
+	sfp_bulk_header_t * header = (sfp_bulk_header_t *) &packet->data[size];
+	header->offset = csp_hton32(offset);
+	header->totalsize = csp_hton32(totalsize);
+	header->mtu = csp_hton16(mtu);
+	header->window = window;
+	header->seq = csp_hton16(seq);
+	packet->length = size + sizeof(sfp_bulk_header_t);
+
+	csp_debug(CSP_PROTOCOL, "Sending SFP bulk at %u size %u", offset, size);
+
+	/* Set fragment flag */
+	conn->idout.flags |= CSP_FFRAG;
+
+	if (!csp_send(conn, packet, timeout)) {
+		csp_buffer_free(packet);
+		return -1;
+	}
+
+	return 0;
+
+}
+
+int csp_sfp_send_bulk(csp_conn_t * conn, csp_sfp_source_t source, void * arg, uint32_t totalsize, uint32_t offset, int mtu, int window, uint32_t timeout) {
+
+	uint32_t tx_seq[CSP_SFP_MAX_WINDOW];
+	uint32_t seq = 0, newest = 0;
+	uint32_t received = 0, i;
+	int timeouts = 0, acked, resent;
+
+	if (conn == NULL || source == NULL || mtu <= 0 || mtu > UINT16_MAX || offset > totalsize)
+		return -1;
+
+	if (window < 1)
+		window = 1;
+	if (window > CSP_SFP_MAX_WINDOW)
+		window = CSP_SFP_MAX_WINDOW;
+
+	/* An empty transfer still sends one fragment */
+	uint32_t count = (totalsize > 0) ? (totalsize + mtu - 1) / mtu : 1;
+
+	/* Fragments [base, next) are in flight, bit i of received is fragment base + i */
+	uint32_t base = offset / mtu;
+	uint32_t next = base;
+
+	while (base < count) {
+
+		/* Fill the window */
+		while (next < count && next < base + window) {
+			tx_seq[next % CSP_SFP_MAX_WINDOW] = seq;
+			if (csp_sfp_send_fragment(conn, source, arg, totalsize, next, mtu, window, seq++, timeout) != 0)
+				return -1;
+			next++;
+		}
+
+		/* Wait for the receiver */
+		csp_packet_t * packet = csp_read(conn, timeout);
+		if (packet == NULL) {
+			if (++timeouts > SFP_BULK_RETRIES) {
+				csp_debug(CSP_ERROR, "SFP bulk receiver not responding");
+				return -1;
+			}
+
+			/* Resend the oldest missing fragment and let the receiver's answer tell what else was lost */
+			for (i = base; i < next && (received & (1UL << (i - base))); i++);
+			if (i < next) {
+				tx_seq[i % CSP_SFP_MAX_WINDOW] = seq;
+				if (csp_sfp_send_fragment(conn, source, arg, totalsize, i, mtu, window | SFP_BULK_PROBE, seq++, timeout) != 0)
+					return -1;
+			}
+			continue;
+		}
+
+		if ((packet->id.flags & CSP_FFRAG) || packet->length != sizeof(sfp_status_t)) {
+			csp_debug(CSP_WARN, "SFP bulk sender discarding unexpected packet");
+			csp_buffer_free(packet);
+			continue;
+		}
+
+		sfp_status_t * status = (sfp_status_t *) packet->data;
+		uint32_t status_next = csp_ntoh32(status->next);
+		uint32_t status_received = csp_ntoh32(status->received);
+		csp_buffer_free(packet);
+		timeouts = 0;
+
+		if (status_next > totalsize)
+			continue;
+		uint32_t new_base = (status_next == totalsize) ? count : status_next / mtu;
+
+		/* The receiver resumes elsewhere, start over from there */
+		if (new_base < base || new_base > next) {
+			csp_debug(CSP_PROTOCOL, "SFP bulk receiver resumes at %u", status_next);
+			base = next = new_base;
+			received = 0;
+			continue;
+		}
+
+		/* Find the most recently sent fragment which has arrived */
+		acked = 0;
+		for (i = base; i < next; i++) {
+			if (i >= new_base && (i - new_base >= 32 || !(status_received & (1UL << (i - new_base)))))
+				continue;
+			if (!acked || (int32_t)(tx_seq[i % CSP_SFP_MAX_WINDOW] - newest) > 0)
+				newest = tx_seq[i % CSP_SFP_MAX_WINDOW];
+			acked = 1;
+		}
+
+		base = new_base;
+		received = status_received;
+
+		/* Fragments sent before one which arrived were lost */
+		resent = 0;
+		for (i = base; acked && i < next && resent < SFP_BULK_RESEND_BURST; i++) {
+			if ((received & (1UL << (i - base))) || (int32_t)(tx_seq[i % CSP_SFP_MAX_WINDOW] - newest) > 0)
+				continue;
+			csp_debug(CSP_PROTOCOL, "SFP bulk resending %u", i * mtu);
+			tx_seq[i % CSP_SFP_MAX_WINDOW] = seq;
+			if (csp_sfp_send_fragment(conn, source, arg, totalsize, i, mtu, window, seq++, timeout) != 0)
+				return -1;
+			resent++;
+		}
+
+	}
+
+	return 0;
+
+}
+
+static int csp_sfp_send_status(csp_conn_t * conn, uint16_t * seq, uint32_t next, uint32_t received, uint32_t timeout) {
+
+	csp_packet_t * packet = csp_buffer_get(sizeof(sfp_status_t));
+	if (packet == NULL)
+		return -1;
+
+	sfp_status_t * status = (sfp_status_t *) packet->data;
+	status->next = csp_hton32(next);
+	status->received = csp_hton32(received);
+	status->seq = csp_hton16((*seq)++);
+	packet->length = sizeof(sfp_status_t);
+
+	/* Status packets are told apart from fragments by the missing fragment flag */
+	conn->idout.flags &= ~CSP_FFRAG;
+
+	if (!csp_send(conn, packet, timeout)) {
+		csp_buffer_free(packet);
+		return -1;
+	}
+
+	return 0;
+
+}
+
+/* Answers a sender which missed the final status, until it goes quiet */
+static int csp_sfp_recv_done(csp_conn_t * conn, uint16_t * seq, uint32_t totalsize, uint32_t timeout) {
+
+	csp_packet_t * packet;
+
+	if (csp_sfp_send_status(conn, seq, totalsize, 0, timeout) != 0)
+		return -1;
+
+	while ((packet = csp_read(conn, timeout)) != NULL) {
+		csp_buffer_free(packet);
+		csp_sfp_send_status(conn, seq, totalsize, 0, timeout);
+	}
+
+	return 0;
+
+}
+
+int csp_sfp_recv_bulk(csp_conn_t * conn, csp_sfp_sink_t sink, void * arg, uint32_t offset, uint32_t * datasize, uint32_t timeout) {
+
+	uint32_t next = offset;
+	uint32_t received = 0;
+	uint32_t totalsize = 0, mtu = 0, i;
+	int pending = 0, started = 0;
+	uint16_t seq = 0;
+	csp_packet_t * packet;
+
+	if (conn == NULL || sink == NULL)
+		return -1;
+
+	while ((packet = csp_read(conn, timeout)) != NULL) {
+
+		/* Check that SFP header is present */
+		if ((packet->id.flags & CSP_FFRAG) == 0 || packet->length < sizeof(sfp_bulk_header_t)) {
+			csp_debug(CSP_WARN, "Missing SFP bulk header");
+			csp_buffer_free(packet);
+			continue;
+		}
+
+		/* Read SFP header */
+		sfp_bulk_header_t * header = (sfp_bulk_header_t *) &packet->data[packet->length - sizeof(sfp_bulk_header_t)];
+		uint32_t frag_offset = csp_ntoh32(header->offset);
+		uint32_t frag_totalsize = csp_ntoh32(header->totalsize);
+		uint32_t frag_mtu = csp_ntoh16(header->mtu);
+		uint32_t size = packet->length - sizeof(sfp_bulk_header_t);
+		int ack_every = ((header->window & ~SFP_BULK_PROBE) + 1) / 2;
+		int probe = header->window & SFP_BULK_PROBE;
+
+		/* The first fragment tells the size of the transfer */
+		if (!started) {
+			if (frag_mtu == 0 || offset > frag_totalsize) {
+				csp_debug(CSP_ERROR, "Invalid SFP bulk transfer");
+				csp_buffer_free(packet);
+				return -1;
+			}
+			mtu = frag_mtu;
+			totalsize = frag_totalsize;
+			next -= next % mtu;
+			*datasize = totalsize;
+			started = 1;
+
+			/* Nothing is missing, tell the sender to stop */
+			if (next >= totalsize) {
+				csp_buffer_free(packet);
+				return csp_sfp_recv_done(conn, &seq, totalsize, timeout);
+			}
+		}
+
+		/* Check that the fragment is where the sender would have put it */
+		if (frag_mtu != mtu || frag_totalsize != totalsize || frag_offset % mtu != 0 || size > mtu ||
+				frag_offset + size > totalsize || (size < mtu && frag_offset + size != totalsize)) {
+			csp_debug(CSP_WARN, "Invalid SFP bulk fragment at %u", frag_offset);
+			csp_buffer_free(packet);
+			continue;
+		}
+
+		/* Duplicates and fragments outside the window mean the sender is out of step */
+		i = (frag_offset >= next) ? (frag_offset - next) / mtu : 32;
+		if (i >= 32 || (received & (1UL << i))) {
+			csp_buffer_free(packet);
+			csp_sfp_send_status(conn, &seq, next, received, timeout);
+			pending = 0;
+			continue;
+		}
+
+		csp_debug(CSP_PROTOCOL, "SFP bulk fragment %u/%u", frag_offset + size, totalsize);
+
+		if ((*sink)(arg, frag_offset, packet->data, size) != 0) {
+			csp_debug(CSP_ERROR, "SFP sink failed at %u", frag_offset);
+			csp_buffer_free(packet);
+			return -1;
+		}
+		csp_buffer_free(packet);
+
+		/* Move past every fragment received in sequence */
+		received |= (1UL << i);
+		while (received & 1) {
+			received >>= 1;
+			next = (totalsize - next > mtu) ? next + mtu : totalsize;
+		}
+
+		if (next >= totalsize) {
+			csp_debug(CSP_PROTOCOL, "SFP bulk complete");
+			return csp_sfp_recv_done(conn, &seq, totalsize, timeout);
+		}
+
+		/* Report gaps and answer probes at once, so the sender resends what is missing */
+		if (received != 0 || probe || ++pending >= ack_every) {
+			if (csp_sfp_send_status(conn, &seq, next, received, timeout) != 0)
+				return -1;
+			pending = 0;
+		}
+
+	}
+
+	return -1;
+
+}
+
+#ifdef CSP_POSIX
+static int csp_sfp_fd_source(void * arg, uint32_t offset, void * data, uint32_t size) {
+	return (pread(*(int *) arg, data, size, offset) == (ssize_t) size) ? 0 : -1;
+}
+
+static int csp_sfp_fd_sink(void * arg, uint32_t offset, const void * data, uint32_t size) {
+	return (pwrite(*(int *) arg, data, size, offset) == (ssize_t) size) ? 0 : -1;
+}
+
+int csp_sfp_send_fd(csp_conn_t * conn, int fd, uint32_t totalsize, uint32_t offset, int mtu, int window, uint32_t timeout) {
+	return csp_sfp_send_bulk(conn, csp_sfp_fd_source, &fd, totalsize, offset, mtu, window, timeout);
+}
+
+int csp_sfp_recv_fd(csp_conn_t * conn, int fd, uint32_t offset, uint32_t * datasize, uint32_t timeout) {
+	return csp_sfp_recv_bulk(conn, csp_sfp_fd_sink, &fd, offset, datasize, timeout);
+}
+#endif
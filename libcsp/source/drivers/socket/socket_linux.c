@@ -18,36 +18,87 @@
 #include <csp/drivers/socket.h>
 #include <csp/interfaces/csp_if_socket.h>
 
+#include <errno.h>
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+
+#include "socket_shm.h"
 
 #define LOCAL_ADDRESS "127.0.0.1"
 #define SERVER_MAX_CONNECTIONS 5
 
+/**
+ * Local address of a socket, for any transport
+ */
+typedef union {
+	struct sockaddr generic;
+	struct sockaddr_in inet;
+	struct sockaddr_un local;
+} socket_address_t;
+
+/**
+ * Creates a socket for a transport and fills in the address of port
+ * @param transport transport to create the socket for
+ * @param port port to create the address for
+ * @param addr address to fill in
+ * @param addr_len length of the address
+ * @return int socket handle, -1 on error
+ */
+static int socket_create(csp_socket_transport transport, uint16_t port, socket_address_t * addr, socklen_t * addr_len);
+
 /**
  * Low level init of server socket connection. Includes waiting on client connection
  * @param socket_iface socket interface to store socket handle in
  * @param port port to accept connection on
+ * @param transport transport to use
  * @return int CSP_ERR_NONE if success, otherwise CSP_ERR_DRIVER
  */
-static int socket_server_init(csp_socket_handle_t * socket_iface, uint16_t port);
+static int socket_server_init(csp_socket_handle_t * socket_iface, uint16_t port, csp_socket_transport transport);
 
 /**
  * Low level init of client server connection. Includes connecting to server socket
  * @param socket_iface socket interface to store socket handle in
  * @param part port to connect to
- * @param addr address to connect to
+ * @param transport transport to use
  * @return int CSP_ERR_NONE if success, otherwise CSP_ERR_DRIVER
  */
-static int socket_client_init(csp_socket_handle_t * socket_iface, uint16_t port);
+static int socket_client_init(csp_socket_handle_t * socket_iface, uint16_t port, csp_socket_transport transport);
+
+static int socket_create(csp_socket_transport transport, uint16_t port, socket_address_t * addr, socklen_t * addr_len) {
+	int length;
+
+	memset(addr, 0, sizeof(socket_address_t));
 
-static int socket_server_init(csp_socket_handle_t * socket_iface, uint16_t port) {
+	if (transport == CSP_SOCKET_TRANSPORT_SCTP) {
+		// For now we will only accept local socket connections
+		addr->inet.sin_addr.s_addr = inet_addr(LOCAL_ADDRESS);
+		addr->inet.sin_family = AF_INET;
+		addr->inet.sin_port = htons(port);
+		*addr_len = sizeof(struct sockaddr_in);
+		return socket(AF_INET, SOCK_STREAM, IPPROTO_SCTP);
+	}
+
+	// Abstract address (leading NUL), nothing is left behind in the file system
+	addr->local.sun_family = AF_UNIX;
+	length = snprintf(addr->local.sun_path + 1, sizeof(addr->local.sun_path) - 1, "%s-%u",
+			(transport == CSP_SOCKET_TRANSPORT_SHM) ? "csp-shm" : "csp-socket", port);
+	*addr_len = offsetof(struct sockaddr_un, sun_path) + 1 + length;
+	return socket(AF_UNIX, SOCK_SEQPACKET, 0);
+}
+
+static int socket_server_init(csp_socket_handle_t * socket_iface, uint16_t port, csp_socket_transport transport) {
 	int socket_handle;
 	static int server_socket;
-	static struct sockaddr_in server;
+	static socket_address_t server;
+	static socklen_t server_len;
 	static bool server_init = false;
 
 	if (socket_iface == NULL) {
@@ -55,7 +106,7 @@ static int socket_server_init(csp_socket_handle_t * socket_iface, uint16_t port)
 	}
 
 	if (server_init == false) {
-		server_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_SCTP);
+		server_socket = socket_create(transport, port, &server, &server_len);
 		if (server_socket == -1) {
 			csp_log_error("Failed to init socket\n");
 			return CSP_ERR_DRIVER;
@@ -64,11 +115,7 @@ static int socket_server_init(csp_socket_handle_t * socket_iface, uint16_t port)
 			csp_log_error("setsockopt(SO_REUSEADDR) failed");
 			return CSP_ERR_DRIVER;
 		}
-		// For now we will only accept local socket connections
-		server.sin_addr.s_addr = inet_addr(LOCAL_ADDRESS);
-		server.sin_family = AF_INET;
-		server.sin_port = htons(port);
-		if (bind(server_socket, (struct sockaddr *)&server, sizeof(server)) < 0) {
+		if (bind(server_socket, &server.generic, server_len) < 0) {
 			csp_log_error("Failed to bind\n");
 			return CSP_ERR_DRIVER;
 		}
@@ -86,47 +133,65 @@ static int socket_server_init(csp_socket_handle_t * socket_iface, uint16_t port)
 		return CSP_ERR_DRIVER;
 	}
 	socket_iface->socket_handle = socket_handle;
+	socket_iface->transport = transport;
+	socket_iface->framing = CSP_SOCKET_FRAMING;
+	socket_iface->shm = NULL;
+	if ((transport == CSP_SOCKET_TRANSPORT_SHM) && (socket_shm_server(socket_iface) != CSP_ERR_NONE)) {
+		csp_log_error("Shared memory setup failed\n");
+		close(socket_handle);
+		return CSP_ERR_DRIVER;
+	}
 	socket_iface->is_active = true;
 	return CSP_ERR_NONE;
 }
 
-static int socket_client_init(csp_socket_handle_t * socket_iface, uint16_t port) {
+static int socket_client_init(csp_socket_handle_t * socket_iface, uint16_t port, csp_socket_transport transport) {
 	int socket_handle;
-	struct sockaddr_in server;
+	socket_address_t server;
+	socklen_t server_len;
 
 	if (socket_iface == NULL)
 		return CSP_ERR_DRIVER;
 
 	//Create socket
-	socket_handle = socket(AF_INET, SOCK_STREAM, IPPROTO_SCTP);
+	socket_handle = socket_create(transport, port, &server, &server_len);
 	if (socket_handle == -1) {
 		csp_log_error("Could not create socket");
 		return CSP_ERR_DRIVER;
 	}
 
-	server.sin_addr.s_addr = inet_addr(LOCAL_ADDRESS);
-	server.sin_family = AF_INET;
-	server.sin_port = htons(port);
-
 	//Connect to remote server
-	if (connect(socket_handle, (struct sockaddr *)&server, sizeof(server)) != 0) {
+	if (connect(socket_handle, &server.generic, server_len) != 0) {
 		csp_log_error("Connect failed. Error");
+		close(socket_handle);
 		return CSP_ERR_DRIVER;
 	}
 	socket_iface->socket_handle = socket_handle;
+	socket_iface->transport = transport;
+	socket_iface->framing = CSP_SOCKET_FRAMING;
+	socket_iface->shm = NULL;
+	if ((transport == CSP_SOCKET_TRANSPORT_SHM) && (socket_shm_client(socket_iface) != CSP_ERR_NONE)) {
+		csp_log_error("Shared memory setup failed\n");
+		close(socket_handle);
+		return CSP_ERR_DRIVER;
+	}
 	socket_iface->is_active = true;
 	return CSP_ERR_NONE;
 }
 
 int socket_init(csp_socket_handle_t * socket_iface, uint8_t mode, uint16_t port) {
+	return socket_init_transport(socket_iface, mode, port, CSP_SOCKET_TRANSPORT);
+}
+
+int socket_init_transport(csp_socket_handle_t * socket_iface, uint8_t mode, uint16_t port, csp_socket_transport transport) {
 	if (socket_iface == NULL) {
 		return CSP_ERR_DRIVER;
 	}
 
 	if (mode == CSP_SOCKET_SERVER) {
-		return socket_server_init(socket_iface, port);
+		return socket_server_init(socket_iface, port, transport);
 	} else if (mode == CSP_SOCKET_CLIENT) {
-		return socket_client_init(socket_iface, port);
+		return socket_client_init(socket_iface, port, transport);
 	}
 	return CSP_ERR_DRIVER;
 }
@@ -142,6 +207,10 @@ int socket_close(csp_socket_handle_t * socket_driver) {
 
 	socket_driver->is_active = false;
 
+	if (socket_driver->shm != NULL) {
+		socket_shm_close(socket_driver);
+	}
+
 	if (shutdown(socket_driver->socket_handle, SHUT_RDWR) != 0) {
 		return CSP_ERR_DRIVER;
 	}
@@ -153,6 +222,55 @@ int socket_close(csp_socket_handle_t * socket_driver) {
 	return CSP_ERR_NONE;
 }
 
+int socket_send(csp_socket_handle_t * socket_driver, const void * data, size_t length, uint32_t timeout) {
+	struct iovec iov = {
+		.iov_base = (void *)data,
+		.iov_len = length
+	};
+
+	return socket_sendv(socket_driver, &iov, 1, timeout);
+}
+
+int socket_sendv(csp_socket_handle_t * socket_driver, const struct iovec * iov, int iovcnt, uint32_t timeout) {
+	struct msghdr msg = {
+		.msg_iov = (struct iovec *)iov,
+		.msg_iovlen = iovcnt
+	};
+	int result;
+
+	if (socket_driver->transport == CSP_SOCKET_TRANSPORT_SHM) {
+		return socket_shm_send(socket_driver, iov, iovcnt, timeout);
+	}
+
+	result = sendmsg(socket_driver->socket_handle, &msg, MSG_NOSIGNAL);
+	if (result < 0) {
+		csp_log_error("Socket write error: %d %s\r\n", result, strerror(errno));
+		return CSP_ERR_DRIVER;
+	}
+	return CSP_ERR_NONE;
+}
+
+int socket_recv(csp_socket_handle_t * socket_driver, void * buffer, size_t length) {
+	struct iovec iov = {
+		.iov_base = buffer,
+		.iov_len = length
+	};
+
+	return socket_recvv(socket_driver, &iov, 1);
+}
+
+int socket_recvv(csp_socket_handle_t * socket_driver, const struct iovec * iov, int iovcnt) {
+	struct msghdr msg = {
+		.msg_iov = (struct iovec *)iov,
+		.msg_iovlen = iovcnt
+	};
+
+	if (socket_driver->transport == CSP_SOCKET_TRANSPORT_SHM) {
+		return socket_shm_recv(socket_driver, iov, iovcnt);
+	}
+
+	return recvmsg(socket_driver->socket_handle, &msg, 0);
+}
 int socket_status(const csp_socket_handle_t * socket_iface) {
 	int error;
 	int retval;
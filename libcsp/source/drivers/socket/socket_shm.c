@@ -0,0 +1,394 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <csp/arch/csp_semaphore.h>
+#include <csp/arch/csp_thread.h>
+#include <csp/arch/csp_time.h>
+#include <csp/csp.h>
+#include <csp/interfaces/csp_if_socket.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "socket_shm.h"
+
+#if (CSP_SOCKET_SHM_SIZE & (CSP_SOCKET_SHM_SIZE - 1)) != 0
+#error "CSP_SOCKET_SHM_SIZE must be a power of two"
+#endif
+
+#define SHM_RING_MASK (CSP_SOCKET_SHM_SIZE - 1)
+#define SHM_CACHE_LINE 64
+
+/* Number of file descriptors handed to the client: the region, then the
+ * data and space eventfds of rings[0] and rings[1] */
+#define SHM_NUM_FDS 5
+
+/**
+ * Single producer, single consumer ring of messages, each stored as a
+ * 16 bit length followed by the message. head and tail only ever grow,
+ * positions in data are taken modulo the ring size.
+ */
+typedef struct {
+	/* Written by the producer only */
+	uint32_t head __attribute__((aligned(SHM_CACHE_LINE)));
+	/* Set by the producer while it sleeps on the ring's space eventfd */
+	uint32_t space_waiting;
+	/* Written by the consumer only */
+	uint32_t tail __attribute__((aligned(SHM_CACHE_LINE)));
+	/* Set by the consumer while it sleeps on the ring's data eventfd */
+	uint32_t waiting;
+	uint8_t data[CSP_SOCKET_SHM_SIZE] __attribute__((aligned(SHM_CACHE_LINE)));
+} shm_ring_t;
+
+/**
+ * Memory shared by both ends of a connection. The server sends on
+ * rings[0] and receives on rings[1].
+ */
+typedef struct {
+	shm_ring_t rings[2];
+} shm_region_t;
+
+struct csp_socket_shm {
+	shm_region_t * region;
+	shm_ring_t * tx;
+	shm_ring_t * rx;
+	/* Signals a sleeping receiver of tx */
+	int tx_event;
+	/* Signalled by the receiver of tx once it made room */
+	int tx_space_event;
+	/* Signalled by the sender of rx */
+	int rx_event;
+	/* Signals a sleeping sender of rx */
+	int rx_space_event;
+	/* Set once the control socket reported the peer going away */
+	bool closed;
+	/* Serializes senders, the ring only supports a single producer */
+	csp_mutex_t tx_lock;
+};
+
+/* Distinguishes the shared memory objects created by this process */
+static uint32_t shm_count = 0;
+
+static void shm_copy_in(shm_ring_t * ring, uint32_t pos, const void * data, uint32_t length) {
+	uint32_t offset = pos & SHM_RING_MASK;
+	uint32_t first = CSP_SOCKET_SHM_SIZE - offset;
+
+	if (first > length)
+		first = length;
+	memcpy(ring->data + offset, data, first);
+	memcpy(ring->data, (const uint8_t *)data + first, length - first);
+}
+
+static void shm_copy_out(const shm_ring_t * ring, uint32_t pos, void * data, uint32_t length) {
+	uint32_t offset = pos & SHM_RING_MASK;
+	uint32_t first = CSP_SOCKET_SHM_SIZE - offset;
+
+	if (first > length)
+		first = length;
+	memcpy(data, ring->data + offset, first);
+	memcpy((uint8_t *)data + first, ring->data, length - first);
+}
+
+/**
+ * Waits for an eventfd to be signalled or the control socket to report
+ * the peer going away, and resets the eventfd
+ * @param shm shared memory state
+ * @param socket_handle control socket
+ * @param event eventfd to wait on
+ * @param timeout max time (ms) to wait, -1 to wait forever
+ */
+static void shm_wait(struct csp_socket_shm * shm, int socket_handle, int event, int timeout) {
+	uint64_t signal;
+	struct pollfd fds[2] = {
+		{ .fd = event, .events = POLLIN },
+		{ .fd = socket_handle, .events = POLLIN }
+	};
+
+	if (poll(fds, 2, timeout) > 0) {
+		if (fds[0].revents & POLLIN) {
+			if (read(event, &signal, sizeof(signal)) != sizeof(signal)) {
+				csp_log_warn("Failed to reset shared memory event\r\n");
+			}
+		}
+		/* Nothing is sent over the control socket after setup */
+		if (fds[1].revents) {
+			shm->closed = true;
+		}
+	}
+}
+
+/**
+ * Signals an eventfd
+ */
+static void shm_signal(int event) {
+	uint64_t signal = 1;
+
+	if (write(event, &signal, sizeof(signal)) != sizeof(signal)) {
+		csp_log_warn("Failed to signal shared memory event\r\n");
+	}
+}
+
+/**
+ * Maps a region and sets up the connection's shared memory state
+ * @param socket_iface socket to set up
+ * @param fds shared memory object and eventfds, all closed on failure
+ * @param server true on the server end
+ * @return int CSP_ERR_NONE if successful, otherwise CSP_ERR_DRIVER
+ */
+static int shm_attach(csp_socket_handle_t * socket_iface, const int * fds, bool server) {
+	struct csp_socket_shm * shm = calloc(1, sizeof(struct csp_socket_shm));
+	void * region = mmap(NULL, sizeof(shm_region_t), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	int i;
+
+	close(fds[0]);
+
+	if ((shm == NULL) || (region == MAP_FAILED) || (csp_mutex_create(&(shm->tx_lock)) != CSP_SEMAPHORE_OK)) {
+		if (region != MAP_FAILED)
+			munmap(region, sizeof(shm_region_t));
+		free(shm);
+		for (i = 1; i < SHM_NUM_FDS; i++)
+			close(fds[i]);
+		return CSP_ERR_DRIVER;
+	}
+
+	shm->region = region;
+	shm->tx = &(shm->region->rings[server ? 0 : 1]);
+	shm->rx = &(shm->region->rings[server ? 1 : 0]);
+	shm->tx_event = fds[server ? 1 : 3];
+	shm->tx_space_event = fds[server ? 2 : 4];
+	shm->rx_event = fds[server ? 3 : 1];
+	shm->rx_space_event = fds[server ? 4 : 2];
+	socket_iface->shm = shm;
+
+	return CSP_ERR_NONE;
+}
+
+int socket_shm_server(csp_socket_handle_t * socket_iface) {
+	int fds[SHM_NUM_FDS];
+	char name[32];
+	int i;
+	char cmsg_buffer[CMSG_SPACE(sizeof(fds))];
+	uint8_t tag = 0;
+	struct iovec iov = {
+		.iov_base = &tag,
+		.iov_len = sizeof(tag)
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cmsg_buffer,
+		.msg_controllen = sizeof(cmsg_buffer)
+	};
+	struct cmsghdr * cmsg;
+
+	snprintf(name, sizeof(name), "/csp-shm-%d-%u", (int) getpid(),
+			__atomic_fetch_add(&shm_count, 1, __ATOMIC_RELAXED));
+	fds[0] = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fds[0] < 0) {
+		return CSP_ERR_DRIVER;
+	}
+	/* The object lives on in the mappings and the descriptor sent to the client */
+	shm_unlink(name);
+
+	for (i = 1; i < SHM_NUM_FDS; i++) {
+		fds[i] = eventfd(0, EFD_CLOEXEC);
+	}
+	for (i = 1; i < SHM_NUM_FDS; i++) {
+		if (fds[i] < 0)
+			goto err;
+	}
+	if (ftruncate(fds[0], sizeof(shm_region_t)) != 0) {
+		goto err;
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	if (sendmsg(socket_iface->socket_handle, &msg, MSG_NOSIGNAL) != sizeof(tag)) {
+		goto err;
+	}
+
+	return shm_attach(socket_iface, fds, true);
+
+err:
+	for (i = 0; i < SHM_NUM_FDS; i++) {
+		if (fds[i] >= 0)
+			close(fds[i]);
+	}
+	return CSP_ERR_DRIVER;
+}
+
+int socket_shm_client(csp_socket_handle_t * socket_iface) {
+	int fds[SHM_NUM_FDS];
+	char cmsg_buffer[CMSG_SPACE(sizeof(fds))];
+	uint8_t tag;
+	struct iovec iov = {
+		.iov_base = &tag,
+		.iov_len = sizeof(tag)
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cmsg_buffer,
+		.msg_controllen = sizeof(cmsg_buffer)
+	};
+	struct cmsghdr * cmsg;
+
+	if (recvmsg(socket_iface->socket_handle, &msg, MSG_CMSG_CLOEXEC) != sizeof(tag)) {
+		return CSP_ERR_DRIVER;
+	}
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if ((cmsg == NULL) || (cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS)
+			|| (cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))) {
+		return CSP_ERR_DRIVER;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+	return shm_attach(socket_iface, fds, false);
+}
+
+int socket_shm_send(csp_socket_handle_t * socket_iface, const struct iovec * iov, int iovcnt, uint32_t timeout) {
+	struct csp_socket_shm * shm = socket_iface->shm;
+	shm_ring_t * ring = shm->tx;
+	uint32_t start = csp_get_ms();
+	size_t length = 0;
+	uint16_t record_length;
+	uint32_t needed;
+	uint32_t elapsed;
+	uint32_t head;
+	int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		length += iov[i].iov_len;
+	}
+	record_length = length;
+	needed = sizeof(record_length) + length;
+
+	if ((length > UINT16_MAX) || (needed > CSP_SOCKET_SHM_SIZE)) {
+		return CSP_ERR_DRIVER;
+	}
+
+	if (csp_mutex_lock(&(shm->tx_lock), timeout) != CSP_MUTEX_OK) {
+		return CSP_ERR_TIMEDOUT;
+	}
+
+	head = ring->head;
+	while ((CSP_SOCKET_SHM_SIZE - (head - __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE))) < needed) {
+		elapsed = csp_get_ms() - start;
+		if (shm->closed || (elapsed >= timeout)) {
+			csp_mutex_unlock(&(shm->tx_lock));
+			return shm->closed ? CSP_ERR_DRIVER : CSP_ERR_TIMEDOUT;
+		}
+
+		/* Same handshake as the receiver waiting for data, with the roles swapped */
+		__atomic_store_n(&(ring->space_waiting), 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if ((CSP_SOCKET_SHM_SIZE - (head - __atomic_load_n(&(ring->tail), __ATOMIC_RELAXED))) < needed) {
+			shm_wait(shm, socket_iface->socket_handle, shm->tx_space_event,
+					(timeout == CSP_MAX_DELAY) ? -1 : (int) (timeout - elapsed));
+		}
+		__atomic_store_n(&(ring->space_waiting), 0, __ATOMIC_RELAXED);
+	}
+
+	shm_copy_in(ring, head, &record_length, sizeof(record_length));
+	head += sizeof(record_length);
+	for (i = 0; i < iovcnt; i++) {
+		shm_copy_in(ring, head, iov[i].iov_base, iov[i].iov_len);
+		head += iov[i].iov_len;
+	}
+	__atomic_store_n(&(ring->head), head, __ATOMIC_RELEASE);
+
+	/* Pairs with the fence in socket_shm_recv: either the receiver sees
+	 * the new head or this sees it waiting */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&(ring->waiting), __ATOMIC_RELAXED)) {
+		shm_signal(shm->tx_event);
+	}
+
+	csp_mutex_unlock(&(shm->tx_lock));
+
+	return CSP_ERR_NONE;
+}
+
+int socket_shm_recv(csp_socket_handle_t * socket_iface, const struct iovec * iov, int iovcnt) {
+	struct csp_socket_shm * shm = socket_iface->shm;
+	shm_ring_t * ring = shm->rx;
+	uint32_t tail = ring->tail;
+	uint16_t record_length;
+	uint32_t remaining;
+	uint32_t part;
+	uint32_t pos;
+	int i;
+
+	while (__atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE) == tail) {
+		/* Messages sent before the peer went away are still delivered */
+		if (shm->closed) {
+			return 0;
+		}
+
+		__atomic_store_n(&(ring->waiting), 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&(ring->head), __ATOMIC_RELAXED) == tail) {
+			shm_wait(shm, socket_iface->socket_handle, shm->rx_event, -1);
+		}
+		__atomic_store_n(&(ring->waiting), 0, __ATOMIC_RELAXED);
+	}
+
+	shm_copy_out(ring, tail, &record_length, sizeof(record_length));
+	pos = tail + sizeof(record_length);
+	remaining = record_length;
+	for (i = 0; (i < iovcnt) && (remaining > 0); i++) {
+		part = (iov[i].iov_len < remaining) ? iov[i].iov_len : remaining;
+		shm_copy_out(ring, pos, iov[i].iov_base, part);
+		pos += part;
+		remaining -= part;
+	}
+	__atomic_store_n(&(ring->tail), tail + sizeof(record_length) + record_length, __ATOMIC_RELEASE);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&(ring->space_waiting), __ATOMIC_RELAXED)) {
+		shm_signal(shm->rx_space_event);
+	}
+
+	return record_length - remaining;
+}
+
+void socket_shm_close(csp_socket_handle_t * socket_iface) {
+	struct csp_socket_shm * shm = socket_iface->shm;
+
+	munmap(shm->region, sizeof(shm_region_t));
+	close(shm->tx_event);
+	close(shm->tx_space_event);
+	close(shm->rx_event);
+	close(shm->rx_space_event);
+	csp_mutex_remove(&(shm->tx_lock));
+	free(shm);
+	socket_iface->shm = NULL;
+}
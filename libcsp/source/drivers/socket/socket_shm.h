@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SOCKET_SHM_H_
+#define _SOCKET_SHM_H_
+
+#include <csp/interfaces/csp_if_socket.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+/**
+ * Shared memory transport of the socket driver.
+ *
+ * Each connection maps one region holding a single producer, single
+ * consumer ring per direction. The server creates the region and two
+ * eventfds per ring and hands them to the client over the connected unix
+ * socket, which afterwards only serves to notice the peer going away.
+ * Receivers only sleep on a ring's data eventfd when it is empty and
+ * senders on its space eventfd when it is full, and either side only
+ * signals the other when it is sleeping.
+ */
+
+/**
+ * Creates the shared memory of an accepted connection and sends it to the client
+ * @param socket_iface connected socket
+ * @return int CSP_ERR_NONE if successful, otherwise CSP_ERR_DRIVER
+ */
+int socket_shm_server(csp_socket_handle_t * socket_iface);
+
+/**
+ * Receives and maps the shared memory of a connection from the server
+ * @param socket_iface connected socket
+ * @return int CSP_ERR_NONE if successful, otherwise CSP_ERR_DRIVER
+ */
+int socket_shm_client(csp_socket_handle_t * socket_iface);
+
+/**
+ * Gathers a message into the transmit ring
+ * @param socket_iface connected socket
+ * @param iov parts of the message
+ * @param iovcnt number of parts
+ * @param timeout max time (ms) to wait for space in the ring
+ * @return int CSP_ERR_NONE if successful, CSP_ERR_TIMEDOUT if the ring stayed full, otherwise CSP_ERR_DRIVER
+ */
+int socket_shm_send(csp_socket_handle_t * socket_iface, const struct iovec * iov, int iovcnt, uint32_t timeout);
+
+/**
+ * Waits for a message and scatters it out of the receive ring
+ * @param socket_iface connected socket
+ * @param iov buffers to store the message in, longer messages are truncated
+ * @param iovcnt number of buffers
+ * @return int number of bytes received, 0 if the connection was closed
+ */
+int socket_shm_recv(csp_socket_handle_t * socket_iface, const struct iovec * iov, int iovcnt);
+
+/**
+ * Unmaps the shared memory and closes the eventfds of a connection
+ * @param socket_iface connected socket
+ */
+void socket_shm_close(csp_socket_handle_t * socket_iface);
+
+#endif /* _SOCKET_SHM_H_ */
@@ -32,6 +32,16 @@ static int csp_i2c_handle = 0;
 
 int csp_i2c_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t timeout) {
 
+	/* The frame is built in the packet buffer, so a shared packet is copied.
+	 * The caller keeps its reference until the frame has been queued. */
+	csp_packet_t * shared = NULL;
+	if (csp_buffer_refcount(packet) > 1) {
+		shared = packet;
+		packet = csp_buffer_clone(shared);
+		if (packet == NULL)
+			return CSP_ERR_NOMEM;
+	}
+
 	/* Cast the CSP packet buffer into an i2c frame */
 	i2c_frame_t * frame = (i2c_frame_t *) packet;
 
@@ -56,8 +66,14 @@ int csp_i2c_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t timeout)
 	frame->retries = 0;
 
 	/* enqueue the frame */
-	if (i2c_send(csp_i2c_handle, frame, timeout) != E_NO_ERR)
+	if (i2c_send(csp_i2c_handle, frame, timeout) != E_NO_ERR) {
+		if (shared != NULL)
+			csp_buffer_free(packet);
 		return CSP_ERR_DRIVER;
+	}
+
+	if (shared != NULL)
+		csp_buffer_free(shared);
 
 	return CSP_ERR_NONE;
 
@@ -52,6 +52,11 @@ static int csp_kiss_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t
 	if (interface == NULL || interface->driver == NULL)
 		return CSP_ERR_DRIVER;
 
+	/* The packet is escaped in place, so it cannot be shared */
+	packet = csp_buffer_unshare(packet);
+	if (packet == NULL)
+		return CSP_ERR_NOMEM;
+
 	/* Add CRC32 checksum */
 	csp_crc32_append(packet, false);
 
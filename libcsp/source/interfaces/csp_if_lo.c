@@ -47,6 +47,11 @@ int csp_lo_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t timeout)
 		return CSP_ERR_NONE;
 	}
 
+	/* The receiver modifies the packet, so it cannot share it with the sender */
+	packet = csp_buffer_unshare(packet);
+	if (packet == NULL)
+		return CSP_ERR_NOMEM;
+
 	/* Send back into CSP, notice calling from task so last argument must be NULL! */
 	csp_qfifo_write(packet, &csp_if_lo, NULL);
 
@@ -16,6 +16,7 @@
 
 #include <csp/arch/csp_thread.h>
 #include <csp/csp.h>
+#include <csp/csp_endian.h>
 #include <csp/csp_error.h>
 #include <csp/csp_interface.h>
 #include <csp/drivers/socket.h>
@@ -26,6 +27,7 @@
 
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <tinycbor/cbor.h>
 
@@ -33,8 +35,8 @@
  * Callback function used by CSP to transmit packets
  * @param ifc csp socket interface
  * @param packet packet to send
- * @param timeout currently not used
- * @return int currently always returns CSP_ERR_NONE
+ * @param timeout max time (ms) to wait for space in a shared memory transport
+ * @return int CSP_ERR_NONE if sent, otherwise error
  */
 
 /**
@@ -42,6 +44,30 @@
  */
 CSP_DEFINE_TASK(csp_socket_rx);
 
+/**
+ * Sends a packet's length, id and data straight out of the packet buffer
+ */
+static int csp_socket_tx_raw(csp_socket_handle_t * socket_driver, csp_packet_t * packet, uint32_t timeout) {
+	/* The packet may be shared with the RDP retransmit window, so it is only read */
+	uint16_t length = csp_hton16(packet->length);
+	uint32_t id = csp_hton32(packet->id.ext);
+	struct iovec iov[3] = {
+		{ .iov_base = &length, .iov_len = sizeof(length) },
+		{ .iov_base = &id, .iov_len = sizeof(id) },
+		{ .iov_base = packet->data, .iov_len = packet->length }
+	};
+
+	int result = socket_sendv(socket_driver, iov, 3, timeout);
+	if (result != CSP_ERR_NONE) {
+		/* The caller still owns the packet */
+		return result;
+	}
+
+	csp_buffer_free(packet);
+
+	return CSP_ERR_NONE;
+}
+
 int csp_socket_tx(struct csp_iface_s * ifc, csp_packet_t * packet, uint32_t timeout) {
 	if ((ifc == NULL) || (ifc->driver == NULL)) {
 		csp_log_error("Null pointer for interface or driver\r\n");
@@ -54,15 +80,18 @@ int csp_socket_tx(struct csp_iface_s * ifc, csp_packet_t * packet, uint32_t time
 
 	csp_log_info("Is active? %d", socket_driver->is_active);
 
+	if (socket_driver->framing == CSP_SOCKET_FRAMING_RAW) {
+		return csp_socket_tx_raw(socket_driver, packet, timeout);
+	}
+
 	uint8_t write_buffer[SOCKET_BUFFER_SIZE];
 	int write_size = cbor_encode_csp_packet(packet, write_buffer);
 	if (write_size > 0) {
 		csp_log_info("about to write csp packet %d - %d\r\n", write_size, packet->length);
-		int result = send(socket_driver->socket_handle, write_buffer, write_size, MSG_NOSIGNAL);
+		int result = socket_send(socket_driver, write_buffer, write_size, timeout);
 		csp_log_info("csp_socket_tx write %d\r\n", result);
-		if (result < 0) {
-			csp_log_error("Socket write error: %u %s\r\n", result, strerror(result));
-			return CSP_ERR_DRIVER;
+		if (result != CSP_ERR_NONE) {
+			return result;
 		}
 		csp_buffer_free(packet);
 	} else {
@@ -72,10 +101,77 @@ int csp_socket_tx(struct csp_iface_s * ifc, csp_packet_t * packet, uint32_t time
 	return CSP_ERR_NONE;
 }
 
+/**
+ * Size of the packet buffers the rx task receives into
+ * @return uint16_t SOCKET_BUFFER_SIZE, or less if the buffers are smaller
+ */
+static uint16_t csp_socket_rx_size(void) {
+	int size = csp_buffer_size() - (int) CSP_BUFFER_PACKET_OVERHEAD;
+
+	return (size < SOCKET_BUFFER_SIZE) ? size : SOCKET_BUFFER_SIZE;
+}
+
+/**
+ * Receives a packet's length, id and data straight into the packet buffer
+ * @param size number of data bytes the packet buffer holds
+ * @return bool true if a valid packet was received
+ */
+static bool csp_socket_rx_raw(csp_socket_handle_t * socket_driver, csp_packet_t * packet, uint16_t size) {
+	uint16_t length;
+	struct iovec iov[3] = {
+		{ .iov_base = &length, .iov_len = sizeof(length) },
+		{ .iov_base = &(packet->id), .iov_len = sizeof(packet->id) },
+		{ .iov_base = packet->data, .iov_len = size }
+	};
+
+	int recv_size = socket_recvv(socket_driver, iov, 3);
+	if (recv_size <= 0) {
+		return false;
+	}
+
+	length = csp_ntoh16(length);
+	if ((recv_size >= (int) SOCKET_RAW_HEADER_SIZE) && (length > size)) {
+		/* The rest of the message was truncated */
+		csp_log_error("Dropping raw csp packet of %u bytes, buffers hold %u\r\n", length, size);
+		return false;
+	}
+
+	if ((recv_size < (int) SOCKET_RAW_HEADER_SIZE) || (length != (recv_size - SOCKET_RAW_HEADER_SIZE))) {
+		csp_log_error("Invalid raw csp packet of %d bytes\r\n", recv_size);
+		return false;
+	}
+
+	packet->length = length;
+	packet->id.ext = csp_ntoh32(packet->id.ext);
+
+	return true;
+}
+
+/**
+ * Receives a CBOR encoded packet and parses it into the packet buffer
+ * @return bool true if a valid packet was received
+ */
+static bool csp_socket_rx_cbor(csp_socket_handle_t * socket_driver, csp_packet_t * packet) {
+	char buffer[SOCKET_BUFFER_SIZE];
+
+	int recv_size = socket_recv(socket_driver, (void *)buffer, SOCKET_BUFFER_SIZE);
+	if (recv_size <= 0) {
+		return false;
+	}
+
+	if (!cbor_parse_csp_packet(packet, buffer, recv_size)) {
+		csp_log_error("Could not parse out csp packet");
+		return false;
+	}
+
+	return true;
+}
+
 CSP_DEFINE_TASK(csp_socket_rx) {
 	csp_iface_t socket_interface;
 	csp_socket_handle_t * socket_driver;
-	csp_packet_t * packet = csp_buffer_get(SOCKET_BUFFER_SIZE);
+	uint16_t rx_size = csp_socket_rx_size();
+	csp_packet_t * packet = csp_buffer_get(rx_size);
 
 	if (param == NULL) {
 		csp_log_error("No socket param found\r\n");
@@ -89,22 +185,23 @@ CSP_DEFINE_TASK(csp_socket_rx) {
 		csp_thread_exit();
 	}
 
+	if (packet == NULL) {
+		csp_log_error("Out of packet buffers\r\n");
+		csp_thread_exit();
+	}
+
 	socket_driver = socket_interface.driver;
 
-	char buffer[SOCKET_BUFFER_SIZE];
 	while (socket_driver->is_active) {
-		memset(buffer, '\0', SOCKET_BUFFER_SIZE);
-		int recv_size = recv(socket_driver->socket_handle, (void *)buffer, SOCKET_BUFFER_SIZE, 0);
-		if (recv_size > 0) {
-			if (cbor_parse_csp_packet(packet, buffer, recv_size)) {
-				csp_new_packet(packet, &socket_interface, NULL);
-				packet = csp_buffer_get(SOCKET_BUFFER_SIZE);
-				if (packet == NULL) {
-					csp_log_error("Out of packet buffers\r\n");
-					break;
-				}
-			} else {
-				csp_log_error("Could not parse out csp packet");
+		bool received = (socket_driver->framing == CSP_SOCKET_FRAMING_RAW)
+			? csp_socket_rx_raw(socket_driver, packet, rx_size)
+			: csp_socket_rx_cbor(socket_driver, packet);
+		if (received) {
+			csp_new_packet(packet, &socket_interface, NULL);
+			packet = csp_buffer_get(rx_size);
+			if (packet == NULL) {
+				csp_log_error("Out of packet buffers\r\n");
+				break;
 			}
 		}
 	}
@@ -140,9 +237,10 @@ int csp_socket_close(csp_iface_t * socket_iface, csp_socket_handle_t * socket_dr
 		return CSP_ERR_DRIVER;
 	}
 
-	socket_close(socket_driver);
-
+	/* Stops the RX thread first, it may still use shared memory socket_close unmaps */
 	csp_thread_kill((socket_driver->rx_thread_handle));
 
+	socket_close(socket_driver);
+
 	return CSP_ERR_NONE;
 }
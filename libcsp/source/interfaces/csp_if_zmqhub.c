@@ -42,6 +42,11 @@ static void * subscriber;
  */
 int csp_zmqhub_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t timeout) {
 
+	/* The envelope overwrites the length field, so the packet cannot be shared */
+	packet = csp_buffer_unshare(packet);
+	if (packet == NULL)
+		return CSP_ERR_NOMEM;
+
 	/* Send envelope */
 	char satid = (char) csp_rtable_find_mac(packet->id.dst);
 	if (satid == (char) 255)
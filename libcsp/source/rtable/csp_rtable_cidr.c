@@ -37,6 +37,21 @@ typedef struct __attribute__((__packed__)) csp_rtable_s {
 /* Routing entries are stored in a linked list*/
 static csp_rtable_t * rtable = NULL;
 
+/* Compiled route for a single host */
+typedef struct {
+	csp_iface_t * interface;
+	uint8_t mac;
+} csp_rtable_route_t;
+
+/* The list is compiled into a table indexed by host address whenever it
+ * changes, so forwarding a packet is a single array lookup. Two copies are
+ * kept so a new table can be built while the router reads the old one.
+ * The generation counts published tables and selects the current copy. A
+ * reader that sees it change during a lookup may have read a copy that was
+ * being rebuilt, so it looks again in the newly published one. */
+static csp_rtable_route_t rtable_compiled[2][CSP_ID_HOST_MAX + 1];
+static uint32_t rtable_generation;
+
 static csp_rtable_t * csp_rtable_find(uint8_t addr, uint8_t netmask, uint8_t exact) {
 
 	/* Remember best result */
@@ -88,6 +103,28 @@ static csp_rtable_t * csp_rtable_find(uint8_t addr, uint8_t netmask, uint8_t exa
 
 }
 
+static void csp_rtable_compile(void) {
+
+	uint32_t generation = __atomic_load_n(&rtable_generation, __ATOMIC_RELAXED) + 1;
+	csp_rtable_route_t * routes = rtable_compiled[generation & 1];
+	csp_rtable_t * entry;
+	int host;
+
+	/* Readers of this copy must see the previous generation change before
+	 * any of the writes below */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	for (host = 0; host <= CSP_ID_HOST_MAX; host++) {
+		entry = csp_rtable_find(host, CSP_ID_HOST_SIZE, 0);
+		__atomic_store_n(&routes[host].interface, entry ? entry->interface : NULL, __ATOMIC_RELAXED);
+		__atomic_store_n(&routes[host].mac, entry ? entry->mac : CSP_NODE_MAC, __ATOMIC_RELAXED);
+	}
+
+	/* Publish the new table */
+	__atomic_store_n(&rtable_generation, generation, __ATOMIC_RELEASE);
+
+}
+
 void csp_rtable_clear(void) {
 	for (csp_rtable_t * i = rtable; (i);) {
 		void * freeme = i;
@@ -95,6 +132,7 @@ void csp_rtable_clear(void) {
 		csp_free(freeme);
 	}
 	rtable = NULL;
+	csp_rtable_compile();
 
 	/* Set loopback up again */
 	csp_rtable_set(csp_get_address(), CSP_ID_HOST_SIZE, &csp_if_lo, CSP_NODE_MAC);
@@ -157,18 +195,32 @@ int csp_rtable_save(char * buffer, int maxlen) {
 	return len;
 }
 
+static csp_rtable_route_t csp_rtable_lookup(uint8_t id) {
+
+	csp_rtable_route_t route;
+	uint32_t generation;
+
+	do {
+		generation = __atomic_load_n(&rtable_generation, __ATOMIC_ACQUIRE);
+		route.interface = __atomic_load_n(&rtable_compiled[generation & 1][id].interface, __ATOMIC_RELAXED);
+		route.mac = __atomic_load_n(&rtable_compiled[generation & 1][id].mac, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (generation != __atomic_load_n(&rtable_generation, __ATOMIC_RELAXED));
+
+	return route;
+
+}
+
 csp_iface_t * csp_rtable_find_iface(uint8_t id) {
-	csp_rtable_t * entry = csp_rtable_find(id, CSP_ID_HOST_SIZE, 0);
-	if (entry == NULL)
+	if (id > CSP_ID_HOST_MAX)
 		return NULL;
-	return entry->interface;
+	return csp_rtable_lookup(id).interface;
 }
 
 uint8_t csp_rtable_find_mac(uint8_t id) {
-	csp_rtable_t * entry = csp_rtable_find(id, CSP_ID_HOST_SIZE, 0);
-	if (entry == NULL)
+	if (id > CSP_ID_HOST_MAX)
 		return 255;
-	return entry->mac;
+	return csp_rtable_lookup(id).mac;
 }
 
 int csp_rtable_set(uint8_t _address, uint8_t _netmask, csp_iface_t *ifc, uint8_t mac) {
@@ -215,6 +267,8 @@ int csp_rtable_set(uint8_t _address, uint8_t _netmask, csp_iface_t *ifc, uint8_t
 	entry->interface = ifc;
 	entry->mac = mac;
 
+	csp_rtable_compile();
+
 	return CSP_ERR_NONE;
 }
 
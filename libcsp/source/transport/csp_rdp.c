@@ -56,8 +56,14 @@ static uint32_t csp_rdp_delayed_acks = 1;
 static uint32_t csp_rdp_ack_timeout = 1000 / 4;
 static uint32_t csp_rdp_ack_delay_count = 4 / 2;
 
-/* Used for queue calls */
-static CSP_BASE_TYPE pdTrue = 1;
+/* Lower bound of the adaptive retransmission timeout (ms) */
+#define RDP_MIN_RTO 10
+
+/* Size of the buffer used for EACK packets */
+#define RDP_EACK_SIZE 100
+
+/* Connection flags which make csp_send_direct modify the packet */
+#define RDP_INPLACE_FLAGS (CSP_FHMAC | CSP_FXTEA | CSP_FCRC32)
 
 typedef struct __attribute__((__packed__)) {
 	/* The timestamp is placed in the padding bytes */
@@ -149,6 +155,150 @@ static inline int csp_rdp_time_after(uint32_t time, uint32_t cmp) {
 	return csp_rdp_time_before(cmp, time);
 }
 
+/**
+ * WINDOWS
+ * Unacknowledged and out of sequence packets are stored in the slot of their
+ * sequence number, so they are added, found and released without searching.
+ * Only sequence numbers inside the current window may be used, so no two
+ * stored packets share a slot.
+ */
+#define RDP_SLOT(seq) ((uint16_t)(seq) & (CSP_RDP_WINDOW_SLOTS - 1))
+#define RDP_BIT(slot) (1UL << ((slot) % 32))
+
+static inline int csp_rdp_window_has(csp_rdp_window_t * window, uint16_t seq) {
+	unsigned int slot = RDP_SLOT(seq);
+	return (window->used[slot / 32] & RDP_BIT(slot)) != 0;
+}
+
+static inline csp_packet_t * csp_rdp_window_get(csp_rdp_window_t * window, uint16_t seq) {
+	return csp_rdp_window_has(window, seq) ? window->slots[RDP_SLOT(seq)] : NULL;
+}
+
+/* Return 0 if a packet is already stored for seq */
+static inline int csp_rdp_window_put(csp_rdp_window_t * window, uint16_t seq, csp_packet_t * packet) {
+	unsigned int slot = RDP_SLOT(seq);
+	if (window->used[slot / 32] & RDP_BIT(slot))
+		return 0;
+	window->slots[slot] = packet;
+	window->used[slot / 32] |= RDP_BIT(slot);
+	window->resent[slot / 32] &= ~RDP_BIT(slot);
+	window->count++;
+	return 1;
+}
+
+/* Remove and return the packet stored for seq, resent is set if it was retransmitted */
+static inline csp_packet_t * csp_rdp_window_take(csp_rdp_window_t * window, uint16_t seq, int * resent) {
+	unsigned int slot = RDP_SLOT(seq);
+	if (!(window->used[slot / 32] & RDP_BIT(slot)))
+		return NULL;
+	if (resent)
+		*resent = (window->resent[slot / 32] & RDP_BIT(slot)) != 0;
+	window->used[slot / 32] &= ~RDP_BIT(slot);
+	window->count--;
+	return window->slots[slot];
+}
+
+static inline void csp_rdp_window_mark_resent(csp_rdp_window_t * window, uint16_t seq) {
+	unsigned int slot = RDP_SLOT(seq);
+	window->resent[slot / 32] |= RDP_BIT(slot);
+}
+
+static void csp_rdp_window_flush(csp_rdp_window_t * window) {
+	unsigned int slot;
+	for (slot = 0; slot < CSP_RDP_WINDOW_SLOTS; slot++) {
+		if (window->used[slot / 32] & RDP_BIT(slot)) {
+			csp_log_protocol("Flush window element, seq %u", csp_ntoh16(csp_rdp_header_ref(window->slots[slot])->seq_nr));
+			csp_buffer_free(window->slots[slot]);
+		}
+	}
+	memset(window->used, 0, sizeof(window->used));
+	memset(window->resent, 0, sizeof(window->resent));
+	window->count = 0;
+}
+
+/**
+ * Returns the packet to pass to the interface for a packet in the TX window.
+ * The buffer is shared with the window, unless sending modifies it or an
+ * earlier transmission still holds a reference to it.
+ */
+static csp_packet_t * csp_rdp_tx_copy(csp_conn_t * conn, csp_packet_t * packet) {
+	if ((conn->idout.flags & RDP_INPLACE_FLAGS) || csp_buffer_refcount(packet) > 1)
+		return csp_buffer_clone(packet);
+	return csp_buffer_ref(packet);
+}
+
+/**
+ * ROUND TRIP TIME
+ * The retransmission timeout follows the measured round trip time (RFC 6298).
+ * Retransmitted packets are not measured, since their ACK may belong to
+ * either transmission. The configured packet timeout is the initial and
+ * largest timeout.
+ */
+static void csp_rdp_rtt_reset(csp_conn_t * conn) {
+	conn->rdp.srtt = 0;
+	conn->rdp.rttvar = 0;
+	conn->rdp.rto = conn->rdp.packet_timeout;
+}
+
+static void csp_rdp_rtt_sample(csp_conn_t * conn, uint32_t rtt) {
+
+	int32_t delta;
+	uint32_t rto, min_rto;
+
+	if (conn->rdp.srtt == 0) {
+		conn->rdp.srtt = rtt << 3;
+		conn->rdp.rttvar = rtt << 1;
+	} else {
+		delta = (int32_t)rtt - (int32_t)(conn->rdp.srtt >> 3);
+		conn->rdp.srtt += delta;
+		if (delta < 0)
+			delta = -delta;
+		conn->rdp.rttvar += delta - (conn->rdp.rttvar >> 2);
+	}
+
+	/* Delayed ACKs may hold back the ACK of the last packet in a burst */
+	min_rto = RDP_MIN_RTO + (conn->rdp.delayed_acks ? conn->rdp.ack_timeout : 0);
+	rto = (conn->rdp.srtt >> 3) + conn->rdp.rttvar;
+	if (rto < min_rto)
+		rto = min_rto;
+	if (rto > conn->rdp.packet_timeout)
+		rto = conn->rdp.packet_timeout;
+	conn->rdp.rto = rto;
+
+	csp_log_protocol("RDP: RTT %"PRIu32", srtt %"PRIu32", rttvar %"PRIu32", rto %"PRIu32,
+			rtt, conn->rdp.srtt >> 3, conn->rdp.rttvar >> 2, conn->rdp.rto);
+
+}
+
+/**
+ * Frees the sent packets acknowledged by ack_nr. ACKs arriving out of order
+ * never move snd_una backwards.
+ */
+static void csp_rdp_tx_ack(csp_conn_t * conn, uint16_t ack_nr) {
+
+	uint16_t una = ack_nr + 1;
+	rdp_packet_t * packet;
+	int resent;
+
+	if (una == conn->rdp.snd_una || !csp_rdp_seq_between(una, conn->rdp.snd_una, conn->rdp.snd_nxt))
+		return;
+
+	csp_conn_lock(conn, CSP_MAX_DELAY);
+	while (conn->rdp.snd_una != una) {
+		packet = (rdp_packet_t *) csp_rdp_window_take(&conn->rdp.tx_window, conn->rdp.snd_una, &resent);
+		if (packet != NULL) {
+			/* Only the packet which was acknowledged is measured */
+			if (conn->rdp.snd_una == ack_nr && !resent)
+				csp_rdp_rtt_sample(conn, csp_get_ms() - packet->timestamp);
+			csp_log_protocol("TX Element %u acknowledged", conn->rdp.snd_una);
+			csp_buffer_free(packet);
+		}
+		conn->rdp.snd_una++;
+	}
+	csp_conn_unlock(conn);
+
+}
+
 /**
  * CONTROL MESSAGES
  * The following function is used to send empty messages,
@@ -175,13 +325,16 @@ static int csp_rdp_send_cmp(csp_conn_t * conn, csp_packet_t * packet, int flags,
 	header->syn = (flags & RDP_SYN) ? 1 : 0;
 	header->rst = (flags & RDP_RST) ? 1 : 0;
 
-	/* Send copy to tx_queue, before sending packet to IF */
+	/* Send copy to TX window, before sending packet to IF */
 	if (flags & RDP_SYN) {
-		rdp_packet_t * rdp_packet = csp_buffer_clone(packet);
+		rdp_packet_t * rdp_packet = (rdp_packet_t *) csp_rdp_tx_copy(conn, packet);
 		if (rdp_packet == NULL) return CSP_ERR_NOMEM;
 		rdp_packet->timestamp = csp_get_ms();
-		if (csp_queue_enqueue(conn->rdp.tx_queue, &rdp_packet, 0) != CSP_QUEUE_OK)
+		rdp_packet->quarantine = 0;
+		csp_conn_lock(conn, CSP_MAX_DELAY);
+		if (!csp_rdp_window_put(&conn->rdp.tx_window, seq_nr, (csp_packet_t *) rdp_packet))
 			csp_buffer_free(rdp_packet);
+		csp_conn_unlock(conn);
 	}
 
 	/* Send control messages with high priority */
@@ -213,31 +366,23 @@ static int csp_rdp_send_cmp(csp_conn_t * conn, csp_packet_t * packet, int flags,
 static int csp_rdp_send_eack(csp_conn_t * conn) {
 
 	/* Allocate message */
-	csp_packet_t * packet_eack = csp_buffer_get(100);
+	csp_packet_t * packet_eack = csp_buffer_get(RDP_EACK_SIZE);
 	if (packet_eack == NULL) return CSP_ERR_NOMEM;
-	packet_eack->length = 0;
 
-	/* Loop through RX queue */
-	int i, count;
-	csp_packet_t * packet;
-	count = csp_queue_size(conn->rdp.rx_queue);
-	for (i = 0; i < count; i++) {
-
-		if (csp_queue_dequeue_isr(conn->rdp.rx_queue, &packet, &pdTrue) != CSP_QUEUE_OK) {
-			csp_log_error("Cannot dequeue from rx_queue in queue deliver");
-			break;
+	/* Add the seq nr of every packet in the RX window, in order */
+	int i, count = 0;
+	int max = (RDP_EACK_SIZE - sizeof(rdp_header_t)) / sizeof(uint16_t);
+	uint16_t seq = conn->rdp.rcv_cur;
+	csp_conn_lock(conn, CSP_MAX_DELAY);
+	for (i = 0; i < CSP_RDP_WINDOW_SLOTS && count < conn->rdp.rx_window.count && count < max; i++) {
+		seq++;
+		if (csp_rdp_window_has(&conn->rdp.rx_window, seq)) {
+			packet_eack->data16[count++] = csp_hton16(seq);
+			csp_log_protocol("Added EACK nr %u", seq);
 		}
-
-		/* Add seq nr to EACK packet */
-		rdp_header_t * header = csp_rdp_header_ref(packet);
-		packet_eack->data16[packet_eack->length/sizeof(uint16_t)] = csp_hton16(header->seq_nr);
-		packet_eack->length += sizeof(uint16_t);
-		csp_log_protocol("Added EACK nr %u", header->seq_nr);
-
-		/* Requeue */
-		csp_queue_enqueue_isr(conn->rdp.rx_queue, &packet, &pdTrue);
-
 	}
+	csp_conn_unlock(conn);
+	packet_eack->length = count * sizeof(uint16_t);
 
 	return csp_rdp_send_cmp(conn, packet_eack, RDP_ACK | RDP_EAK, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
 
@@ -255,7 +400,7 @@ static int csp_rdp_send_syn(csp_conn_t * conn) {
 	if (packet == NULL) return CSP_ERR_NOMEM;
 
 	/* Generate contents */
-	packet->data32[0] = csp_hton32(csp_rdp_window_size);
+	packet->data32[0] = csp_hton32(conn->rdp.window_size);
 	packet->data32[1] = csp_hton32(csp_rdp_conn_timeout);
 	packet->data32[2] = csp_hton32(csp_rdp_packet_timeout);
 	packet->data32[3] = csp_hton32(csp_rdp_delayed_acks);
@@ -298,122 +443,75 @@ static inline int csp_rdp_receive_data(csp_conn_t * conn, csp_packet_t * packet)
 
 }
 
-static inline void csp_rdp_rx_queue_flush(csp_conn_t * conn) {
+static inline void csp_rdp_rx_window_flush(csp_conn_t * conn) {
 
-	/* Loop through RX queue */
-	int i, count;
 	csp_packet_t * packet;
 
-front:
-	count = csp_queue_size(conn->rdp.rx_queue);
-	for (i = 0; i < count; i++) {
-
-		if (csp_queue_dequeue_isr(conn->rdp.rx_queue, &packet, &pdTrue) != CSP_QUEUE_OK) {
-			csp_log_error("Cannot dequeue from rx_queue in queue deliver");
-			break;
-		}
-
-		rdp_header_t * header = csp_rdp_header_ref(packet);
-		csp_log_protocol("RX Queue deliver matching Element, seq %u", header->seq_nr);
-
-		/* If the matching packet was found: */
-		if (header->seq_nr == (uint16_t)(conn->rdp.rcv_cur + 1)) {
-			csp_log_protocol("Deliver seq %u", header->seq_nr);
-			csp_rdp_receive_data(conn, packet);
-			conn->rdp.rcv_cur++;
-			/* Loop from first element again */
-			goto front;
-
-		/* Otherwise, requeue */
-		} else {
-			csp_queue_enqueue_isr(conn->rdp.rx_queue, &packet, &pdTrue);
-		}
-
+	/* Deliver the packets which are now in sequence */
+	csp_conn_lock(conn, CSP_MAX_DELAY);
+	while ((packet = csp_rdp_window_take(&conn->rdp.rx_window, conn->rdp.rcv_cur + 1, NULL)) != NULL) {
+		csp_log_protocol("Deliver seq %u", (uint16_t)(conn->rdp.rcv_cur + 1));
+		if (csp_rdp_receive_data(conn, packet) != CSP_ERR_NONE)
+			csp_buffer_free(packet);
+		conn->rdp.rcv_cur++;
 	}
+	csp_conn_unlock(conn);
 
 }
 
-static inline bool csp_rdp_seq_in_rx_queue(csp_conn_t * conn, uint16_t seq_nr) {
+static inline int csp_rdp_rx_window_add(csp_conn_t * conn, csp_packet_t * packet, uint16_t seq_nr) {
 
-	/* Loop through RX queue */
-	int i, count;
-	rdp_packet_t * packet;
-	count = csp_queue_size(conn->rdp.rx_queue);
-	for (i = 0; i < count; i++) {
+	int added;
 
-		if (csp_queue_dequeue_isr(conn->rdp.rx_queue, &packet, &pdTrue) != CSP_QUEUE_OK) {
-			csp_log_error("Cannot dequeue from rx_queue in queue exists");
-			break;
-		}
-
-		csp_queue_enqueue_isr(conn->rdp.rx_queue, &packet, &pdTrue);
+	csp_conn_lock(conn, CSP_MAX_DELAY);
+	added = csp_rdp_window_put(&conn->rdp.rx_window, seq_nr, packet);
+	csp_conn_unlock(conn);
 
-		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *) packet);
-		csp_log_protocol("RX Queue exists matching Element, seq %u", header->seq_nr);
-
-		/* If the matching packet was found, deliver */
-		if (header->seq_nr == seq_nr) {
-			csp_log_protocol("We have a match");
-			return true;
-		}
-
-	}
-
-	return false;
-
-}
-
-static inline int csp_rdp_rx_queue_add(csp_conn_t * conn, csp_packet_t * packet, uint16_t seq_nr) {
-
-	if (csp_rdp_seq_in_rx_queue(conn, seq_nr))
-		return CSP_QUEUE_ERROR;
-	return csp_queue_enqueue_isr(conn->rdp.rx_queue, &packet, &pdTrue);
+	return added ? CSP_QUEUE_OK : CSP_QUEUE_ERROR;
 
 }
 
 static void csp_rdp_flush_eack(csp_conn_t * conn, csp_packet_t * eack_packet) {
 
-	/* Loop through TX queue */
-	int i, j, count;
+	int i, count = (eack_packet->length - sizeof(rdp_header_t)) / sizeof(uint16_t);
+	int found = 0;
+	uint16_t seq, highest = 0;
+	uint32_t time_now = csp_get_ms();
 	rdp_packet_t * packet;
-	count = csp_queue_size(conn->rdp.tx_queue);
-	for (i = 0; i < count; i++) {
 
-		if (csp_queue_dequeue(conn->rdp.tx_queue, &packet, 0) != CSP_QUEUE_OK) {
-			csp_log_error("Cannot dequeue from tx_queue in flush EACK");
-			break;
-		}
+	csp_conn_lock(conn, CSP_MAX_DELAY);
 
-		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *) packet);
-		csp_log_protocol("EACK compare element, time %u, seq %u", packet->timestamp, csp_ntoh16(header->seq_nr));
-
-		/* Look for this element in EACKs */
-		int match = 0;
-		for (j = 0; j < (int)((eack_packet->length - sizeof(rdp_header_t)) / sizeof(uint16_t)); j++) {
-			if (csp_ntoh16(eack_packet->data16[j]) == csp_ntoh16(header->seq_nr))
-				match = 1;
-
-			/* Enable this if you want EACK's to trigger retransmission */
-			if (csp_ntoh16(eack_packet->data16[j]) > csp_ntoh16(header->seq_nr)) {
-				uint32_t time_now = csp_get_ms();
-				if (csp_rdp_time_after(time_now, packet->quarantine)) {
-					packet->timestamp = time_now - conn->rdp.packet_timeout - 1;
-					packet->quarantine = time_now +	conn->rdp.packet_timeout / 2;
-				}
-			}
-		}
+	/* Free the packets the receiver already has */
+	for (i = 0; i < count; i++) {
+		seq = csp_ntoh16(eack_packet->data16[i]);
+		if (!csp_rdp_seq_between(seq, conn->rdp.snd_una, conn->rdp.snd_nxt - 1))
+			continue;
 
-		if (match == 0) {
-			/* If not found, put back on tx queue */
-			csp_queue_enqueue(conn->rdp.tx_queue, &packet, 0);
-		} else {
-			/* Found, free */
-			csp_log_protocol("TX Element %u freed", csp_ntoh16(header->seq_nr));
+		if (!found || csp_rdp_seq_after(seq, highest))
+			highest = seq;
+		found = 1;
+
+		packet = (rdp_packet_t *) csp_rdp_window_take(&conn->rdp.tx_window, seq, NULL);
+		if (packet != NULL) {
+			csp_log_protocol("TX Element %u freed", seq);
 			csp_buffer_free(packet);
 		}
+	}
 
+	/* Packets sent before the newest one received were probably lost,
+	 * have them retransmitted by the next timeout check */
+	for (seq = conn->rdp.snd_una; found && csp_rdp_seq_before(seq, highest); seq++) {
+		packet = (rdp_packet_t *) csp_rdp_window_get(&conn->rdp.tx_window, seq);
+		if (packet != NULL && csp_rdp_time_after(time_now, packet->quarantine)) {
+			csp_log_protocol("EACK retransmit seq %u", seq);
+			packet->timestamp = time_now - conn->rdp.rto - 1;
+			packet->quarantine = time_now + conn->rdp.rto / 2;
+			csp_rdp_window_mark_resent(&conn->rdp.tx_window, seq);
+		}
 	}
 
+	csp_conn_unlock(conn);
+
 }
 
 static inline bool csp_rdp_should_ack(csp_conn_t * conn) {
@@ -442,28 +540,16 @@ static inline bool csp_rdp_should_ack(csp_conn_t * conn) {
 
 void csp_rdp_flush_all(csp_conn_t * conn) {
 
-	if ((conn == NULL) || conn->rdp.tx_queue == NULL) {
+	if (conn == NULL) {
 		csp_log_error("Null pointer passed to rdp flush all");
 		return;
 	}
 
-	rdp_packet_t * packet;
-
-	/* Empty TX queue */
-	while (csp_queue_dequeue_isr(conn->rdp.tx_queue, &packet, &pdTrue) == CSP_QUEUE_OK) {
-		if (packet != NULL) {
-			csp_log_protocol("Flush TX Element, time %u, seq %u", packet->timestamp, csp_ntoh16(csp_rdp_header_ref((csp_packet_t *) packet)->seq_nr));
-			csp_buffer_free(packet);
-		}
-	}
-
-	/* Empty RX queue */
-	while (csp_queue_dequeue_isr(conn->rdp.rx_queue, &packet, &pdTrue) == CSP_QUEUE_OK) {
-		if (packet != NULL) {
-			csp_log_protocol("Flush RX Element, time %u, seq %u", packet->timestamp, csp_ntoh16(csp_rdp_header_ref((csp_packet_t *) packet)->seq_nr));
-			csp_buffer_free(packet);
-		}
-	}
+	/* Empty TX and RX windows */
+	csp_conn_lock(conn, CSP_MAX_DELAY);
+	csp_rdp_window_flush(&conn->rdp.tx_window);
+	csp_rdp_window_flush(&conn->rdp.rx_window);
+	csp_conn_unlock(conn);
 
 }
 
@@ -495,6 +581,8 @@ int csp_rdp_check_ack(csp_conn_t * conn) {
 void csp_rdp_check_timeouts(csp_conn_t * conn) {
 
 	rdp_packet_t * packet;
+	uint16_t seq;
+	int backoff = 0;
 
 	/**
 	 * CONNECTION TIMEOUT:
@@ -525,47 +613,44 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 	 * MESSAGE TIMEOUT:
 	 * Check each outgoing message for TX timeout
 	 */
-	int i, count;
-	count = csp_queue_size(conn->rdp.tx_queue);
-	for (i = 0; i < count; i++) {
-
-		if ((csp_queue_dequeue_isr(conn->rdp.tx_queue, &packet, &pdTrue) != CSP_QUEUE_OK) || packet == NULL) {
-			csp_log_warn("Cannot dequeue from tx_queue in check timeout");
-			break;
-		}
-
-		/* Get header */
-		rdp_header_t * header = csp_rdp_header_ref((csp_packet_t *) packet);
+	csp_conn_lock(conn, CSP_MAX_DELAY);
+	for (seq = conn->rdp.snd_una; conn->rdp.tx_window.count > 0 && csp_rdp_seq_before(seq, conn->rdp.snd_nxt); seq++) {
 
-		/* If acked, do not retransmit */
-		if (csp_rdp_seq_before(csp_ntoh16(header->seq_nr), conn->rdp.snd_una)) {
-			csp_log_protocol("TX Element Free, time %u, seq %u, una %u", packet->timestamp, csp_ntoh16(header->seq_nr), conn->rdp.snd_una);
-			csp_buffer_free(packet);
+		/* Packets already EACKed are gone from the window */
+		packet = (rdp_packet_t *) csp_rdp_window_get(&conn->rdp.tx_window, seq);
+		if (packet == NULL)
 			continue;
-		}
 
 		/* Check timestamp and retransmit if needed */
-		if (csp_rdp_time_after(time_now, packet->timestamp + conn->rdp.packet_timeout)) {
-			csp_log_protocol("TX Element timed out, retransmitting seq %u", csp_ntoh16(header->seq_nr));
+		if (csp_rdp_time_after(time_now, packet->timestamp + conn->rdp.rto)) {
+			csp_log_protocol("TX Element timed out, retransmitting seq %u", seq);
+
+			/* Send to IF, the packet stays in the TX window */
+			packet->timestamp = time_now;
+			csp_rdp_window_mark_resent(&conn->rdp.tx_window, seq);
+			backoff = 1;
+			csp_packet_t * new_packet = csp_rdp_tx_copy(conn, (csp_packet_t *) packet);
 
 			/* Update to latest outgoing ACK */
-			header->ack_nr = csp_hton16(conn->rdp.rcv_cur);
+			if (new_packet != NULL)
+				csp_rdp_header_ref(new_packet)->ack_nr = csp_hton16(conn->rdp.rcv_cur);
 
-			/* Send copy to tx_queue */
-			packet->timestamp = csp_get_ms();
-			csp_packet_t * new_packet = csp_buffer_clone(packet);
 			csp_iface_t * ifout = csp_rtable_find_iface(conn->idout.dst);
-			if (csp_send_direct(conn->idout, new_packet, ifout, 0) != CSP_ERR_NONE) {
+			if (new_packet != NULL && csp_send_direct(conn->idout, new_packet, ifout, 0) != CSP_ERR_NONE) {
 				csp_log_warn("Retransmission failed");
 				csp_buffer_free(new_packet);
 			}
 
 		}
 
-		/* Requeue the TX element */
-		csp_queue_enqueue_isr(conn->rdp.tx_queue, &packet, &pdTrue);
+	}
 
+	/* Back off once per check, until packets are acknowledged again */
+	if (backoff) {
+		conn->rdp.rto = (conn->rdp.rto * 2 < conn->rdp.packet_timeout) ? conn->rdp.rto * 2 : conn->rdp.packet_timeout;
+		csp_log_protocol("RDP: Retransmission timeout backed off to %"PRIu32, conn->rdp.rto);
 	}
+	csp_conn_unlock(conn);
 
 	/**
 	 * ACK TIMEOUT:
@@ -573,11 +658,10 @@ void csp_rdp_check_timeouts(csp_conn_t * conn) {
 	 */
 	csp_rdp_check_ack(conn);
 
-	/* Wake user task if TX queue is ready for more data */
+	/* Wake user task if TX window is ready for more data */
 	if (conn->rdp.state == RDP_OPEN)
-		if (csp_queue_size(conn->rdp.tx_queue) < (int)conn->rdp.window_size)
-			if (csp_rdp_seq_before(conn->rdp.snd_nxt - conn->rdp.snd_una, conn->rdp.window_size * 2))
-				csp_bin_sem_post(&conn->rdp.tx_wait);
+		if ((uint16_t)(conn->rdp.snd_nxt - conn->rdp.snd_una) < conn->rdp.window_size)
+			csp_bin_sem_post(&conn->rdp.tx_wait);
 
 }
 
@@ -599,7 +683,7 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 
 		if (rx_header->ack) {
 			/* Store current ack'ed sequence number */
-			conn->rdp.snd_una = rx_header->ack_nr + 1;
+			csp_rdp_tx_ack(conn, rx_header->ack_nr);
 		}
 
 		if (conn->rdp.state == RDP_CLOSE_WAIT || conn->rdp.state == RDP_CLOSED) {
@@ -653,6 +737,8 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 
 		/* Store RDP options */
 		conn->rdp.window_size 		= csp_ntoh32(packet->data32[0]);
+		if (conn->rdp.window_size > CSP_RDP_MAX_WINDOW)
+			conn->rdp.window_size = CSP_RDP_MAX_WINDOW;
 		conn->rdp.conn_timeout 		= csp_ntoh32(packet->data32[1]);
 		conn->rdp.packet_timeout 	= csp_ntoh32(packet->data32[2]);
 		conn->rdp.delayed_acks 		= csp_ntoh32(packet->data32[3]);
@@ -662,6 +748,7 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 				conn->rdp.window_size, conn->rdp.conn_timeout, conn->rdp.packet_timeout);
 		csp_log_protocol("RDP: Delayed acks: %u, ack timeout %u, ack each %u packet",
 				conn->rdp.delayed_acks, conn->rdp.ack_timeout, conn->rdp.ack_delay_count);
+		csp_rdp_rtt_reset(conn);
 
 		/* Connection accepted */
 		conn->rdp.state = RDP_SYN_RCVD;
@@ -685,7 +772,7 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			conn->rdp.rcv_cur = rx_header->seq_nr;
 			conn->rdp.rcv_irs = rx_header->seq_nr;
 			conn->rdp.rcv_lsa = rx_header->seq_nr - 1;
-			conn->rdp.snd_una = rx_header->ack_nr + 1;
+			csp_rdp_tx_ack(conn, rx_header->ack_nr);
 			conn->rdp.ack_timestamp = csp_get_ms();
 			conn->rdp.state = RDP_OPEN;
 
@@ -773,8 +860,8 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			conn->rdp.state = RDP_OPEN;
 		}
 
-		/* Store current ack'ed sequence number */
-		conn->rdp.snd_una = rx_header->ack_nr + 1;
+		/* Free acknowledged packets */
+		csp_rdp_tx_ack(conn, rx_header->ack_nr);
 
 		/* We have an EACK */
 		if (rx_header->eak) {
@@ -789,7 +876,7 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 
 		/* If message is not in sequence, send EACK and store packet */
 		if (rx_header->seq_nr != (uint16_t)(conn->rdp.rcv_cur + 1)) {
-			if (csp_rdp_rx_queue_add(conn, packet, rx_header->seq_nr) != CSP_QUEUE_OK) {
+			if (csp_rdp_rx_window_add(conn, packet, rx_header->seq_nr) != CSP_QUEUE_OK) {
 				csp_log_protocol("Duplicate sequence number");
 				goto discard_open;
 			}
@@ -821,8 +908,8 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			csp_log_protocol("Less than one window free in RX_queue, deferring acknowledgment for %"PRIu16, conn->rdp.rcv_cur);
 		}
 
-		/* Flush RX queue */
-		csp_rdp_rx_queue_flush(conn);
+		/* Deliver packets from the RX window which are now in sequence */
+		csp_rdp_rx_window_flush(conn);
 
 		goto accepted_open;
 
@@ -844,8 +931,8 @@ void csp_rdp_new_packet(csp_conn_t * conn, csp_packet_t * packet) {
 			goto discard_open;
 		}
 
-		/* Store current ack'ed sequence number */
-		conn->rdp.snd_una = rx_header->ack_nr + 1;
+		/* Free acknowledged packets */
+		csp_rdp_tx_ack(conn, rx_header->ack_nr);
 
 		/* Send back a reset */
 		csp_rdp_send_cmp(conn, NULL, RDP_ACK | RDP_RST, conn->rdp.snd_nxt, conn->rdp.rcv_cur);
@@ -878,13 +965,14 @@ int csp_rdp_connect(csp_conn_t * conn, uint32_t timeout) {
 
 	int retry = 1;
 
-	conn->rdp.window_size	 = csp_rdp_window_size;
+	conn->rdp.window_size	 = (csp_rdp_window_size < CSP_RDP_MAX_WINDOW) ? csp_rdp_window_size : CSP_RDP_MAX_WINDOW;
 	conn->rdp.conn_timeout	= csp_rdp_conn_timeout;
 	conn->rdp.packet_timeout  = csp_rdp_packet_timeout;
 	conn->rdp.delayed_acks	= csp_rdp_delayed_acks;
 	conn->rdp.ack_timeout 	  = csp_rdp_ack_timeout;
 	conn->rdp.ack_delay_count = csp_rdp_ack_delay_count;
 	conn->rdp.ack_timestamp   = csp_get_ms();
+	csp_rdp_rtt_reset(conn);
 
 retry:
 	csp_log_protocol("RDP: Active connect, conn state %u", conn->rdp.state);
@@ -948,20 +1036,19 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout) {
 		return CSP_ERR_RESET;
 	}
 
-	/* If TX window is full, wait here */
-	uint16_t in_flight = conn->rdp.snd_nxt - conn->rdp.snd_una + 1;
-	if (in_flight > conn->rdp.window_size) {
+	/* If TX window is full, wait here. The router task wakes us on window
+	 * updates, which may still leave the window full. */
+	while ((uint16_t)(conn->rdp.snd_nxt - conn->rdp.snd_una) >= conn->rdp.window_size) {
 		csp_log_protocol("RDP: Waiting for window update before sending seq %u", conn->rdp.snd_nxt);
-		csp_bin_sem_wait(&conn->rdp.tx_wait, 0);
 		if ((csp_bin_sem_wait(&conn->rdp.tx_wait, conn->rdp.conn_timeout)) != CSP_SEMAPHORE_OK) {
 			csp_log_error("Timeout during send");
 			return CSP_ERR_TIMEDOUT;
 		}
-	}
 
-	if (conn->rdp.state != RDP_OPEN) {
-		csp_log_error("RDP: ERROR cannot send, connection reset");
-		return CSP_ERR_RESET;
+		if (conn->rdp.state != RDP_OPEN) {
+			csp_log_error("RDP: ERROR cannot send, connection reset");
+			return CSP_ERR_RESET;
+		}
 	}
 
 	/* Add RDP header */
@@ -970,8 +1057,8 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout) {
 	tx_header->seq_nr = csp_hton16(conn->rdp.snd_nxt);
 	tx_header->ack = 1;
 
-	/* Send copy to tx_queue */
-	rdp_packet_t * rdp_packet = csp_buffer_clone(packet);
+	/* Send copy to TX window, usually sharing the buffer with the IF */
+	rdp_packet_t * rdp_packet = (rdp_packet_t *) csp_rdp_tx_copy(conn, packet);
 	if (rdp_packet == NULL) {
 		csp_log_error("Failed to allocate packet buffer");
 		return CSP_ERR_NOMEM;
@@ -979,11 +1066,15 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout) {
 
 	rdp_packet->timestamp = csp_get_ms();
 	rdp_packet->quarantine = 0;
-	if (csp_queue_enqueue(conn->rdp.tx_queue, &rdp_packet, 0) != CSP_QUEUE_OK) {
-		csp_log_error("No more space in RDP retransmit queue");
+	csp_conn_lock(conn, CSP_MAX_DELAY);
+	if (!csp_rdp_window_put(&conn->rdp.tx_window, conn->rdp.snd_nxt, (csp_packet_t *) rdp_packet)) {
+		csp_conn_unlock(conn);
+		csp_log_error("No more space in RDP retransmit window");
 		csp_buffer_free(rdp_packet);
 		return CSP_ERR_NOBUFS;
 	}
+	conn->rdp.snd_nxt++;
+	csp_conn_unlock(conn);
 
 	csp_log_protocol("RDP: Sending  in S %u: syn %u, ack %u, eack %u, "
 				"rst %u, seq_nr %5u, ack_nr %5u, packet_len %u (%u)",
@@ -991,19 +1082,21 @@ int csp_rdp_send(csp_conn_t * conn, csp_packet_t * packet, uint32_t timeout) {
 				tx_header->rst, csp_ntoh16(tx_header->seq_nr), csp_ntoh16(tx_header->ack_nr),
 				packet->length, packet->length - sizeof(rdp_header_t));
 
-	conn->rdp.snd_nxt++;
 	return CSP_ERR_NONE;
 
 }
 
 int csp_rdp_allocate(csp_conn_t * conn) {
 
-	csp_log_buffer("RDP: Creating RDP queues for conn %p", conn);
+	csp_log_buffer("RDP: Creating RDP windows for conn %p", conn);
 
 	/* Set initial state */
 	conn->rdp.state = RDP_CLOSED;
 	conn->rdp.conn_timeout = csp_rdp_conn_timeout;
 	conn->rdp.packet_timeout = csp_rdp_packet_timeout;
+	csp_rdp_rtt_reset(conn);
+	memset(&conn->rdp.tx_window, 0, sizeof(conn->rdp.tx_window));
+	memset(&conn->rdp.rx_window, 0, sizeof(conn->rdp.rx_window));
 
 	/* Create a binary semaphore to wait on for tasks */
 	if (csp_bin_sem_create(&conn->rdp.tx_wait) != CSP_SEMAPHORE_OK) {
@@ -1011,23 +1104,6 @@ int csp_rdp_allocate(csp_conn_t * conn) {
 		return CSP_ERR_NOMEM;
 	}
 
-	/* Create TX queue */
-	conn->rdp.tx_queue = csp_queue_create(CSP_RDP_MAX_WINDOW, sizeof(csp_packet_t *));
-	if (conn->rdp.tx_queue == NULL) {
-		csp_log_error("Failed to create TX queue for conn");
-		csp_bin_sem_remove(&conn->rdp.tx_wait);
-		return CSP_ERR_NOMEM;
-	}
-
-	/* Create RX queue */
-	conn->rdp.rx_queue = csp_queue_create(CSP_RDP_MAX_WINDOW * 2, sizeof(csp_packet_t *));
-	if (conn->rdp.rx_queue == NULL) {
-		csp_log_error("Failed to create RX queue for conn");
-		csp_bin_sem_remove(&conn->rdp.tx_wait);
-		csp_queue_remove(conn->rdp.tx_queue);
-		return CSP_ERR_NOMEM;
-	}
-
 	return CSP_ERR_NONE;
 
 }
@@ -1097,8 +1173,8 @@ void csp_rdp_conn_print(csp_conn_t * conn) {
 	if (conn == NULL)
 		return;
 
-	printf("\tRDP: State %"PRIu16", rcv %"PRIu16", snd %"PRIu16", win %"PRIu32"\r\n",
-			conn->rdp.state, conn->rdp.rcv_cur, conn->rdp.snd_una, conn->rdp.window_size);
+	printf("\tRDP: State %"PRIu16", rcv %"PRIu16", snd %"PRIu16", win %"PRIu32", rto %"PRIu32"\r\n",
+			conn->rdp.state, conn->rdp.rcv_cur, conn->rdp.snd_una, conn->rdp.window_size, conn->rdp.rto);
 
 }
 #endif
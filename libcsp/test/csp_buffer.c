@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmocka.h>
+#include <csp/csp.h>
+#include <csp/csp_crc32.h>
+
+#ifdef CSP_USE_HMAC
+#include "crypto/csp_hmac.h"
+#endif
+
+static void test_get_free(void ** arg) {
+	csp_packet_t * packets[4];
+	int i;
+
+	assert_int_equal(csp_buffer_init(4, 100), CSP_ERR_NONE);
+	assert_int_equal(csp_buffer_remaining(), 4);
+
+	for (i = 0; i < 4; i++) {
+		packets[i] = csp_buffer_get(100);
+		assert_non_null(packets[i]);
+	}
+
+	assert_int_equal(csp_buffer_remaining(), 0);
+	assert_null(csp_buffer_get(10));
+
+	for (i = 0; i < 4; i++)
+		csp_buffer_free(packets[i]);
+
+	assert_int_equal(csp_buffer_remaining(), 4);
+
+	/* Double free must not corrupt the pool */
+	csp_buffer_free(packets[0]);
+	assert_int_equal(csp_buffer_remaining(), 4);
+
+	csp_buffer_cleanup();
+}
+
+static void test_get_too_large(void ** arg) {
+	assert_int_equal(csp_buffer_init(2, 100), CSP_ERR_NONE);
+
+	assert_null(csp_buffer_get(101));
+	assert_int_equal(csp_buffer_remaining(), 2);
+
+	csp_buffer_cleanup();
+}
+
+static void test_clone(void ** arg) {
+	csp_packet_t *packet, *clone;
+
+	assert_int_equal(csp_buffer_init(2, 100), CSP_ERR_NONE);
+
+	packet = csp_buffer_get(100);
+	assert_non_null(packet);
+
+	sprintf((char *) packet->data, "test1234test");
+	packet->length = strlen((char *) packet->data);
+
+	clone = csp_buffer_clone(packet);
+	assert_non_null(clone);
+	assert_int_equal(clone->length, packet->length);
+	assert_memory_equal(clone->data, packet->data, packet->length);
+
+	csp_buffer_free(packet);
+	csp_buffer_free(clone);
+	assert_int_equal(csp_buffer_remaining(), 2);
+
+	csp_buffer_cleanup();
+}
+
+static void test_ref(void ** arg) {
+	csp_packet_t *packet, *copy;
+
+	assert_int_equal(csp_buffer_init(2, 100), CSP_ERR_NONE);
+
+	packet = csp_buffer_get(100);
+	assert_non_null(packet);
+	assert_int_equal(csp_buffer_refcount(packet), 1);
+
+	/* Unshared buffers are returned as they are */
+	assert_ptr_equal(csp_buffer_unshare(packet), packet);
+
+	/* A reference shares the buffer, which stays allocated until both are freed */
+	assert_ptr_equal(csp_buffer_ref(packet), packet);
+	assert_int_equal(csp_buffer_refcount(packet), 2);
+	assert_int_equal(csp_buffer_remaining(), 1);
+
+	packet->length = 4;
+	memcpy(packet->data, "test", 4);
+	copy = csp_buffer_unshare(packet);
+	assert_non_null(copy);
+	assert_ptr_not_equal(copy, packet);
+	assert_memory_equal(copy->data, "test", 4);
+	assert_int_equal(csp_buffer_refcount(packet), 1);
+	assert_int_equal(csp_buffer_remaining(), 0);
+
+	/* Without free buffers a shared buffer cannot be unshared */
+	assert_ptr_equal(csp_buffer_ref(packet), packet);
+	assert_null(csp_buffer_unshare(packet));
+	assert_int_equal(csp_buffer_refcount(packet), 2);
+
+	csp_buffer_free(packet);
+	assert_int_equal(csp_buffer_remaining(), 0);
+	csp_buffer_free(packet);
+	csp_buffer_free(copy);
+	assert_int_equal(csp_buffer_remaining(), 2);
+
+	/* Free buffers cannot be referenced */
+	assert_null(csp_buffer_ref(packet));
+	assert_int_equal(csp_buffer_refcount(packet), 0);
+
+	csp_buffer_cleanup();
+}
+
+#ifdef CSP_BUFFER_LOCKFREE
+static void test_size_classes(void ** arg) {
+	const int counts[] = {2, 1};
+	const int sizes[] = {16, 256};
+	csp_packet_t *small1, *small2, *small3, *large;
+
+	assert_int_equal(csp_buffer_init_classes(2, counts, sizes), CSP_ERR_NONE);
+	assert_int_equal(csp_buffer_remaining(), 3);
+	assert_int_equal(csp_buffer_size(), 256 + CSP_BUFFER_PACKET_OVERHEAD);
+
+	small1 = csp_buffer_get(4);
+	small2 = csp_buffer_get(16);
+	assert_non_null(small1);
+	assert_non_null(small2);
+
+	/* Small class is exhausted, so this one spills into the large class */
+	small3 = csp_buffer_get(4);
+	assert_non_null(small3);
+
+	/* ... which leaves nothing for a large request */
+	large = csp_buffer_get(200);
+	assert_null(large);
+
+	csp_buffer_free(small3);
+	large = csp_buffer_get(200);
+	assert_non_null(large);
+
+	csp_buffer_free(small1);
+	csp_buffer_free(small2);
+	csp_buffer_free(large);
+	assert_int_equal(csp_buffer_remaining(), 3);
+
+	csp_buffer_cleanup();
+}
+
+static void test_trailer_room(void ** arg) {
+	const int counts[] = {2, 1};
+	const int sizes[] = {16, 256};
+	csp_packet_t *packet, *next;
+	int i;
+
+	assert_int_equal(csp_buffer_init_classes(2, counts, sizes), CSP_ERR_NONE);
+
+	/* Both come from the smallest class, next right after packet */
+	packet = csp_buffer_get(1);
+	next = csp_buffer_get(16);
+	assert_non_null(packet);
+	assert_non_null(next);
+
+	memset(next->data, 0x5a, 16);
+	next->length = 16;
+
+	memset(packet->data, 0xa5, 16);
+	packet->length = 16;
+#ifdef CSP_USE_HMAC
+	csp_hmac_set_key("key", 3);
+	assert_int_equal(csp_hmac_append(packet, true), CSP_ERR_NONE);
+#endif
+#ifdef CSP_USE_CRC32
+	assert_int_equal(csp_crc32_append(packet, true), CSP_ERR_NONE);
+#endif
+	/* What remains of the trailer room, as RDP and SFP headers would use */
+	memset(&packet->data[packet->length], 0xff, 16 + CSP_BUFFER_TRAILER_MAX - packet->length);
+
+	/* The next buffer is untouched and still frees cleanly */
+	assert_int_equal(next->length, 16);
+	assert_int_equal(csp_buffer_refcount(next), 1);
+	for (i = 0; i < 16; i++)
+		assert_int_equal(next->data[i], 0x5a);
+
+	csp_buffer_free(packet);
+	csp_buffer_free(next);
+	assert_int_equal(csp_buffer_remaining(), 3);
+
+	csp_buffer_cleanup();
+}
+
+static void test_invalid_classes(void ** arg) {
+	const int counts[] = {2, 2};
+	const int sizes[] = {256, 16};
+
+	assert_int_equal(csp_buffer_init_classes(2, counts, sizes), CSP_ERR_INVAL);
+	assert_int_equal(csp_buffer_init_classes(0, counts, sizes), CSP_ERR_INVAL);
+}
+#endif
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_get_free),
+		cmocka_unit_test(test_get_too_large),
+		cmocka_unit_test(test_clone),
+		cmocka_unit_test(test_ref),
+#ifdef CSP_BUFFER_LOCKFREE
+		cmocka_unit_test(test_size_classes),
+		cmocka_unit_test(test_trailer_room),
+		cmocka_unit_test(test_invalid_classes),
+#endif
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that every CRC32 kernel available on this machine agrees with the
+ * byte-wise reference, then benchmarks them from tiny frames up to the MTU.
+ */
+
+#include <cmocka.h>
+#include <stdlib.h>
+#include <time.h>
+#include <csp/csp.h>
+#include <csp/csp_crc32.h>
+
+#define BENCH_BYTES		(16 * 1024 * 1024)
+#define BUFFER_SIZE		(1024 + 8)
+
+static const struct {
+	csp_crc32_kernel_t kernel;
+	const char * name;
+} kernels[] = {
+	{CSP_CRC32_KERNEL_BYTE, "byte"},
+	{CSP_CRC32_KERNEL_SLICE8, "slice8"},
+	{CSP_CRC32_KERNEL_SSE42, "sse4.2"},
+	{CSP_CRC32_KERNEL_ARMV8, "armv8"},
+};
+
+#define KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static const unsigned int bench_sizes[] = {4, 16, 64, 128, 256, 1024};
+
+static uint8_t data[BUFFER_SIZE];
+
+static int setup(void ** arg) {
+	unsigned int i;
+
+	srand(1);
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = rand();
+
+	return 0;
+}
+
+static void test_check_value(void ** arg) {
+	unsigned int k;
+
+	for (k = 0; k < KERNELS; k++) {
+		if (csp_crc32_set_kernel(kernels[k].kernel) != CSP_ERR_NONE)
+			continue;
+		/* Standard CRC-32C check value */
+		assert_int_equal(csp_crc32_memory((const uint8_t *) "123456789", 9), 0xE3069283);
+	}
+}
+
+static void test_kernels_agree(void ** arg) {
+	unsigned int k, offset, length;
+	uint32_t reference;
+
+	for (offset = 0; offset < 8; offset++) {
+		for (length = 0; length <= 300; length++) {
+			assert_int_equal(csp_crc32_set_kernel(CSP_CRC32_KERNEL_BYTE), CSP_ERR_NONE);
+			reference = csp_crc32_memory(&data[offset], length);
+
+			for (k = 0; k < KERNELS; k++) {
+				if (csp_crc32_set_kernel(kernels[k].kernel) != CSP_ERR_NONE)
+					continue;
+				assert_int_equal(csp_crc32_memory(&data[offset], length), reference);
+			}
+		}
+	}
+}
+
+static void test_auto(void ** arg) {
+	csp_crc32_gentab();
+	assert_int_not_equal(csp_crc32_get_kernel(), CSP_CRC32_KERNEL_AUTO);
+
+	csp_crc32_set_kernel(CSP_CRC32_KERNEL_AUTO);
+	assert_int_not_equal(csp_crc32_get_kernel(), CSP_CRC32_KERNEL_AUTO);
+}
+
+static void bench_crc32(void ** arg) {
+	unsigned int k, s, i, iterations;
+	struct timespec start, end;
+	volatile uint32_t sink = 0;
+	double seconds;
+
+	for (s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+		iterations = BENCH_BYTES / bench_sizes[s];
+
+		for (k = 0; k < KERNELS; k++) {
+			if (csp_crc32_set_kernel(kernels[k].kernel) != CSP_ERR_NONE)
+				continue;
+
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (i = 0; i < iterations; i++)
+				sink ^= csp_crc32_memory(data, bench_sizes[s]);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+
+			seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+			print_message("%5u B %-7s %8.1f MB/s %7.1f ns/call\n", bench_sizes[s], kernels[k].name,
+					(double) iterations * bench_sizes[s] / seconds / 1e6, seconds * 1e9 / iterations);
+		}
+	}
+
+	(void) sink;
+	csp_crc32_gentab();
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_check_value),
+		cmocka_unit_test(test_kernels_agree),
+		cmocka_unit_test(test_auto),
+		cmocka_unit_test(bench_crc32),
+	};
+
+	return cmocka_run_group_tests(tests, setup, NULL);
+}
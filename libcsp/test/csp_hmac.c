@@ -0,0 +1,300 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that every SHA1 kernel available on this machine agrees with the
+ * portable one and that packet HMACs match RFC 2202, then benchmarks them.
+ */
+
+#include <cmocka.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <csp/csp.h>
+
+#include "crypto/csp_hmac.h"
+#include "crypto/csp_sha1.h"
+
+#define BENCH_BYTES		(16 * 1024 * 1024)
+#define BUFFER_SIZE		(1024 + 8)
+#define KEY_CHANGES		2000
+#define KEY_THREADS		3
+
+#ifdef CSP_USE_HMAC
+
+static const struct {
+	csp_sha1_kernel_t kernel;
+	const char * name;
+} kernels[] = {
+	{CSP_SHA1_KERNEL_GENERIC, "generic"},
+	{CSP_SHA1_KERNEL_SHANI, "sha-ni"},
+	{CSP_SHA1_KERNEL_ARMV8, "armv8"},
+};
+
+#define KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static const unsigned int bench_sizes[] = {16, 64, 128, 256, 1024};
+
+static uint8_t data[BUFFER_SIZE];
+
+static int setup(void ** arg) {
+	unsigned int i;
+
+	srand(1);
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = rand();
+
+	return 0;
+}
+
+static void test_sha1_vectors(void ** arg) {
+	const uint8_t abc[] = {
+		0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e,
+		0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d};
+	const uint8_t two_blocks[] = {
+		0x84, 0x98, 0x3e, 0x44, 0x1c, 0x3b, 0xd2, 0x6e, 0xba, 0xae,
+		0x4a, 0xa1, 0xf9, 0x51, 0x29, 0xe5, 0xe5, 0x46, 0x70, 0xf1};
+	const char * msg = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	uint8_t hash[SHA1_DIGESTSIZE];
+	unsigned int k;
+
+	for (k = 0; k < KERNELS; k++) {
+		if (csp_sha1_set_kernel(kernels[k].kernel) != CSP_ERR_NONE)
+			continue;
+		/* FIPS 180-2 examples */
+		csp_sha1_memory((const uint8_t *) "abc", 3, hash);
+		assert_memory_equal(hash, abc, SHA1_DIGESTSIZE);
+		csp_sha1_memory((const uint8_t *) msg, strlen(msg), hash);
+		assert_memory_equal(hash, two_blocks, SHA1_DIGESTSIZE);
+	}
+}
+
+static void test_sha1_kernels_agree(void ** arg) {
+	uint8_t reference[SHA1_DIGESTSIZE];
+	uint8_t hash[SHA1_DIGESTSIZE];
+	unsigned int k, offset, length;
+	csp_sha1_state md;
+
+	for (offset = 0; offset < 8; offset++) {
+		for (length = 0; length <= 300; length++) {
+			assert_int_equal(csp_sha1_set_kernel(CSP_SHA1_KERNEL_GENERIC), CSP_ERR_NONE);
+			csp_sha1_memory(&data[offset], length, reference);
+
+			for (k = 0; k < KERNELS; k++) {
+				if (csp_sha1_set_kernel(kernels[k].kernel) != CSP_ERR_NONE)
+					continue;
+				csp_sha1_memory(&data[offset], length, hash);
+				assert_memory_equal(hash, reference, SHA1_DIGESTSIZE);
+
+				/* Also in pieces that straddle block boundaries */
+				csp_sha1_init(&md);
+				csp_sha1_process(&md, &data[offset], length / 3);
+				csp_sha1_process(&md, &data[offset + length / 3], length - length / 3);
+				csp_sha1_done(&md, hash);
+				assert_memory_equal(hash, reference, SHA1_DIGESTSIZE);
+			}
+		}
+	}
+}
+
+static void test_auto(void ** arg) {
+	assert_int_equal(csp_sha1_set_kernel(CSP_SHA1_KERNEL_AUTO), CSP_ERR_NONE);
+	assert_int_not_equal(csp_sha1_get_kernel(), CSP_SHA1_KERNEL_AUTO);
+}
+
+static void test_hmac_vectors(void ** arg) {
+	const uint8_t key[20] = {
+		0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b,
+		0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b};
+	const uint8_t expected[] = {
+		0xb6, 0x17, 0x31, 0x86, 0x55, 0x05, 0x72, 0x64, 0xe2, 0x8b,
+		0xc0, 0xb6, 0xfb, 0x37, 0x8c, 0x8e, 0xf1, 0x46, 0xbe, 0x00};
+	uint8_t long_key[80];
+	const uint8_t long_expected[] = {
+		0xaa, 0x4a, 0xe5, 0xe1, 0x52, 0x72, 0xd0, 0x0e, 0x95, 0x70,
+		0x56, 0x37, 0xce, 0x8a, 0x3b, 0x55, 0xed, 0x40, 0x21, 0x12};
+	const char * long_msg = "Test Using Larger Than Block-Size Key - Hash Key First";
+	uint8_t hmac[SHA1_DIGESTSIZE];
+	unsigned int k;
+
+	memset(long_key, 0xaa, sizeof(long_key));
+
+	for (k = 0; k < KERNELS; k++) {
+		if (csp_sha1_set_kernel(kernels[k].kernel) != CSP_ERR_NONE)
+			continue;
+		/* RFC 2202 test cases 1 and 6 */
+		assert_int_equal(csp_hmac_memory(key, sizeof(key), (const uint8_t *) "Hi There", 8, hmac), CSP_ERR_NONE);
+		assert_memory_equal(hmac, expected, SHA1_DIGESTSIZE);
+		assert_int_equal(csp_hmac_memory(long_key, sizeof(long_key), (const uint8_t *) long_msg, strlen(long_msg), hmac), CSP_ERR_NONE);
+		assert_memory_equal(hmac, long_expected, SHA1_DIGESTSIZE);
+	}
+}
+
+static void test_hmac_packet(void ** arg) {
+	csp_packet_t * packet = malloc(sizeof(csp_packet_t) + 64);
+	char key[] = "secret";
+
+	assert_non_null(packet);
+	csp_sha1_set_kernel(CSP_SHA1_KERNEL_AUTO);
+	csp_hmac_set_key(key, strlen(key));
+
+	memcpy(packet->data, data, 32);
+	packet->length = 32;
+	assert_int_equal(csp_hmac_append(packet, false), CSP_ERR_NONE);
+	assert_int_equal(packet->length, 32 + CSP_HMAC_LENGTH);
+	assert_int_equal(csp_hmac_verify(packet, false), CSP_ERR_NONE);
+	assert_int_equal(packet->length, 32);
+
+	/* Any change to the data or to the key is noticed */
+	assert_int_equal(csp_hmac_append(packet, false), CSP_ERR_NONE);
+	packet->data[0] ^= 1;
+	assert_int_equal(csp_hmac_verify(packet, false), CSP_ERR_HMAC);
+	packet->data[0] ^= 1;
+
+	csp_hmac_set_key("other", 5);
+	assert_int_equal(csp_hmac_verify(packet, false), CSP_ERR_HMAC);
+	csp_hmac_set_key(key, strlen(key));
+	assert_int_equal(csp_hmac_verify(packet, false), CSP_ERR_NONE);
+
+	free(packet);
+}
+
+static const uint8_t * key_hmacs[2];
+static volatile bool key_changing;
+static unsigned int key_mismatches;
+
+static void * key_reader(void * arg) {
+	csp_packet_t * packet = malloc(sizeof(csp_packet_t) + 64);
+	unsigned int mismatches = 0;
+
+	while (key_changing) {
+		memcpy(packet->data, data, 32);
+		packet->length = 32;
+		csp_hmac_append(packet, false);
+		if (memcmp(&packet->data[32], key_hmacs[0], CSP_HMAC_LENGTH) != 0
+				&& memcmp(&packet->data[32], key_hmacs[1], CSP_HMAC_LENGTH) != 0)
+			mismatches++;
+	}
+
+	__atomic_add_fetch(&key_mismatches, mismatches, __ATOMIC_RELAXED);
+	free(packet);
+	return NULL;
+}
+
+static void test_hmac_key_change(void ** arg) {
+	char * keys[2] = {"first", "second"};
+	uint8_t hmacs[2][SHA1_DIGESTSIZE];
+	uint8_t derived[SHA1_DIGESTSIZE];
+	pthread_t readers[KEY_THREADS];
+	unsigned int i;
+
+	/* The HMAC of the test data under either key, csp_hmac_set_key uses
+	 * the first 16 bytes of the SHA1 of the key */
+	for (i = 0; i < 2; i++) {
+		csp_sha1_memory((uint8_t *) keys[i], strlen(keys[i]), derived);
+		csp_hmac_memory(derived, 16, data, 32, hmacs[i]);
+		key_hmacs[i] = hmacs[i];
+	}
+
+	/* Every packet is authenticated with one whole key while they change */
+	csp_hmac_set_key(keys[0], strlen(keys[0]));
+	key_changing = true;
+	key_mismatches = 0;
+	for (i = 0; i < KEY_THREADS; i++)
+		assert_int_equal(pthread_create(&readers[i], NULL, key_reader, NULL), 0);
+
+	for (i = 0; i < KEY_CHANGES; i++)
+		csp_hmac_set_key(keys[i % 2], strlen(keys[i % 2]));
+
+	key_changing = false;
+	for (i = 0; i < KEY_THREADS; i++)
+		pthread_join(readers[i], NULL);
+
+	assert_int_equal(key_mismatches, 0);
+}
+
+static void bench_hmac(void ** arg) {
+	csp_packet_t * packet = malloc(sizeof(csp_packet_t) + BUFFER_SIZE + CSP_HMAC_LENGTH);
+	uint8_t key[16] = {0};
+	uint8_t hmac[SHA1_DIGESTSIZE];
+	unsigned int k, s, i, iterations;
+	struct timespec start, end;
+	double seconds, keyed;
+
+	assert_non_null(packet);
+	memcpy(packet->data, data, BUFFER_SIZE);
+
+	for (s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+		iterations = BENCH_BYTES / bench_sizes[s] / 8;
+
+		for (k = 0; k < KERNELS; k++) {
+			if (csp_sha1_set_kernel(kernels[k].kernel) != CSP_ERR_NONE)
+				continue;
+
+			/* Hashing the key blocks for every packet */
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (i = 0; i < iterations; i++)
+				csp_hmac_memory(key, sizeof(key), packet->data, bench_sizes[s], hmac);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+			/* Starting from the state saved by csp_hmac_set_key */
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			for (i = 0; i < iterations; i++) {
+				packet->length = bench_sizes[s];
+				csp_hmac_append(packet, false);
+			}
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			keyed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+			print_message("%5u B %-7s %7.1f ns/packet, %7.1f ns/packet keyed\n", bench_sizes[s], kernels[k].name,
+					seconds * 1e9 / iterations, keyed * 1e9 / iterations);
+		}
+	}
+
+	free(packet);
+	csp_sha1_set_kernel(CSP_SHA1_KERNEL_AUTO);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_sha1_vectors),
+		cmocka_unit_test(test_sha1_kernels_agree),
+		cmocka_unit_test(test_auto),
+		cmocka_unit_test(test_hmac_vectors),
+		cmocka_unit_test(test_hmac_packet),
+		cmocka_unit_test(test_hmac_key_change),
+		cmocka_unit_test(bench_hmac),
+	};
+
+	return cmocka_run_group_tests(tests, setup, NULL);
+}
+
+#else
+
+static void test_hmac(void ** arg) {
+	skip();
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_hmac),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+#endif
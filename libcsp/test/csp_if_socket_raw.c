@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmocka.h>
+#include <csp/csp.h>
+#include <csp/csp_endian.h>
+#include <csp/drivers/socket.h>
+#include <csp/interfaces/csp_if_socket.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define TEST_ADDRESS 1
+#define TEST_REMOTE_ADDRESS 2
+#define TEST_PORT 10
+#define TEST_REMOTE_PORT 11
+
+#define TEST_SMALL_BUFFER_SIZE 32
+
+static char msg[] = "test123test";
+static char long_msg[TEST_SMALL_BUFFER_SIZE + 8];
+
+static csp_iface_t csp_socket_if;
+static csp_socket_handle_t socket_driver;
+static int peer;
+static int buffer_size = 256;
+
+/**
+ * Builds a raw frame the way a peer would send it
+ */
+static size_t build_frame(uint8_t * frame, const char * data, uint16_t length, uint8_t src, uint8_t dst, uint8_t dport, uint8_t sport) {
+	csp_id_t id = {
+		.pri = CSP_PRIO_NORM,
+		.src = src,
+		.dst = dst,
+		.dport = dport,
+		.sport = sport,
+		.flags = 0
+	};
+	uint16_t length_be = csp_hton16(length);
+
+	id.ext = csp_hton32(id.ext);
+	memcpy(frame, &length_be, sizeof(length_be));
+	memcpy(frame + sizeof(length_be), &id, sizeof(id));
+	memcpy(frame + SOCKET_RAW_HEADER_SIZE, data, length);
+
+	return SOCKET_RAW_HEADER_SIZE + length;
+}
+
+static int setup(void ** arg) {
+	int fds[2];
+
+	assert_int_equal(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds), 0);
+	peer = fds[1];
+
+	memset(&socket_driver, 0, sizeof(socket_driver));
+	socket_driver.socket_handle = fds[0];
+	socket_driver.is_active = true;
+	socket_driver.transport = CSP_SOCKET_TRANSPORT_UNIX;
+	socket_driver.framing = CSP_SOCKET_FRAMING_RAW;
+
+	csp_buffer_init(20, buffer_size);
+	assert_int_equal(csp_init(TEST_ADDRESS), CSP_ERR_NONE);
+	csp_route_start_task(500, 1);
+
+	memset(&csp_socket_if, 0, sizeof(csp_socket_if));
+	assert_int_equal(csp_socket_init(&csp_socket_if, &socket_driver), CSP_ERR_NONE);
+	csp_route_set(TEST_REMOTE_ADDRESS, &csp_socket_if, CSP_NODE_MAC);
+
+	return 0;
+}
+
+static int setup_small_buffers(void ** arg) {
+	buffer_size = TEST_SMALL_BUFFER_SIZE;
+	return setup(arg);
+}
+
+static int teardown(void ** arg) {
+	close(peer);
+	csp_socket_close(&csp_socket_if, &socket_driver);
+	csp_route_end_task();
+	csp_terminate();
+	csp_buffer_cleanup();
+	buffer_size = 256;
+
+	return 0;
+}
+
+static void test_raw_tx(void ** arg) {
+	uint8_t frame[SOCKET_BUFFER_SIZE];
+	uint8_t expected[SOCKET_BUFFER_SIZE];
+	csp_packet_t * packet = csp_buffer_get(sizeof(msg));
+
+	assert_non_null(packet);
+	memcpy(packet->data, msg, sizeof(msg));
+	packet->length = sizeof(msg);
+	assert_int_equal(csp_sendto(CSP_PRIO_NORM, TEST_REMOTE_ADDRESS, TEST_REMOTE_PORT, TEST_PORT, CSP_O_NONE, packet, 1000), CSP_ERR_NONE);
+
+	size_t expected_size = build_frame(expected, msg, sizeof(msg), TEST_ADDRESS, TEST_REMOTE_ADDRESS, TEST_REMOTE_PORT, TEST_PORT);
+	assert_int_equal(recv(peer, frame, sizeof(frame), 0), expected_size);
+	assert_memory_equal(frame, expected, expected_size);
+}
+
+static void test_raw_rx(void ** arg) {
+	uint8_t frame[SOCKET_BUFFER_SIZE];
+	csp_socket_t * socket = csp_socket(CSP_SO_CONN_LESS);
+	csp_packet_t * packet;
+	size_t frame_size;
+
+	assert_non_null(socket);
+	assert_int_equal(csp_bind(socket, TEST_PORT), CSP_ERR_NONE);
+
+	/* Frames which are too short or whose length is wrong are dropped */
+	frame_size = build_frame(frame, msg, sizeof(msg), TEST_REMOTE_ADDRESS, TEST_ADDRESS, TEST_PORT, TEST_REMOTE_PORT);
+	assert_int_equal(send(peer, frame, SOCKET_RAW_HEADER_SIZE - 1, 0), SOCKET_RAW_HEADER_SIZE - 1);
+	assert_int_equal(send(peer, frame, frame_size - 1, 0), frame_size - 1);
+
+	assert_int_equal(send(peer, frame, frame_size, 0), frame_size);
+
+	packet = csp_recvfrom(socket, 1000);
+	assert_non_null(packet);
+	assert_int_equal(packet->length, sizeof(msg));
+	assert_memory_equal(packet->data, msg, sizeof(msg));
+	assert_int_equal(packet->id.src, TEST_REMOTE_ADDRESS);
+	assert_int_equal(packet->id.dst, TEST_ADDRESS);
+	assert_int_equal(packet->id.dport, TEST_PORT);
+	assert_int_equal(packet->id.sport, TEST_REMOTE_PORT);
+	csp_buffer_free(packet);
+
+	assert_null(csp_recvfrom(socket, 50));
+
+	csp_close_socket(socket);
+}
+
+static void test_raw_rx_small_buffers(void ** arg) {
+	uint8_t frame[SOCKET_BUFFER_SIZE];
+	csp_socket_t * socket = csp_socket(CSP_SO_CONN_LESS);
+	csp_packet_t * packet;
+	size_t frame_size;
+
+	assert_non_null(socket);
+	assert_int_equal(csp_bind(socket, TEST_PORT), CSP_ERR_NONE);
+
+	/* A frame larger than the buffers is dropped instead of overrunning them */
+	memset(long_msg, 'x', sizeof(long_msg));
+	frame_size = build_frame(frame, long_msg, sizeof(long_msg), TEST_REMOTE_ADDRESS, TEST_ADDRESS, TEST_PORT, TEST_REMOTE_PORT);
+	assert_int_equal(send(peer, frame, frame_size, 0), frame_size);
+
+	frame_size = build_frame(frame, msg, sizeof(msg), TEST_REMOTE_ADDRESS, TEST_ADDRESS, TEST_PORT, TEST_REMOTE_PORT);
+	assert_int_equal(send(peer, frame, frame_size, 0), frame_size);
+
+	packet = csp_recvfrom(socket, 1000);
+	assert_non_null(packet);
+	assert_int_equal(packet->length, sizeof(msg));
+	assert_memory_equal(packet->data, msg, sizeof(msg));
+	csp_buffer_free(packet);
+
+	assert_null(csp_recvfrom(socket, 50));
+
+	csp_close_socket(socket);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_raw_tx, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_raw_rx, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_raw_rx_small_buffers, setup_small_buffers, teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
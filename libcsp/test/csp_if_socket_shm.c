@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmocka.h>
+#include <csp/csp.h>
+#include <csp/drivers/socket.h>
+#include <csp/interfaces/csp_if_socket.h>
+
+#define TEST_SOCKET_PORT 8190
+/* Enough messages to wrap around the rings several times */
+#define TEST_NUM_MSGS ((4 * CSP_SOCKET_SHM_SIZE) / sizeof(test_msg))
+
+static char test_msg[] = "test123test test123test test123test";
+
+CSP_DEFINE_TASK(client_task) {
+	csp_socket_handle_t socket_driver;
+	char buffer[SOCKET_BUFFER_SIZE];
+	unsigned int i;
+	int tries = 0;
+
+	while ((tries++ < 50) && (socket_init_transport(&socket_driver, CSP_SOCKET_CLIENT, TEST_SOCKET_PORT,
+			CSP_SOCKET_TRANSPORT_SHM) != CSP_ERR_NONE)) {
+		csp_sleep_ms(10);
+	}
+	assert_true(socket_driver.is_active);
+
+	/* Echoes every message back to the server */
+	for (i = 0; i < TEST_NUM_MSGS; i++) {
+		int size = socket_recv(&socket_driver, buffer, sizeof(buffer));
+		assert_int_equal(size, sizeof(test_msg));
+		assert_int_equal(socket_send(&socket_driver, buffer, size, 1000), CSP_ERR_NONE);
+	}
+
+	/* Messages longer than the buffer are truncated */
+	assert_int_equal(socket_recv(&socket_driver, buffer, 4), 4);
+	assert_memory_equal(buffer, test_msg, 4);
+
+	/* The server closing wakes up a waiting receiver */
+	assert_int_equal(socket_recv(&socket_driver, buffer, sizeof(buffer)), 0);
+
+	assert_int_equal(socket_close(&socket_driver), CSP_ERR_NONE);
+
+	csp_thread_exit();
+}
+
+static void test_socket_shm(void ** arg) {
+	csp_socket_handle_t socket_driver;
+	csp_thread_handle_t client_task_handle;
+	char buffer[SOCKET_BUFFER_SIZE];
+	unsigned int sent = 0, received = 0;
+
+	csp_thread_create(client_task, "CLIENT", 1024, NULL, 0, &client_task_handle);
+
+	assert_int_equal(socket_init_transport(&socket_driver, CSP_SOCKET_SERVER, TEST_SOCKET_PORT,
+			CSP_SOCKET_TRANSPORT_SHM), CSP_ERR_NONE);
+	assert_true(socket_driver.is_active);
+	assert_non_null(socket_driver.shm);
+
+	/* Keeps a few messages in flight in both directions */
+	while (received < TEST_NUM_MSGS) {
+		while ((sent < TEST_NUM_MSGS) && ((sent - received) < 16)) {
+			test_msg[0] = 'a' + (sent % 26);
+			assert_int_equal(socket_send(&socket_driver, test_msg, sizeof(test_msg), 1000), CSP_ERR_NONE);
+			sent++;
+		}
+
+		assert_int_equal(socket_recv(&socket_driver, buffer, sizeof(buffer)), sizeof(test_msg));
+		assert_int_equal(buffer[0], 'a' + (received % 26));
+		assert_memory_equal(buffer + 1, test_msg + 1, sizeof(test_msg) - 1);
+		received++;
+	}
+
+	/* Read by the client with a smaller buffer */
+	assert_int_equal(socket_send(&socket_driver, test_msg, sizeof(test_msg), 1000), CSP_ERR_NONE);
+	csp_sleep_ms(50);
+
+	assert_int_equal(socket_close(&socket_driver), CSP_ERR_NONE);
+	assert_false(socket_driver.is_active);
+	assert_null(socket_driver.shm);
+
+	csp_thread_kill(client_task_handle);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_socket_shm),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Checks the csp_queue semantics the stack relies on, then measures
+ * throughput with several producers and consumers, and the round trip
+ * latency of a blocked consumer being woken up.
+ */
+
+#include <cmocka.h>
+#include <pthread.h>
+#include <time.h>
+#include <csp/csp.h>
+#include <csp/arch/csp_queue.h>
+
+#define BENCH_ITEMS		1000000
+#define BENCH_PINGS		50000
+#define BENCH_LENGTH	64
+#define BENCH_THREADS	4
+
+typedef struct {
+	csp_queue_handle_t queue;
+	unsigned int count;
+	uint64_t sum;
+} worker_t;
+
+static double elapsed(const struct timespec * start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void test_fifo_order(void ** arg) {
+	csp_queue_handle_t queue;
+	int i, value;
+
+	queue = csp_queue_create(5, sizeof(int));
+	assert_non_null(queue);
+
+	for (i = 0; i < 5; i++)
+		assert_int_equal(csp_queue_enqueue(queue, &i, 0), CSP_QUEUE_OK);
+
+	assert_int_equal(csp_queue_size(queue), 5);
+	assert_int_equal(csp_queue_enqueue(queue, &i, 0), CSP_QUEUE_FULL);
+
+	for (i = 0; i < 5; i++) {
+		assert_int_equal(csp_queue_dequeue(queue, &value, 0), CSP_QUEUE_OK);
+		assert_int_equal(value, i);
+	}
+
+	assert_int_equal(csp_queue_size(queue), 0);
+	assert_int_equal(csp_queue_dequeue(queue, &value, 0), CSP_QUEUE_ERROR);
+
+	csp_queue_remove(queue);
+}
+
+static void test_wraparound(void ** arg) {
+	csp_queue_handle_t queue;
+	uint8_t value, out;
+	int i;
+
+	/* Odd length and item size, many laps around the ring */
+	queue = csp_queue_create(3, sizeof(value));
+	assert_non_null(queue);
+
+	for (i = 0; i < 1000; i++) {
+		value = i;
+		assert_int_equal(csp_queue_enqueue(queue, &value, 0), CSP_QUEUE_OK);
+		if (i % 2) {
+			assert_int_equal(csp_queue_dequeue(queue, &out, 0), CSP_QUEUE_OK);
+			assert_int_equal(csp_queue_dequeue(queue, &out, 0), CSP_QUEUE_OK);
+			assert_int_equal(out, value);
+		}
+	}
+
+	csp_queue_remove(queue);
+}
+
+static void test_timeout(void ** arg) {
+	csp_queue_handle_t queue;
+	struct timespec start;
+	int value = 0;
+
+	queue = csp_queue_create(1, sizeof(int));
+	assert_non_null(queue);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	assert_int_equal(csp_queue_dequeue(queue, &value, 50), CSP_QUEUE_ERROR);
+	assert_true(elapsed(&start) >= 0.045);
+
+	assert_int_equal(csp_queue_enqueue(queue, &value, 0), CSP_QUEUE_OK);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	assert_int_equal(csp_queue_enqueue(queue, &value, 50), CSP_QUEUE_FULL);
+	assert_true(elapsed(&start) >= 0.045);
+
+	csp_queue_remove(queue);
+}
+
+static void * producer(void * arg) {
+	worker_t * worker = arg;
+	unsigned int i;
+
+	for (i = 1; i <= worker->count; i++) {
+		if (csp_queue_enqueue(worker->queue, &i, CSP_MAX_DELAY) != CSP_QUEUE_OK)
+			break;
+		worker->sum += i;
+	}
+
+	return NULL;
+}
+
+static void * consumer(void * arg) {
+	worker_t * worker = arg;
+	unsigned int i, value;
+
+	for (i = 0; i < worker->count; i++) {
+		if (csp_queue_dequeue(worker->queue, &value, CSP_MAX_DELAY) != CSP_QUEUE_OK)
+			break;
+		worker->sum += value;
+	}
+
+	return NULL;
+}
+
+static double run_mpmc(unsigned int threads, unsigned int items) {
+	pthread_t producers[BENCH_THREADS], consumers[BENCH_THREADS];
+	worker_t put[BENCH_THREADS] = {}, get[BENCH_THREADS] = {};
+	uint64_t put_sum = 0, get_sum = 0;
+	struct timespec start;
+	double seconds;
+	unsigned int i;
+
+	csp_queue_handle_t queue = csp_queue_create(BENCH_LENGTH, sizeof(unsigned int));
+	assert_non_null(queue);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < threads; i++) {
+		put[i].queue = get[i].queue = queue;
+		put[i].count = get[i].count = items / threads;
+		pthread_create(&consumers[i], NULL, consumer, &get[i]);
+		pthread_create(&producers[i], NULL, producer, &put[i]);
+	}
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(producers[i], NULL);
+		pthread_join(consumers[i], NULL);
+		put_sum += put[i].sum;
+		get_sum += get[i].sum;
+	}
+
+	seconds = elapsed(&start);
+
+	/* Every item must come out exactly once */
+	assert_true(put_sum == get_sum);
+	assert_int_equal(csp_queue_size(queue), 0);
+
+	csp_queue_remove(queue);
+
+	return seconds;
+}
+
+static void test_mpmc(void ** arg) {
+	run_mpmc(BENCH_THREADS, 100000);
+}
+
+static void bench_throughput(void ** arg) {
+	unsigned int threads;
+	double seconds;
+
+	for (threads = 1; threads <= BENCH_THREADS; threads *= 2) {
+		seconds = run_mpmc(threads, BENCH_ITEMS);
+		print_message("%u producer(s), %u consumer(s): %8.2f Mitems/s\n", threads, threads, BENCH_ITEMS / seconds / 1e6);
+	}
+}
+
+static void * echo(void * arg) {
+	csp_queue_handle_t * queues = arg;
+	unsigned int value;
+
+	while (csp_queue_dequeue(queues[0], &value, CSP_MAX_DELAY) == CSP_QUEUE_OK) {
+		csp_queue_enqueue(queues[1], &value, CSP_MAX_DELAY);
+		if (value == 0)
+			break;
+	}
+
+	return NULL;
+}
+
+static void bench_latency(void ** arg) {
+	csp_queue_handle_t queues[2];
+	struct timespec start;
+	unsigned int i, value;
+	pthread_t thread;
+	double seconds;
+
+	queues[0] = csp_queue_create(1, sizeof(unsigned int));
+	queues[1] = csp_queue_create(1, sizeof(unsigned int));
+	pthread_create(&thread, NULL, echo, queues);
+
+	/* Each round trip wakes the echo thread and then this one */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = BENCH_PINGS; i > 0; i--) {
+		value = i - 1;
+		csp_queue_enqueue(queues[0], &value, CSP_MAX_DELAY);
+		assert_int_equal(csp_queue_dequeue(queues[1], &value, CSP_MAX_DELAY), CSP_QUEUE_OK);
+		assert_int_equal(value, i - 1);
+	}
+	seconds = elapsed(&start);
+
+	pthread_join(thread, NULL);
+	print_message("round trip: %8.2f us\n", seconds / BENCH_PINGS * 1e6);
+
+	csp_queue_remove(queues[0]);
+	csp_queue_remove(queues[1]);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_fifo_order),
+		cmocka_unit_test(test_wraparound),
+		cmocka_unit_test(test_timeout),
+		cmocka_unit_test(test_mpmc),
+		cmocka_unit_test(bench_throughput),
+		cmocka_unit_test(bench_latency),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
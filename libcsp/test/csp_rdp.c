@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmocka.h>
+#include <csp/csp.h>
+#include <csp/arch/csp_semaphore.h>
+#include <csp/arch/csp_thread.h>
+#include <csp/csp_interface.h>
+
+#include "csp_conn.h"
+
+#define TEST_ADDRESS 1
+#define TEST_PORT 10
+#define TEST_NUM_MSGS 200
+#define TEST_NUM_CLEAN 10
+#define TEST_PACKET_TIMEOUT 1000
+
+#ifdef CSP_USE_RDP
+
+static csp_mutex_t lossy_lock;
+static volatile bool lossy;
+static unsigned int lossy_count;
+static csp_packet_t * lossy_held;
+static volatile bool test_done;
+
+/**
+ * Loops packets back, but drops and reorders some of them
+ */
+static int lossy_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t timeout) {
+
+	csp_packet_t * held = NULL;
+
+	/* The receiver modifies the packet */
+	packet = csp_buffer_unshare(packet);
+	if (packet == NULL)
+		return CSP_ERR_NOMEM;
+
+	/* Both ends and the router task send */
+	csp_mutex_lock(&lossy_lock, CSP_MAX_DELAY);
+	lossy_count++;
+
+	/* Let the handshake through */
+	if (lossy && lossy_count > 4 && lossy_count % 5 == 0) {
+		csp_mutex_unlock(&lossy_lock);
+		csp_buffer_free(packet);
+		return CSP_ERR_NONE;
+	}
+
+	if (lossy && lossy_held == NULL && lossy_count % 7 == 0) {
+		lossy_held = packet;
+		csp_mutex_unlock(&lossy_lock);
+		return CSP_ERR_NONE;
+	}
+
+	held = lossy_held;
+	lossy_held = NULL;
+	csp_mutex_unlock(&lossy_lock);
+
+	csp_qfifo_write(packet, interface, NULL);
+	if (held != NULL)
+		csp_qfifo_write(held, interface, NULL);
+
+	return CSP_ERR_NONE;
+
+}
+
+static csp_iface_t lossy_if = {
+	.name = "LOSSY",
+	.nexthop = lossy_tx,
+};
+
+CSP_DEFINE_TASK(server_task) {
+	csp_socket_t * socket = csp_socket(CSP_SO_RDPREQ);
+	csp_conn_t * conn;
+	csp_packet_t * packet;
+	uint32_t i;
+
+	assert_non_null(socket);
+	assert_int_equal(csp_bind(socket, TEST_PORT), CSP_ERR_NONE);
+	assert_int_equal(csp_listen(socket, 1), CSP_ERR_NONE);
+
+	conn = csp_accept(socket, 2000);
+	assert_non_null(conn);
+
+	/* Every message arrives once and in order */
+	for (i = 0; i < TEST_NUM_MSGS + TEST_NUM_CLEAN; i++) {
+		packet = csp_read(conn, 5000);
+		assert_non_null(packet);
+		assert_int_equal(packet->length, sizeof(i));
+		assert_memory_equal(packet->data, &i, sizeof(i));
+		csp_buffer_free(packet);
+	}
+
+	/* Stay open until the client has seen every ACK */
+	while (!test_done)
+		csp_sleep_ms(10);
+
+	csp_close(conn);
+	csp_close_socket(socket);
+
+	csp_thread_exit();
+}
+
+static void test_rdp_lossy(void ** arg) {
+	csp_thread_handle_t server_task_handle;
+	csp_packet_t * packet;
+	csp_conn_t * conn;
+	uint32_t i;
+
+	lossy = true;
+	lossy_count = 0;
+	test_done = false;
+	assert_int_equal(csp_mutex_create(&lossy_lock), CSP_MUTEX_OK);
+
+	csp_buffer_init(60, 256);
+	assert_int_equal(csp_init(TEST_ADDRESS), CSP_ERR_NONE);
+	csp_route_start_task(500, 1);
+	csp_route_set(TEST_ADDRESS, &lossy_if, CSP_NODE_MAC);
+	csp_rdp_set_opt(8, 5000, TEST_PACKET_TIMEOUT, 0, 250, 2);
+
+	csp_thread_create(server_task, "SERVER", 1024, NULL, 0, &server_task_handle);
+	csp_sleep_ms(10);
+
+	conn = csp_connect(CSP_PRIO_NORM, TEST_ADDRESS, TEST_PORT, 5000, CSP_O_RDP);
+	assert_non_null(conn);
+
+	for (i = 0; i < TEST_NUM_MSGS + TEST_NUM_CLEAN; i++) {
+		/* Finish on a clean link, so the round trip time is measured again */
+		if (i == TEST_NUM_MSGS)
+			lossy = false;
+
+		packet = csp_buffer_get(sizeof(i));
+		assert_non_null(packet);
+		memcpy(packet->data, &i, sizeof(i));
+		packet->length = sizeof(i);
+		assert_int_equal(csp_send(conn, packet, 5000), 1);
+	}
+
+	/* Wait for the last messages to be acknowledged */
+	for (i = 0; i < 100 && conn->rdp.snd_una != conn->rdp.snd_nxt; i++)
+		csp_sleep_ms(50);
+	assert_int_equal(conn->rdp.snd_una, conn->rdp.snd_nxt);
+	assert_int_equal(conn->rdp.tx_window.count, 0);
+
+	/* The retransmission timeout follows the round trip time */
+	assert_true(conn->rdp.rto < TEST_PACKET_TIMEOUT);
+
+	test_done = true;
+	csp_close(conn);
+	csp_sleep_ms(50);
+	csp_thread_kill(server_task_handle);
+
+	csp_route_end_task();
+	csp_terminate();
+	csp_buffer_cleanup();
+	csp_mutex_remove(&lossy_lock);
+}
+
+#else
+
+static void test_rdp_lossy(void ** arg) {
+	skip();
+}
+
+#endif
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_rdp_lossy),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
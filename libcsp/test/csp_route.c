@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmocka.h>
+#include <csp/csp.h>
+#include <csp/arch/csp_time.h>
+
+#define TEST_ADDRESS 1
+
+static int setup(void ** arg) {
+	assert_int_equal(csp_buffer_init(10, 100), CSP_ERR_NONE);
+	assert_int_equal(csp_init(TEST_ADDRESS), CSP_ERR_NONE);
+
+	return 0;
+}
+
+static int teardown(void ** arg) {
+	csp_terminate();
+	csp_buffer_cleanup();
+
+	return 0;
+}
+
+static void test_route_work_timeout(void ** arg) {
+	uint32_t start = csp_get_ms();
+
+	/* Nothing to route, so this returns once the timeout passed */
+	assert_int_equal(csp_route_work(50), -1);
+	assert_in_range(csp_get_ms() - start, 40, 1000);
+}
+
+static void test_route_workers_fixed(void ** arg) {
+	assert_int_equal(csp_route_start_workers(500, 1, CSP_ROUTE_WORKERS_MAX), CSP_ERR_NONE);
+
+	/* Re-hashing flows under running workers could reorder them */
+	assert_int_equal(csp_route_start_workers(500, 1, CSP_ROUTE_WORKERS_MAX), CSP_ERR_BUSY);
+	assert_int_equal(csp_route_start_task(500, 1), CSP_ERR_BUSY);
+
+	csp_route_end_task();
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup_teardown(test_route_work_timeout, setup, teardown),
+		cmocka_unit_test_setup_teardown(test_route_workers_fixed, setup, teardown),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmocka.h>
+#include <csp/csp.h>
+#include <csp/arch/csp_semaphore.h>
+#include <csp/arch/csp_thread.h>
+#include <csp/csp_interface.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define TEST_ADDRESS 1
+#define TEST_PORT 10
+#define TEST_SIZE 20000
+#define TEST_MTU 200
+#define TEST_RESUME 5000
+#define TEST_DEDUP_SIZE 256
+
+static uint8_t source_data[TEST_SIZE];
+static uint8_t sink_data[TEST_SIZE];
+static unsigned int sink_writes;
+
+static csp_socket_t * recv_socket;
+static csp_bin_sem_handle_t recv_done;
+static uint32_t recv_offset;
+static uint32_t recv_size;
+static int recv_fd;
+static int recv_result;
+
+static csp_mutex_t lossy_lock;
+static bool lossy;
+static unsigned int lossy_count;
+
+/* Checksums of recent packets, to drop repeats the way a deduplicating hop does */
+static bool dedup;
+static uint32_t dedup_hash[TEST_DEDUP_SIZE];
+static unsigned int dedup_count;
+
+static uint32_t packet_hash(csp_packet_t * packet) {
+	const uint8_t * data = (const uint8_t *) &packet->id;
+	uint32_t hash = 2166136261u;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(packet->id) + packet->length; i++)
+		hash = (hash ^ data[i]) * 16777619u;
+
+	return hash;
+}
+
+/**
+ * Loops packets back, but drops some of them
+ */
+static int lossy_tx(csp_iface_t * interface, csp_packet_t * packet, uint32_t timeout) {
+
+	bool drop;
+	uint32_t hash;
+	unsigned int i;
+
+	/* The receiver modifies the packet */
+	packet = csp_buffer_unshare(packet);
+	if (packet == NULL)
+		return CSP_ERR_NOMEM;
+
+	hash = packet_hash(packet);
+
+	csp_mutex_lock(&lossy_lock, CSP_MAX_DELAY);
+	drop = lossy && (++lossy_count % 7 == 0);
+	if (dedup) {
+		for (i = 0; i < TEST_DEDUP_SIZE && i < dedup_count; i++)
+			drop |= (dedup_hash[i] == hash);
+		dedup_hash[dedup_count++ % TEST_DEDUP_SIZE] = hash;
+	}
+	csp_mutex_unlock(&lossy_lock);
+
+	if (drop)
+		csp_buffer_free(packet);
+	else
+		csp_qfifo_write(packet, interface, NULL);
+
+	return CSP_ERR_NONE;
+
+}
+
+static csp_iface_t lossy_if = {
+	.name = "LOSSY",
+	.nexthop = lossy_tx,
+};
+
+static int memory_source(void * arg, uint32_t offset, void * data, uint32_t size) {
+	memcpy(data, (uint8_t *) arg + offset, size);
+	return 0;
+}
+
+static int memory_sink(void * arg, uint32_t offset, const void * data, uint32_t size) {
+	memcpy((uint8_t *) arg + offset, data, size);
+	sink_writes++;
+	return 0;
+}
+
+CSP_DEFINE_TASK(receiver_task) {
+	csp_conn_t * conn;
+
+	recv_result = -1;
+	conn = csp_accept(recv_socket, 2000);
+	if (conn != NULL) {
+		if (recv_fd >= 0)
+			recv_result = csp_sfp_recv_fd(conn, recv_fd, recv_offset, &recv_size, 500);
+		else
+			recv_result = csp_sfp_recv_bulk(conn, memory_sink, sink_data, recv_offset, &recv_size, 500);
+		csp_close(conn);
+	}
+
+	csp_bin_sem_post(&recv_done);
+
+	csp_thread_exit();
+}
+
+static int group_setup(void ** arg) {
+	assert_int_equal(csp_mutex_create(&lossy_lock), CSP_MUTEX_OK);
+	assert_int_equal(csp_bin_sem_create(&recv_done), CSP_SEMAPHORE_OK);
+	csp_bin_sem_wait(&recv_done, 0);
+
+	csp_buffer_init(100, 256);
+	assert_int_equal(csp_init(TEST_ADDRESS), CSP_ERR_NONE);
+	csp_route_start_task(500, 1);
+	csp_route_set(TEST_ADDRESS, &lossy_if, CSP_NODE_MAC);
+
+	/* Ports cannot be unbound, so one socket serves every transfer */
+	recv_socket = csp_socket(CSP_SO_NONE);
+	assert_non_null(recv_socket);
+	assert_int_equal(csp_bind(recv_socket, TEST_PORT), CSP_ERR_NONE);
+	assert_int_equal(csp_listen(recv_socket, 1), CSP_ERR_NONE);
+
+	return 0;
+}
+
+static int group_teardown(void ** arg) {
+	csp_close_socket(recv_socket);
+	csp_route_end_task();
+	csp_terminate();
+	csp_buffer_cleanup();
+	csp_bin_sem_remove(&recv_done);
+	csp_mutex_remove(&lossy_lock);
+
+	return 0;
+}
+
+static int setup(void ** arg) {
+	unsigned int i;
+
+	for (i = 0; i < TEST_SIZE; i++)
+		source_data[i] = rand();
+	memset(sink_data, 0, sizeof(sink_data));
+	sink_writes = 0;
+
+	recv_offset = 0;
+	recv_size = 0;
+	recv_fd = -1;
+	lossy = false;
+	lossy_count = 0;
+	dedup = false;
+	dedup_count = 0;
+
+	return 0;
+}
+
+/* Runs one transfer to the receiver task, sending from offset */
+static int transfer(uint32_t offset, int window) {
+	csp_thread_handle_t receiver_task_handle;
+	csp_conn_t * conn;
+	int result;
+
+	csp_thread_create(receiver_task, "RECEIVER", 1024, NULL, 0, &receiver_task_handle);
+	csp_sleep_ms(10);
+
+	conn = csp_connect(CSP_PRIO_NORM, TEST_ADDRESS, TEST_PORT, 1000, CSP_O_NONE);
+	assert_non_null(conn);
+
+	result = csp_sfp_send_bulk(conn, memory_source, source_data, TEST_SIZE, offset, TEST_MTU, window, 200);
+	csp_close(conn);
+
+	assert_int_equal(csp_bin_sem_wait(&recv_done, 5000), CSP_SEMAPHORE_OK);
+
+	return result;
+}
+
+static void test_bulk(void ** arg) {
+	assert_int_equal(transfer(0, 8), 0);
+
+	assert_int_equal(recv_result, 0);
+	assert_int_equal(recv_size, TEST_SIZE);
+	assert_memory_equal(sink_data, source_data, TEST_SIZE);
+	assert_int_equal(sink_writes, TEST_SIZE / TEST_MTU);
+}
+
+static void test_bulk_lossy(void ** arg) {
+	lossy = true;
+	assert_int_equal(transfer(0, 16), 0);
+
+	/* Every byte is still written once */
+	assert_int_equal(recv_result, 0);
+	assert_memory_equal(sink_data, source_data, TEST_SIZE);
+	assert_int_equal(sink_writes, TEST_SIZE / TEST_MTU);
+}
+
+static void test_bulk_lossy_dedup(void ** arg) {
+	/* Resent fragments and repeated statuses must still get through */
+	lossy = true;
+	dedup = true;
+	assert_int_equal(transfer(0, 16), 0);
+
+	assert_int_equal(recv_result, 0);
+	assert_memory_equal(sink_data, source_data, TEST_SIZE);
+	assert_int_equal(sink_writes, TEST_SIZE / TEST_MTU);
+}
+
+static void test_bulk_resume(void ** arg) {
+	/* The receiver already has the start and asks the sender to skip it */
+	recv_offset = TEST_RESUME;
+	assert_int_equal(transfer(0, 8), 0);
+
+	assert_int_equal(recv_result, 0);
+	assert_int_equal(sink_writes, (TEST_SIZE - TEST_RESUME) / TEST_MTU);
+	assert_memory_equal(sink_data + TEST_RESUME, source_data + TEST_RESUME, TEST_SIZE - TEST_RESUME);
+
+	/* The sender may also resume further along than the receiver */
+	memset(sink_data, 0, sizeof(sink_data));
+	sink_writes = 0;
+	recv_offset = 0;
+	assert_int_equal(transfer(TEST_RESUME, 8), 0);
+
+	assert_int_equal(recv_result, 0);
+	assert_memory_equal(sink_data, source_data, TEST_SIZE);
+}
+
+static void test_bulk_fd(void ** arg) {
+	uint8_t file_data[TEST_SIZE];
+	FILE * file = tmpfile();
+
+	assert_non_null(file);
+	recv_fd = fileno(file);
+
+	assert_int_equal(transfer(0, 32), 0);
+	assert_int_equal(recv_result, 0);
+
+	assert_int_equal(pread(recv_fd, file_data, TEST_SIZE, 0), TEST_SIZE);
+	assert_memory_equal(file_data, source_data, TEST_SIZE);
+
+	fclose(file);
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test_setup(test_bulk, setup),
+		cmocka_unit_test_setup(test_bulk_lossy, setup),
+		cmocka_unit_test_setup(test_bulk_lossy_dedup, setup),
+		cmocka_unit_test_setup(test_bulk_resume, setup),
+		cmocka_unit_test_setup(test_bulk_fd, setup),
+	};
+
+	return cmocka_run_group_tests(tests, group_setup, group_teardown);
+}
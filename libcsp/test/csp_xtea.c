@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks that the batched XTEA-CTR keystream matches the original block by
+ * block implementation, so nodes running either interoperate, then
+ * benchmarks both.
+ */
+
+#include <cmocka.h>
+#include <stdlib.h>
+#include <time.h>
+#include <csp/csp.h>
+#include <csp/csp_endian.h>
+
+#include "crypto/csp_sha1.h"
+#include "crypto/csp_xtea.h"
+
+#define BENCH_BYTES		(16 * 1024 * 1024)
+#define BUFFER_SIZE		(1024 + 8)
+
+#ifdef CSP_USE_XTEA
+
+static const unsigned int bench_sizes[] = {16, 64, 128, 256, 1024};
+
+static uint8_t data[BUFFER_SIZE];
+
+/* The original implementation */
+static uint8_t ref_key[16];
+
+#define LOAD32L(x, y) do { (x) = ((uint32_t)(y)[3] << 24) | ((uint32_t)(y)[2] << 16) | ((uint32_t)(y)[1] << 8) | (y)[0]; } while (0)
+#define STORE32L(x, y) do { (y)[3] = (x) >> 24; (y)[2] = (x) >> 16; (y)[1] = (x) >> 8; (y)[0] = (x); } while (0)
+
+static void ref_encrypt_block(uint8_t * block, const uint8_t * key) {
+	uint32_t i, v0, v1, delta = 0x9E3779B9, sum = 0, k[4];
+
+	LOAD32L(k[0], &key[0]);
+	LOAD32L(k[1], &key[4]);
+	LOAD32L(k[2], &key[8]);
+	LOAD32L(k[3], &key[12]);
+	LOAD32L(v0, &block[0]);
+	LOAD32L(v1, &block[4]);
+
+	for (i = 0; i < 32; i++) {
+		v0 += (((v1 << 4) ^ (v1 >> 5)) + v1) ^ (sum + k[sum & 3]);
+		sum += delta;
+		v1 += (((v0 << 4) ^ (v0 >> 5)) + v0) ^ (sum + k[(sum >> 11) & 3]);
+	}
+
+	STORE32L(v0, &block[0]);
+	STORE32L(v1, &block[4]);
+}
+
+static void ref_encrypt(uint8_t * plain, uint32_t len, uint32_t iv[2]) {
+	uint32_t i, j, stream[2], remain;
+	uint32_t blocks = (len + 7) / 8;
+
+	stream[0] = csp_htobe32(iv[0]);
+	stream[1] = csp_htobe32(iv[1]);
+
+	for (i = 0; i < blocks; i++) {
+		ref_encrypt_block((uint8_t *) stream, ref_key);
+		remain = len - i * 8;
+		for (j = 0; j < remain && j < 8; j++)
+			plain[len - remain + j] ^= ((uint8_t *) stream)[j];
+		stream[0] = csp_htobe32(iv[0]);
+		stream[1] = csp_htobe32(iv[1]++);
+	}
+}
+
+static void ref_set_key(char * key, uint32_t keylen) {
+	uint8_t hash[SHA1_DIGESTSIZE];
+
+	csp_sha1_memory((uint8_t *) key, keylen, hash);
+	memcpy(ref_key, hash, sizeof(ref_key));
+}
+
+static int setup(void ** arg) {
+	unsigned int i;
+
+	srand(1);
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = rand();
+
+	return 0;
+}
+
+static void check_against_reference(void) {
+	uint8_t expected[BUFFER_SIZE];
+	uint8_t cipher[BUFFER_SIZE];
+	unsigned int offset, length;
+
+	for (offset = 0; offset < 4; offset++) {
+		for (length = 0; length <= 300; length++) {
+			uint32_t iv[2] = {0x12345678 + length, 1};
+			uint32_t ref_iv[2] = {0x12345678 + length, 1};
+
+			memcpy(expected, data, length);
+			ref_encrypt(expected, length, ref_iv);
+
+			memcpy(&cipher[offset], data, length);
+			assert_int_equal(csp_xtea_encrypt(&cipher[offset], length, iv), CSP_ERR_NONE);
+			assert_memory_equal(&cipher[offset], expected, length);
+			assert_memory_equal(iv, ref_iv, sizeof(iv));
+		}
+	}
+}
+
+static void test_default_key(void ** arg) {
+	/* Runs first: without a key both use all zeroes */
+	check_against_reference();
+}
+
+static void test_matches_reference(void ** arg) {
+	char key[] = "secret";
+
+	csp_xtea_set_key(key, strlen(key));
+	ref_set_key(key, strlen(key));
+	check_against_reference();
+}
+
+static void test_roundtrip(void ** arg) {
+	uint8_t buf[BUFFER_SIZE];
+	uint32_t iv[2] = {42, 1};
+
+	memcpy(buf, data, sizeof(buf));
+	csp_xtea_encrypt(buf, sizeof(buf), iv);
+	assert_memory_not_equal(buf, data, sizeof(buf));
+
+	iv[0] = 42;
+	iv[1] = 1;
+	csp_xtea_decrypt(buf, sizeof(buf), iv);
+	assert_memory_equal(buf, data, sizeof(buf));
+}
+
+static void bench_xtea(void ** arg) {
+	uint8_t buf[BUFFER_SIZE];
+	unsigned int s, i, iterations;
+	struct timespec start, end;
+	double seconds, batched;
+	uint32_t iv[2];
+
+	for (s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++) {
+		iterations = BENCH_BYTES / bench_sizes[s] / 8;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < iterations; i++) {
+			iv[0] = i;
+			iv[1] = 1;
+			ref_encrypt(buf, bench_sizes[s], iv);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < iterations; i++) {
+			iv[0] = i;
+			iv[1] = 1;
+			csp_xtea_encrypt(buf, bench_sizes[s], iv);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		batched = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+		print_message("%5u B block %7.1f MB/s, batched %7.1f MB/s\n", bench_sizes[s],
+				(double) iterations * bench_sizes[s] / seconds / 1e6,
+				(double) iterations * bench_sizes[s] / batched / 1e6);
+	}
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_default_key),
+		cmocka_unit_test(test_matches_reference),
+		cmocka_unit_test(test_roundtrip),
+		cmocka_unit_test(bench_xtea),
+	};
+
+	return cmocka_run_group_tests(tests, setup, NULL);
+}
+
+#else
+
+static void test_xtea(void ** arg) {
+	skip();
+}
+
+int main(void) {
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_xtea),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+#endif
@@ -14,7 +14,7 @@
  * limitations under the License.
  */
  
-#include <ipc/socket.h>
+#include <ipc/reactor.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -25,7 +25,7 @@
 #include "publishers.h"
 
 static bool running = true;
-static socket_conn server_conn;
+static socket_reactor server_reactor;
 
 void terminate(int signum)
 {
@@ -33,54 +33,42 @@ void terminate(int signum)
     running = false;
 }
 
-CSP_DEFINE_TASK(main_thread)
+int main(int argc, char ** argv)
 {
-    printf("Telemetry service beginning..\r\n");
+    struct sigaction action = { 0 };
 
-    while (running)
+    if (!telemetry_server_init())
     {
-        printf("Waiting on new telemetry client...\r\n");
-        socket_conn conn;
-        while (!kprv_socket_server_accept(&server_conn, &conn))
-        {
-            continue;
-        }
-
-        subscriber_list_item * sub = kprv_subscriber_init(conn);
-        if (sub != NULL)
-        {
-            csp_thread_create(client_handler, NULL, 1000, sub, 0, &(sub->rx_thread));
-            kprv_subscriber_add(sub);
-        }
+        printf("Failed to init telemetry server\r\n");
+        return -1;
     }
 
-    printf("Server shut down...\r\n");
-}
-
-int main(int argc, char ** argv)
-{
-    csp_thread_handle_t thread_handle;
-    struct sigaction action = { 0 };
-
-    kprv_socket_server_setup(&server_conn, TELEMETRY_SOCKET_PORT, TELEMETRY_SUBSCRIBERS_MAX_NUM);
+    if (!telemetry_server_listen(&server_reactor))
+    {
+        printf("Failed to listen for telemetry clients\r\n");
+        return -1;
+    }
 
     action.sa_handler = terminate;
     sigaction(SIGTERM, &action, NULL);
 
-    csp_thread_create(main_thread, NULL, 1000, NULL, 0, &thread_handle);
+    printf("Telemetry service beginning..\r\n");
 
     #ifdef TARGET_LIKE_ISIS
     csp_thread_handle_t supervisor_handle;
     csp_thread_create(supervisor_publisher, NULL, 1000, NULL, 0, &supervisor_handle);
     #endif
 
+    /* Serves all clients, waking up in time to send out batches which
+     * did not fill up */
     while (running)
     {
-        csp_sleep_ms(100);
+        kprv_reactor_poll(&server_reactor, (TELEMETRY_BATCH_SIZE > 1) ? TELEMETRY_BATCH_LATENCY : 100);
+        telemetry_server_flush(false);
     }
 
-    csp_thread_kill(&thread_handle);
-    
+    printf("Server shut down...\r\n");
+
     #ifdef TARGET_LIKE_ISIS
     csp_thread_kill(&supervisor_handle);
     #endif
@@ -22,18 +22,173 @@
 #include <csp/csp.h>
 
 #include <kubos-core/utlist.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/time.h>
 
 #include <ipc/socket.h>
 
 #include <tinycbor/cbor.h>
 
+/**
+ * Message format state of a client connection
+ */
+typedef struct client_format
+{
+    /* Socket handle of the connection */
+    int socket_handle;
+    /* Format messages on the connection are encoded in */
+    telemetry_msg_format format;
+    /* The negotiation reply has not been received yet */
+    bool pending;
+    struct client_format * next;
+} client_format;
+
+static client_format * client_formats = NULL;
+static pthread_mutex_t client_formats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Returns the format state of a connection, NULL if it has none. Must be
+ * called with client_formats_lock held.
+ */
+static client_format * kprv_format_find(int socket_handle)
+{
+    client_format * entry = NULL;
+
+    LL_SEARCH_SCALAR(client_formats, entry, socket_handle, socket_handle);
+    return entry;
+}
+
+/**
+ * Stores the format state of a connection
+ */
+static void kprv_format_set(int socket_handle, telemetry_msg_format format, bool pending)
+{
+    client_format * entry;
+
+    pthread_mutex_lock(&client_formats_lock);
+    entry = kprv_format_find(socket_handle);
+    if (entry == NULL)
+    {
+        entry = calloc(1, sizeof(client_format));
+        if (entry != NULL)
+        {
+            entry->socket_handle = socket_handle;
+            LL_APPEND(client_formats, entry);
+        }
+    }
+    if (entry != NULL)
+    {
+        entry->format = format;
+        entry->pending = pending;
+    }
+    pthread_mutex_unlock(&client_formats_lock);
+}
+
+/**
+ * Copies the format state of a connection, which is the map format with
+ * no reply pending for connections that never negotiated
+ */
+static void kprv_format_get(int socket_handle, telemetry_msg_format * format, bool * pending)
+{
+    client_format * entry;
+
+    pthread_mutex_lock(&client_formats_lock);
+    entry = kprv_format_find(socket_handle);
+    *format = (entry != NULL) ? entry->format : TELEMETRY_MSG_FORMAT_MAP;
+    *pending = (entry != NULL) && entry->pending;
+    pthread_mutex_unlock(&client_formats_lock);
+}
+
+/**
+ * Forgets the format state of a connection which is being closed
+ */
+static void kprv_format_remove(int socket_handle)
+{
+    client_format * entry;
+
+    pthread_mutex_lock(&client_formats_lock);
+    entry = kprv_format_find(socket_handle);
+    if (entry != NULL)
+    {
+        LL_DELETE(client_formats, entry);
+        free(entry);
+    }
+    pthread_mutex_unlock(&client_formats_lock);
+}
+
+/**
+ * Encodes a message in the format negotiated for conn
+ */
+static int kprv_encode_conn_msg(const socket_conn * conn, uint8_t * buffer, telemetry_message_type message_type, const void * msg)
+{
+    telemetry_msg_format format;
+    bool pending;
+
+    kprv_format_get(conn->socket_handle, &format, &pending);
+    return kprv_encode_msg(buffer, message_type, msg, format);
+}
+
+/**
+ * Receives the server's reply to the format negotiation of conn, if it has
+ * not been received yet. The server answers before it sends any telemetry,
+ * so a late reply is the next message on the connection.
+ */
+static void kprv_receive_format(const socket_conn * conn)
+{
+    uint8_t buffer[TELEMETRY_BUFFER_SIZE];
+    telemetry_msg_format format;
+    uint32_t msg_size;
+    bool pending;
+
+    kprv_format_get(conn->socket_handle, &format, &pending);
+    if (pending && kprv_socket_recv(conn, buffer, TELEMETRY_BUFFER_SIZE, &msg_size))
+    {
+        if (!telemetry_parse_format_msg(buffer, msg_size, &format) || (format > TELEMETRY_MSG_FORMAT_LATEST))
+        {
+            format = TELEMETRY_MSG_FORMAT_MAP;
+        }
+        kprv_format_set(conn->socket_handle, format, false);
+    }
+}
+
+/**
+ * Asks the server for the newest message format it supports. The reply is
+ * waited for up to TELEMETRY_FORMAT_TIMEOUT ms. If it comes later, the
+ * connection keeps using the map format until a read receives it.
+ */
+static void kprv_negotiate_format(const socket_conn * conn)
+{
+    uint8_t buffer[TELEMETRY_BUFFER_SIZE] = { 0 };
+    struct timeval timeout = {
+        .tv_sec = TELEMETRY_FORMAT_TIMEOUT / 1000,
+        .tv_usec = (TELEMETRY_FORMAT_TIMEOUT % 1000) * 1000
+    };
+    int size;
+
+    kprv_format_set(conn->socket_handle, TELEMETRY_MSG_FORMAT_MAP, false);
+
+    size = telemetry_encode_format_msg(buffer, TELEMETRY_MSG_FORMAT_LATEST);
+    if ((size <= 0) || !kprv_socket_send(conn, buffer, size))
+    {
+        return;
+    }
+    kprv_format_set(conn->socket_handle, TELEMETRY_MSG_FORMAT_MAP, true);
+
+    setsockopt(conn->socket_handle, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    kprv_receive_format(conn);
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 0;
+    setsockopt(conn->socket_handle, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
 bool telemetry_connect(socket_conn * conn)
 {
     bool ret = false;
     if (kprv_socket_client_connect(conn, TELEMETRY_SOCKET_PORT))
     {
+        kprv_negotiate_format(conn);
         ret = true;
     }
     return ret;
@@ -45,11 +200,12 @@ bool telemetry_disconnect(socket_conn * client_conn)
     if (client_conn != NULL)
     {
         uint8_t buffer[TELEMETRY_BUFFER_SIZE] = { 0 };
-        int msg_size = telemetry_encode_disconnect_msg(buffer);
+        int msg_size = kprv_encode_conn_msg(client_conn, buffer, MESSAGE_TYPE_DISCONNECT, NULL);
         if (msg_size > 0)
         {
             ret = kprv_socket_send(client_conn, buffer, msg_size);
         }
+        kprv_format_remove(client_conn->socket_handle);
         kprv_socket_close(client_conn);
     }
     return ret;
@@ -61,7 +217,7 @@ bool telemetry_subscribe(const socket_conn * client_conn, uint16_t topic_id)
     if (client_conn != NULL)
     {
         uint8_t buffer[TELEMETRY_BUFFER_SIZE] = { 0 };
-        int msg_size = telemetry_encode_subscribe_msg(buffer, &topic_id);
+        int msg_size = kprv_encode_conn_msg(client_conn, buffer, MESSAGE_TYPE_SUBSCRIBE, &topic_id);
         if (msg_size > 0)
         {
             ret = kprv_socket_send(client_conn, buffer, msg_size);
@@ -76,7 +232,7 @@ bool telemetry_unsubscribe(const socket_conn * client_conn, uint16_t topic_id)
     if (client_conn != NULL)
     {
         uint8_t buffer[TELEMETRY_BUFFER_SIZE] = { 0 };
-        int msg_size = telemetry_encode_unsubscribe_msg(buffer, &topic_id);
+        int msg_size = kprv_encode_conn_msg(client_conn, buffer, MESSAGE_TYPE_UNSUBSCRIBE, &topic_id);
 
         if (msg_size > 0)
         {
@@ -92,10 +248,35 @@ bool telemetry_read(const socket_conn * conn, telemetry_packet * packet)
     uint32_t msg_size;
     if ((conn != NULL) && (packet != NULL))
     {
+        kprv_receive_format(conn);
+        while (tries++ < TELEMETRY_SUBSCRIBER_READ_ATTEMPTS)
+        {
+            /* Anything other than a whole packet is not telemetry */
+            if (kprv_socket_recv(conn, (void *)packet, sizeof(telemetry_packet), &msg_size)
+                && (msg_size == sizeof(telemetry_packet)))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool telemetry_read_batch(const socket_conn * conn, telemetry_packet * packets, uint16_t max_packets, uint16_t * num_packets)
+{
+    int tries = 0;
+    uint32_t msg_size;
+    if ((conn != NULL) && (packets != NULL) && (num_packets != NULL) && (max_packets > 0))
+    {
+        kprv_receive_format(conn);
         while (tries++ < TELEMETRY_SUBSCRIBER_READ_ATTEMPTS)
         {
-            if (kprv_socket_recv(conn, (void *)packet, sizeof(telemetry_packet), &msg_size))
+            /* The server sends batches as a single message of whole packets.
+             * Whatever does not fit is returned by the next read. */
+            if (kprv_socket_recv(conn, (void *)packets, max_packets * sizeof(telemetry_packet), &msg_size)
+                && (msg_size > 0) && ((msg_size % sizeof(telemetry_packet)) == 0))
             {
+                *num_packets = msg_size / sizeof(telemetry_packet);
                 return true;
             }
         }
@@ -110,7 +291,7 @@ bool telemetry_publish(telemetry_packet pkt)
     if (telemetry_connect(&conn) == true)
     {
         uint8_t buffer[TELEMETRY_BUFFER_SIZE] = { 0 };
-        int msg_size = telemetry_encode_packet_msg(buffer, &pkt);
+        int msg_size = kprv_encode_conn_msg(&conn, buffer, MESSAGE_TYPE_PACKET, &pkt);
 
         if (msg_size > 0)
         {
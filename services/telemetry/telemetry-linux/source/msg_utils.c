@@ -14,233 +14,283 @@
  * limitations under the License.
  */
 #include "telemetry-linux/msg.h"
+#include <stddef.h>
 #include <telemetry/telemetry.h>
 #include <tinycbor/cbor.h>
 
-bool telemetry_parse_msg_type(const uint8_t * buffer, uint32_t buffer_size, telemetry_message_type * msg_type)
+/**
+ * How a message field is stored in its struct and encoded
+ */
+typedef enum
 {
-    CborParser parser;
-    CborValue map, element;
-
-    if ((buffer == NULL) || (msg_type == NULL))
+    /*! uint16_t topic id, a half float in the map format (for historical reasons) */
+    FIELD_TOPIC = 0,
+    /*! int, or an enum stored as int */
+    FIELD_INT,
+    /*! telemetry_union, its type given by the telemetry_data_type at aux_offset */
+    FIELD_DATA
+} msg_field_type;
+
+/**
+ * Describes one field of a message. Fields are encoded in table order,
+ * by key in the map format and by position in the array format.
+ */
+typedef struct
+{
+    /*! Key of the field in the map format */
+    const char * key;
+    /*! Field type */
+    msg_field_type type;
+    /*! Offset of the field in the message struct */
+    size_t offset;
+    /*! Offset of a related field, FIELD_DATA's data type */
+    size_t aux_offset;
+} msg_field;
+
+/*! Number of entries in a field table */
+#define NUM_FIELDS(fields) (sizeof(fields) / sizeof(msg_field))
+
+static const msg_field packet_fields[] = {
+    { "TOPIC_ID", FIELD_TOPIC, offsetof(telemetry_packet, source.topic_id), 0 },
+    { "SUBSYSTEM_ID", FIELD_INT, offsetof(telemetry_packet, source.subsystem_id), 0 },
+    { "DATA_TYPE", FIELD_INT, offsetof(telemetry_packet, source.data_type), 0 },
+    { "DATA", FIELD_DATA, offsetof(telemetry_packet, data), offsetof(telemetry_packet, source.data_type) },
+    { "TIMESTAMP", FIELD_INT, offsetof(telemetry_packet, timestamp), 0 }
+};
+
+/* Subscribe and unsubscribe messages, the struct is a uint16_t topic id */
+static const msg_field topic_fields[] = {
+    { "TOPIC_ID", FIELD_TOPIC, 0, 0 }
+};
+
+/* Format negotiation messages, the struct is a telemetry_msg_format */
+static const msg_field format_fields[] = {
+    { "FORMAT", FIELD_INT, 0, 0 }
+};
+
+/* Format used by the telemetry_encode_*_msg functions */
+static telemetry_msg_format msg_format = TELEMETRY_MSG_FORMAT_MAP;
+
+void telemetry_set_msg_format(telemetry_msg_format format)
+{
+    if (format <= TELEMETRY_MSG_FORMAT_LATEST)
     {
-        return false;
+        msg_format = format;
     }
+}
 
-    CborError err = cbor_parser_init(buffer, buffer_size, 0, &parser, &map);
-    if (err || !cbor_value_is_map(&map))
-    {
-        return false;
-    }
+telemetry_msg_format telemetry_get_msg_format(void)
+{
+    return msg_format;
+}
 
-    if (cbor_value_map_find_value(&map, "MESSAGE_TYPE", &element))
-    {
-        return false;
+/**
+ * Encodes the value of a single field
+ */
+static CborError encode_field(CborEncoder * container, const msg_field * field, const uint8_t * msg, telemetry_msg_format format)
+{
+    const void * value = msg + field->offset;
+    const telemetry_union * data;
+
+    switch (field->type)
+    {
+        case FIELD_TOPIC:
+            if (format == TELEMETRY_MSG_FORMAT_MAP)
+            {
+                return cbor_encode_half_float(container, value);
+            }
+            return cbor_encode_uint(container, *(const uint16_t *)value);
+        case FIELD_INT:
+            return cbor_encode_int(container, *(const int *)value);
+        case FIELD_DATA:
+            data = value;
+            if (*(const int *)(msg + field->aux_offset) == TELEMETRY_TYPE_INT)
+            {
+                return cbor_encode_int(container, data->i);
+            }
+            else if (*(const int *)(msg + field->aux_offset) == TELEMETRY_TYPE_FLOAT)
+            {
+                return cbor_encode_float(container, data->f);
+            }
+            printf("Invalid telemetry data type detected\r\n");
+            return CborErrorIllegalType;
+        default:
+            return CborErrorIllegalType;
     }
+}
 
-    if (cbor_value_get_int(&element, (int *)msg_type))
-    {
-        return false;
+/**
+ * Parses the value of a single field, fields it depends on must already be parsed
+ */
+static bool parse_field(const CborValue * element, const msg_field * field, uint8_t * msg, telemetry_msg_format format)
+{
+    void * value = msg + field->offset;
+    telemetry_union * data;
+    uint64_t topic_id;
+
+    switch (field->type)
+    {
+        case FIELD_TOPIC:
+            if (format == TELEMETRY_MSG_FORMAT_MAP)
+            {
+                return cbor_value_is_half_float(element)
+                    && !cbor_value_get_half_float(element, value);
+            }
+            if (!cbor_value_is_unsigned_integer(element)
+                || cbor_value_get_uint64(element, &topic_id) || (topic_id > UINT16_MAX))
+            {
+                return false;
+            }
+            *(uint16_t *)value = topic_id;
+            return true;
+        case FIELD_INT:
+            return cbor_value_is_integer(element)
+                && !cbor_value_get_int_checked(element, value);
+        case FIELD_DATA:
+            data = value;
+            if (*(int *)(msg + field->aux_offset) == TELEMETRY_TYPE_INT)
+            {
+                return cbor_value_is_integer(element)
+                    && !cbor_value_get_int_checked(element, &(data->i));
+            }
+            else if (*(int *)(msg + field->aux_offset) == TELEMETRY_TYPE_FLOAT)
+            {
+                return cbor_value_is_float(element)
+                    && !cbor_value_get_float(element, &(data->f));
+            }
+            printf("Parsed invalid data type\r\n");
+            return false;
+        default:
+            return false;
     }
-
-    return true;
 }
 
-int telemetry_encode_packet_msg(uint8_t * buffer, const telemetry_packet * pkt)
+/**
+ * Encodes a message described by a field table
+ */
+static int encode_msg(uint8_t * buffer, telemetry_message_type message_type, const msg_field * fields,
+                      uint8_t num_fields, const void * msg, telemetry_msg_format format)
 {
     CborEncoder encoder, container;
     CborError err;
+    int ret;
+    int i;
 
-    if ((buffer == NULL) || (pkt == NULL))
+    if ((buffer == NULL) || (msg == NULL))
     {
         return -1;
     }
 
-    if (start_encode_msg(&encoder, &container, buffer, TELEMETRY_BUFFER_SIZE, 6, MESSAGE_TYPE_PACKET))
-    {
-        return -1;
-    }
-
-    if ((err = cbor_encode_text_stringz(&container, "TOPIC_ID")) > 0)
-    {
-        return -err;
-    }
-
-    if ((err = cbor_encode_half_float(&container, &(pkt->source.topic_id))) > 0)
-    {
-        return -err;
-    }
-
-    if ((err = cbor_encode_text_stringz(&container, "SUBSYSTEM_ID")) > 0)
-    {
-        return -err;
-    }
-
-    if ((err = cbor_encode_int(&container, pkt->source.subsystem_id)) > 0)
-    {
-        return -err;
-    }
-
-    if ((err = cbor_encode_text_stringz(&container, "DATA_TYPE")) > 0)
+    if ((ret = kprv_start_encode_msg(&encoder, &container, buffer, TELEMETRY_BUFFER_SIZE,
+                                     num_fields + 1, message_type, format)) != 0)
     {
-        return -err;
+        return (ret < 0) ? ret : -1;
     }
 
-    if ((err = cbor_encode_int(&container, pkt->source.data_type)) > 0)
+    for (i = 0; i < num_fields; i++)
     {
-        return -err;
-    }
-
-    if ((err = cbor_encode_text_stringz(&container, "DATA")) > 0)
-    {
-        return -err;
-    }
-
-    if (pkt->source.data_type == TELEMETRY_TYPE_INT)
-    {
-        err = cbor_encode_int(&container, pkt->data.i);
-    }
-    else if (pkt->source.data_type == TELEMETRY_TYPE_FLOAT)
-    {
-        err = cbor_encode_float(&container, pkt->data.f);
-    }
-    else
-    {
-        printf("Invalid telemetry data type detected\r\n");
-        err = -1;
-    }
-    if (err > 0)
-    {
-        return -err;
-    }
-
-    if ((err = cbor_encode_text_stringz(&container, "TIMESTAMP")) > 0)
-    {
-        return -err;
-    }
+        if ((format == TELEMETRY_MSG_FORMAT_MAP)
+            && ((err = cbor_encode_text_stringz(&container, fields[i].key)) > 0))
+        {
+            return -err;
+        }
 
-    if ((err = cbor_encode_int(&container, pkt->timestamp)) > 0)
-    {
-        return -err;
+        if ((err = encode_field(&container, &fields[i], msg, format)) > 0)
+        {
+            return -err;
+        }
     }
 
     return end_encode_msg(buffer, &encoder, &container);
 }
 
-bool telemetry_parse_packet_msg(const uint8_t * buffer, uint32_t buffer_size, telemetry_packet * packet)
+/**
+ * Parses a message described by a field table, in either format
+ */
+static bool parse_msg(const uint8_t * buffer, uint32_t buffer_size, const msg_field * fields,
+                      uint8_t num_fields, void * msg)
 {
     CborParser parser;
-    CborValue map, element;
+    CborValue top, element;
+    size_t length;
+    int i;
 
-    if ((buffer == NULL) || (packet == NULL))
+    if ((buffer == NULL) || (msg == NULL))
     {
         return false;
     }
 
-    CborError err = cbor_parser_init(buffer, buffer_size, 0, &parser, &map);
-    if (err || !cbor_value_is_map(&map))
+    if (cbor_parser_init(buffer, buffer_size, 0, &parser, &top))
     {
         return false;
     }
 
-    if (cbor_value_map_find_value(&map, "TOPIC_ID", &element))
+    if (cbor_value_is_array(&top))
     {
-        return false;
-    }
-
-    if (cbor_value_get_half_float(&element, &(packet->source.topic_id)))
-    {
-        return false;
-    }
+        /* Newer senders may append fields, only the known ones are read */
+        if (cbor_value_get_array_length(&top, &length) || (length < (size_t)(num_fields + 1))
+            || cbor_value_enter_container(&top, &element) || cbor_value_advance_fixed(&element))
+        {
+            return false;
+        }
 
-    err = cbor_value_map_find_value(&map, "SUBSYSTEM_ID", &element);
-    if (err || cbor_value_get_int(&element, &(packet->source.subsystem_id)))
-    {
-        return false;
+        for (i = 0; i < num_fields; i++)
+        {
+            if (!parse_field(&element, &fields[i], msg, TELEMETRY_MSG_FORMAT_ARRAY)
+                || cbor_value_advance(&element))
+            {
+                return false;
+            }
+        }
+        return true;
     }
 
-    err = cbor_value_map_find_value(&map, "DATA_TYPE", &element);
-    if (err || cbor_value_get_int(&element, (int *)&(packet->source.data_type)))
+    if (!cbor_value_is_map(&top))
     {
         return false;
     }
 
-    if (!cbor_value_map_find_value(&map, "DATA", &element))
+    for (i = 0; i < num_fields; i++)
     {
-        if (packet->source.data_type == TELEMETRY_TYPE_INT)
-        {
-            cbor_value_get_int(&element, &(packet->data.i));
-        }
-        else if (packet->source.data_type == TELEMETRY_TYPE_FLOAT)
-        {
-            cbor_value_get_float(&element, &(packet->data.f));
-        }
-        else
+        if (cbor_value_map_find_value(&top, fields[i].key, &element)
+            || !parse_field(&element, &fields[i], msg, TELEMETRY_MSG_FORMAT_MAP))
         {
-            printf("Parsed invalid data type\r\n");
             return false;
         }
     }
-
-    err = cbor_value_map_find_value(&map, "TIMESTAMP", &element);
-    if (err || cbor_value_get_int(&element, &(packet->timestamp)))
-    {
-        return false;
-    }
-
     return true;
 }
 
-int telemetry_encode_subscribe_msg(uint8_t * buffer, const uint16_t * topic_id)
-{
-    CborEncoder encoder, container;
-    CborError err;
-
-    if ((buffer == NULL) || (topic_id == NULL))
-    {
-        return -1;
-    }
-
-    if (start_encode_msg(&encoder, &container, buffer, TELEMETRY_BUFFER_SIZE, 2, MESSAGE_TYPE_SUBSCRIBE))
-    {
-        return -1;
-    }
-
-    if ((err = cbor_encode_text_stringz(&container, "TOPIC_ID")) > 0)
-    {
-        return -err;
-    }
-    
-    if ((err = cbor_encode_half_float(&container, topic_id)) > 0)
-    {
-        return -err;
-    }
-
-    return end_encode_msg(buffer, &encoder, &container);
-}
-
-bool telemetry_parse_subscribe_msg(const uint8_t * buffer, uint32_t buffer_size, uint16_t * topic_id)
+bool telemetry_parse_msg_type(const uint8_t * buffer, uint32_t buffer_size, telemetry_message_type * msg_type)
 {
     CborParser parser;
-    CborValue map, element;
+    CborValue top, element;
 
-    if ((buffer == NULL) || (topic_id == NULL))
+    if ((buffer == NULL) || (msg_type == NULL))
     {
         return false;
     }
 
-    CborError err = cbor_parser_init(buffer, buffer_size, 0, &parser, &map);
-    if (err || !cbor_value_is_map(&map))
+    CborError err = cbor_parser_init(buffer, buffer_size, 0, &parser, &top);
+    if (err)
     {
         return false;
     }
 
-    if (cbor_value_map_find_value(&map, "TOPIC_ID", &element))
+    if (cbor_value_is_array(&top))
+    {
+        /* The message type is always the first element */
+        if (cbor_value_enter_container(&top, &element))
+        {
+            return false;
+        }
+    }
+    else if (!cbor_value_is_map(&top) || cbor_value_map_find_value(&top, "MESSAGE_TYPE", &element))
     {
         return false;
     }
 
-    if (cbor_value_get_half_float(&element, topic_id))
+    if (!cbor_value_is_integer(&element) || cbor_value_get_int_checked(&element, (int *)msg_type))
     {
         return false;
     }
@@ -248,78 +298,112 @@ bool telemetry_parse_subscribe_msg(const uint8_t * buffer, uint32_t buffer_size,
     return true;
 }
 
-int telemetry_encode_unsubscribe_msg(uint8_t * buffer, const uint16_t * topic_id)
+int kprv_encode_msg(uint8_t * buffer, telemetry_message_type message_type, const void * msg, telemetry_msg_format format)
 {
     CborEncoder encoder, container;
-    CborError err;
 
-    if ((buffer == NULL) || (topic_id == NULL))
-    {
-        return -1;
+    switch (message_type)
+    {
+        case MESSAGE_TYPE_PACKET:
+            return encode_msg(buffer, message_type, packet_fields, NUM_FIELDS(packet_fields), msg, format);
+        case MESSAGE_TYPE_SUBSCRIBE:
+        case MESSAGE_TYPE_UNSUBSCRIBE:
+            return encode_msg(buffer, message_type, topic_fields, NUM_FIELDS(topic_fields), msg, format);
+        case MESSAGE_TYPE_DISCONNECT:
+            if ((buffer == NULL)
+                || kprv_start_encode_msg(&encoder, &container, buffer, TELEMETRY_BUFFER_SIZE, 1, message_type, format))
+            {
+                return -1;
+            }
+            return end_encode_msg(buffer, &encoder, &container);
+        default:
+            return -1;
     }
+}
 
-    if (start_encode_msg(&encoder, &container, buffer, TELEMETRY_BUFFER_SIZE, 2, MESSAGE_TYPE_UNSUBSCRIBE))
-    {
-        return -1;
-    }
+int telemetry_encode_packet_msg(uint8_t * buffer, const telemetry_packet * pkt)
+{
+    return kprv_encode_msg(buffer, MESSAGE_TYPE_PACKET, pkt, msg_format);
+}
 
-    if ((err = cbor_encode_text_stringz(&container, "TOPIC_ID")) > 0)
-    {
-        return -err;
-    }
+bool telemetry_parse_packet_msg(const uint8_t * buffer, uint32_t buffer_size, telemetry_packet * packet)
+{
+    return parse_msg(buffer, buffer_size, packet_fields, NUM_FIELDS(packet_fields), packet);
+}
 
-    if ((err = cbor_encode_half_float(&container, topic_id)) > 0)
-    {
-        return -err;
-    }
+int telemetry_encode_subscribe_msg(uint8_t * buffer, const uint16_t * topic_id)
+{
+    return kprv_encode_msg(buffer, MESSAGE_TYPE_SUBSCRIBE, topic_id, msg_format);
+}
 
-    return end_encode_msg(buffer, &encoder, &container);
+bool telemetry_parse_subscribe_msg(const uint8_t * buffer, uint32_t buffer_size, uint16_t * topic_id)
+{
+    return parse_msg(buffer, buffer_size, topic_fields, NUM_FIELDS(topic_fields), topic_id);
+}
+
+int telemetry_encode_unsubscribe_msg(uint8_t * buffer, const uint16_t * topic_id)
+{
+    return kprv_encode_msg(buffer, MESSAGE_TYPE_UNSUBSCRIBE, topic_id, msg_format);
 }
 
 bool telemetry_parse_unsubscribe_msg(const uint8_t * buffer, uint32_t buffer_size, uint16_t * topic_id)
 {
-    CborParser parser;
-    CborValue map, element;
+    return parse_msg(buffer, buffer_size, topic_fields, NUM_FIELDS(topic_fields), topic_id);
+}
 
-    if ((buffer == NULL) || (topic_id == NULL))
-    {
-        return false;
-    }
+int telemetry_encode_disconnect_msg(uint8_t * buffer)
+{
+    return kprv_encode_msg(buffer, MESSAGE_TYPE_DISCONNECT, NULL, msg_format);
+}
 
-    CborError err = cbor_parser_init(buffer, buffer_size, 0, &parser, &map);
-    if (err || !cbor_value_is_map(&map))
-    {
-        return false;
-    }
+int telemetry_encode_format_msg(uint8_t * buffer, telemetry_msg_format format)
+{
+    int value = format;
 
-    if (cbor_value_map_find_value(&map, "TOPIC_ID", &element))
-    {
-        return false;
-    }
+    /* Always a map, before negotiation that is the only format both sides know of */
+    return encode_msg(buffer, MESSAGE_TYPE_FORMAT, format_fields, NUM_FIELDS(format_fields), &value, TELEMETRY_MSG_FORMAT_MAP);
+}
 
-    if (cbor_value_get_half_float(&element, topic_id))
+bool telemetry_parse_format_msg(const uint8_t * buffer, uint32_t buffer_size, telemetry_msg_format * format)
+{
+    int value;
+
+    if ((format == NULL) || !parse_msg(buffer, buffer_size, format_fields, NUM_FIELDS(format_fields), &value)
+        || (value < 0))
     {
         return false;
     }
 
+    *format = value;
     return true;
 }
 
-int telemetry_encode_disconnect_msg(uint8_t * buffer)
+int kprv_start_encode_msg(CborEncoder * encoder, CborEncoder * container, uint8_t * buffer, uint32_t buffer_size, uint8_t num_elements, telemetry_message_type message_type, telemetry_msg_format format)
 {
-    CborEncoder encoder, container;
+    CborError err;
 
-    if (buffer == NULL)
+    if ((buffer == NULL) || (encoder == NULL) || (container == NULL))
     {
         return -1;
     }
 
-    if (start_encode_msg(&encoder, &container, buffer, TELEMETRY_BUFFER_SIZE, 1, MESSAGE_TYPE_DISCONNECT))
+    if (format == TELEMETRY_MSG_FORMAT_MAP)
     {
-        return -1;
+        return start_encode_msg(encoder, container, buffer, buffer_size, num_elements, message_type);
     }
 
-    return end_encode_msg(buffer, &encoder, &container);
+    cbor_encoder_init(encoder, buffer, buffer_size, 0);
+
+    if ((err = cbor_encoder_create_array(encoder, container, num_elements)) > 0)
+    {
+        return -err;
+    }
+
+    if ((err = cbor_encode_int(container, message_type)) > 0)
+    {
+        return -err;
+    }
+    return 0;
 }
 
 int start_encode_msg(CborEncoder * encoder, CborEncoder * container, uint8_t * buffer, uint32_t buffer_size, uint8_t num_elements, telemetry_message_type message_type)
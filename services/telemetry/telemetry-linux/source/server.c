@@ -20,6 +20,8 @@
 
 #include <csp/arch/csp_queue.h>
 #include <csp/arch/csp_semaphore.h>
+#include <csp/arch/csp_time.h>
+#include <ipc/reactor.h>
 #include <ipc/socket.h>
 #include <kubos-core/utlist.h>
 #include <stdio.h>
@@ -32,6 +34,59 @@ static subscriber_list_item * subscribers = NULL;
 /* Base id for subscribers */
 static uint16_t sub_id = 0;
 
+/* Reactor serving subscribers set up by telemetry_server_listen */
+static socket_reactor * server_reactor = NULL;
+
+/* Number of hash buckets in the topic index */
+#define TOPIC_INDEX_BUCKETS 64
+
+/**
+ * Set of subscribers interested in a single topic
+ */
+typedef struct topic_index_item
+{
+    uint16_t topic_id;
+    int num_subs;
+    int max_subs;
+    subscriber_list_item ** subs;
+    struct topic_index_item * next;
+} topic_index_item;
+
+/* Topic id -> subscribers, so publishing only touches interested subscribers */
+static topic_index_item * topic_index[TOPIC_INDEX_BUCKETS] = { NULL };
+
+/* Subscribers of TELEMETRY_TOPIC_ALL */
+static topic_index_item topic_index_all = { .topic_id = TELEMETRY_TOPIC_ALL };
+
+/* Lock protecting the topic index and the subscribers' topic lists */
+static csp_mutex_t topic_index_lock;
+
+/* Subscribers with packets waiting in their batch, protected by topic_index_lock */
+static subscriber_list_item * batch_pending[TELEMETRY_SUBSCRIBERS_MAX_NUM + 1];
+static int num_batch_pending = 0;
+
+/**
+ * Send to a subscriber served by rx_thread, which is made once
+ * topic_index_lock is released as it may block
+ */
+typedef struct
+{
+    subscriber_list_item * sub;
+    const void * data;
+    uint32_t length;
+    /* data is a copy to be freed after sending */
+    bool owned;
+} deferred_send;
+
+/**
+ * Sends collected while topic_index_lock is held
+ */
+typedef struct
+{
+    deferred_send sends[TELEMETRY_SUBSCRIBERS_MAX_NUM];
+    int num_sends;
+} deferred_sends;
+
 /**
  * Used to compare topic_ids when searching a topic list
  */
@@ -40,6 +95,234 @@ static int topic_cmp(const topic_list_item * a, const topic_list_item * b)
     return (a->topic_id != b->topic_id);
 }
 
+/**
+ * Finds the index item for a topic, creating it if requested
+ */
+static topic_index_item * kprv_topic_index_get(uint16_t topic_id, bool create)
+{
+    topic_index_item * item = NULL;
+
+    if (topic_id == TELEMETRY_TOPIC_ALL)
+    {
+        return &topic_index_all;
+    }
+
+    for (item = topic_index[topic_id % TOPIC_INDEX_BUCKETS]; item != NULL; item = item->next)
+    {
+        if (item->topic_id == topic_id)
+        {
+            return item;
+        }
+    }
+
+    if (create && ((item = calloc(1, sizeof(topic_index_item))) != NULL))
+    {
+        item->topic_id = topic_id;
+        LL_PREPEND(topic_index[topic_id % TOPIC_INDEX_BUCKETS], item);
+    }
+
+    return item;
+}
+
+/**
+ * Adds a subscriber to the index item of a topic
+ */
+static bool kprv_topic_index_add(uint16_t topic_id, subscriber_list_item * sub)
+{
+    topic_index_item * item = kprv_topic_index_get(topic_id, true);
+    subscriber_list_item ** subs = NULL;
+
+    if (item == NULL)
+    {
+        return false;
+    }
+
+    if (item->num_subs == item->max_subs)
+    {
+        int max_subs = (item->max_subs == 0) ? 4 : (item->max_subs * 2);
+        if ((subs = realloc(item->subs, max_subs * sizeof(subscriber_list_item *))) == NULL)
+        {
+            return false;
+        }
+        item->subs = subs;
+        item->max_subs = max_subs;
+    }
+
+    item->subs[item->num_subs++] = sub;
+    return true;
+}
+
+/**
+ * Removes a subscriber from the index item of a topic
+ */
+static void kprv_topic_index_remove(uint16_t topic_id, const subscriber_list_item * sub)
+{
+    topic_index_item * item = kprv_topic_index_get(topic_id, false);
+    int i;
+
+    if (item == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < item->num_subs; i++)
+    {
+        if (item->subs[i] == sub)
+        {
+            /* Order does not matter, fill the hole with the last entry */
+            item->subs[i] = item->subs[--item->num_subs];
+            break;
+        }
+    }
+
+    if ((item->num_subs == 0) && (item != &topic_index_all))
+    {
+        LL_DELETE(topic_index[topic_id % TOPIC_INDEX_BUCKETS], item);
+        free(item->subs);
+        free(item);
+    }
+}
+
+/**
+ * Sends a message to a subscriber, through the reactor if it serves the subscriber
+ */
+static bool kprv_subscriber_send(subscriber_list_item * sub, const void * data, uint32_t length)
+{
+    bool ret;
+
+    if (sub->rconn != NULL)
+    {
+        return kprv_reactor_send(server_reactor, sub->rconn, data, length);
+    }
+
+    csp_mutex_lock(&(sub->tx_lock), CSP_MAX_DELAY);
+    ret = kprv_socket_send(&(sub->conn), data, length);
+    csp_mutex_unlock(&(sub->tx_lock));
+
+    return ret;
+}
+
+/**
+ * Sends a message to a subscriber while topic_index_lock is held. Reactor
+ * sends never block and are made right away, others are added to later
+ * and made by kprv_send_deferred. If copy is set, data is only valid
+ * until the lock is released.
+ */
+static bool kprv_subscriber_send_locked(subscriber_list_item * sub, const void * data, uint32_t length,
+                                        bool copy, deferred_sends * later)
+{
+    deferred_send * send;
+    void * data_copy = NULL;
+
+    if (sub->rconn != NULL)
+    {
+        return kprv_subscriber_send(sub, data, length);
+    }
+
+    if ((later->num_sends >= TELEMETRY_SUBSCRIBERS_MAX_NUM)
+        || (copy && ((data_copy = malloc(length)) == NULL)))
+    {
+        /* More subscribers than configured, or out of memory */
+        return kprv_subscriber_send(sub, data, length);
+    }
+
+    if (copy)
+    {
+        memcpy(data_copy, data, length);
+        data = data_copy;
+    }
+
+    send = &(later->sends[later->num_sends++]);
+    send->sub = sub;
+    send->data = data;
+    send->length = length;
+    send->owned = copy;
+
+    /* Keeps the subscriber around until the send is made */
+    sub->sending++;
+
+    return true;
+}
+
+/**
+ * Makes the sends collected in later, must be called after releasing topic_index_lock
+ */
+static bool kprv_send_deferred(deferred_sends * later)
+{
+    bool ret = true;
+    int i;
+
+    for (i = 0; i < later->num_sends; i++)
+    {
+        deferred_send * send = &(later->sends[i]);
+
+        if (!kprv_subscriber_send(send->sub, send->data, send->length))
+        {
+            printf("Failed to publish to %d\r\n", send->sub->id);
+            ret = false;
+        }
+        if (send->owned)
+        {
+            free((void *)send->data);
+        }
+    }
+
+    if (later->num_sends > 0)
+    {
+        csp_mutex_lock(&topic_index_lock, CSP_MAX_DELAY);
+        for (i = 0; i < later->num_sends; i++)
+        {
+            later->sends[i].sub->sending--;
+        }
+        csp_mutex_unlock(&topic_index_lock);
+        later->num_sends = 0;
+    }
+
+    return ret;
+}
+
+/**
+ * Sends all packets waiting in a subscriber's batch with a single send
+ */
+static bool kprv_batch_flush(subscriber_list_item * sub, deferred_sends * later)
+{
+    bool ret = true;
+
+    if (sub->batch_count > 0)
+    {
+        if (!kprv_subscriber_send_locked(sub, (void *)sub->batch, sub->batch_count * sizeof(telemetry_packet), true, later))
+        {
+            printf("Failed to publish to %d\r\n", sub->id);
+            ret = false;
+        }
+        sub->batch_count = 0;
+    }
+
+    return ret;
+}
+
+/**
+ * Removes a subscriber from the set of subscribers with waiting packets
+ */
+static void kprv_batch_forget(const subscriber_list_item * sub)
+{
+    int i;
+
+    for (i = 0; i < num_batch_pending; i++)
+    {
+        if (batch_pending[i] == sub)
+        {
+            batch_pending[i] = batch_pending[--num_batch_pending];
+            break;
+        }
+    }
+}
+
+bool telemetry_server_init(void)
+{
+    return (csp_mutex_create(&topic_index_lock) == CSP_SEMAPHORE_OK);
+}
+
 subscriber_list_item * kprv_subscriber_init(socket_conn conn)
 {
     subscriber_list_item * sub = NULL;
@@ -52,6 +335,17 @@ subscriber_list_item * kprv_subscriber_init(socket_conn conn)
         sub->id = sub_id++;
         sub->next = NULL;
         sub->rx_thread = 0;
+        sub->rconn = NULL;
+        sub->sending = 0;
+        if (csp_mutex_create(&(sub->tx_lock)) != CSP_SEMAPHORE_OK)
+        {
+            free(sub);
+            return NULL;
+        }
+        if (TELEMETRY_BATCH_SIZE > 1)
+        {
+            sub->batch = calloc(TELEMETRY_BATCH_SIZE, sizeof(telemetry_packet));
+        }
     }
     return sub;
 }
@@ -72,14 +366,37 @@ void kprv_subscriber_destroy(subscriber_list_item ** sub)
 {
     if ((sub != NULL) && (*sub != NULL))
     {
-        csp_thread_kill((*sub)->rx_thread);
+        if ((*sub)->rx_thread != 0)
+        {
+            csp_thread_kill((*sub)->rx_thread);
+        }
 
         kprv_subscriber_remove_all_topics(*sub);
 
-        kprv_socket_close(&((*sub)->conn));
+        /* Packets still waiting in the batch are dropped with the connection */
+        csp_mutex_lock(&topic_index_lock, CSP_MAX_DELAY);
+        kprv_batch_forget(*sub);
+        /* No new publishes find the subscriber, waits for those still sending to it */
+        while ((*sub)->sending > 0)
+        {
+            csp_mutex_unlock(&topic_index_lock);
+            csp_sleep_ms(1);
+            csp_mutex_lock(&topic_index_lock, CSP_MAX_DELAY);
+        }
+        csp_mutex_unlock(&topic_index_lock);
+
+        /* The reactor closes its connections itself */
+        if ((*sub)->rconn == NULL)
+        {
+            kprv_socket_close(&((*sub)->conn));
+        }
 
         csp_queue_remove((*sub)->packet_queue);
 
+        free((*sub)->batch);
+
+        csp_mutex_remove(&((*sub)->tx_lock));
+
         free(*sub);
         *sub = NULL;
     }
@@ -90,13 +407,30 @@ bool kprv_subscriber_add_topic(subscriber_list_item * sub, uint16_t topic_id)
     bool ret = false;
     if (sub != NULL)
     {
-        topic_list_item * new_topic = NULL;
-        if ((new_topic = calloc(1, sizeof(topic_list_item))) != NULL)
+        csp_mutex_lock(&topic_index_lock, CSP_MAX_DELAY);
+        if (kprv_subscriber_has_topic(sub, topic_id))
         {
-            new_topic->topic_id = topic_id;
-            LL_APPEND(sub->topics, new_topic);
+            /* Already subscribed, do not deliver packets twice */
             ret = true;
         }
+        else
+        {
+            topic_list_item * new_topic = NULL;
+            if ((new_topic = calloc(1, sizeof(topic_list_item))) != NULL)
+            {
+                if (kprv_topic_index_add(topic_id, sub))
+                {
+                    new_topic->topic_id = topic_id;
+                    LL_APPEND(sub->topics, new_topic);
+                    ret = true;
+                }
+                else
+                {
+                    free(new_topic);
+                }
+            }
+        }
+        csp_mutex_unlock(&topic_index_lock);
     }
     return ret;
 }
@@ -110,28 +444,34 @@ bool kprv_subscriber_remove_topic(subscriber_list_item * sub, uint16_t topic_id)
             .topic_id = topic_id
         };
         topic_list_item * temp;
+        csp_mutex_lock(&topic_index_lock, CSP_MAX_DELAY);
         LL_SEARCH(sub->topics, temp, &topic, topic_cmp);
         if (temp != NULL)
         {
+            kprv_topic_index_remove(topic_id, sub);
             LL_DELETE(sub->topics, temp);
             free(temp);
             ret = true;
         }
+        csp_mutex_unlock(&topic_index_lock);
     }
     return ret;
 }
 
 void kprv_subscriber_remove_all_topics(subscriber_list_item * sub)
 {
+    csp_mutex_lock(&topic_index_lock, CSP_MAX_DELAY);
     if (sub->topics != NULL)
     {
         topic_list_item *temp_topic, *next_topic;
         LL_FOREACH_SAFE(sub->topics, temp_topic, next_topic)
         {
+            kprv_topic_index_remove(temp_topic->topic_id, sub);
             LL_DELETE(sub->topics, temp_topic);
             free(temp_topic);
         }
     }
+    csp_mutex_unlock(&topic_index_lock);
 }
 
 bool kprv_subscriber_has_topic(const subscriber_list_item * sub, uint16_t topic_id)
@@ -165,29 +505,140 @@ void kprv_delete_all_subscribers()
     }
 }
 
+/**
+ * Sends a packet to a single subscriber, or queues it in the
+ * subscriber's batch if batching is enabled
+ */
+static bool kprv_publish_to(subscriber_list_item * sub, telemetry_packet * packet, deferred_sends * later)
+{
+    if (sub->batch == NULL)
+    {
+        if (!kprv_subscriber_send_locked(sub, (void *)packet, sizeof(telemetry_packet), false, later))
+        {
+            printf("Failed to publish to %d\r\n", sub->id);
+            return false;
+        }
+        return true;
+    }
+
+    if (sub->batch_count == 0)
+    {
+        if (num_batch_pending > TELEMETRY_SUBSCRIBERS_MAX_NUM)
+        {
+            /* More subscribers than configured, do not hold packets back */
+            sub->batch[0] = *packet;
+            sub->batch_count = 1;
+            return kprv_batch_flush(sub, later);
+        }
+        batch_pending[num_batch_pending++] = sub;
+        sub->batch_time = csp_get_ms();
+    }
+
+    sub->batch[sub->batch_count++] = *packet;
+
+    if ((sub->batch_count < TELEMETRY_BATCH_SIZE)
+        && ((csp_get_ms() - sub->batch_time) < TELEMETRY_BATCH_LATENCY))
+    {
+        return true;
+    }
+
+    kprv_batch_forget(sub);
+    return kprv_batch_flush(sub, later);
+}
+
+bool telemetry_server_flush(bool force)
+{
+    deferred_sends later = { .num_sends = 0 };
+    bool ret = true;
+    uint32_t now = csp_get_ms();
+    int i = 0;
+
+    csp_mutex_lock(&topic_index_lock, CSP_MAX_DELAY);
+    while (i < num_batch_pending)
+    {
+        subscriber_list_item * sub = batch_pending[i];
+        if (force || ((now - sub->batch_time) >= TELEMETRY_BATCH_LATENCY))
+        {
+            /* Fills slot i with the last pending subscriber */
+            kprv_batch_forget(sub);
+            ret &= kprv_batch_flush(sub, &later);
+        }
+        else
+        {
+            i++;
+        }
+    }
+    csp_mutex_unlock(&topic_index_lock);
+
+    ret &= kprv_send_deferred(&later);
+
+    return ret;
+}
+
 bool kprv_publish_packet(telemetry_packet packet)
 {
+    deferred_sends later = { .num_sends = 0 };
     bool ret = true;
-    subscriber_list_item *current, *next;
-    LL_FOREACH_SAFE(subscribers, current, next)
+    topic_index_item * item = NULL;
+    int i;
+
+    /* Subscribers can not go away while they are being published to, blocking
+     * sends are made after releasing the lock so they don't hold up others */
+    csp_mutex_lock(&topic_index_lock, CSP_MAX_DELAY);
+
+    if ((packet.source.topic_id != TELEMETRY_TOPIC_ALL)
+        && ((item = kprv_topic_index_get(packet.source.topic_id, false)) != NULL))
     {
-        if (kprv_subscriber_has_topic(current, packet.source.topic_id))
+        for (i = 0; i < item->num_subs; i++)
         {
-            if (!kprv_socket_send(&(current->conn), (void *)&packet, sizeof(telemetry_packet)))
-            {
-                printf("Failed to publish to %d\r\n", current->id);
-                ret = false;
-            }
+            ret &= kprv_publish_to(item->subs[i], &packet, &later);
         }
     }
+
+    for (i = 0; i < topic_index_all.num_subs; i++)
+    {
+        /* Already sent above if also subscribed to this topic */
+        if ((item == NULL) || !kprv_subscriber_has_topic(topic_index_all.subs[i], packet.source.topic_id))
+        {
+            ret &= kprv_publish_to(topic_index_all.subs[i], &packet, &later);
+        }
+    }
+
+    csp_mutex_unlock(&topic_index_lock);
+
+    ret &= kprv_send_deferred(&later);
+
     return ret;
 }
 
+/**
+ * Answers a client's format negotiation with the newest format both sides support
+ */
+static bool kprv_reply_format(subscriber_list_item * sub, telemetry_msg_format requested)
+{
+    uint8_t buffer[TELEMETRY_BUFFER_SIZE];
+    int msg_size;
+
+    if (requested > TELEMETRY_MSG_FORMAT_LATEST)
+    {
+        requested = TELEMETRY_MSG_FORMAT_LATEST;
+    }
+
+    msg_size = telemetry_encode_format_msg(buffer, requested);
+    if (msg_size <= 0)
+    {
+        return false;
+    }
+
+    return kprv_subscriber_send(sub, buffer, msg_size);
+}
+
 bool telemetry_process_message(subscriber_list_item * sub, const void * buffer, int buffer_size)
 {
     bool ret = false;
     telemetry_message_type req;
     telemetry_packet packet;
+    telemetry_msg_format format;
     uint16_t topic_id;
 
     if ((sub == NULL) || (buffer == NULL))
@@ -221,6 +672,12 @@ bool telemetry_process_message(subscriber_list_item * sub, const void * buffer,
                 sub->active = false;
                 ret = true;
                 break;
+            case MESSAGE_TYPE_FORMAT:
+                if (telemetry_parse_format_msg(buffer, buffer_size, &format))
+                {
+                    ret = kprv_reply_format(sub, format);
+                }
+                break;
             default:
                 break;
         }
@@ -265,7 +722,73 @@ bool client_rx_work(subscriber_list_item * sub)
     return ret;
 }
 
+/**
+ * Creates a subscriber for a new reactor connection
+ */
+static bool kprv_reactor_on_accept(reactor_conn * conn, void * arg)
+{
+    subscriber_list_item * sub = kprv_subscriber_init(conn->conn);
+    if (sub == NULL)
+    {
+        return false;
+    }
+
+    sub->rconn = conn;
+    conn->user = sub;
+    return kprv_subscriber_add(sub);
+}
+
+/**
+ * Processes a message received by the reactor
+ */
+static bool kprv_reactor_on_message(reactor_conn * conn, const uint8_t * data, uint32_t length, void * arg)
+{
+    subscriber_list_item * sub = conn->user;
+
+    telemetry_process_message(sub, data, length);
+
+    /* Closes the connection once the subscriber disconnected */
+    return sub->active;
+}
+
+/**
+ * Destroys the subscriber of a closed reactor connection
+ */
+static void kprv_reactor_on_close(reactor_conn * conn, void * arg)
+{
+    subscriber_list_item * sub = conn->user;
+
+    LL_DELETE(subscribers, sub);
+    kprv_subscriber_destroy(&sub);
+}
+
+bool telemetry_server_listen(socket_reactor * reactor)
+{
+    const socket_reactor_callbacks callbacks = {
+        .on_accept = kprv_reactor_on_accept,
+        .on_message = kprv_reactor_on_message,
+        .on_close = kprv_reactor_on_close
+    };
+
+    if (!kprv_reactor_init(reactor, TELEMETRY_SOCKET_PORT, TELEMETRY_SUBSCRIBERS_MAX_NUM,
+                           &callbacks, NULL, TELEMETRY_BUFFER_SIZE))
+    {
+        return false;
+    }
+
+    server_reactor = reactor;
+    return true;
+}
+
 void telemetry_server_cleanup(void)
 {
+    telemetry_server_flush(true);
+    if (server_reactor != NULL)
+    {
+        /* Destroys the reactor's subscribers */
+        kprv_reactor_cleanup(server_reactor);
+        server_reactor = NULL;
+    }
     kprv_delete_all_subscribers();
+    csp_mutex_remove(&topic_index_lock);
 }
\ No newline at end of file
@@ -18,6 +18,14 @@
  * @defgroup Telemetry-Message
  * @addtogroup Telemetry-Message
  * @brief Telemetry Message Parsing/Encoding Interface
+ *
+ * Messages are encoded in one of two formats. The map format is a CBOR
+ * map with a text key for every field. The array format is a CBOR array
+ * holding the message type followed by the fields, identified by their
+ * position. Both are built from the same field tables, and parsing
+ * accepts either format. Every client connection starts out with the map
+ * format and switches to the newest format the server supports after
+ * negotiating with a MESSAGE_TYPE_FORMAT message on connect.
  * @{
  */
 
@@ -26,6 +34,33 @@
 #include <telemetry/types.h>
 #include <tinycbor/cbor.h>
 
+/**
+ * Telemetry message encodings
+ */
+typedef enum
+{
+    /*! CBOR map with text keys, understood by all servers */
+    TELEMETRY_MSG_FORMAT_MAP = 0,
+    /*! CBOR array with fields identified by position */
+    TELEMETRY_MSG_FORMAT_ARRAY
+} telemetry_msg_format;
+
+/*! Newest message format this library supports */
+#define TELEMETRY_MSG_FORMAT_LATEST TELEMETRY_MSG_FORMAT_ARRAY
+
+/**
+ * Sets the format used by the telemetry_encode_*_msg functions. Clients
+ * encode in the format negotiated for each connection instead.
+ * @param[in] format message format, ignored if unsupported
+ */
+void telemetry_set_msg_format(telemetry_msg_format format);
+
+/**
+ * Returns the format used for encoding messages
+ * @return telemetry_msg_format current message format
+ */
+telemetry_msg_format telemetry_get_msg_format(void);
+
 /**
  * Parses out the message type from an encoded message
  * @param[in] buffer buffer with encoded message
@@ -94,7 +129,51 @@ bool telemetry_parse_unsubscribe_msg(const uint8_t * buffer, uint32_t buffer_siz
 int telemetry_encode_disconnect_msg(uint8_t * buffer);
 
 /**
- * Sets up the structures for encoding a message
+ * Attempts to encode a packet, subscribe, unsubscribe or disconnect
+ * message in the given format
+ * @param[out] buffer buffer to store encoded message in
+ * @param[in] message_type type of message to encode
+ * @param[in] msg telemetry_packet for packet messages, uint16_t topic id for
+ *            (un)subscribe messages, ignored for disconnect messages
+ * @param[in] format message format
+ * @return int size of encoded message if successful, otherwise negative error code
+ */
+int kprv_encode_msg(uint8_t * buffer, telemetry_message_type message_type, const void * msg, telemetry_msg_format format);
+
+/**
+ * Attempts to encode a format negotiation message. Clients send it with
+ * the newest format they support, the server answers with the format it
+ * picked. These are always encoded in the map format.
+ * @param[out] buffer buffer to store encoded packet in
+ * @param[in] format message format to encode in message
+ * @return int 0 if successful, otherwise negative error code
+ */
+int telemetry_encode_format_msg(uint8_t * buffer, telemetry_msg_format format);
+
+/**
+ * Attempt to parse a format negotiation message
+ * @param[in] buffer buffer storing packet data
+ * @param[in] buffer_size size of buffer
+ * @param[out] format message format read from message
+ * @return bool true if successful, otherwise false
+ */
+bool telemetry_parse_format_msg(const uint8_t * buffer, uint32_t buffer_size, telemetry_msg_format * format);
+
+/**
+ * Sets up the structures for encoding a message in the given format
+ * @param[out] encoder Master CBOR encoder
+ * @param[out] container CBOR container for map or array
+ * @param[out] buffer buffer to store end data in
+ * @param[in] buffer_size size of buffer
+ * @param[in] num_elements number of elements in the message, including the message type
+ * @param[in] message_type message type to be encoded
+ * @param[in] format message format
+ * @return int 0 if successful, otherwise negative error
+ */
+int kprv_start_encode_msg(CborEncoder * encoder, CborEncoder * container, uint8_t * buffer, uint32_t buffer_size, uint8_t num_elements, telemetry_message_type message_type, telemetry_msg_format format);
+
+/**
+ * Sets up the structures for encoding a message in the map format
  * @param[out] encoder Master CBOR encoder
  * @param[out] container CBOR container for map
  * @param[out] buffer buffer to store end data in
@@ -23,11 +23,18 @@
 
 #pragma once
 
+#include <ipc/reactor.h>
 #include <ipc/socket.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <telemetry/telemetry.h>
 
+/**
+ * Sets up the topic index used to deliver packets to subscribers
+ * @return bool true if successful, otherwise false
+ */
+bool telemetry_server_init(void);
+
 /**
  * Inits a new subscriber structure
  * @param[in] conn socket_connection used by subscriber
@@ -49,7 +56,8 @@ bool kprv_subscriber_add(subscriber_list_item * sub);
 void kprv_subscriber_destroy(subscriber_list_item ** sub);
 
 /**
- * Adds a topic id to a subscribers list of topics
+ * Adds a topic id to a subscribers list of topics. Subscribing to
+ * TELEMETRY_TOPIC_ALL delivers packets of every topic.
  * @param[in,out] sub subscriber list item
  * @param[in] topic_id topic id to add
  * @return bool true if successful, false otherwise
@@ -93,7 +101,26 @@ void kprv_delete_all_subscribers();
 bool telemetry_process_message(subscriber_list_item * sub, const void * buffer, int buffer_size);
 
 /**
- * Performs cleanup of telemetry server stuff
+ * Sends packets which have been waiting in subscriber batches for at
+ * least TELEMETRY_BATCH_LATENCY ms. Should be called periodically when
+ * TELEMETRY_BATCH_SIZE is larger than one.
+ * @param[in] force send all waiting packets regardless of their age
+ * @return bool true if successful, otherwise false
+ */
+bool telemetry_server_flush(bool force);
+
+/**
+ * Listens for subscribers on TELEMETRY_SOCKET_PORT and serves all of them
+ * from the thread calling kprv_reactor_poll on reactor, instead of one
+ * client_handler thread per subscriber
+ * @param[out] reactor socket_reactor to set up, must stay valid until telemetry_server_cleanup
+ * @return bool true if successful, otherwise false
+ */
+bool telemetry_server_listen(socket_reactor * reactor);
+
+/**
+ * Performs cleanup of telemetry server stuff, including the reactor set
+ * up by telemetry_server_listen
  */
 void telemetry_server_cleanup(void);
 
@@ -15,31 +15,118 @@
  */
 
 #include "telemetry/telemetry.h"
+#include "telemetry-linux/msg.h"
 #include <cmocka.h>
 #include <tinycbor/cbor.h>
 
+static const telemetry_packet packets_in[4] = { 0 };
+
+/**
+ * Checks that a sent message is encoded in the format given as value
+ */
+static int check_msg_format(const LargestIntegralType value, const LargestIntegralType format)
+{
+    const uint8_t * buffer = (const uint8_t *)value;
+    uint8_t major_type = buffer[0] & 0xE0;
+
+    return (format == TELEMETRY_MSG_FORMAT_ARRAY) ? (major_type == 0x80) : (major_type == 0xA0);
+}
+
+static void expect_send(telemetry_msg_format format)
+{
+    expect_value(__wrap_kprv_socket_send, conn->is_active, true);
+    expect_check(__wrap_kprv_socket_send, data, check_msg_format, format);
+    will_return(__wrap_kprv_socket_send, true);
+}
+
+static void expect_recv(const void * data, uint32_t size, bool ret)
+{
+    expect_value(__wrap_kprv_socket_recv, conn->is_active, true);
+    expect_not_value(__wrap_kprv_socket_recv, buffer, NULL);
+    will_return(__wrap_kprv_socket_recv, data);
+    will_return(__wrap_kprv_socket_recv, size);
+    will_return(__wrap_kprv_socket_recv, ret);
+}
+
+/**
+ * Expects a read of the server's reply to the format request, which
+ * arrives if reply is true and times out otherwise
+ */
+static void expect_format_reply(bool reply)
+{
+    static uint8_t format_msg[TELEMETRY_BUFFER_SIZE];
+    int msg_size = telemetry_encode_format_msg(format_msg, TELEMETRY_MSG_FORMAT_ARRAY);
+
+    expect_recv(format_msg, reply ? msg_size : 0, reply);
+}
+
+static void expect_connect(bool reply)
+{
+    will_return(__wrap_kprv_socket_client_connect, true);
+    expect_send(TELEMETRY_MSG_FORMAT_MAP);
+    expect_format_reply(reply);
+}
+
 static void test_client_connect(void ** arg)
 {
     socket_conn conn;
 
-    will_return(__wrap_kprv_socket_client_connect, true);
+    expect_connect(true);
 
     assert_true(telemetry_connect(&conn));
     assert_true(conn.socket_handle > 0);
     assert_true(conn.is_active);
+
+    /* The negotiated format is used from then on */
+    expect_send(TELEMETRY_MSG_FORMAT_ARRAY);
+    assert_true(telemetry_subscribe(&conn, 0));
 }
 
-static void test_client_disconnect(void ** arg)
+static void test_client_connect_format_late(void ** arg)
 {
     socket_conn conn;
+    telemetry_packet packet;
 
-    will_return(__wrap_kprv_socket_client_connect, true);
+    expect_connect(false);
+    assert_true(telemetry_connect(&conn));
+
+    expect_send(TELEMETRY_MSG_FORMAT_MAP);
+    assert_true(telemetry_subscribe(&conn, 0));
+
+    /* The late reply comes before any telemetry and is read first */
+    expect_format_reply(true);
+    expect_recv(packets_in, sizeof(telemetry_packet), true);
+    assert_true(telemetry_read(&conn, &packet));
+
+    expect_send(TELEMETRY_MSG_FORMAT_ARRAY);
+    assert_true(telemetry_subscribe(&conn, 0));
+}
+
+static void test_client_connect_per_connection(void ** arg)
+{
+    socket_conn conn_array;
+    socket_conn conn_map;
+
+    expect_connect(true);
+    assert_true(telemetry_connect(&conn_array));
+    expect_connect(false);
+    assert_true(telemetry_connect(&conn_map));
+
+    /* Each connection keeps the format it negotiated */
+    expect_send(TELEMETRY_MSG_FORMAT_ARRAY);
+    assert_true(telemetry_subscribe(&conn_array, 0));
+    expect_send(TELEMETRY_MSG_FORMAT_MAP);
+    assert_true(telemetry_subscribe(&conn_map, 0));
+}
+
+static void test_client_disconnect(void ** arg)
+{
+    socket_conn conn;
 
+    expect_connect(true);
     telemetry_connect(&conn);
 
-    expect_not_value(__wrap_kprv_socket_send, conn->is_active, false);
-    expect_not_value(__wrap_kprv_socket_send, data, NULL);
-    will_return(__wrap_kprv_socket_send, true);
+    expect_send(TELEMETRY_MSG_FORMAT_ARRAY);
 
     assert_true(telemetry_disconnect(&conn));
     assert_false(conn.is_active);
@@ -52,9 +139,7 @@ static void test_client_subscribe(void ** arg)
     will_return(__wrap_kprv_socket_client_connect, true);
     kprv_socket_client_connect(&conn, 0);
 
-    expect_not_value(__wrap_kprv_socket_send, conn->is_active, false);
-    expect_not_value(__wrap_kprv_socket_send, data, NULL);
-    will_return(__wrap_kprv_socket_send, true);
+    expect_send(TELEMETRY_MSG_FORMAT_MAP);
 
     assert_true(telemetry_subscribe(&conn, 0));
 }
@@ -66,9 +151,7 @@ static void test_client_unsubscribe(void ** arg)
     will_return(__wrap_kprv_socket_client_connect, true);
     kprv_socket_client_connect(&conn, 0);
 
-    expect_not_value(__wrap_kprv_socket_send, conn->is_active, false);
-    expect_not_value(__wrap_kprv_socket_send, data, NULL);
-    will_return(__wrap_kprv_socket_send, true);
+    expect_send(TELEMETRY_MSG_FORMAT_MAP);
 
     assert_true(telemetry_unsubscribe(&conn, 0));
 }
@@ -81,23 +164,84 @@ static void test_client_read(void ** arg)
     will_return(__wrap_kprv_socket_client_connect, true);
     kprv_socket_client_connect(&conn, 0);
 
-    expect_value(__wrap_kprv_socket_recv, conn->is_active, true);
-    expect_not_value(__wrap_kprv_socket_recv, buffer, NULL);
-    will_return(__wrap_kprv_socket_recv, "");
-    will_return(__wrap_kprv_socket_recv, true);
+    expect_recv(packets_in, sizeof(telemetry_packet), true);
 
     assert_true(telemetry_read(&conn, &packet));
 }
 
+static void test_client_read_short(void ** arg)
+{
+    socket_conn conn;
+    telemetry_packet packet;
+
+    will_return(__wrap_kprv_socket_client_connect, true);
+    kprv_socket_client_connect(&conn, 0);
+
+    /* A message shorter than a packet is not read as one */
+    expect_recv(packets_in, sizeof(telemetry_packet) - 1, true);
+    expect_recv(packets_in, sizeof(telemetry_packet), true);
+
+    assert_true(telemetry_read(&conn, &packet));
+}
+
+static void test_client_read_batch(void ** arg)
+{
+    socket_conn conn;
+    telemetry_packet packets[4];
+    uint16_t num_packets = 0;
+
+    will_return(__wrap_kprv_socket_client_connect, true);
+    kprv_socket_client_connect(&conn, 0);
+
+    /* Six packets are waiting, only four fit in the first read */
+    expect_recv(packets_in, 4 * sizeof(telemetry_packet), true);
+
+    assert_true(telemetry_read_batch(&conn, packets, 4, &num_packets));
+    assert_int_equal(num_packets, 4);
+
+    /* The other two come with the next read */
+    expect_recv(packets_in, 2 * sizeof(telemetry_packet), true);
+
+    assert_true(telemetry_read_batch(&conn, packets, 4, &num_packets));
+    assert_int_equal(num_packets, 2);
+
+    assert_false(telemetry_read_batch(&conn, packets, 0, &num_packets));
+}
+
+static void test_client_read_batch_short(void ** arg)
+{
+    socket_conn conn;
+    telemetry_packet packets[4];
+    uint16_t num_packets = 0;
+
+    will_return(__wrap_kprv_socket_client_connect, true);
+    kprv_socket_client_connect(&conn, 0);
+
+    /* Messages which are not whole packets are not counted as packets */
+    expect_recv(packets_in, sizeof(telemetry_packet) - 1, true);
+    expect_recv(packets_in, sizeof(telemetry_packet) + 1, true);
+
+    /* So the next message is read instead */
+    expect_recv(packets_in, sizeof(telemetry_packet), true);
+
+    assert_true(telemetry_read_batch(&conn, packets, 4, &num_packets));
+    assert_int_equal(num_packets, 1);
+}
+
 int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_client_connect),
+        cmocka_unit_test(test_client_connect_format_late),
+        cmocka_unit_test(test_client_connect_per_connection),
         cmocka_unit_test(test_client_disconnect),
         cmocka_unit_test(test_client_subscribe),
         cmocka_unit_test(test_client_unsubscribe),
         cmocka_unit_test(test_client_read),
+        cmocka_unit_test(test_client_read_short),
+        cmocka_unit_test(test_client_read_batch),
+        cmocka_unit_test(test_client_read_batch_short),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
-}
\ No newline at end of file
+}
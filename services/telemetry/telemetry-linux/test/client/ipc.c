@@ -16,12 +16,15 @@
 
 #include <cmocka.h>
 #include <ipc/socket.h>
+#include <string.h>
 
 bool __wrap_kprv_socket_client_connect(socket_conn * conn, uint8_t port)
 {
+    static int socket_handle = 10;
+
     if (conn != NULL)
     {
-        conn->socket_handle = 10;
+        conn->socket_handle = socket_handle++;
         conn->is_active = true;
     }
     return mock_type(bool);
@@ -37,9 +40,13 @@ bool __wrap_kprv_socket_send(socket_conn * conn, void * data, uint16_t length)
 
 bool __wrap_kprv_socket_recv(socket_conn * conn, void * buffer, int buffer_size, uint32_t * size_read)
 {
+    const void * data;
+
     check_expected(conn->is_active);
     check_expected(buffer);
-    buffer = mock_type(void *);
+    data = mock_type(const void *);
+    *size_read = mock_type(uint32_t);
+    memcpy(buffer, data, *size_read);
     return mock_type(bool);
 }
 
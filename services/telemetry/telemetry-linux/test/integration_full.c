@@ -69,6 +69,8 @@ static int setup(void ** arg)
 {
     test_running = true;
 
+    assert_true(telemetry_server_init());
+
     csp_thread_create(server_task, "SERVER", 1024, NULL, 0, &server_task_handle);
 
     return 0;
@@ -58,6 +58,8 @@ static void test_server(void ** arg)
     uint8_t message[TELEMETRY_BUFFER_SIZE];
     uint32_t msg_size;
 
+    assert_true(telemetry_server_init());
+
     csp_thread_create(client_task, "CLIENT", 1024, NULL, 0, &client_task_handle);
 
     assert_true(kprv_socket_server_setup(&server_conn, TELEMETRY_SOCKET_PORT, TELEMETRY_SUBSCRIBERS_MAX_NUM));
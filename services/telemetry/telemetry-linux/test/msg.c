@@ -50,6 +50,78 @@ static void test_packet_msg(void ** arg)
 
 
 
+static void test_packet_msg_array(void ** arg)
+{
+    telemetry_packet in = {
+        .source.topic_id = 300,
+        .source.subsystem_id = -2,
+        .source.data_type = TELEMETRY_TYPE_FLOAT,
+        .data.f = 1.5,
+        .timestamp = 1010101
+    };
+    telemetry_message_type msg_type;
+    telemetry_packet out;
+    uint8_t buffer[100];
+
+    int map_size = telemetry_encode_packet_msg(buffer, &in);
+
+    telemetry_set_msg_format(TELEMETRY_MSG_FORMAT_ARRAY);
+    int msg_size = telemetry_encode_packet_msg(buffer, &in);
+    telemetry_set_msg_format(TELEMETRY_MSG_FORMAT_MAP);
+
+    bool parsed_type = telemetry_parse_msg_type(buffer, msg_size, &msg_type);
+    bool parsed = telemetry_parse_packet_msg(buffer, msg_size, &out);
+
+    assert_true(msg_size > 0);
+    assert_true(msg_size < map_size / 2);
+    assert_true(parsed_type);
+    assert_true(parsed);
+
+    assert_int_equal(msg_type, MESSAGE_TYPE_PACKET);
+    assert_int_equal(in.source.topic_id, out.source.topic_id);
+    assert_int_equal(in.source.subsystem_id, out.source.subsystem_id);
+    assert_int_equal(in.source.data_type, out.source.data_type);
+    assert_true(in.data.f == out.data.f);
+    assert_int_equal(in.timestamp, out.timestamp);
+}
+
+static void test_packet_msg_array_short(void ** arg)
+{
+    telemetry_packet in = {
+        .source.topic_id = 1,
+        .source.data_type = TELEMETRY_TYPE_INT
+    };
+    telemetry_packet out;
+    uint8_t buffer[100];
+
+    telemetry_set_msg_format(TELEMETRY_MSG_FORMAT_ARRAY);
+    int msg_size = telemetry_encode_packet_msg(buffer, &in);
+    telemetry_set_msg_format(TELEMETRY_MSG_FORMAT_MAP);
+
+    assert_true(msg_size > 0);
+    /* One field short of a packet message */
+    buffer[0]--;
+    assert_false(telemetry_parse_packet_msg(buffer, msg_size, &out));
+}
+
+static void test_format_msg(void ** arg)
+{
+    uint8_t buffer[100];
+    telemetry_message_type msg_type;
+    telemetry_msg_format format_out;
+
+    int msg_size = telemetry_encode_format_msg(buffer, TELEMETRY_MSG_FORMAT_ARRAY);
+    bool parsed_type = telemetry_parse_msg_type(buffer, msg_size, &msg_type);
+    bool parsed = telemetry_parse_format_msg(buffer, msg_size, &format_out);
+
+    assert_true(msg_size > 0);
+    assert_true(parsed_type);
+    assert_true(parsed);
+
+    assert_int_equal(msg_type, MESSAGE_TYPE_FORMAT);
+    assert_int_equal(format_out, TELEMETRY_MSG_FORMAT_ARRAY);
+}
+
 static void test_packet_bad_type(void ** arg)
 {
     telemetry_packet in = {
@@ -169,6 +241,9 @@ int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_packet_msg),
+        cmocka_unit_test(test_packet_msg_array),
+        cmocka_unit_test(test_packet_msg_array_short),
+        cmocka_unit_test(test_format_msg),
         cmocka_unit_test(test_packet_bad_type),
         cmocka_unit_test(test_subscribe_msg),
         cmocka_unit_test(test_unsubscribe_msg),
@@ -27,11 +27,19 @@ bool __wrap_kprv_socket_client_connect(socket_conn * conn, uint8_t port)
     return mock_type(bool);
 }
 
+/* Called by the kprv_socket_send mock if set */
+void (*send_hook)(void) = NULL;
+
 bool __wrap_kprv_socket_send(socket_conn * conn, void * buffer, uint16_t length)
 {
     check_expected(conn->is_active);
     check_expected(buffer);
 
+    if (send_hook != NULL)
+    {
+        send_hook();
+    }
+
     return mock_type(bool);
 }
 
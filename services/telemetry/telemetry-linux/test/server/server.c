@@ -19,6 +19,8 @@
 #include <telemetry-linux/server.h>
 #include <tinycbor/cbor.h>
 
+extern void (*send_hook)(void);
+
 static void test_server_add_subscription(void ** arg)
 {
     subscriber_list_item sub = {
@@ -183,6 +185,45 @@ static void test_server_get_packet_msg(void ** arg)
     kprv_subscriber_destroy(&sub);
 }
 
+static void test_server_get_format_msg(void ** arg)
+{
+    uint8_t buffer[100];
+    int msg_size;
+    subscriber_list_item sub = {
+        .conn.is_active = true,
+        .topics = NULL
+    };
+
+    /* A client newer than the server gets the server's newest format */
+    msg_size = telemetry_encode_format_msg(buffer, TELEMETRY_MSG_FORMAT_LATEST + 1);
+
+    expect_value(__wrap_kprv_socket_send, conn->is_active, true);
+    expect_any(__wrap_kprv_socket_send, buffer);
+    will_return(__wrap_kprv_socket_send, true);
+
+    assert_true(telemetry_process_message(&sub, buffer, msg_size));
+}
+
+static void test_server_get_array_msg(void ** arg)
+{
+    uint8_t buffer[100];
+    uint16_t subscribe_topic = 12;
+    int msg_size;
+    subscriber_list_item sub = {
+        .conn.is_active = true,
+        .topics = NULL
+    };
+
+    telemetry_set_msg_format(TELEMETRY_MSG_FORMAT_ARRAY);
+    msg_size = telemetry_encode_subscribe_msg(buffer, &subscribe_topic);
+    telemetry_set_msg_format(TELEMETRY_MSG_FORMAT_MAP);
+
+    assert_true(telemetry_process_message(&sub, buffer, msg_size));
+    assert_true(kprv_subscriber_has_topic(&sub, subscribe_topic));
+
+    kprv_subscriber_remove_all_topics(&sub);
+}
+
 static void test_server_get_bad_msg(void ** arg)
 {
     uint8_t buffer[100] = { 0 };
@@ -201,6 +242,194 @@ static void test_server_get_bad_msg(void ** arg)
     kprv_subscriber_destroy(&sub);
 }
 
+static void test_server_publish_to_subscribed(void ** arg)
+{
+    telemetry_packet packet = {
+        .source.topic_id = 5,
+        .data.i = 5
+    };
+    subscriber_list_item sub_a = {
+        .conn.is_active = true,
+        .topics = NULL
+    };
+    subscriber_list_item sub_b = {
+        .conn.is_active = true,
+        .topics = NULL
+    };
+
+    csp_mutex_create(&(sub_a.tx_lock));
+    csp_mutex_create(&(sub_b.tx_lock));
+    kprv_subscriber_add_topic(&sub_a, 5);
+    kprv_subscriber_add_topic(&sub_b, 6);
+
+    /* Only sub_a is interested in topic 5 */
+    expect_value(__wrap_kprv_socket_send, conn->is_active, true);
+    expect_any(__wrap_kprv_socket_send, buffer);
+    will_return(__wrap_kprv_socket_send, true);
+    assert_true(kprv_publish_packet(packet));
+
+    /* Nobody is interested anymore */
+    kprv_subscriber_remove_topic(&sub_a, 5);
+    assert_true(kprv_publish_packet(packet));
+
+    kprv_subscriber_remove_all_topics(&sub_b);
+    csp_mutex_remove(&(sub_a.tx_lock));
+    csp_mutex_remove(&(sub_b.tx_lock));
+}
+
+static void test_server_publish_to_all(void ** arg)
+{
+    telemetry_packet packet = {
+        .source.topic_id = 7,
+        .data.i = 7
+    };
+    subscriber_list_item sub = {
+        .conn.is_active = true,
+        .topics = NULL
+    };
+
+    csp_mutex_create(&(sub.tx_lock));
+
+    /* Subscribing twice, and to everything, still delivers once */
+    assert_true(kprv_subscriber_add_topic(&sub, TELEMETRY_TOPIC_ALL));
+    assert_true(kprv_subscriber_add_topic(&sub, 7));
+    assert_true(kprv_subscriber_add_topic(&sub, 7));
+
+    expect_value(__wrap_kprv_socket_send, conn->is_active, true);
+    expect_any(__wrap_kprv_socket_send, buffer);
+    will_return(__wrap_kprv_socket_send, true);
+    assert_true(kprv_publish_packet(packet));
+
+    packet.source.topic_id = 8;
+    expect_value(__wrap_kprv_socket_send, conn->is_active, true);
+    expect_any(__wrap_kprv_socket_send, buffer);
+    will_return(__wrap_kprv_socket_send, true);
+    assert_true(kprv_publish_packet(packet));
+
+    kprv_subscriber_remove_all_topics(&sub);
+    assert_false(kprv_subscriber_has_topic(&sub, TELEMETRY_TOPIC_ALL));
+    assert_true(kprv_publish_packet(packet));
+    csp_mutex_remove(&(sub.tx_lock));
+}
+
+static void test_server_publish_batch(void ** arg)
+{
+    telemetry_packet batch[TELEMETRY_BATCH_SIZE];
+    telemetry_packet sent[TELEMETRY_BATCH_SIZE];
+    telemetry_packet packet = {
+        .source.topic_id = 9,
+        .data.i = 9
+    };
+    subscriber_list_item sub = {
+        .conn.is_active = true,
+        .topics = NULL,
+        .batch = batch
+    };
+    int i;
+
+    for (i = 0; i < TELEMETRY_BATCH_SIZE; i++)
+    {
+        sent[i] = packet;
+    }
+
+    csp_mutex_create(&(sub.tx_lock));
+    kprv_subscriber_add_topic(&sub, 9);
+
+    /* Nothing is sent until the batch fills up... */
+    for (i = 0; i < TELEMETRY_BATCH_SIZE - 1; i++)
+    {
+        assert_true(kprv_publish_packet(packet));
+    }
+    assert_int_equal(sub.batch_count, TELEMETRY_BATCH_SIZE - 1);
+
+    /* ...and then the whole batch goes out in one send */
+    expect_value(__wrap_kprv_socket_send, conn->is_active, true);
+    expect_memory(__wrap_kprv_socket_send, buffer, sent, sizeof(sent));
+    will_return(__wrap_kprv_socket_send, true);
+    assert_true(kprv_publish_packet(packet));
+    assert_int_equal(sub.batch_count, 0);
+
+    /* A partial batch is sent when flushed */
+    if (TELEMETRY_BATCH_SIZE > 1)
+    {
+        assert_true(kprv_publish_packet(packet));
+        assert_int_equal(sub.batch_count, 1);
+
+        expect_value(__wrap_kprv_socket_send, conn->is_active, true);
+        expect_memory(__wrap_kprv_socket_send, buffer, sent, sizeof(telemetry_packet));
+        will_return(__wrap_kprv_socket_send, true);
+        assert_true(telemetry_server_flush(true));
+        assert_int_equal(sub.batch_count, 0);
+    }
+
+    /* Nothing left to send */
+    assert_true(telemetry_server_flush(true));
+
+    kprv_subscriber_remove_all_topics(&sub);
+    csp_mutex_remove(&(sub.tx_lock));
+}
+
+static subscriber_list_item unlocked_sub = {
+    .conn.is_active = true,
+    .topics = NULL
+};
+static csp_bin_sem_handle_t unlocked_done;
+
+CSP_DEFINE_TASK(unlocked_subscribe_task)
+{
+    kprv_subscriber_add_topic(&unlocked_sub, 11);
+    csp_bin_sem_post(&unlocked_done);
+    csp_thread_exit();
+}
+
+/**
+ * Subscribes from another thread while a packet is being sent
+ */
+static void unlocked_send_hook(void)
+{
+    csp_thread_handle_t handle;
+
+    assert_int_equal(csp_thread_create(unlocked_subscribe_task, NULL, 1000, NULL, 0, &handle), 0);
+    assert_int_equal(csp_bin_sem_wait(&unlocked_done, 1000), CSP_SEMAPHORE_OK);
+}
+
+static void test_server_publish_unlocked(void ** arg)
+{
+    telemetry_packet packet = {
+        .source.topic_id = 10,
+        .data.i = 10
+    };
+
+    csp_mutex_create(&(unlocked_sub.tx_lock));
+    csp_bin_sem_create(&unlocked_done);
+    csp_bin_sem_wait(&unlocked_done, 0);
+    kprv_subscriber_add_topic(&unlocked_sub, 10);
+
+    /* A blocking send does not keep others from changing subscriptions */
+    send_hook = unlocked_send_hook;
+    expect_value(__wrap_kprv_socket_send, conn->is_active, true);
+    expect_any(__wrap_kprv_socket_send, buffer);
+    will_return(__wrap_kprv_socket_send, true);
+    assert_true(kprv_publish_packet(packet));
+    send_hook = NULL;
+    assert_true(kprv_subscriber_has_topic(&unlocked_sub, 11));
+
+    kprv_subscriber_remove_all_topics(&unlocked_sub);
+    csp_bin_sem_remove(&unlocked_done);
+    csp_mutex_remove(&(unlocked_sub.tx_lock));
+}
+
+static int setup(void ** arg)
+{
+    return telemetry_server_init() ? 0 : -1;
+}
+
+static int teardown(void ** arg)
+{
+    telemetry_server_cleanup();
+    return 0;
+}
+
 int main(void)
 {
     const struct CMUnitTest tests[] = {
@@ -212,8 +441,14 @@ int main(void)
         cmocka_unit_test(test_server_get_unsubscribe_msg),
         cmocka_unit_test(test_server_get_disconnect_msg),
         cmocka_unit_test(test_server_get_packet_msg),
+        cmocka_unit_test(test_server_get_format_msg),
+        cmocka_unit_test(test_server_get_array_msg),
         cmocka_unit_test(test_server_get_bad_msg),
+        cmocka_unit_test(test_server_publish_to_subscribed),
+        cmocka_unit_test(test_server_publish_to_all),
+        cmocka_unit_test(test_server_publish_batch),
+        cmocka_unit_test(test_server_publish_unlocked),
     };
 
-    return cmocka_run_group_tests(tests, NULL, NULL);
+    return cmocka_run_group_tests(tests, setup, teardown);
 }
\ No newline at end of file
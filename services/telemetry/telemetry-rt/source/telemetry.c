@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <csp/interfaces/csp_if_lo.h>
 #include <csp/interfaces/csp_if_socket.h>
 #include <csp/drivers/socket.h>
 
@@ -76,6 +77,48 @@ static subscriber_list_item * subscribers = NULL;
 /* Private CSP socket used for telemetry connections */
 static csp_socket_t * socket = NULL;
 
+#ifndef TARGET_LIKE_KUBOS_RT
+/* Socket interface to the telemetry server, shared by all publishers.
+   It is the default route while any publisher is open. */
+static csp_socket_handle_t publisher_driver;
+static csp_iface_t publisher_iface;
+static unsigned int publisher_refs = 0;
+
+/* Default route in place before the first publisher was opened */
+static csp_iface_t * publisher_prev_route = NULL;
+static uint8_t publisher_prev_mac;
+
+/* Mutex to lock the publisher interface */
+static csp_mutex_t publisher_lock;
+
+/* Mutex to lock default_publisher */
+static csp_mutex_t default_publisher_lock;
+
+/* Publisher used by telemetry_publish, opened on first use */
+static telemetry_publisher default_publisher = {
+    .is_open = false
+};
+
+/* Set once the publisher locks have been created */
+static bool publisher_locks_created = false;
+#endif
+
+/**
+ * Creates the locks used by publishers, for both telemetry_init and
+ * telemetry_client_init
+ */
+static void kprv_publisher_locks_create(void)
+{
+#ifndef TARGET_LIKE_KUBOS_RT
+    if (!publisher_locks_created)
+    {
+        csp_mutex_create(&publisher_lock);
+        csp_mutex_create(&default_publisher_lock);
+        publisher_locks_created = true;
+    }
+#endif
+}
+
 void telemetry_init(void)
 {
     csp_buffer_init(20, 256);
@@ -90,6 +133,7 @@ void telemetry_init(void)
 
     csp_mutex_create(&subscribing_lock);
     csp_mutex_create(&unsubscribing_lock);
+    kprv_publisher_locks_create();
 
     csp_debug_set_level(CSP_ERROR, true);
     csp_debug_set_level(CSP_WARN, true);
@@ -113,6 +157,8 @@ void telemetry_client_init(void)
 
     csp_route_start_task(500, 1);
 
+    kprv_publisher_locks_create();
+
     csp_debug_set_level(CSP_ERROR, true);
     csp_debug_set_level(CSP_WARN, true);
     csp_debug_set_level(CSP_INFO, true);
@@ -152,6 +198,18 @@ void telemetry_cleanup(void)
 
     csp_mutex_remove(&subscribing_lock);
     csp_queue_remove(packet_queue);
+
+#ifndef TARGET_LIKE_KUBOS_RT
+    csp_mutex_lock(&default_publisher_lock, CSP_MAX_DELAY);
+    if (default_publisher.is_open)
+    {
+        telemetry_publisher_close(&default_publisher);
+    }
+    csp_mutex_unlock(&default_publisher_lock);
+    csp_mutex_remove(&default_publisher_lock);
+    csp_mutex_remove(&publisher_lock);
+    publisher_locks_created = false;
+#endif
 }
 
 CSP_DEFINE_TASK(telemetry_rx_task)
@@ -200,54 +258,194 @@ bool telemetry_publish(telemetry_packet packet)
     }
     return false;
 }
+
+bool telemetry_publisher_open(telemetry_publisher * publisher)
+{
+    if ((publisher == NULL) || (packet_queue == NULL))
+    {
+        return false;
+    }
+    publisher->is_open = true;
+    return true;
+}
+
+bool telemetry_publisher_publish(telemetry_publisher * publisher, const telemetry_packet * packets, uint16_t count)
+{
+    uint16_t i;
+
+    if ((publisher == NULL) || !publisher->is_open || (packets == NULL))
+    {
+        return false;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (!telemetry_publish(packets[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool telemetry_publisher_close(telemetry_publisher * publisher)
+{
+    if ((publisher == NULL) || !publisher->is_open)
+    {
+        return false;
+    }
+    publisher->is_open = false;
+    return true;
+}
 #else
-bool telemetry_publish(telemetry_packet pkt)
+/**
+ * Takes a reference to the publisher interface, opening it and routing
+ * to it for the first publisher
+ */
+static bool kprv_publisher_iface_get(void)
 {
-    csp_iface_t csp_socket_if;
-    csp_socket_handle_t socket_driver;
-    csp_conn_t *conn;
-    csp_packet_t *packet;
+    bool ret = true;
 
-    if (socket_init(&socket_driver, CSP_SOCKET_CLIENT, 8888) != CSP_ERR_NONE)
+    csp_mutex_lock(&publisher_lock, CSP_MAX_DELAY);
+    if (publisher_refs == 0)
+    {
+        if (socket_init(&publisher_driver, CSP_SOCKET_CLIENT, 8888) != CSP_ERR_NONE)
+        {
+            ret = false;
+        }
+        else if (csp_socket_init(&publisher_iface, &publisher_driver) != CSP_ERR_NONE)
+        {
+            socket_close(&publisher_driver);
+            ret = false;
+        }
+        else
+        {
+            /* Set default route to the telemetry server */
+            publisher_prev_route = csp_rtable_find_iface(CSP_DEFAULT_ROUTE);
+            publisher_prev_mac = csp_rtable_find_mac(CSP_DEFAULT_ROUTE);
+            csp_route_set(CSP_DEFAULT_ROUTE, &publisher_iface, CSP_NODE_MAC);
+        }
+    }
+    if (ret)
+    {
+        publisher_refs++;
+    }
+    csp_mutex_unlock(&publisher_lock);
+
+    return ret;
+}
+
+/**
+ * Releases a reference to the publisher interface. The last one restores
+ * the previous default route and closes the interface.
+ */
+static void kprv_publisher_iface_put(void)
+{
+    csp_mutex_lock(&publisher_lock, CSP_MAX_DELAY);
+    if ((publisher_refs > 0) && (--publisher_refs == 0))
+    {
+        /* csp_init routes to loopback by default */
+        if (publisher_prev_route != NULL)
+        {
+            csp_route_set(CSP_DEFAULT_ROUTE, publisher_prev_route, publisher_prev_mac);
+        }
+        else
+        {
+            csp_route_set(CSP_DEFAULT_ROUTE, &csp_if_lo, CSP_NODE_MAC);
+        }
+        csp_socket_close(&publisher_iface, &publisher_driver);
+    }
+    csp_mutex_unlock(&publisher_lock);
+}
+
+bool telemetry_publisher_open(telemetry_publisher * publisher)
+{
+    if (publisher == NULL)
     {
         return false;
     }
+    publisher->is_open = false;
 
-    if (csp_socket_init(&csp_socket_if, &socket_driver) != CSP_ERR_NONE)
+    if (!kprv_publisher_iface_get())
     {
         return false;
     }
 
+    publisher->conn = csp_connect(CSP_PRIO_NORM, TELEMETRY_CSP_ADDRESS, TELEMETRY_EXTERNAL_PORT, 1000, CSP_O_NONE);
+    if (publisher->conn == NULL)
+    {
+        kprv_publisher_iface_put();
+        return false;
+    }
 
-    /* Set default route and start router */
-    csp_route_set(CSP_DEFAULT_ROUTE, &csp_socket_if, CSP_NODE_MAC);
+    publisher->is_open = true;
+    return true;
+}
+
+bool telemetry_publisher_publish(telemetry_publisher * publisher, const telemetry_packet * packets, uint16_t count)
+{
+    csp_packet_t * packet;
+    uint16_t i;
 
-    packet = csp_buffer_get(sizeof(telemetry_packet));
-    if (packet) {
-        // strcpy((char *) packet->data, message);
-        memcpy(&packet->data, &pkt, sizeof(telemetry_packet));
-        // packet->length = strlen(message);
+    if ((publisher == NULL) || !publisher->is_open || (packets == NULL))
+    {
+        return false;
+    }
+
+    /* Each telemetry packet keeps its own CSP packet, the server
+       reads them one at a time */
+    for (i = 0; i < count; i++)
+    {
+        packet = csp_buffer_get(sizeof(telemetry_packet));
+        if (packet == NULL)
+        {
+            return false;
+        }
+
+        memcpy(&packet->data, &packets[i], sizeof(telemetry_packet));
         packet->length = sizeof(telemetry_packet);
 
-        conn = csp_connect(CSP_PRIO_NORM, TELEMETRY_CSP_ADDRESS, TELEMETRY_EXTERNAL_PORT, 1000, CSP_O_NONE);
-        // printf("Sending: %s\r\n", message);
-        if (!conn) {
-            csp_buffer_free(packet);
-            printf("conn err\r\n");
-            return -1;
-        } 
-        
-        if (!csp_send(conn, packet, 1000))
+        if (!csp_send(publisher->conn, packet, 1000))
         {
             csp_buffer_free(packet);
-            printf("send err\r\n");
-            return -1;
+            return false;
         }
-        csp_close(conn);
-        printf("sent!\r\n");
     }
+    return true;
+}
 
-    csp_socket_close(&csp_socket_if, &socket_driver);
+bool telemetry_publisher_close(telemetry_publisher * publisher)
+{
+    if ((publisher == NULL) || !publisher->is_open)
+    {
+        return false;
+    }
+
+    csp_close(publisher->conn);
+    publisher->conn = NULL;
+    publisher->is_open = false;
+    kprv_publisher_iface_put();
+    return true;
+}
+
+bool telemetry_publish(telemetry_packet pkt)
+{
+    bool ret = false;
+
+    /* default_publisher is shared by every thread of the process */
+    csp_mutex_lock(&default_publisher_lock, CSP_MAX_DELAY);
+    if (default_publisher.is_open || telemetry_publisher_open(&default_publisher))
+    {
+        ret = telemetry_publisher_publish(&default_publisher, &pkt, 1);
+        if (!ret)
+        {
+            /* Reconnects on the next publish */
+            telemetry_publisher_close(&default_publisher);
+        }
+    }
+    csp_mutex_unlock(&default_publisher_lock);
+
+    return ret;
 }
 #endif
 
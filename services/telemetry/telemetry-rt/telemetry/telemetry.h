@@ -99,6 +99,30 @@ bool telemetry_read(const pubsub_conn * conn, telemetry_packet * packet);
  */
 bool telemetry_publish(telemetry_packet packet);
 
+/**
+ * Opens a publisher handle which stays connected to the telemetry
+ * system until it is closed.
+ * @param publisher pointer to telemetry_publisher to open
+ * @return bool true if successful, otherwise false
+ */
+bool telemetry_publisher_open(telemetry_publisher * publisher);
+
+/**
+ * Publishes one or more telemetry packets over an open publisher handle.
+ * @param publisher pointer to open telemetry_publisher
+ * @param packets array of telemetry_packets to publish
+ * @param count number of packets in the array
+ * @return bool true if all packets were published, otherwise false
+ */
+bool telemetry_publisher_publish(telemetry_publisher * publisher, const telemetry_packet * packets, uint16_t count);
+
+/**
+ * Closes a publisher handle.
+ * @param publisher pointer to telemetry_publisher to close
+ * @return bool true if successful, otherwise false
+ */
+bool telemetry_publisher_close(telemetry_publisher * publisher);
+
 /**
  * @return int number of active telemetry subscribers
  */
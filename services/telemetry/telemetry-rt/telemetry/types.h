@@ -24,6 +24,7 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <csp/csp.h>
 
@@ -77,6 +78,20 @@ typedef struct
     uint16_t timestamp;
 } telemetry_packet;
 
+/**
+ * Publisher handle - keeps the connection to the telemetry server open
+ * between publishes. All publishers of a process share one route to it.
+ */
+typedef struct
+{
+#ifndef TARGET_LIKE_KUBOS_RT
+    /*! CSP connection to the telemetry server */
+    csp_conn_t * conn;
+#endif
+    /*! Indicates the publisher is open */
+    bool is_open;
+} telemetry_publisher;
+
 #endif
 
 /* @} */
\ No newline at end of file
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmocka.h>
+#include "telemetry/telemetry.h"
+#include <csp/interfaces/csp_if_lo.h>
+
+static void test_publisher(void ** arg)
+{
+    pubsub_conn * connection;
+    telemetry_publisher publisher;
+    telemetry_publisher other_publisher;
+    telemetry_packet incoming_packet;
+    uint16_t topic_id = 18;
+    telemetry_packet outgoing_packets[2] = {
+        {
+            .data.i = 16,
+            .source.topic_id = topic_id,
+            .source.data_type = TELEMETRY_TYPE_INT,
+            .source.subsystem_id = 1
+        },
+        {
+            .data.i = 17,
+            .source.topic_id = topic_id,
+            .source.data_type = TELEMETRY_TYPE_INT,
+            .source.subsystem_id = 1
+        }
+    };
+
+    telemetry_init();
+
+    connection = telemetry_connect();
+    assert_non_null(connection);
+
+    assert_true(telemetry_subscribe(connection, topic_id));
+
+    assert_true(telemetry_publisher_open(&publisher));
+
+    /* Publishers share one route, which outlives closing either of them */
+    assert_true(telemetry_publisher_open(&other_publisher));
+    assert_true(telemetry_publisher_close(&other_publisher));
+
+    assert_true(telemetry_publisher_publish(&publisher, outgoing_packets, 2));
+
+    assert_true(telemetry_read(connection, &incoming_packet));
+    assert_int_equal(incoming_packet.data.i, 16);
+
+    assert_true(telemetry_read(connection, &incoming_packet));
+    assert_int_equal(incoming_packet.data.i, 17);
+
+    assert_true(telemetry_publisher_close(&publisher));
+#ifndef TARGET_LIKE_KUBOS_RT
+    assert_ptr_equal(csp_rtable_find_iface(CSP_DEFAULT_ROUTE), &csp_if_lo);
+#endif
+
+    assert_false(telemetry_publisher_publish(&publisher, outgoing_packets, 2));
+
+    assert_true(telemetry_disconnect(connection));
+
+    telemetry_cleanup();
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_publisher)
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -47,6 +47,20 @@
 #define MESSAGE_QUEUE_SIZE YOTTA_CFG_TELEMETRY_MESSAGE_QUEUE_SIZE
 #endif
 
+/*! Max number of packets the server collects for a subscriber before sending them in one go */
+#ifndef YOTTA_CFG_TELEMETRY_BATCH_SIZE
+#define TELEMETRY_BATCH_SIZE 1
+#else
+#define TELEMETRY_BATCH_SIZE YOTTA_CFG_TELEMETRY_BATCH_SIZE
+#endif
+
+/*! Max time (ms) a packet is held back while its batch fills up */
+#ifndef YOTTA_CFG_TELEMETRY_BATCH_LATENCY
+#define TELEMETRY_BATCH_LATENCY 10
+#else
+#define TELEMETRY_BATCH_LATENCY YOTTA_CFG_TELEMETRY_BATCH_LATENCY
+#endif
+
 /*! Port number used for the telemetry server's internal connections */
 #ifndef YOTTA_CFG_TELEMETRY_INTERNAL_PORT
 #define TELEMETRY_INTERNAL_PORT 20
@@ -100,6 +114,13 @@
 #define TELEMETRY_RX_THREAD_PRIORITY YOTTA_CFG_TELEMETRY_RX_THREAD_PRIORITY
 #endif
 
+/*! Max time (ms) a client waits for the server to answer format negotiation */
+#ifndef YOTTA_CFG_TELEMETRY_FORMAT_TIMEOUT
+#define TELEMETRY_FORMAT_TIMEOUT 500
+#else
+#define TELEMETRY_FORMAT_TIMEOUT YOTTA_CFG_TELEMETRY_FORMAT_TIMEOUT
+#endif
+
 /*! Standard telemetry buffer size */
 #ifndef YOTTA_CFG_TELEMETRY_BUFFER_SIZE
 #define TELEMETRY_BUFFER_SIZE 256
@@ -91,6 +91,17 @@ bool telemetry_unsubscribe(const socket_conn * conn, uint16_t topic_id);
  */
 bool telemetry_read(const socket_conn * conn, telemetry_packet * packet);
 
+/**
+ * Reads as many telemetry packets as are available, up to max_packets,
+ * from the telemetry server in a single receive.
+ * @param conn socket_connection to use for the request
+ * @param packets array of telemetry_packet to store data in
+ * @param max_packets number of elements in packets
+ * @param num_packets number of packets actually read
+ * @return bool true if successful, otherwise false
+ */
+bool telemetry_read_batch(const socket_conn * conn, telemetry_packet * packets, uint16_t max_packets, uint16_t * num_packets);
+
 /**
  * Public facing telemetry input interface. Takes a telemetry_packet packet
  * and passes it through the telemetry system.
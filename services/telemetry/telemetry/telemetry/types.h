@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include <csp/csp.h>
 #include <csp/arch/csp_queue.h>
+#include <csp/arch/csp_semaphore.h>
 #include <csp/arch/csp_thread.h>
 #include <ipc/socket.h>
 
@@ -92,7 +93,9 @@ typedef enum
     /*! Message containing unsubscribe request */
     MESSAGE_TYPE_UNSUBSCRIBE,
     /*! Message containing disconnect request */
-    MESSAGE_TYPE_DISCONNECT
+    MESSAGE_TYPE_DISCONNECT,
+    /*! Message negotiating the message format */
+    MESSAGE_TYPE_FORMAT
 } telemetry_message_type;
 
 /**
@@ -106,6 +109,9 @@ typedef enum
     RESPONSE_ERR
 } telemetry_response_type;
 
+/*! Topic id which subscribes a connection to every telemetry topic */
+#define TELEMETRY_TOPIC_ALL 0xFFFF
+
 /**
  * Structure for storing a list of telemetry sources 
  */
@@ -134,6 +140,18 @@ typedef struct subscriber_list_item
     topic_list_item * topics;
     /*! Handle for subscriber's message receive thread */
     csp_thread_handle_t rx_thread;
+    /*! Reactor connection serving the subscriber, NULL if served by rx_thread */
+    struct reactor_conn * rconn;
+    /*! Packets waiting to be sent to the subscriber in one batch */
+    telemetry_packet * batch;
+    /*! Number of packets waiting in batch */
+    uint16_t batch_count;
+    /*! Time (ms) the first packet in batch was queued */
+    uint32_t batch_time;
+    /*! Keeps sends to a subscriber served by rx_thread from interleaving */
+    csp_mutex_t tx_lock;
+    /*! Number of publishes which are about to send to the subscriber */
+    int sending;
     /*! Next subscriber in list */
     struct subscriber_list_item * next;
 } subscriber_list_item;
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <argp.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <telemetry-storage/query.h>
+#include "tinycbor/cbor.h"
+
+typedef enum
+{
+    OUTPUT_CSV = 0,
+    OUTPUT_CBOR
+} output_type;
+
+typedef struct
+{
+    telemetry_query_params params;
+    output_type output;
+    bool have_topic;
+} query_args;
+
+static int parse_opt(int key, char * arg, struct argp_state * state);
+
+static struct argp_option options[] =
+{
+    {"topic",     't', "ID",     0, "Topic id to read (required)"},
+    {"subsystem", 's', "ID",     0, "Subsystem id to read (default: 0)"},
+    {"from",      'f', "TIME",   0, "Smallest timestamp to read (default: oldest)"},
+    {"to",        'u', "TIME",   0, "Largest timestamp to read (default: newest)"},
+    {"dir",       'd', "PATH",   0, "Directory holding the telemetry files (default: working directory)"},
+    {"binary",    'b', 0,        0, "Read telemetry stored with FORMAT_TYPE_HEX instead of CSV"},
+    {"output",    'o', "FORMAT", 0, "Output format, csv or cbor (default: csv)"},
+    {0}
+};
+
+static char doc[] = "Telemetry Query - Read stored telemetry of one topic within a time range";
+static struct argp argp = { options, parse_opt, 0, doc };
+
+static int parse_opt(int key, char * arg, struct argp_state * state)
+{
+    query_args * args = state->input;
+
+    switch (key)
+    {
+        case 't':
+            args->params.topic_id = strtoul(arg, NULL, 0);
+            args->have_topic = true;
+            break;
+        case 's':
+            args->params.subsystem_id = strtol(arg, NULL, 0);
+            break;
+        case 'f':
+            args->params.start = strtol(arg, NULL, 0);
+            break;
+        case 'u':
+            args->params.end = strtol(arg, NULL, 0);
+            break;
+        case 'd':
+            args->params.directory = arg;
+            break;
+        case 'b':
+            args->params.format = FORMAT_TYPE_HEX;
+            break;
+        case 'o':
+            if (strcmp(arg, "csv") == 0)
+            {
+                args->output = OUTPUT_CSV;
+            }
+            else if (strcmp(arg, "cbor") == 0)
+            {
+                args->output = OUTPUT_CBOR;
+            }
+            else
+            {
+                argp_error(state, "unknown output format %s", arg);
+            }
+            break;
+        case ARGP_KEY_END:
+            if (!args->have_topic)
+            {
+                argp_error(state, "a topic id is required");
+            }
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/**
+ * Writes a packet as a "timestamp,value" line, the same as CSV storage
+ */
+static bool write_csv(const telemetry_packet * packet, void * arg)
+{
+    if (packet->source.data_type == TELEMETRY_TYPE_FLOAT)
+    {
+        printf("%d,%f\n", packet->timestamp, packet->data.f);
+    }
+    else
+    {
+        printf("%d,%d\n", packet->timestamp, packet->data.i);
+    }
+    return true;
+}
+
+/**
+ * Writes a packet as a CBOR array of [timestamp, value]. The output is a
+ * sequence of these arrays, one per packet.
+ */
+static bool write_cbor(const telemetry_packet * packet, void * arg)
+{
+    uint8_t buffer[32];
+    CborEncoder encoder, container;
+    CborError err;
+
+    cbor_encoder_init(&encoder, buffer, sizeof(buffer), 0);
+    err = cbor_encoder_create_array(&encoder, &container, 2);
+    err |= cbor_encode_int(&container, packet->timestamp);
+    if (packet->source.data_type == TELEMETRY_TYPE_FLOAT)
+    {
+        err |= cbor_encode_float(&container, packet->data.f);
+    }
+    else
+    {
+        err |= cbor_encode_int(&container, packet->data.i);
+    }
+    err |= cbor_encoder_close_container(&encoder, &container);
+
+    if (err != CborNoError)
+    {
+        fprintf(stderr, "Failed to encode telemetry packet\n");
+        return false;
+    }
+
+    return fwrite(buffer, cbor_encoder_get_buffer_size(&encoder, buffer), 1, stdout) == 1;
+}
+
+int main(int argc, char ** argv)
+{
+    query_args args = {
+        .params = {
+            .directory = NULL,
+            .format = FORMAT_TYPE_CSV,
+            .subsystem_id = 0,
+            .start = INT_MIN,
+            .end = INT_MAX
+        },
+        .output = OUTPUT_CSV,
+        .have_topic = false
+    };
+    int count;
+
+    if (argp_parse(&argp, argc, argv, 0, 0, &args) != 0)
+    {
+        return -1;
+    }
+
+    count = telemetry_query(&args.params, (args.output == OUTPUT_CBOR) ? write_cbor : write_csv, NULL);
+    if (count < 0)
+    {
+        fprintf(stderr, "Invalid telemetry query\n");
+        return -1;
+    }
+
+    fflush(stdout);
+    return 0;
+}
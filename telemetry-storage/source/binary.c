@@ -0,0 +1,371 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <csp/arch/csp_time.h>
+#include "telemetry-storage/binary.h"
+
+/* Records which fit in a part of DATA_PART_SIZE bytes */
+#define RECORDS_PER_PART ((DATA_PART_SIZE > (sizeof(storage_chunk_header) + sizeof(storage_record))) ? \
+    ((DATA_PART_SIZE - sizeof(storage_chunk_header)) / sizeof(storage_record)) : 1)
+
+static storage_writer writers[STORAGE_WRITER_CACHE_SIZE];
+static uint32_t use_counter = 0;
+static uint32_t last_commit = 0;
+
+
+/**
+ * @brief writes the file name of one of a writer's parts into its path buffer.
+ */
+static void set_part_path(storage_writer * writer, uint8_t part)
+{
+    sprintf(writer->path + writer->path_len, ".%03d", part);
+}
+
+
+/**
+ * @brief reads and validates the header of a part file.
+ * @retval true if the header belongs to the writer's topic and subsystem.
+ */
+static bool read_header(FILE * file, const storage_writer * writer, storage_chunk_header * header)
+{
+    if (fread(header, sizeof(storage_chunk_header), 1, file) != 1)
+    {
+        return false;
+    }
+
+    return (header->magic == STORAGE_CHUNK_MAGIC)
+        && (header->version == STORAGE_CHUNK_VERSION)
+        && (header->record_size == sizeof(storage_record))
+        && (header->topic_id == writer->topic_id)
+        && (header->subsystem_id == writer->subsystem_id);
+}
+
+
+/**
+ * @brief flushes a writer's buffered records and syncs them to disk.
+ */
+static bool commit_writer(storage_writer * writer)
+{
+    if (writer->uncommitted == 0)
+    {
+        return true;
+    }
+
+    writer->uncommitted = 0;
+    if (fflush(writer->file) != 0)
+    {
+        printf("Failed to write telemetry to %s\r\n", writer->path);
+        return false;
+    }
+    fsync(fileno(writer->file));
+    return true;
+}
+
+
+static void close_writer(storage_writer * writer)
+{
+    if (writer->file != NULL)
+    {
+        commit_writer(writer);
+        fclose(writer->file);
+        writer->file = NULL;
+    }
+}
+
+
+/**
+ * @brief checks that a part file may be replaced by the writer. It may if it
+ *        does not exist, is too short to hold a header, or already belongs
+ *        to the writer's topic and subsystem.
+ */
+static bool part_is_replaceable(const storage_writer * writer)
+{
+    storage_chunk_header header;
+    FILE * file;
+    bool ret;
+
+    file = fopen(writer->path, "rb");
+    if (file == NULL)
+    {
+        return true;
+    }
+
+    ret = read_header(file, writer, &header) || feof(file);
+    fclose(file);
+    return ret;
+}
+
+
+/**
+ * @brief closes the writer's current part, if any, and starts a new, empty one.
+ *        Fails rather than truncate a part which holds another stream's records.
+ */
+static bool start_part(storage_writer * writer, uint8_t part, uint32_t sequence)
+{
+    storage_chunk_header header = {
+        .magic = STORAGE_CHUNK_MAGIC,
+        .version = STORAGE_CHUNK_VERSION,
+        .record_size = sizeof(storage_record),
+        .topic_id = writer->topic_id,
+        .subsystem_id = writer->subsystem_id,
+        .sequence = sequence
+    };
+
+    close_writer(writer);
+
+    set_part_path(writer, part);
+    if (!part_is_replaceable(writer))
+    {
+        printf("Not replacing %s, it belongs to other telemetry\r\n", writer->path);
+        return false;
+    }
+
+    writer->file = fopen(writer->path, "w+b");
+    if (writer->file == NULL)
+    {
+        printf("Failed to create %s\r\n", writer->path);
+        return false;
+    }
+
+    if (fwrite(&header, sizeof(header), 1, writer->file) != 1)
+    {
+        fclose(writer->file);
+        writer->file = NULL;
+        return false;
+    }
+
+    writer->part = part;
+    writer->sequence = sequence;
+    writer->records = 0;
+    writer->uncommitted = sizeof(header);
+    return true;
+}
+
+
+/**
+ * @brief reopens the newest existing part of a writer. A record which was
+ *        only partially written is overwritten by the next append, and a
+ *        full part is rotated by it.
+ * @retval 1 if a part was resumed, 0 if there is none, -1 on error.
+ */
+static int resume_part(storage_writer * writer)
+{
+    storage_chunk_header header;
+    uint32_t newest_sequence = 0;
+    int newest_part = -1;
+    long size;
+    FILE * file;
+    int i;
+
+    for (i = 0; i < DATA_MAX_PARTS; i++)
+    {
+        set_part_path(writer, i);
+        file = fopen(writer->path, "rb");
+        if (file == NULL)
+        {
+            continue;
+        }
+
+        if (read_header(file, writer, &header)
+            && ((newest_part < 0) || (header.sequence > newest_sequence)))
+        {
+            newest_part = i;
+            newest_sequence = header.sequence;
+        }
+        fclose(file);
+    }
+
+    if (newest_part < 0)
+    {
+        return 0;
+    }
+
+    set_part_path(writer, newest_part);
+    writer->file = fopen(writer->path, "r+b");
+    if ((writer->file == NULL) || (fseek(writer->file, 0, SEEK_END) != 0)
+        || ((size = ftell(writer->file)) < (long) sizeof(storage_chunk_header)))
+    {
+        if (writer->file != NULL)
+        {
+            fclose(writer->file);
+            writer->file = NULL;
+        }
+        printf("Failed to open %s\r\n", writer->path);
+        return -1;
+    }
+
+    writer->part = newest_part;
+    writer->sequence = newest_sequence;
+    writer->records = (size - sizeof(storage_chunk_header)) / sizeof(storage_record);
+    writer->uncommitted = 0;
+
+    if (fseek(writer->file, sizeof(storage_chunk_header) + writer->records * sizeof(storage_record), SEEK_SET) != 0)
+    {
+        fclose(writer->file);
+        writer->file = NULL;
+        return -1;
+    }
+    return 1;
+}
+
+
+storage_writer * storage_writer_find(uint16_t topic_id, int subsystem_id)
+{
+    int i;
+
+    for (i = 0; i < STORAGE_WRITER_CACHE_SIZE; i++)
+    {
+        if ((writers[i].file != NULL) && (writers[i].topic_id == topic_id)
+            && (writers[i].subsystem_id == subsystem_id))
+        {
+            writers[i].last_used = ++use_counter;
+            return &writers[i];
+        }
+    }
+    return NULL;
+}
+
+
+storage_writer * storage_writer_open(uint16_t topic_id, int subsystem_id, const char * path, uint16_t path_len)
+{
+    storage_writer * writer = &writers[0];
+    int resumed;
+    int i;
+
+    if ((path == NULL) || (path_len >= FILE_NAME_BUFFER_SIZE))
+    {
+        return NULL;
+    }
+
+    /* Use a free slot or evict the least recently used writer */
+    for (i = 0; i < STORAGE_WRITER_CACHE_SIZE; i++)
+    {
+        if (writers[i].file == NULL)
+        {
+            writer = &writers[i];
+            break;
+        }
+        if (writers[i].last_used < writer->last_used)
+        {
+            writer = &writers[i];
+        }
+    }
+    close_writer(writer);
+
+    writer->topic_id = topic_id;
+    writer->subsystem_id = subsystem_id;
+    memcpy(writer->path, path, path_len);
+    writer->path_len = path_len;
+
+    resumed = resume_part(writer);
+    if ((resumed < 0) || ((resumed == 0) && !start_part(writer, 0, 0)))
+    {
+        return NULL;
+    }
+
+    writer->last_used = ++use_counter;
+    return writer;
+}
+
+
+bool storage_writer_append(storage_writer * writer, const telemetry_packet * packet)
+{
+    storage_record record = { 0 };
+
+    if ((writer == NULL) || (writer->file == NULL) || (packet == NULL))
+    {
+        return false;
+    }
+
+    record.timestamp = packet->timestamp;
+    record.data_type = packet->source.data_type;
+    record.data = packet->data;
+
+    if ((writer->records >= RECORDS_PER_PART)
+        && !start_part(writer, (writer->part + 1) % DATA_MAX_PARTS, writer->sequence + 1))
+    {
+        return false;
+    }
+
+    if (fwrite(&record, sizeof(record), 1, writer->file) != 1)
+    {
+        printf("Failed to write telemetry to %s\r\n", writer->path);
+        return false;
+    }
+
+    writer->records++;
+    writer->uncommitted += sizeof(record);
+
+    if (writer->uncommitted >= STORAGE_COMMIT_BYTES)
+    {
+        return commit_writer(writer);
+    }
+    return true;
+}
+
+
+bool storage_writer_commit(bool force)
+{
+    uint32_t now = csp_get_ms();
+    bool ret = true;
+    int i;
+
+    if (!force && ((now - last_commit) < STORAGE_COMMIT_INTERVAL))
+    {
+        return true;
+    }
+
+    for (i = 0; i < STORAGE_WRITER_CACHE_SIZE; i++)
+    {
+        if (writers[i].file != NULL)
+        {
+            ret &= commit_writer(&writers[i]);
+        }
+    }
+    last_commit = now;
+
+    return ret;
+}
+
+
+int storage_writer_commit_timeout(void)
+{
+    uint32_t elapsed = csp_get_ms() - last_commit;
+    int i;
+
+    for (i = 0; i < STORAGE_WRITER_CACHE_SIZE; i++)
+    {
+        if ((writers[i].file != NULL) && (writers[i].uncommitted > 0))
+        {
+            return (elapsed < STORAGE_COMMIT_INTERVAL) ? (int) (STORAGE_COMMIT_INTERVAL - elapsed) : 0;
+        }
+    }
+    return -1;
+}
+
+
+void storage_writer_close_all(void)
+{
+    int i;
+
+    for (i = 0; i < STORAGE_WRITER_CACHE_SIZE; i++)
+    {
+        close_writer(&writers[i]);
+    }
+}
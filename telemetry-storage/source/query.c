@@ -0,0 +1,536 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "telemetry-storage/binary.h"
+#include "telemetry-storage/query.h"
+
+/* Longest CSV line written by klog for a telemetry entry */
+#define CSV_LINE_SIZE (DATA_BUFFER_SIZE + 32)
+
+/**
+ * In memory copy of a part's index
+ */
+typedef struct
+{
+    storage_index_header header;
+    storage_index_block * blocks;
+    uint32_t capacity;
+} part_index;
+
+/**
+ * A part file found by a query
+ */
+typedef struct
+{
+    uint8_t part;
+    uint32_t order;
+} part_order;
+
+
+/**
+ * @brief reads the record at the current position of a part file.
+ * @param valid set to whether the record held a telemetry packet.
+ * @retval Number of bytes the record takes up, 0 at the end of the part.
+ */
+static long read_record(FILE * file, output_data_format format, telemetry_packet * packet, bool * valid)
+{
+    storage_record record;
+    char line[CSV_LINE_SIZE];
+    char * data;
+    long len;
+
+    *valid = false;
+
+    if (format == FORMAT_TYPE_HEX)
+    {
+        if (fread(&record, sizeof(record), 1, file) != 1)
+        {
+            return 0;
+        }
+        packet->timestamp = record.timestamp;
+        packet->source.data_type = record.data_type;
+        packet->data = record.data;
+        *valid = true;
+        return sizeof(record);
+    }
+
+    if (fgets(line, sizeof(line), file) == NULL)
+    {
+        return 0;
+    }
+    len = strlen(line);
+    if (line[len - 1] != '\n')
+    {
+        /* Line is still being written */
+        return 0;
+    }
+
+    /* klog lines look like "<seconds>.<ms> <logger>:T <timestamp>,<value>" */
+    data = strchr(line, ' ');
+    if ((data != NULL) && ((data = strchr(data + 1, ' ')) != NULL)
+        && (sscanf(data + 1, "%d,", &packet->timestamp) == 1)
+        && ((data = strchr(data, ',')) != NULL))
+    {
+        if (strchr(data, '.') != NULL)
+        {
+            packet->source.data_type = TELEMETRY_TYPE_FLOAT;
+            packet->data.f = strtof(data + 1, NULL);
+        }
+        else
+        {
+            packet->source.data_type = TELEMETRY_TYPE_INT;
+            packet->data.i = strtol(data + 1, NULL, 10);
+        }
+        *valid = true;
+    }
+    return len;
+}
+
+
+/**
+ * @brief reads the timestamp of the record at offset in a part file.
+ */
+static bool read_timestamp(FILE * file, output_data_format format, uint32_t offset, int32_t * timestamp)
+{
+    telemetry_packet packet;
+    bool valid;
+
+    if ((fseek(file, offset, SEEK_SET) != 0) || (read_record(file, format, &packet, &valid) == 0) || !valid)
+    {
+        return false;
+    }
+    *timestamp = packet.timestamp;
+    return true;
+}
+
+
+static bool add_block(part_index * index, uint32_t offset, int32_t timestamp)
+{
+    storage_index_block * blocks;
+
+    if (index->header.blocks == index->capacity)
+    {
+        blocks = realloc(index->blocks, (index->capacity + 16) * sizeof(storage_index_block));
+        if (blocks == NULL)
+        {
+            return false;
+        }
+        index->blocks = blocks;
+        index->capacity += 16;
+    }
+
+    index->blocks[index->header.blocks++] = (storage_index_block) {
+        .offset = offset,
+        .first_timestamp = timestamp,
+        .min_timestamp = timestamp,
+        .max_timestamp = timestamp
+    };
+    return true;
+}
+
+
+/**
+ * @brief loads an index file. Leaves index empty if the file does not exist
+ *        or does not match the part.
+ */
+static void load_index(const char * path, output_data_format format, uint32_t sequence, part_index * index)
+{
+    storage_index_header header;
+    FILE * file;
+
+    if ((file = fopen(path, "rb")) == NULL)
+    {
+        return;
+    }
+
+    if ((fread(&header, sizeof(header), 1, file) == 1)
+        && (header.magic == STORAGE_INDEX_MAGIC)
+        && (header.version == STORAGE_INDEX_VERSION)
+        && (header.format == format)
+        && (header.interval == STORAGE_INDEX_INTERVAL)
+        && (header.sequence == sequence))
+    {
+        index->blocks = malloc(header.blocks * sizeof(storage_index_block));
+        if ((index->blocks != NULL)
+            && (fread(index->blocks, sizeof(storage_index_block), header.blocks, file) == header.blocks))
+        {
+            index->header = header;
+            index->capacity = header.blocks;
+        }
+        else
+        {
+            free(index->blocks);
+            index->blocks = NULL;
+        }
+    }
+    fclose(file);
+}
+
+
+static bool save_index(const char * path, const part_index * index)
+{
+    char tmp_path[KLOG_PATH_LEN + 8];
+    FILE * file;
+    bool ret;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if ((file = fopen(tmp_path, "wb")) == NULL)
+    {
+        return false;
+    }
+
+    ret = (fwrite(&index->header, sizeof(index->header), 1, file) == 1)
+        && (fwrite(index->blocks, sizeof(storage_index_block), index->header.blocks, file) == index->header.blocks);
+    ret = (fclose(file) == 0) && ret;
+
+    /* Replace the old index in one step so readers never see half of it */
+    if (!ret || (rename(tmp_path, path) != 0))
+    {
+        remove(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+
+/**
+ * @brief checks that an index loaded from disk still describes the part. Parts
+ *        are overwritten when storage rotates through them.
+ */
+static bool index_matches(FILE * file, output_data_format format, long size, const part_index * index)
+{
+    int32_t timestamp;
+    uint32_t last;
+
+    if ((index->blocks == NULL) || (size < (long) index->header.size))
+    {
+        return false;
+    }
+    if (index->header.blocks == 0)
+    {
+        return true;
+    }
+
+    last = index->header.blocks - 1;
+    return read_timestamp(file, format, index->blocks[0].offset, &timestamp)
+        && (timestamp == index->blocks[0].first_timestamp)
+        && read_timestamp(file, format, index->blocks[last].offset, &timestamp)
+        && (timestamp == index->blocks[last].first_timestamp);
+}
+
+
+/**
+ * @brief opens a part file and brings its index up to date.
+ * @param file set to the opened part file on success.
+ */
+static bool index_part(const char * path, output_data_format format, FILE ** file, part_index * index)
+{
+    char index_path[KLOG_PATH_LEN + 4];
+    storage_chunk_header chunk = { .sequence = 0 };
+    storage_index_block * block;
+    telemetry_packet packet;
+    uint32_t offset = 0;
+    uint32_t in_block;
+    uint32_t i;
+    long size;
+    long len;
+    bool valid;
+
+    memset(index, 0, sizeof(part_index));
+
+    if ((*file = fopen(path, "rb")) == NULL)
+    {
+        return false;
+    }
+
+    if (format == FORMAT_TYPE_HEX)
+    {
+        if ((fread(&chunk, sizeof(chunk), 1, *file) != 1) || (chunk.magic != STORAGE_CHUNK_MAGIC)
+            || (chunk.record_size != sizeof(storage_record)))
+        {
+            fclose(*file);
+            return false;
+        }
+        offset = sizeof(chunk);
+    }
+
+    fseek(*file, 0, SEEK_END);
+    size = ftell(*file);
+
+    snprintf(index_path, sizeof(index_path), "%s%s", path, FILE_EXTENSION_INDEX);
+    load_index(index_path, format, chunk.sequence, index);
+
+    if (!index_matches(*file, format, size, index))
+    {
+        free(index->blocks);
+        memset(index, 0, sizeof(part_index));
+    }
+
+    if ((index->blocks != NULL) && (size == (long) index->header.size))
+    {
+        return true;
+    }
+
+    /* Rescan the last, possibly incomplete, block along with any new records */
+    if (index->header.blocks > 0)
+    {
+        in_block = index->header.records - (index->header.blocks - 1) * STORAGE_INDEX_INTERVAL;
+        if (in_block < STORAGE_INDEX_INTERVAL)
+        {
+            index->header.blocks--;
+            index->header.records -= in_block;
+            offset = index->blocks[index->header.blocks].offset;
+        }
+        else
+        {
+            offset = index->header.size;
+        }
+    }
+
+    index->header.magic = STORAGE_INDEX_MAGIC;
+    index->header.version = STORAGE_INDEX_VERSION;
+    index->header.format = format;
+    index->header.interval = STORAGE_INDEX_INTERVAL;
+    index->header.sequence = chunk.sequence;
+
+    fseek(*file, offset, SEEK_SET);
+    while ((len = read_record(*file, format, &packet, &valid)) > 0)
+    {
+        if (valid)
+        {
+            if ((index->header.records % STORAGE_INDEX_INTERVAL) == 0)
+            {
+                if (!add_block(index, offset, packet.timestamp))
+                {
+                    break;
+                }
+            }
+            block = &index->blocks[index->header.blocks - 1];
+            if (packet.timestamp < block->min_timestamp)
+            {
+                block->min_timestamp = packet.timestamp;
+            }
+            if (packet.timestamp > block->max_timestamp)
+            {
+                block->max_timestamp = packet.timestamp;
+            }
+            index->header.records++;
+        }
+        offset += len;
+    }
+    index->header.size = offset;
+
+    for (i = 0; i < index->header.blocks; i++)
+    {
+        if ((i == 0) || (index->blocks[i].min_timestamp < index->header.min_timestamp))
+        {
+            index->header.min_timestamp = index->blocks[i].min_timestamp;
+        }
+        if ((i == 0) || (index->blocks[i].max_timestamp > index->header.max_timestamp))
+        {
+            index->header.max_timestamp = index->blocks[i].max_timestamp;
+        }
+    }
+
+    if (!save_index(index_path, index))
+    {
+        printf("Failed to save telemetry index %s\r\n", index_path);
+    }
+    return true;
+}
+
+
+bool telemetry_query_index_part(const char * path, output_data_format format, storage_index_header * header)
+{
+    part_index index;
+    FILE * file;
+
+    if ((path == NULL) || (header == NULL) || !index_part(path, format, &file, &index))
+    {
+        return false;
+    }
+
+    *header = index.header;
+    free(index.blocks);
+    fclose(file);
+    return true;
+}
+
+
+static void create_part_path(char * path, const telemetry_query_params * params, uint8_t part)
+{
+    /* Named the same way create_filename does when storing */
+    snprintf(path, KLOG_PATH_LEN, "%s%s%u_%u%s.%03d",
+             (params->directory != NULL) ? params->directory : "",
+             (params->directory != NULL) ? "/" : "",
+             params->topic_id, params->subsystem_id,
+             (params->format == FORMAT_TYPE_HEX) ? FILE_EXTENSION_HEX : FILE_EXTENSION_NONE, part);
+}
+
+
+static int compare_parts(const void * a, const void * b)
+{
+    const part_order * pa = a;
+    const part_order * pb = b;
+
+    if (pa->order != pb->order)
+    {
+        return (pa->order < pb->order) ? -1 : 1;
+    }
+    return pa->part - pb->part;
+}
+
+
+/**
+ * @brief finds the parts of a query's topic and subsystem, oldest first.
+ * @retval Number of parts found.
+ */
+static int find_parts(const telemetry_query_params * params, part_order * parts)
+{
+    char path[KLOG_PATH_LEN];
+    storage_chunk_header chunk;
+    struct stat st;
+    FILE * file;
+    int count = 0;
+    int i;
+
+    for (i = 0; i < DATA_MAX_PARTS; i++)
+    {
+        create_part_path(path, params, i);
+        if (stat(path, &st) != 0)
+        {
+            continue;
+        }
+
+        parts[count].part = i;
+        if (params->format == FORMAT_TYPE_HEX)
+        {
+            /* Binary parts carry their age in the header */
+            if (((file = fopen(path, "rb")) == NULL)
+                || (fread(&chunk, sizeof(chunk), 1, file) != 1))
+            {
+                if (file != NULL)
+                {
+                    fclose(file);
+                }
+                continue;
+            }
+            fclose(file);
+            parts[count].order = chunk.sequence;
+        }
+        else
+        {
+            parts[count].order = st.st_mtime;
+        }
+        count++;
+    }
+
+    qsort(parts, count, sizeof(part_order), compare_parts);
+    return count;
+}
+
+
+/**
+ * @brief passes the packets of one part which are within the query's window
+ *        to the callback.
+ * @param count increased by the number of packets passed on.
+ * @retval false if the callback stopped the query.
+ */
+static bool query_part(FILE * file, const part_index * index, const telemetry_query_params * params,
+                       telemetry_query_cb callback, void * arg, int * count)
+{
+    const storage_index_block * block;
+    telemetry_packet packet = {
+        .source.topic_id = params->topic_id,
+        .source.subsystem_id = params->subsystem_id
+    };
+    uint32_t offset;
+    uint32_t end;
+    uint32_t i;
+    long len;
+    bool valid;
+
+    if ((index->header.blocks == 0) || (index->header.max_timestamp < params->start)
+        || (index->header.min_timestamp > params->end))
+    {
+        return true;
+    }
+
+    for (i = 0; i < index->header.blocks; i++)
+    {
+        block = &index->blocks[i];
+        if ((block->max_timestamp < params->start) || (block->min_timestamp > params->end))
+        {
+            continue;
+        }
+
+        offset = block->offset;
+        end = (i + 1 < index->header.blocks) ? index->blocks[i + 1].offset : index->header.size;
+        fseek(file, offset, SEEK_SET);
+
+        while ((offset < end) && ((len = read_record(file, params->format, &packet, &valid)) > 0))
+        {
+            offset += len;
+            if (valid && (packet.timestamp >= params->start) && (packet.timestamp <= params->end))
+            {
+                (*count)++;
+                if (!callback(&packet, arg))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+
+int telemetry_query(const telemetry_query_params * params, telemetry_query_cb callback, void * arg)
+{
+    part_order parts[DATA_MAX_PARTS];
+    char path[KLOG_PATH_LEN];
+    part_index index;
+    FILE * file;
+    int num_parts;
+    int count = 0;
+    bool more = true;
+    int i;
+
+    if ((params == NULL) || (callback == NULL) || (params->start > params->end))
+    {
+        return -1;
+    }
+
+    num_parts = find_parts(params, parts);
+    for (i = 0; (i < num_parts) && more; i++)
+    {
+        create_part_path(path, params, parts[i].part);
+        if (!index_part(path, params->format, &file, &index))
+        {
+            continue;
+        }
+
+        more = query_part(file, &index, params, callback, arg, &count);
+
+        free(index.blocks);
+        fclose(file);
+    }
+    return count;
+}
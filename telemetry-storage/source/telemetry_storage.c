@@ -15,12 +15,36 @@
  */
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+#include <poll.h>
 
 #include <telemetry/telemetry.h>
 #include "telemetry-storage/telemetry_storage.h"
+#include "telemetry-storage/binary.h"
 #include "telemetry-storage/config.h"
 
 
+/**
+ * @brief waits for data on the telemetry connection.
+ * @param connection connection to the telemetry system.
+ * @param timeout max time (ms) to wait, -1 to wait until data arrives.
+ * @retval true if the connection can be read, false on timeout.
+ */
+static bool wait_for_telemetry(const socket_conn *connection, int timeout)
+{
+    struct pollfd fds = { .fd = connection->socket_handle, .events = POLLIN };
+    int ret;
+
+    ret = poll(&fds, 1, timeout);
+    if (ret < 0 && errno != EINTR)
+    {
+        /* Leave errors to telemetry_read */
+        return true;
+    }
+    return (ret > 0);
+}
+
+
 CSP_DEFINE_TASK(telemetry_store_rx)
 {
     telemetry_packet packet;
@@ -40,6 +64,14 @@ CSP_DEFINE_TASK(telemetry_store_rx)
 
     while (1)
     {
+        /* Commit binary records on time even when no new packets arrive */
+        if ((DATA_OUTPUT_FORMAT == FORMAT_TYPE_HEX)
+            && !wait_for_telemetry(&connection, storage_writer_commit_timeout()))
+        {
+            storage_writer_commit(false);
+            continue;
+        }
+
         if (telemetry_read(&connection, &packet))
         {
             /* Store telemetry packets from the telemetry system */
@@ -58,14 +90,15 @@ void telemetry_storage_init(void)
 
 /**
  * @brief creates a filename that corresponds to the telemetry packet topic_id and 
- *        the csp packet address.
+ *        the csp packet address. The two are separated so every pair maps
+ *        to a different name, e.g. 1_23 and 12_3.
  * @param filename_buf_ptr a pointer to the char[] to write to.
  * @param topic_id the telemetry packet topic_id from packet.source.topic_id.
  * @param address the csp packet address from packet->id.src. 
  * @param file_extension. 
  * @retval The length of the filename written.
  */
-static uint16_t create_filename(char *filename_buf_ptr, uint8_t topic_id, unsigned int address, const char *file_extension)
+static uint16_t create_filename(char *filename_buf_ptr, uint16_t topic_id, unsigned int address, const char *file_extension)
 {
     int len;
 
@@ -74,7 +107,7 @@ static uint16_t create_filename(char *filename_buf_ptr, uint8_t topic_id, unsign
         return 0;
     }
 
-    len = snprintf(filename_buf_ptr, FILE_NAME_BUFFER_SIZE, "%u%u%s", topic_id, address, file_extension);
+    len = snprintf(filename_buf_ptr, FILE_NAME_BUFFER_SIZE, "%u_%u%s", topic_id, address, file_extension);
 
     if(len < 0 || len >= FILE_NAME_BUFFER_SIZE) 
     {
@@ -148,6 +181,7 @@ bool telemetry_store(telemetry_packet packet)
     static char data_buffer[DATA_BUFFER_SIZE];
     static char *data_buf_ptr;
     int init_ret = 0;
+    storage_writer *writer;
     
     uint16_t data_len;
     uint16_t filename_len;
@@ -186,7 +220,23 @@ bool telemetry_store(telemetry_packet packet)
     }
     else if(DATA_OUTPUT_FORMAT == FORMAT_TYPE_HEX)
     { 
-        /* Placeholder for hexidecimal format */
+        /* Fixed width binary records, see telemetry-storage/binary.h */
+        writer = storage_writer_find(packet.source.topic_id, packet.source.subsystem_id);
+        if (writer == NULL)
+        {
+            filename_len = create_filename(filename_buf_ptr, packet.source.topic_id, packet.source.subsystem_id, FILE_EXTENSION_HEX);
+            if (filename_len > 0)
+            {
+                writer = storage_writer_open(packet.source.topic_id, packet.source.subsystem_id, filename_buf_ptr, filename_len);
+            }
+        }
+
+        if (storage_writer_append(writer, &packet))
+        {
+            storage_writer_commit(false);
+            return true;
+        }
+        printf("Error storing binary telemetry packet\r\n");
     }
     else
     {
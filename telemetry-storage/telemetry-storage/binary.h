@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @defgroup Binary-Storage
+ * @addtogroup Binary-Storage
+ * @brief Binary telemetry storage format and writer cache
+ *
+ * Binary telemetry is stored per (topic, subsystem) in rotating part files
+ * named like their CSV counterparts plus FILE_EXTENSION_HEX, e.g.
+ * "1_2.hex.000" for topic 1 and subsystem 2. Every part starts with a
+ * ::storage_chunk_header and is followed by fixed width ::storage_record
+ * entries. Values are stored in the byte order of the machine which wrote
+ * them.
+ *
+ * Open part files are kept in a small least recently used cache so storing
+ * a sample does not reopen its file, and buffered records are only synced
+ * to disk once STORAGE_COMMIT_INTERVAL ms or STORAGE_COMMIT_BYTES bytes
+ * have built up.
+ * @{
+ */
+
+#ifndef TELEMETRY_STORAGE_BINARY_H
+#define TELEMETRY_STORAGE_BINARY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <telemetry/telemetry.h>
+#include "telemetry-storage/config.h"
+
+/*! Magic number at the start of every binary part file ("KTLM") */
+#define STORAGE_CHUNK_MAGIC 0x4D4C544B
+/*! Current version of the binary format */
+#define STORAGE_CHUNK_VERSION 1
+/*! Length of the ".NNN" part suffix appended to a writer's path */
+#define STORAGE_PART_SUFFIX_LEN 4
+
+/**
+ * Header found at the start of each binary part file
+ */
+typedef struct __attribute__((packed))
+{
+    /*! Always STORAGE_CHUNK_MAGIC */
+    uint32_t magic;
+    /*! Format version, STORAGE_CHUNK_VERSION */
+    uint8_t version;
+    /*! Size in bytes of each record following the header */
+    uint8_t record_size;
+    /*! Topic id of all records in this part */
+    uint16_t topic_id;
+    /*! Subsystem id of all records in this part */
+    int32_t subsystem_id;
+    /*! Increases by one for every new part, the highest is the newest */
+    uint32_t sequence;
+} storage_chunk_header;
+
+/**
+ * A single stored telemetry sample
+ */
+typedef struct __attribute__((packed))
+{
+    /*! Timestamp of the telemetry packet */
+    int32_t timestamp;
+    /*! A telemetry_data_type value */
+    uint8_t data_type;
+    /*! Unused, always zero */
+    uint8_t reserved[3];
+    /*! Data payload */
+    telemetry_union data;
+} storage_record;
+
+/**
+ * An open binary part file in the writer cache
+ */
+typedef struct
+{
+    /*! File handle, NULL if this cache slot is unused */
+    FILE * file;
+    /*! Topic id of the stored packets */
+    uint16_t topic_id;
+    /*! Subsystem id of the stored packets */
+    int subsystem_id;
+    /*! Base path of the part files, without the part suffix */
+    char path[FILE_NAME_BUFFER_SIZE + STORAGE_PART_SUFFIX_LEN];
+    /*! Character length of path */
+    uint16_t path_len;
+    /*! Index of the current part file */
+    uint8_t part;
+    /*! Sequence number of the current part file */
+    uint32_t sequence;
+    /*! Number of records in the current part file */
+    uint32_t records;
+    /*! Bytes written since the last commit */
+    uint32_t uncommitted;
+    /*! Value of the cache's use counter when last used */
+    uint32_t last_used;
+} storage_writer;
+
+/**
+ * @brief returns the cached writer for a topic and subsystem.
+ * @param topic_id topic id of the packets to store.
+ * @param subsystem_id subsystem id of the packets to store.
+ * @retval The writer, or NULL if it is not open.
+ */
+storage_writer * storage_writer_find(uint16_t topic_id, int subsystem_id);
+
+/**
+ * @brief opens the newest part file at path, or creates the first one, and
+ *        adds it to the writer cache. The least recently used writer is
+ *        committed and closed if the cache is full.
+ * @param topic_id topic id of the packets to store.
+ * @param subsystem_id subsystem id of the packets to store.
+ * @param path base path of the part files.
+ * @param path_len length of path.
+ * @retval The writer, or NULL on error.
+ */
+storage_writer * storage_writer_open(uint16_t topic_id, int subsystem_id, const char * path, uint16_t path_len);
+
+/**
+ * @brief appends a packet to a writer's current part, moving on to the
+ *        next part once it holds DATA_PART_SIZE bytes.
+ * @param writer writer to append to.
+ * @param packet telemetry packet to store.
+ * @retval true if successful, otherwise false
+ */
+bool storage_writer_append(storage_writer * writer, const telemetry_packet * packet);
+
+/**
+ * @brief syncs buffered records to disk. Without force this only happens if
+ *        STORAGE_COMMIT_INTERVAL ms have passed since the last commit.
+ * @param force commit regardless of the time since the last commit.
+ * @retval true if successful, otherwise false
+ */
+bool storage_writer_commit(bool force);
+
+/**
+ * @brief returns how long until storage_writer_commit(false) will sync the
+ *        records buffered so far.
+ * @retval Time in ms, 0 if a commit is due, or -1 if nothing is buffered.
+ */
+int storage_writer_commit_timeout(void);
+
+/**
+ * @brief commits and closes all cached writers.
+ */
+void storage_writer_close_all(void);
+
+#endif
+
+/* @} */
@@ -59,6 +59,34 @@
 #define DATA_OUTPUT_FORMAT YOTTA_CFG_TELEMETRY_STORAGE_DATA_OUTPUT_FORMAT
 #endif
 
+/*! Number of binary storage files kept open at once */
+#ifndef YOTTA_CFG_TELEMETRY_STORAGE_WRITER_CACHE_SIZE
+#define STORAGE_WRITER_CACHE_SIZE 8
+#else
+#define STORAGE_WRITER_CACHE_SIZE YOTTA_CFG_TELEMETRY_STORAGE_WRITER_CACHE_SIZE
+#endif
+
+/*! Max time (ms) binary records are buffered before they are synced to disk */
+#ifndef YOTTA_CFG_TELEMETRY_STORAGE_WRITER_COMMIT_INTERVAL
+#define STORAGE_COMMIT_INTERVAL 1000
+#else
+#define STORAGE_COMMIT_INTERVAL YOTTA_CFG_TELEMETRY_STORAGE_WRITER_COMMIT_INTERVAL
+#endif
+
+/*! Max bytes a binary storage file buffers before it is synced to disk */
+#ifndef YOTTA_CFG_TELEMETRY_STORAGE_WRITER_COMMIT_BYTES
+#define STORAGE_COMMIT_BYTES 4096
+#else
+#define STORAGE_COMMIT_BYTES YOTTA_CFG_TELEMETRY_STORAGE_WRITER_COMMIT_BYTES
+#endif
+
+/*! Number of stored records covered by each entry of a part's query index */
+#ifndef YOTTA_CFG_TELEMETRY_STORAGE_INDEX_INTERVAL
+#define STORAGE_INDEX_INTERVAL 64
+#else
+#define STORAGE_INDEX_INTERVAL YOTTA_CFG_TELEMETRY_STORAGE_INDEX_INTERVAL
+#endif
+
 /*! The telemetry publishers for storage to subscribe to and store */
 #ifndef YOTTA_CFG_TELEMETRY_STORAGE_SUBSCRIPTIONS
 #define STORAGE_SUBSCRIPTIONS 0x0
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2017 Kubos Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * @defgroup Storage-Query
+ * @addtogroup Storage-Query
+ * @brief Time range queries over stored telemetry
+ *
+ * Each part file gets a sparse index stored next to it with the extra
+ * extension ".idx". The index holds the smallest and largest timestamp of
+ * the part, plus the byte offset and timestamp range of every block of
+ * STORAGE_INDEX_INTERVAL records. A query only reads the blocks whose
+ * range overlaps the requested window. Indexes are brought up to date
+ * when a part is queried, which only reads records appended since the
+ * last query.
+ * @{
+ */
+
+#ifndef TELEMETRY_STORAGE_QUERY_H
+#define TELEMETRY_STORAGE_QUERY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <telemetry/telemetry.h>
+#include "telemetry-storage/telemetry_storage.h"
+#include "telemetry-storage/config.h"
+
+/*! Magic number at the start of every index file ("KTIX") */
+#define STORAGE_INDEX_MAGIC 0x5849544B
+/*! Current version of the index format */
+#define STORAGE_INDEX_VERSION 1
+/*! Extension appended to a part's file name to get its index */
+#define FILE_EXTENSION_INDEX ".idx"
+
+/**
+ * Header found at the start of each index file
+ */
+typedef struct __attribute__((packed))
+{
+    /*! Always STORAGE_INDEX_MAGIC */
+    uint32_t magic;
+    /*! Format version, STORAGE_INDEX_VERSION */
+    uint8_t version;
+    /*! output_data_format of the indexed part */
+    uint8_t format;
+    /*! Number of records per block */
+    uint16_t interval;
+    /*! Sequence number of an indexed binary part */
+    uint32_t sequence;
+    /*! Number of bytes of the part covered by the index */
+    uint32_t size;
+    /*! Number of records covered by the index */
+    uint32_t records;
+    /*! Number of block entries following the header */
+    uint32_t blocks;
+    /*! Smallest timestamp in the part */
+    int32_t min_timestamp;
+    /*! Largest timestamp in the part */
+    int32_t max_timestamp;
+} storage_index_header;
+
+/**
+ * Index entry covering a block of STORAGE_INDEX_INTERVAL records
+ */
+typedef struct __attribute__((packed))
+{
+    /*! Byte offset of the block's first record in the part */
+    uint32_t offset;
+    /*! Timestamp of the block's first record */
+    int32_t first_timestamp;
+    /*! Smallest timestamp in the block */
+    int32_t min_timestamp;
+    /*! Largest timestamp in the block */
+    int32_t max_timestamp;
+} storage_index_block;
+
+/**
+ * Describes which stored telemetry to return
+ */
+typedef struct
+{
+    /*! Directory holding the part files, NULL for the working directory */
+    const char * directory;
+    /*! Format the telemetry was stored in */
+    output_data_format format;
+    /*! Topic id to return telemetry for */
+    uint16_t topic_id;
+    /*! Subsystem id to return telemetry for */
+    int subsystem_id;
+    /*! Smallest timestamp to return */
+    int start;
+    /*! Largest timestamp to return */
+    int end;
+} telemetry_query_params;
+
+/**
+ * Called for every packet matched by telemetry_query
+ * @param packet matched telemetry packet
+ * @param arg argument passed to telemetry_query
+ * @return false to stop the query early
+ */
+typedef bool (*telemetry_query_cb)(const telemetry_packet * packet, void * arg);
+
+/**
+ * @brief streams all stored packets of a topic and subsystem with a timestamp
+ *        between params->start and params->end. Parts are visited oldest
+ *        first and packets are returned in the order they were stored.
+ * @param params what to query.
+ * @param callback called for every matching packet.
+ * @param arg passed on to callback.
+ * @retval Number of packets passed to callback, -1 on error.
+ */
+int telemetry_query(const telemetry_query_params * params, telemetry_query_cb callback, void * arg);
+
+/**
+ * @brief brings the index of a single part file up to date, creating it if
+ *        needed.
+ * @param path path of the part file.
+ * @param format format of the part file.
+ * @param header set to the header of the updated index.
+ * @retval true if successful, otherwise false
+ */
+bool telemetry_query_index_part(const char * path, output_data_format format, storage_index_header * header);
+
+#endif
+
+/* @} */
@@ -40,7 +40,7 @@ typedef enum
 {
     /*! CSV File */
     FORMAT_TYPE_CSV = 0,
-    /*! Hex File */
+    /*! Binary File of fixed width records, see telemetry-storage/binary.h */
     FORMAT_TYPE_HEX
 } output_data_format;
 
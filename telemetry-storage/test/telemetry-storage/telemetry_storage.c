@@ -17,6 +17,8 @@
 #include <telemetry/telemetry.h>
 #include <float.h>
 #include "source/telemetry_storage.c"
+#include "source/binary.c"
+#include "source/query.c"
 #include "telemetry-storage/config.h"
  
 static void test_create_filename_null_pointers(void **state)
@@ -39,12 +41,12 @@ static void test_create_filename(void **state)
     static char *filename_buf_ptr;
     filename_buf_ptr = filename_buffer;
     char test_string_file_ext[FILE_NAME_BUFFER_SIZE];
-    char test_compare_string[] = "11.tst";
+    char test_compare_string[] = "1_1.tst";
     memset(test_string_file_ext, 't', sizeof(test_string_file_ext));
 
     /* Test catching partial writes from snprintf by passing 128 chars 
      * given a file extension size of 126 and a address and source id of 
-     * one char each (no room for null terminator)
+     * one char each plus a separator (no room for null terminator)
      */
     assert_int_equal(create_filename(filename_buf_ptr, 1, 1, test_string_file_ext), 0);
     
@@ -55,6 +57,23 @@ static void test_create_filename(void **state)
 }
 
 
+static void test_create_filename_distinct(void **state)
+{
+    char first[FILE_NAME_BUFFER_SIZE];
+    char second[FILE_NAME_BUFFER_SIZE];
+
+    /* Topic ids use all 16 bits */
+    create_filename(first, 1, 2, ".tst");
+    create_filename(second, 257, 2, ".tst");
+    assert_string_not_equal(first, second);
+
+    /* Ids which concatenate to the same digits */
+    create_filename(first, 1, 23, ".tst");
+    create_filename(second, 12, 3, ".tst");
+    assert_string_not_equal(first, second);
+}
+
+
 static void test_format_log_entry_csv(void **state)
 {
     static char data_buffer[DATA_BUFFER_SIZE];
@@ -109,14 +128,251 @@ static void test_telemetry_store(void **state)
 }
 
 
+static void test_storage_writer(void **state)
+{
+    char path[FILE_NAME_BUFFER_SIZE] = "/tmp/telemetry-storage-XXXXXX";
+    char part_path[FILE_NAME_BUFFER_SIZE];
+    storage_chunk_header header;
+    storage_record record;
+    storage_writer *writer;
+    FILE *file;
+    int i;
+
+    telemetry_packet packet = { .data.i = 0, .timestamp = 0, \
+        .source.subsystem_id = 2, .source.data_type = TELEMETRY_TYPE_INT, \
+        .source.topic_id = 1};
+
+    assert_non_null(mkdtemp(path));
+    strcat(path, "/1_2.hex");
+
+    assert_null(storage_writer_find(1, 2));
+    writer = storage_writer_open(1, 2, path, strlen(path));
+    assert_non_null(writer);
+    assert_ptr_equal(storage_writer_find(1, 2), writer);
+
+    /* Fill the first part and start the second one */
+    for (i = 0; i <= RECORDS_PER_PART; i++)
+    {
+        packet.timestamp = i;
+        packet.data.i = -i;
+        assert_true(storage_writer_append(writer, &packet));
+    }
+    assert_int_equal(writer->part, 1);
+    assert_int_equal(writer->sequence, 1);
+    assert_int_equal(writer->records, 1);
+    storage_writer_close_all();
+    assert_null(storage_writer_find(1, 2));
+
+    snprintf(part_path, sizeof(part_path), "%s.000", path);
+    file = fopen(part_path, "rb");
+    assert_non_null(file);
+    assert_int_equal(fread(&header, sizeof(header), 1, file), 1);
+    assert_int_equal(header.magic, STORAGE_CHUNK_MAGIC);
+    assert_int_equal(header.record_size, sizeof(storage_record));
+    assert_int_equal(header.topic_id, 1);
+    assert_int_equal(header.subsystem_id, 2);
+    assert_int_equal(header.sequence, 0);
+    assert_int_equal(fread(&record, sizeof(record), 1, file), 1);
+    assert_int_equal(record.timestamp, 0);
+    assert_int_equal(fread(&record, sizeof(record), 1, file), 1);
+    assert_int_equal(record.timestamp, 1);
+    assert_int_equal(record.data_type, TELEMETRY_TYPE_INT);
+    assert_int_equal(record.data.i, -1);
+    fclose(file);
+
+    /* Reopening continues where the newest part left off */
+    writer = storage_writer_open(1, 2, path, strlen(path));
+    assert_non_null(writer);
+    assert_int_equal(writer->part, 1);
+    assert_int_equal(writer->records, 1);
+    assert_int_equal(storage_writer_commit_timeout(), -1);
+    assert_true(storage_writer_append(writer, &packet));
+
+    /* Buffered records are due for a commit within the interval */
+    assert_in_range(storage_writer_commit_timeout(), 0, STORAGE_COMMIT_INTERVAL);
+    assert_true(storage_writer_commit(true));
+    assert_int_equal(storage_writer_commit_timeout(), -1);
+    assert_int_equal(writer->records, 2);
+    storage_writer_close_all();
+
+    for (i = 0; i < 2; i++)
+    {
+        snprintf(part_path, sizeof(part_path), "%s.%03d", path, i);
+        remove(part_path);
+    }
+    path[strlen(path) - strlen("/1_2.hex")] = '\0';
+    rmdir(path);
+}
+
+
+static void test_storage_writer_foreign_part(void **state)
+{
+    char path[FILE_NAME_BUFFER_SIZE] = "/tmp/telemetry-storage-XXXXXX";
+    char part_path[FILE_NAME_BUFFER_SIZE];
+    storage_chunk_header header;
+    storage_writer *writer;
+    FILE *file;
+
+    telemetry_packet packet = { .data.i = 7, .timestamp = 7, \
+        .source.subsystem_id = 2, .source.data_type = TELEMETRY_TYPE_INT, \
+        .source.topic_id = 1};
+
+    assert_non_null(mkdtemp(path));
+    strcat(path, "/shared.hex");
+
+    writer = storage_writer_open(1, 2, path, strlen(path));
+    assert_non_null(writer);
+    assert_true(storage_writer_append(writer, &packet));
+    storage_writer_close_all();
+
+    /* Another stream at the same path must not truncate the stored part */
+    assert_null(storage_writer_open(257, 2, path, strlen(path)));
+
+    snprintf(part_path, sizeof(part_path), "%s.000", path);
+    file = fopen(part_path, "rb");
+    assert_non_null(file);
+    assert_int_equal(fread(&header, sizeof(header), 1, file), 1);
+    assert_int_equal(header.topic_id, 1);
+    fseek(file, 0, SEEK_END);
+    assert_int_equal(ftell(file), sizeof(header) + sizeof(storage_record));
+    fclose(file);
+
+    remove(part_path);
+    path[strlen(path) - strlen("/shared.hex")] = '\0';
+    rmdir(path);
+}
+
+
+static bool count_packets(const telemetry_packet *packet, void *arg)
+{
+    int *last = arg;
+
+    /* Packets come back in the order they were stored */
+    assert_true(packet->timestamp > *last);
+    assert_int_equal(packet->data.i, -packet->timestamp);
+    *last = packet->timestamp;
+    return true;
+}
+
+
+static void test_query_binary(void **state)
+{
+    char dir[] = "/tmp/telemetry-storage-XXXXXX";
+    char path[KLOG_PATH_LEN];
+    storage_index_header header;
+    storage_writer *writer;
+    int last;
+    int i;
+
+    telemetry_packet packet = { .source.subsystem_id = 3, \
+        .source.data_type = TELEMETRY_TYPE_INT, .source.topic_id = 4};
+
+    telemetry_query_params params = { .format = FORMAT_TYPE_HEX, \
+        .topic_id = 4, .subsystem_id = 3, .start = 1000, .end = 1999 };
+
+    assert_non_null(mkdtemp(dir));
+    params.directory = dir;
+    snprintf(path, sizeof(path), "%s/4_3.hex", dir);
+
+    writer = storage_writer_open(4, 3, path, strlen(path));
+    assert_non_null(writer);
+    for (i = 0; i < 3000; i++)
+    {
+        packet.timestamp = i;
+        packet.data.i = -i;
+        assert_true(storage_writer_append(writer, &packet));
+    }
+    assert_true(storage_writer_commit(true));
+
+    last = 999;
+    assert_int_equal(telemetry_query(&params, count_packets, &last), 1000);
+    assert_int_equal(last, 1999);
+
+    snprintf(path, sizeof(path), "%s/4_3.hex.000", dir);
+    assert_true(telemetry_query_index_part(path, FORMAT_TYPE_HEX, &header));
+    assert_int_equal(header.records, 3000);
+    assert_int_equal(header.min_timestamp, 0);
+    assert_int_equal(header.max_timestamp, 2999);
+
+    /* New records are picked up by the next query */
+    for (i = 3000; i < 3100; i++)
+    {
+        packet.timestamp = i;
+        packet.data.i = -i;
+        assert_true(storage_writer_append(writer, &packet));
+    }
+    assert_true(storage_writer_commit(true));
+
+    params.start = 2990;
+    params.end = 3050;
+    last = 2989;
+    assert_int_equal(telemetry_query(&params, count_packets, &last), 61);
+    assert_int_equal(last, 3050);
+
+    params.start = 5000;
+    params.end = 6000;
+    assert_int_equal(telemetry_query(&params, count_packets, &last), 0);
+
+    /* Empty range */
+    params.start = 6001;
+    assert_int_equal(telemetry_query(&params, count_packets, &last), -1);
+    storage_writer_close_all();
+
+    snprintf(path, sizeof(path), "%s/4_3.hex.000", dir);
+    remove(path);
+    strcat(path, FILE_EXTENSION_INDEX);
+    remove(path);
+    rmdir(dir);
+}
+
+
+static void test_query_csv(void **state)
+{
+    char dir[] = "/tmp/telemetry-storage-XXXXXX";
+    char path[KLOG_PATH_LEN];
+    int last = 9;
+    FILE *file;
+    int i;
+
+    telemetry_query_params params = { .format = FORMAT_TYPE_CSV, \
+        .topic_id = 5, .subsystem_id = 1, .start = 10, .end = 19 };
+
+    assert_non_null(mkdtemp(dir));
+    params.directory = dir;
+    snprintf(path, sizeof(path), "%s/5_1.000", dir);
+
+    /* Lines as written by klog */
+    file = fopen(path, "w");
+    assert_non_null(file);
+    for (i = 0; i < 200; i++)
+    {
+        fprintf(file, "%010d.%03d :T %d,%d\n", i / 1000, i % 1000, i, -i);
+    }
+    fclose(file);
+
+    assert_int_equal(telemetry_query(&params, count_packets, &last), 10);
+    assert_int_equal(last, 19);
+
+    remove(path);
+    strcat(path, FILE_EXTENSION_INDEX);
+    remove(path);
+    rmdir(dir);
+}
+
+
 int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_create_filename_null_pointers),
         cmocka_unit_test(test_format_log_entry_csv_null_pointers),
         cmocka_unit_test(test_create_filename),
+        cmocka_unit_test(test_create_filename_distinct),
         cmocka_unit_test(test_format_log_entry_csv),
         cmocka_unit_test(test_telemetry_store),
+        cmocka_unit_test(test_storage_writer),
+        cmocka_unit_test(test_storage_writer_foreign_part),
+        cmocka_unit_test(test_query_binary),
+        cmocka_unit_test(test_query_csv),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
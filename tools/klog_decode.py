@@ -0,0 +1,214 @@
+#!/usr/bin/env python
+# Kubos Tools
+# Copyright (C) 2017 Kubos Corporation
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Turns binary klog parts (klog_config.klog_binary) back into the text
+# lines klog would have written. Parts are decoded in the order given:
+#
+#   klog_decode.py $(ls -tr /home/system/log/app.*)
+
+import argparse
+import re
+import struct
+import sys
+
+MAGIC = 0x42474C4B
+VERSION = 1
+
+RECORD_DEFINITION = 1
+RECORD_LINE = 2
+RECORD_TEXT = 3
+
+LEVELS = {0: 'N', 1: 'E', 2: 'W', 3: 'T', 4: 'I', 5: 'D'}
+
+# Matches the conversions klog's format parser accepts
+CONVERSION = re.compile(r"%([-+ #0']*)(\*|\d+)?(?:\.(\*|\d*))?(hh|ll|[hlLqjzt])?([diouxXcsfFeEgGaApn%])")
+
+
+class DecodeError(Exception):
+    pass
+
+
+class Reader(object):
+    def __init__(self, data, order):
+        self.data = data
+        self.order = order
+        self.pos = 0
+
+    def remaining(self):
+        return len(self.data) - self.pos
+
+    def unpack(self, fmt):
+        fmt = self.order + fmt
+        size = struct.calcsize(fmt)
+        if self.remaining() < size:
+            raise DecodeError('truncated record')
+        values = struct.unpack_from(fmt, self.data, self.pos)
+        self.pos += size
+        return values
+
+    def read(self, size):
+        if self.remaining() < size:
+            raise DecodeError('truncated record')
+        value = self.data[self.pos:self.pos + size]
+        self.pos += size
+        return value
+
+
+def text(raw):
+    return raw.decode('utf-8', 'replace')
+
+
+def wrap(value, bits, signed):
+    value &= (1 << bits) - 1
+    if signed and value >= (1 << (bits - 1)):
+        value -= 1 << bits
+    return value
+
+
+def render(fmt, args):
+    '''Formats args, read from a binary line, like printf would'''
+    out = []
+    pos = 0
+    for match in CONVERSION.finditer(fmt):
+        out.append(fmt[pos:match.start()])
+        pos = match.end()
+        flags, width, precision, length, conv = match.groups()
+        if conv == '%':
+            out.append('%')
+            continue
+
+        spec = '%' + flags.replace("'", '')
+        if width == '*':
+            width = str(args.int32())
+        if precision == '*':
+            precision = str(args.int32())
+        if width:
+            spec += width
+        if precision is not None and conv not in 'cp':
+            spec += '.' + (precision or '0')
+
+        narrow = length in (None, 'h', 'hh')
+        if conv in 'di':
+            value = args.int32() if narrow else args.int64()
+            if length == 'hh':
+                value = wrap(value, 8, True)
+            elif length == 'h':
+                value = wrap(value, 16, True)
+            out.append((spec + 'd') % value)
+        elif conv in 'ouxX':
+            value = args.uint32() if narrow else args.uint64()
+            if length == 'hh':
+                value &= 0xff
+            elif length == 'h':
+                value &= 0xffff
+            out.append((spec + ('d' if conv == 'u' else conv)) % value)
+        elif conv == 'c':
+            out.append((spec + 's') % chr(args.int32() & 0xff))
+        elif conv in 'aA':
+            value = float.hex(args.double())
+            out.append((spec + 's') % (value.upper() if conv == 'A' else value))
+        elif conv in 'fFeEgG':
+            out.append((spec + conv) % args.double())
+        elif conv == 's':
+            out.append((spec + 's') % args.string())
+        elif conv == 'p':
+            value = args.uint64()
+            out.append((spec + 's') % (hex(value).rstrip('L') if value else '(nil)'))
+        elif conv == 'n':
+            args.uint64()
+    out.append(fmt[pos:])
+    return ''.join(out)
+
+
+class Arguments(Reader):
+    def int32(self):
+        return self.unpack('i')[0]
+
+    def uint32(self):
+        return self.unpack('I')[0]
+
+    def int64(self):
+        return self.unpack('q')[0]
+
+    def uint64(self):
+        return self.unpack('Q')[0]
+
+    def double(self):
+        return self.unpack('d')[0]
+
+    def string(self):
+        return text(self.read(self.unpack('B')[0]))
+
+
+def line_prefix(millis, logger, level):
+    return '%010d.%03d %s:%s ' % (millis // 1000, millis % 1000, logger, LEVELS.get(level, 'N'))
+
+
+def decode_part(data, out):
+    if len(data) < 8:
+        raise DecodeError('missing header')
+    if struct.unpack('<I', data[:4])[0] == MAGIC:
+        order = '<'
+    elif struct.unpack('>I', data[:4])[0] == MAGIC:
+        order = '>'
+    else:
+        raise DecodeError('not a binary klog part')
+    reader = Reader(data, order)
+    version = reader.unpack('4xB3x')[0]
+    if version != VERSION:
+        raise DecodeError('unsupported version %d' % version)
+
+    formats = {}
+    while reader.remaining() > 0:
+        record_type = reader.unpack('B')[0]
+        if record_type == RECORD_DEFINITION:
+            logger_length, format_id, format_length = reader.unpack('BHH')
+            logger = text(reader.read(logger_length))
+            formats[format_id] = (logger, text(reader.read(format_length)))
+        elif record_type in (RECORD_LINE, RECORD_TEXT):
+            level, format_id, millis, length = reader.unpack('BHIH')
+            payload = reader.read(length)
+            if record_type == RECORD_TEXT:
+                logger, _, message = payload.partition(b'\0')
+                out.write(line_prefix(millis, text(logger), level) + text(message) + '\n')
+                continue
+            if format_id not in formats:
+                raise DecodeError('format id %d used before its definition' % format_id)
+            logger, fmt = formats[format_id]
+            out.write(line_prefix(millis, logger, level) + render(fmt, Arguments(payload, order)) + '\n')
+        else:
+            raise DecodeError('unknown record type %d' % record_type)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode binary klog files')
+    parser.add_argument('parts', nargs='+', help='log file parts, oldest first')
+    args = parser.parse_args()
+
+    status = 0
+    for path in args.parts:
+        with open(path, 'rb') as part:
+            data = part.read()
+        try:
+            decode_part(data, sys.stdout)
+        except DecodeError as err:
+            sys.stderr.write('%s: %s\n' % (path, err))
+            status = 1
+    return status
+
+
+if __name__ == '__main__':
+    sys.exit(main())